@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "cJSON/cJSON.h"
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+#define ALIGN_UP(x) (((x) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+/* Every allocation is preceded by its size so that realloc can copy. */
+#define ALLOC_HEADER ALIGN_UP(sizeof(size_t))
+#define BLOCK_HEADER ALIGN_UP(sizeof(ArenaBlock))
+#define MAX_BLOCK_SIZE ((size_t)64 << 20)
+/* Allocations this large come from the heap even inside a scope: they
+   are few, do not fragment it, and would otherwise keep temporaries of
+   a big circuit alive until the reset. */
+#define LARGE_ALLOCATION ((size_t)64 << 10)
+
+struct ArenaBlock
+{
+    ArenaBlock *next;
+    size_t size;
+    size_t used;
+    char *last;
+};
+
+static _Thread_local Arena *active_arena;
+static atomic_size_t heap_allocations;
+
+static char *blockData(ArenaBlock *b)
+{
+    return (char *)b + BLOCK_HEADER;
+}
+
+static void countHeap(void)
+{
+    atomic_fetch_add_explicit(&heap_allocations, 1, memory_order_relaxed);
+}
+
+void arenaInit(Arena *a, size_t block_size)
+{
+    memset(a, 0, sizeof(*a));
+    a->block_size = block_size ? ALIGN_UP(block_size) : 64 << 10;
+}
+
+static ArenaBlock *newBlock(Arena *a, size_t size)
+{
+    ArenaBlock *b = malloc(BLOCK_HEADER + size);
+    if (!b)
+        return NULL;
+    countHeap();
+    b->next = a->head;
+    b->size = size;
+    b->used = 0;
+    b->last = NULL;
+    a->head = b;
+    a->blocks++;
+    return b;
+}
+
+/* Blocks double in size as the arena grows, so a circuit of any size
+   needs O(log n) of them. */
+void *arenaAlloc(Arena *a, size_t size)
+{
+    size_t need = ALLOC_HEADER + ALIGN_UP(size ? size : 1);
+    ArenaBlock *b = a->head;
+
+    if (!b || b->size - b->used < need)
+    {
+        size_t block = a->block_size > need ? a->block_size : ALIGN_UP(need);
+        if (!(b = newBlock(a, block)))
+            return NULL;
+        if (a->block_size < MAX_BLOCK_SIZE)
+            a->block_size *= 2;
+    }
+
+    char *p = blockData(b) + b->used;
+    *(size_t *)p = size;
+    b->last = p;
+    b->used += need;
+    a->used += need;
+    if (a->used > a->peak)
+        a->peak = a->used;
+    return p + ALLOC_HEADER;
+}
+
+/* The newest allocation of the current block grows in place, which is
+   the common case for an array being appended to while it loads. */
+void *arenaRealloc(Arena *a, void *p, size_t size)
+{
+    if (!p)
+        return arenaAlloc(a, size);
+
+    char *base = (char *)p - ALLOC_HEADER;
+    size_t old = *(size_t *)base;
+    ArenaBlock *b = a->head;
+
+    if (size <= old)
+        return p;
+    if (b && b->last == base && ALIGN_UP(size) - ALIGN_UP(old) <= b->size - b->used)
+    {
+        size_t grow = ALIGN_UP(size) - ALIGN_UP(old);
+        b->used += grow;
+        a->used += grow;
+        if (a->used > a->peak)
+            a->peak = a->used;
+        *(size_t *)base = size;
+        return p;
+    }
+
+    void *q = arenaAlloc(a, size);
+    if (q)
+        memcpy(q, p, old);
+    return q;
+}
+
+bool arenaOwns(const Arena *a, const void *p)
+{
+    for (const ArenaBlock *b = a->head; b; b = b->next)
+    {
+        const char *data = (const char *)b + BLOCK_HEADER;
+        if ((const char *)p >= data && (const char *)p < data + b->size)
+            return true;
+    }
+    return false;
+}
+
+/* Keeps one block when that is all the last circuit needed; otherwise
+   the blocks are merged into one that holds the whole high-water mark. */
+void arenaReset(Arena *a)
+{
+    if (a->head && a->head->next)
+    {
+        size_t total = 0;
+        ArenaBlock *b = a->head;
+        while (b)
+        {
+            ArenaBlock *next = b->next;
+            total += b->size;
+            free(b);
+            b = next;
+        }
+        a->head = NULL;
+        newBlock(a, total);
+    }
+    else if (a->head)
+    {
+        a->head->used = 0;
+        a->head->last = NULL;
+    }
+    a->used = 0;
+}
+
+void arenaDestroy(Arena *a)
+{
+    ArenaBlock *b = a->head;
+    while (b)
+    {
+        ArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    if (active_arena == a)
+        active_arena = NULL;
+    memset(a, 0, sizeof(*a));
+}
+
+Arena *arenaActivate(Arena *a)
+{
+    Arena *previous = active_arena;
+    active_arena = a;
+    return previous;
+}
+
+void *cadMalloc(size_t size)
+{
+    if (active_arena && size < LARGE_ALLOCATION)
+        return arenaAlloc(active_arena, size);
+    countHeap();
+    return malloc(size);
+}
+
+void *cadCalloc(size_t count, size_t size)
+{
+    if (active_arena && (!size || count < LARGE_ALLOCATION / size))
+    {
+        void *p = arenaAlloc(active_arena, count * size);
+        if (p)
+            memset(p, 0, count * size);
+        return p;
+    }
+    countHeap();
+    return calloc(count, size);
+}
+
+/* Heap memory stays on the heap even inside a scope, since its old size
+   is unknown here; arena memory moves to the heap once it grows large. */
+void *cadRealloc(void *p, size_t size)
+{
+    bool owned = active_arena && p && arenaOwns(active_arena, p);
+
+    if (active_arena && (!p || owned) && size < LARGE_ALLOCATION)
+        return arenaRealloc(active_arena, p, size);
+    countHeap();
+    if (!owned)
+        return realloc(p, size);
+
+    size_t old = *(size_t *)((char *)p - ALLOC_HEADER);
+    void *q = malloc(size);
+    if (q)
+        memcpy(q, p, old < size ? old : size);
+    return q;
+}
+
+void cadFree(void *p)
+{
+    if (!p || (active_arena && arenaOwns(active_arena, p)))
+        return;
+    free(p);
+}
+
+void installJsonHooks(void)
+{
+    cJSON_Hooks hooks = {cadMalloc, cadFree};
+    cJSON_InitHooks(&hooks);
+}
+
+size_t heapAllocations(void)
+{
+    return atomic_load_explicit(&heap_allocations, memory_order_relaxed);
+}
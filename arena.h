@@ -0,0 +1,48 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Bump allocator for the many small allocations that belong to one
+   circuit. Allocations are not freed one by one; arenaReset drops them
+   all at once and keeps a single block sized for the previous high-water
+   mark, so a worker that loads and discards circuit after circuit stops
+   touching the heap. */
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct
+{
+    ArenaBlock *head;
+    size_t block_size;
+    size_t used;
+    size_t peak;
+    size_t blocks;
+} Arena;
+
+void arenaInit(Arena *a, size_t block_size);
+void *arenaAlloc(Arena *a, size_t size);
+void *arenaRealloc(Arena *a, void *p, size_t size);
+bool arenaOwns(const Arena *a, const void *p);
+void arenaReset(Arena *a);
+void arenaDestroy(Arena *a);
+
+/* Per-thread allocation scope. While an arena is active on a thread the
+   cad* functions take small requests from it and cadFree ignores what it
+   owns; large requests, and everything outside a scope, use the C heap,
+   so callers still free what they allocate. Nothing allocated inside a
+   scope may be used after the arena's next reset. Per-circuit code
+   (component arrays, the net graph, schedules, columns, the solver and
+   cJSON once installJsonHooks has run) allocates through these. */
+Arena *arenaActivate(Arena *a);
+void *cadMalloc(size_t size);
+void *cadCalloc(size_t count, size_t size);
+void *cadRealloc(void *p, size_t size);
+void cadFree(void *p);
+void installJsonHooks(void);
+
+/* Heap allocations made through this module so far: cad* calls outside
+   an arena plus arena blocks. */
+size_t heapAllocations(void);
+
+#endif
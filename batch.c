@@ -0,0 +1,578 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "batch.h"
+#include "arena.h"
+#include "binformat.h"
+#include "columns.h"
+#include "domains.h"
+#include "kernels.h"
+#include "memo.h"
+#include "output.h"
+#include "platform.h"
+#include "profile.h"
+#include "server.h"
+#include "subcircuit.h"
+#include "sweep.h"
+#include "symbolic.h"
+#include "threadpool.h"
+#include "transient.h"
+
+#define ARENA_BLOCK_SIZE (1u << 20)
+
+typedef struct
+{
+    const char *input;
+    char *output;
+    bool ok;
+    size_t components;
+    SolveStats stats;
+    int levels;
+    double eval_time;
+    DesignStats design;
+} BatchJob;
+
+typedef struct
+{
+    BatchJob *jobs;
+    bool solve;
+    bool evaluate;
+    bool symbolic_cache;
+    int domains;
+    ThreadPool *level_pool;
+    Arena *arenas;
+    MemoCache *memo;
+} BatchRun;
+
+/* The format follows the file's extension, JSON unless .csv or .txt. */
+bool writeResults(const char *file_name, const char *netlist, const ComponentArray *array, const SolveStats *stats,
+                  ThreadPool *pool)
+{
+    PROFILE_BEGIN(PROFILE_OUTPUT);
+    FILE *fp = fopen(file_name, "w");
+    bool ok = fp != NULL;
+    if (ok)
+    {
+        ok = exportComponents(fp, outputFormatFor(file_name), array, netlist, stats, pool);
+        if (fclose(fp) != 0)
+            ok = false;
+    }
+    if (!ok)
+        perror("File write failed");
+    PROFILE_END(PROFILE_OUTPUT);
+    return ok;
+}
+
+/* Evaluates or solves the flat circuit in place; false once the failure
+   has been reported. */
+static bool simulate(BatchRun *run, BatchJob *job, ComponentArray *array, SolveStats **stats)
+{
+    bool need_solve = run->solve;
+    if (run->evaluate)
+    {
+        ComponentColumns cols;
+        double start = monotonicSeconds();
+        if (buildColumns(array, &cols) != 0)
+            return false;
+        int unsolved = evaluateColumnsParallel(&cols, run->level_pool);
+        if (unsolved == 0)
+        {
+            storeColumns(&cols, array);
+            need_solve = false;
+        }
+        job->levels = cols.levels;
+        job->eval_time = monotonicSeconds() - start;
+        freeColumns(&cols);
+        if (unsolved > 0 && !need_solve)
+        {
+            fprintf(stderr, "%s: %d components on feedback loops did not settle, use --solve\n", job->input,
+                    unsolved);
+            return false;
+        }
+    }
+    if (need_solve)
+    {
+        int status;
+        *stats = &job->stats;
+        if (run->domains > 1)
+            status = solveCircuitDomains(array, NULL, run->domains, run->level_pool, *stats);
+        else if (run->symbolic_cache)
+            status = solveCircuitCached(array, job->input, *stats);
+        else
+            status = solveCircuit(array, *stats);
+        if (status < 0)
+        {
+            fprintf(stderr, "%s: solve failed\n", job->input);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* A hierarchical design is evaluated instance by instance with cached
+   bodies when it can be; solving, and designs with loops through the top
+   level, go through the flattened circuit. */
+static void processJob(BatchRun *run, BatchJob *job)
+{
+    ComponentArray array = {0};
+    SolveStats *stats = NULL;
+    bool ok;
+
+    if (!job->output || !loadCircuit(job->input, &array))
+    {
+        freeComponentArray(&array);
+        return;
+    }
+    job->components = array.size;
+    if (!isHierarchical(&array))
+        ok = simulate(run, job, &array, &stats);
+    else
+    {
+        double start = monotonicSeconds();
+        ok = run->evaluate && !run->solve && evaluateDesign(&array, run->memo, &job->design) == 0;
+        job->eval_time = monotonicSeconds() - start;
+        if (!ok)
+        {
+            ComponentArray flat;
+            memset(&job->design, 0, sizeof(job->design));
+            ok = flattenCircuit(&array, &flat);
+            if (ok)
+            {
+                job->components = flat.size;
+                ok = simulate(run, job, &flat, &stats);
+                if (ok)
+                    storeFlatResults(&flat, &array);
+                freeComponentArray(&flat);
+            }
+        }
+    }
+    if (ok)
+        job->ok = writeResults(job->output, job->input, &array, stats, run->level_pool);
+    freeComponentArray(&array);
+}
+
+/* Everything a job allocates for its circuit comes from the worker's
+   arena, which is reset in one step once the result is written. */
+static void runJob(void *arg, size_t index, int worker)
+{
+    BatchRun *run = arg;
+    Arena *arena = run->arenas ? &run->arenas[worker] : NULL;
+    Arena *previous = arenaActivate(arena);
+
+    processJob(run, &run->jobs[index]);
+    arenaActivate(previous);
+    if (arena)
+        arenaReset(arena);
+}
+
+/* The output format follows the output file's extension; the input
+   format is detected by loadCircuit. JSON output is serialized on the
+   pool's threads. */
+static bool convertCircuit(const char *input, const char *output, bool compact, int threads)
+{
+    ComponentArray array = {0};
+    bool ok = loadCircuit(input, &array);
+    if (ok && hasBinaryExtension(output))
+        ok = saveCircuit(output, &array);
+    else if (ok)
+    {
+        SaveOptions options = {compact, threadPoolCreate(threads)};
+        ok = saveCircuitJson(output, &array, &options);
+        threadPoolDestroy(options.pool);
+    }
+    freeComponentArray(&array);
+    return ok;
+}
+
+/* Loading validates, so a netlist that loads is clean; problems go to
+   stderr as they are found. */
+static int lintCircuits(int count, char **files)
+{
+    int status = EXIT_SUCCESS;
+    for (int i = 0; i < count; i++)
+    {
+        ComponentArray array = {0};
+        if (loadCircuit(files[i], &array))
+            printf("%s: %zu components, ok\n", files[i], array.size);
+        else
+            status = EXIT_FAILURE;
+        freeComponentArray(&array);
+    }
+    return status;
+}
+
+/* Writes the CSV next to the netlist unless an output file is given. */
+static int sweepCircuit(const char *input, const char *spec_file, const char *out, int threads, MemoCache *memo)
+{
+    ComponentArray array = {0};
+    SweepSpec spec;
+    SweepStats stats;
+    char *output = NULL;
+    FILE *fp = NULL;
+    int status = EXIT_FAILURE;
+
+    if (!loadSweepSpec(spec_file, &spec))
+        return EXIT_FAILURE;
+    if (!loadCircuit(input, &array) || !flattenInPlace(&array))
+        goto done;
+    if (out)
+        output = strdup(out);
+    else if ((output = malloc(strlen(input) + sizeof(".sweep.csv"))))
+        sprintf(output, "%s.sweep.csv", input);
+    if (!output)
+        goto done;
+    fp = fopen(output, "w");
+    if (!fp)
+    {
+        perror("File write failed");
+        goto done;
+    }
+    if (runSweep(&array, &spec, threads, memo, fp, &stats) == 0)
+    {
+        printf("%s: %zu variants (%zu from cache) in %.3f s on %d threads (%.0f variants/s) -> %s\n", input,
+               stats.variants, stats.cached, stats.time, stats.threads, stats.variants / stats.time, output);
+        if (stats.unsolved)
+            fprintf(stderr, "%s: feedback loops did not settle in %zu variants\n", input, stats.unsolved);
+        status = EXIT_SUCCESS;
+    }
+
+done:
+    if (fp && fclose(fp) != 0)
+        status = EXIT_FAILURE;
+    free(output);
+    freeComponentArray(&array);
+    freeSweepSpec(&spec);
+    return status;
+}
+
+/* Binary output unless the output file ends in .csv. */
+static int transientCircuit(const char *input, const char *spec_file, const char *out)
+{
+    ComponentArray array = {0};
+    TransientSpec spec;
+    TransientStats stats;
+    char *output = NULL;
+    FILE *fp = NULL;
+    int status = EXIT_FAILURE;
+
+    if (!loadTransientSpec(spec_file, &spec))
+        return EXIT_FAILURE;
+    if (!loadCircuit(input, &array) || !flattenInPlace(&array))
+        goto done;
+    if (out)
+        output = strdup(out);
+    else if ((output = malloc(strlen(input) + sizeof(".transient.csv"))))
+        sprintf(output, "%s.transient.csv", input);
+    if (!output)
+        goto done;
+    size_t len = strlen(output);
+    bool binary = len < 4 || strcmp(output + len - 4, ".csv") != 0;
+    fp = fopen(output, binary ? "wb" : "w");
+    if (!fp)
+    {
+        perror("File write failed");
+        goto done;
+    }
+    if (runTransient(&array, &spec, fp, binary, &stats) == 0)
+    {
+        printf("%s: %zu steps (%zu rejected) to t=%g in %.3f s (%.1f M component-steps/s) -> %s\n", input,
+               stats.steps, stats.rejected, spec.stop, stats.time,
+               (stats.steps + stats.rejected + 1) * (double)stats.components / stats.time * 1e-6, output);
+        if (stats.unsolved)
+            fprintf(stderr, "%s: feedback loops did not settle at %zu time points\n", input, stats.unsolved);
+        status = EXIT_SUCCESS;
+    }
+
+done:
+    if (fp && fclose(fp) != 0)
+        status = EXIT_FAILURE;
+    free(output);
+    freeComponentArray(&array);
+    freeTransientSpec(&spec);
+    return status;
+}
+
+static void printUsage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [--load FILE]... [FILE...] [--solve] [--eval] [--sweep SPEC] [--transient SPEC] [--out FILE] [--jobs N] [--memo FILE]\n"
+            "  --load FILE  netlist to process (may be repeated)\n"
+            "  --solve      solve each netlist before writing results, reusing the ordering and symbolic\n"
+            "               factorization saved in NETLIST" SYMBOLIC_FILE_EXTENSION " while the connectivity is unchanged\n"
+            "  --no-symbolic-cache  solve without reading or writing NETLIST" SYMBOLIC_FILE_EXTENSION "\n"
+            "  --domains N  solve a single netlist split into up to N pieces factored on --jobs threads\n"
+            "  --eval       evaluate level by level over per-type columns, feedback loops per group\n"
+            "  --out FILE   result file (single netlist only, default NETLIST.result.json); .csv and .txt select CSV and text\n"
+            "  --jobs N     worker threads (default: all cores)\n"
+            "  --sweep SPEC evaluate the variants in a sweep spec, CSV to --out or NETLIST.sweep.csv\n"
+            "  --transient SPEC  time-domain run, CSV or binary to --out or NETLIST.transient.csv\n"
+            "  --memo FILE       reuse instance and sweep results cached in FILE, and save them back\n"
+            "  --memo-size MB    memory for cached results (default %zu)\n"
+            "  --serve [--jobs N] [--queue N]\n"
+            "                    JSON-lines requests on stdin, responses on stdout; at most N (default %d) unanswered\n"
+            "  --convert IN OUT [--compact] [--jobs N]\n"
+            "                    rewrite a netlist as JSON or binary (" CIRCUIT_BINARY_EXTENSION "), compact JSON on request\n"
+            "  --lint FILE...    check netlists for duplicate or misplaced ids, dangling pins and bad values\n"
+            "  --check-kernels   compare the vector evaluation kernels against the scalar model\n"
+            "  --profile FILE    phase times and counters as JSON (needs a -DCAD_PROFILE build)\n"
+            "  --trace FILE      Chrome trace-event file of the phases (needs a -DCAD_PROFILE build)\n",
+            prog, MEMO_DEFAULT_BYTES >> 20, SERVER_DEFAULT_QUEUE);
+}
+
+/* Saves and reports the memo cache, if the run had one. */
+static int finishMemo(int status, MemoCache *memo, const char *file)
+{
+    if (!memo)
+        return status;
+    MemoStats stats = memoStats(memo);
+    printf("memo: %zu hits, %zu misses, %zu evictions, %zu entries (%.1f MB)\n", stats.hits, stats.misses,
+           stats.evictions, stats.entries, stats.bytes / 1048576.0);
+    if (file && !memoSave(memo, file))
+        status = EXIT_FAILURE;
+    memoDestroy(memo);
+    return status;
+}
+
+/* Called on every exit once the work has run, so that a failed run can
+   still be profiled. */
+static int finishProfile(int status, const char *profile, const char *trace)
+{
+    if (profile && !profileWriteJson(profile))
+        status = EXIT_FAILURE;
+    if (trace && !profileWriteTrace(trace))
+        status = EXIT_FAILURE;
+    return status;
+}
+
+/* Headless entry point: processes every netlist on the command line
+   across a thread pool and writes one result file per netlist. */
+int runBatch(int argc, char **argv)
+{
+    const char **inputs = calloc(argc, sizeof(char *));
+    const char *out = NULL;
+    const char *sweep = NULL;
+    const char *transient = NULL;
+    const char *profile = NULL;
+    const char *trace = NULL;
+    const char *memo_file = NULL;
+    size_t memo_bytes = 0;
+    MemoCache *memo = NULL;
+    int input_count = 0;
+    int threads = cpuCount();
+    bool solve = false;
+    bool evaluate = false;
+    bool symbolic_cache = true;
+    int domains = 0;
+
+    if (!inputs)
+        return EXIT_FAILURE;
+
+    if (argc == 2 && strcmp(argv[1], "--check-kernels") == 0)
+    {
+        free(inputs);
+        printf("Selected kernels: %s\n", kernelIsa());
+        return checkKernels(1 << 20) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "--lint") == 0)
+    {
+        free(inputs);
+        return lintCircuits(argc - 2, argv + 2);
+    }
+
+    if (argc >= 4 && strcmp(argv[1], "--convert") == 0)
+    {
+        bool compact = false;
+        for (int i = 4; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--compact") == 0)
+                compact = true;
+            else if ((strcmp(argv[i], "--jobs") == 0 || strcmp(argv[i], "-j") == 0) && i + 1 < argc)
+                threads = atoi(argv[++i]);
+            else
+            {
+                printUsage(argv[0]);
+                free(inputs);
+                return EXIT_FAILURE;
+            }
+        }
+        free(inputs);
+        return convertCircuit(argv[2], argv[3], compact, threads) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (strcmp(argv[1], "--serve") == 0)
+    {
+        size_t queue = SERVER_DEFAULT_QUEUE;
+        for (int i = 2; i < argc; i++)
+        {
+            if ((strcmp(argv[i], "--jobs") == 0 || strcmp(argv[i], "-j") == 0) && i + 1 < argc)
+                threads = atoi(argv[++i]);
+            else if (strcmp(argv[i], "--queue") == 0 && i + 1 < argc)
+                queue = (size_t)atoi(argv[++i]);
+            else
+            {
+                printUsage(argv[0]);
+                free(inputs);
+                return EXIT_FAILURE;
+            }
+        }
+        free(inputs);
+        return runServer(stdin, stdout, threads, queue);
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--load") == 0 && i + 1 < argc)
+            inputs[input_count++] = argv[++i];
+        else if (strcmp(argv[i], "--solve") == 0)
+            solve = true;
+        else if (strcmp(argv[i], "--eval") == 0)
+            evaluate = true;
+        else if (strcmp(argv[i], "--no-symbolic-cache") == 0)
+            symbolic_cache = false;
+        else if (strcmp(argv[i], "--domains") == 0 && i + 1 < argc)
+            domains = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--sweep") == 0 && i + 1 < argc)
+            sweep = argv[++i];
+        else if (strcmp(argv[i], "--transient") == 0 && i + 1 < argc)
+            transient = argv[++i];
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            out = argv[++i];
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+            profile = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            trace = argv[++i];
+        else if (strcmp(argv[i], "--memo") == 0 && i + 1 < argc)
+            memo_file = argv[++i];
+        else if (strcmp(argv[i], "--memo-size") == 0 && i + 1 < argc)
+            memo_bytes = (size_t)atoi(argv[++i]) << 20;
+        else if ((strcmp(argv[i], "--jobs") == 0 || strcmp(argv[i], "-j") == 0) && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if (argv[i][0] != '-')
+            inputs[input_count++] = argv[i];
+        else
+        {
+            printUsage(argv[0]);
+            free(inputs);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (input_count == 0 || ((out || sweep || transient) && input_count > 1))
+    {
+        printUsage(argv[0]);
+        free(inputs);
+        return EXIT_FAILURE;
+    }
+    if ((profile || trace) && !profileEnabled())
+    {
+        fprintf(stderr, "Profiling is not compiled in; rebuild with -DCAD_PROFILE.\n");
+        free(inputs);
+        return EXIT_FAILURE;
+    }
+    if (trace && !profileStartTrace())
+    {
+        free(inputs);
+        return EXIT_FAILURE;
+    }
+    if (memo_file || memo_bytes)
+    {
+        memo = memoCreate(memo_bytes ? memo_bytes : MEMO_DEFAULT_BYTES);
+        if (!memo || (memo_file && !memoLoad(memo, memo_file)))
+        {
+            memoDestroy(memo);
+            free(inputs);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (sweep)
+    {
+        int status = sweepCircuit(inputs[0], sweep, out, threads, memo);
+        free(inputs);
+        return finishProfile(finishMemo(status, memo, memo_file), profile, trace);
+    }
+
+    if (transient)
+    {
+        int status = transientCircuit(inputs[0], transient, out);
+        free(inputs);
+        return finishProfile(finishMemo(status, memo, memo_file), profile, trace);
+    }
+
+    BatchRun run = {calloc(input_count, sizeof(BatchJob)), solve, evaluate, symbolic_cache, domains, NULL, NULL, memo};
+    if (!run.jobs)
+    {
+        memoDestroy(memo);
+        free(inputs);
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < input_count; i++)
+    {
+        run.jobs[i].input = inputs[i];
+        if (out)
+            run.jobs[i].output = strdup(out);
+        else
+        {
+            run.jobs[i].output = malloc(strlen(inputs[i]) + sizeof(".result.json"));
+            if (run.jobs[i].output)
+                sprintf(run.jobs[i].output, "%s.result.json", inputs[i]);
+        }
+    }
+
+    /* A single netlist gets the threads for its wide levels and its
+       output instead. */
+    if (input_count == 1 && threads > 1)
+        run.level_pool = threadPoolCreate(threads);
+    if (threads > input_count)
+        threads = input_count;
+    ThreadPool *pool = threadPoolCreate(threads);
+    run.arenas = malloc(threadPoolSize(pool) * sizeof(Arena));
+    if (run.arenas)
+        for (int w = 0; w < threadPoolSize(pool); w++)
+            arenaInit(&run.arenas[w], ARENA_BLOCK_SIZE);
+    double start = monotonicSeconds();
+    threadPoolRun(pool, runJob, &run, input_count);
+    double elapsed = monotonicSeconds() - start;
+    threads = run.level_pool ? threadPoolSize(run.level_pool) : threadPoolSize(pool);
+    if (run.arenas)
+        for (int w = 0; w < threadPoolSize(pool); w++)
+            arenaDestroy(&run.arenas[w]);
+    free(run.arenas);
+    threadPoolDestroy(pool);
+    threadPoolDestroy(run.level_pool);
+
+    int failed = 0;
+    for (int i = 0; i < input_count; i++)
+    {
+        BatchJob *job = &run.jobs[i];
+        if (!job->ok)
+            failed++;
+        else if (job->design.instances)
+            printf("%s: %zu components, %zu instances of %zu definitions, %zu cache hits, evaluated in %.3f ms -> %s\n",
+                   job->input, job->components, job->design.instances, job->design.definitions, job->design.hits,
+                   job->eval_time * 1e3, job->output);
+        else if (evaluate && job->stats.n == 0)
+            printf("%s: %zu components, %d levels, evaluated in %.3f ms -> %s\n", job->input, job->components,
+                   job->levels, job->eval_time * 1e3, job->output);
+        else if (solve)
+        {
+            char split[32] = "";
+            if (job->stats.domains > 1)
+                snprintf(split, sizeof(split), ", %d domains", job->stats.domains);
+            printf("%s: %zu components, %d nonzeros, %d iterations%s%s%s, solved in %.3f ms -> %s\n", job->input,
+                   job->components, job->stats.nnz, job->stats.iterations,
+                   job->stats.converged ? "" : " (not converged)",
+                   job->stats.symbolic_reused ? ", cached symbolic" : "", split,
+                   (job->stats.assemble_time + job->stats.factor_time + job->stats.solve_time) * 1e3, job->output);
+        }
+        else
+            printf("%s: %zu components -> %s\n", job->input, job->components, job->output);
+        free(job->output);
+    }
+    printf("%d of %d netlists processed in %.3f s on %d threads\n", input_count - failed, input_count, elapsed, threads);
+
+    free(run.jobs);
+    free(inputs);
+    return finishProfile(finishMemo(failed ? EXIT_FAILURE : EXIT_SUCCESS, memo, memo_file), profile, trace);
+}
@@ -0,0 +1,12 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "circuit.h"
+#include "solver.h"
+#include "threadpool.h"
+
+bool writeResults(const char *file_name, const char *netlist, const ComponentArray *array, const SolveStats *stats,
+                  ThreadPool *pool);
+int runBatch(int argc, char **argv);
+
+#endif
@@ -0,0 +1,677 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "circuit.h"
+#include "netgraph.h"
+#include "columns.h"
+#include "domains.h"
+#include "solver.h"
+#include "batch.h"
+#include "arena.h"
+#include "platform.h"
+#include "threadpool.h"
+
+#define ARENA_BLOCK_SIZE (1u << 20)
+#define STRIP_WIDTH 16
+#define STRIP_COMPONENTS 1000000
+
+#ifdef _WIN32
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+typedef enum
+{
+    KIND_LADDER,
+    KIND_MESH,
+    KIND_CHAIN,
+    KIND_RANDOM,
+    KIND_COUNT
+} NetlistKind;
+
+static const char *const kind_names[KIND_COUNT] = {"ladder", "mesh", "chain", "random"};
+
+static const size_t default_sizes[] = {1000, 10000, 100000, 1000000};
+
+static void printUsage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [--kinds LIST] [--sizes LIST] [--dir DIR] [--keep] [--compact] [--report FILE]\n"
+            "       %s [--arena] [--rounds N] [--out FILE] NETLIST...\n"
+            "       %s --scaling [--sizes LIST] [--width N] [--jobs N] [--report FILE]\n"
+            "Without netlists, generates synthetic circuits and times each stage:\n"
+            "  --kinds LIST   comma-separated from ladder,mesh,chain,random (default all)\n"
+            "  --sizes LIST   comma-separated component counts (default 1000,10000,100000,1000000)\n"
+            "  --dir DIR      where the generated netlists are written (default .)\n"
+            "  --keep         keep the generated netlists\n"
+            "  --compact      save the netlists without whitespace\n"
+            "  --report FILE  JSON lines report (default stdout)\n"
+            "With netlists, measures allocations over repeated load, solve and write:\n"
+            "  --arena        take every circuit's memory from one arena, reset after each circuit\n"
+            "  --rounds N     passes over the netlists (default 100)\n"
+            "  --out FILE     scratch result file (default bench.result.json)\n"
+            "With --scaling, solves a feedback mesh strip directly, then split into --jobs domains\n"
+            "on 1 to --jobs threads, and compares the results:\n"
+            "  --sizes LIST   component counts (default %d)\n"
+            "  --width N      cells across the strip (default %d)\n"
+            "  --jobs N       domains and most threads (default all cores, at least 2)\n",
+            prog, prog, prog, STRIP_COMPONENTS, STRIP_WIDTH);
+}
+
+/* splitmix64, so that a given kind and size always yields the same
+   netlist on every platform. */
+static uint64_t nextRandom(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static int pickBelow(uint64_t *state, int n)
+{
+    return (int)(nextRandom(state) % (uint64_t)n);
+}
+
+/* The generators set each component's inputs only; the loads follow from
+   the net graph, as in the interactive editor. */
+static int addSupply(ComponentArray *array, double voltage)
+{
+    Component c = {0};
+    c.type = POWERSUPPLY;
+    c.data.powersupply.id = (int)array->size;
+    c.data.powersupply.voltage = voltage;
+    c.data.powersupply.pin1 = -1;
+    addComponent(array, c);
+    return (int)array->size - 1;
+}
+
+static int addResistor(ComponentArray *array, double resistance, bool current, int input)
+{
+    Component c = {0};
+    c.type = RESISTOR;
+    c.data.resistor.id = (int)array->size;
+    c.data.resistor.resistance = resistance;
+    c.data.resistor.otype = current ? CALC_CURRENT : CALC_VOLTAGE;
+    c.data.resistor.pin1 = input;
+    c.data.resistor.pin2 = -1;
+    addComponent(array, c);
+    return (int)array->size - 1;
+}
+
+static int addTransistor(ComponentArray *array, bool pnp, int input, int base)
+{
+    Component c = {0};
+    c.type = TRANSISTOR;
+    c.data.transistor.id = (int)array->size;
+    c.data.transistor.type = pnp;
+    c.data.transistor.beta = TRANSISTOR_BETA;
+    c.data.transistor.pin1 = input;
+    c.data.transistor.pin2 = base;
+    c.data.transistor.pin3 = -1;
+    addComponent(array, c);
+    return (int)array->size - 1;
+}
+
+/* Series resistors from one supply, each node loaded by a shunt resistor
+   that reports its current. */
+static void generateLadder(ComponentArray *array, size_t n)
+{
+    int node = addSupply(array, 12.0);
+    while (array->size < n)
+    {
+        node = addResistor(array, 100.0, false, node);
+        if (array->size < n)
+            addResistor(array, 1000.0, true, node);
+    }
+}
+
+/* A square grid of transistors, each reading the cell to its left and
+   the cell above; the first row and column are resistors fed from a
+   supply. */
+static void generateMesh(ComponentArray *array, size_t n)
+{
+    size_t width = 1;
+    while ((width + 1) * (width + 1) + 1 <= n)
+        width++;
+    int supply = addSupply(array, 5.0);
+    int *row = calloc(width, sizeof(int));
+    if (!row)
+        return;
+
+    for (size_t y = 0; y < width && array->size < n; y++)
+    {
+        int left = -1;
+        for (size_t x = 0; x < width && array->size < n; x++)
+        {
+            if (y == 0)
+                left = addResistor(array, 100.0 + x, false, x == 0 ? supply : left);
+            else if (x == 0)
+                left = addResistor(array, 100.0 + y, false, row[0]);
+            else
+                left = addTransistor(array, (x + y) % 2, left, row[x]);
+            row[x] = left;
+        }
+    }
+    free(row);
+    while (array->size < n)
+        addResistor(array, 1000.0, true, supply);
+}
+
+/* Transistor stages in series, each biased by its own divider resistor
+   off the supply, with a new supply every 64 stages. */
+static void generateChain(ComponentArray *array, size_t n)
+{
+    int supply = -1, stage = -1;
+    for (size_t k = 0; array->size < n; k++)
+    {
+        if (k % 64 == 0)
+        {
+            supply = addSupply(array, 9.0);
+            stage = supply;
+            continue;
+        }
+        int bias = addResistor(array, 4700.0, false, supply);
+        if (array->size < n)
+            stage = addTransistor(array, false, stage, bias);
+    }
+}
+
+/* Mostly local wiring with occasional long edges, and a few resistors
+   that read a component added just after them, so the circuit has small
+   feedback loops the way real netlists do. */
+static void generateRandom(ComponentArray *array, size_t n)
+{
+    uint64_t state = n;
+    addSupply(array, 5.0);
+    while (array->size < n)
+    {
+        int i = (int)array->size;
+        int r = pickBelow(&state, 64);
+        int near = i - 1 - pickBelow(&state, i < 256 ? i : 256);
+        int far = pickBelow(&state, i);
+
+        if (r == 0 && (size_t)i + 8 < n)
+            addResistor(array, 1000.0, false, i + 1 + pickBelow(&state, 8));
+        else if (r < 4)
+            addSupply(array, 1.0 + pickBelow(&state, 12));
+        else if (r < 40)
+            addResistor(array, 10.0 * (1 + pickBelow(&state, 1000)), r % 2, r < 36 ? near : far);
+        else
+            addTransistor(array, r % 2, near, r < 60 ? i - 1 - pickBelow(&state, i < 16 ? i : 16) : far);
+    }
+}
+
+/* A mesh width cells across and as long as n allows, with feedback both
+   ways: rows alternate direction and every third column reads the row
+   below instead of the one above. One cell in 32 is a supply, the rest
+   resistors reading one neighbour or transistors reading both. The
+   transistors are PNP and stay cut off with every supply positive, so
+   the Newton iteration settles at once and the time goes to the linear
+   algebra. The strip is one feedback loop with narrow cross-sections,
+   which is what a domain split wants. */
+static void generateStrip(ComponentArray *array, size_t n, size_t width)
+{
+    uint64_t state = n;
+    size_t rows = (n - 1) / width;
+    int supply = addSupply(array, 5.0);
+
+    for (size_t y = 0; y < rows; y++)
+    {
+        for (size_t x = 0; x < width; x++)
+        {
+            int h, v;
+            if (y % 2 == 0)
+                h = x > 0 ? (int)(1 + y * width + x - 1) : supply;
+            else
+                h = x + 1 < width ? (int)(1 + y * width + x + 1) : supply;
+            if (x % 3 == 1)
+                v = y + 1 < rows ? (int)(1 + (y + 1) * width + x) : supply;
+            else
+                v = y > 0 ? (int)(1 + (y - 1) * width + x) : supply;
+
+            int r = pickBelow(&state, 160);
+            if (r < 5)
+                addSupply(array, 1.0 + r);
+            else if (r < 96)
+                addResistor(array, 2.0 + pickBelow(&state, 4), true, r % 2 ? v : h);
+            else
+                addTransistor(array, true, h, v);
+        }
+    }
+    while (array->size < n)
+        addResistor(array, 1000.0, true, supply);
+}
+
+static bool generateNetlist(NetlistKind kind, size_t n, ComponentArray *array)
+{
+    switch (kind)
+    {
+    case KIND_LADDER:
+        generateLadder(array, n);
+        break;
+    case KIND_MESH:
+        generateMesh(array, n);
+        break;
+    case KIND_CHAIN:
+        generateChain(array, n);
+        break;
+    default:
+        generateRandom(array, n);
+        break;
+    }
+    if (array->size != n)
+    {
+        fprintf(stderr, "Out of memory generating %zu components.\n", n);
+        return false;
+    }
+    return true;
+}
+
+static size_t fileBytes(const char *path)
+{
+    MappedFile map;
+    if (!mapFile(path, &map))
+        return 0;
+    size_t size = map.size;
+    unmapFile(&map);
+    return size;
+}
+
+static double perSecond(double amount, double seconds)
+{
+    return seconds > 0.0 ? amount / seconds : 0.0;
+}
+
+/* Times one generated netlist through save, load, evaluation and listing
+   and writes one JSON object. Resident memory is sampled after the
+   evaluation, when the loaded circuit and its columns are both alive;
+   the peak covers the process so far, which is why the sizes run from
+   small to large. */
+static bool runCase(FILE *report, const char *dir, NetlistKind kind, size_t n, bool keep, const SaveOptions *save)
+{
+    ComponentArray generated = {0}, loaded = {0};
+    ComponentColumns cols;
+    char path[4096];
+    bool ok = false;
+
+    snprintf(path, sizeof(path), "%s/bench-%s-%zu.json", dir, kind_names[kind], n);
+    fprintf(stderr, "%s %zu...\n", kind_names[kind], n);
+
+    double t0 = monotonicSeconds();
+    if (!generateNetlist(kind, n, &generated))
+        goto done;
+    double t1 = monotonicSeconds();
+    if (!saveCircuitJson(path, &generated, save))
+        goto done;
+    double t2 = monotonicSeconds();
+    freeComponentArray(&generated);
+    size_t bytes = fileBytes(path);
+
+    double t3 = monotonicSeconds();
+    if (!loadCircuit(path, &loaded))
+        goto done;
+    double t4 = monotonicSeconds();
+    if (buildColumns(&loaded, &cols) < 0)
+        goto done;
+    double t5 = monotonicSeconds();
+    int unsolved = evaluateColumns(&cols);
+    storeColumns(&cols, &loaded);
+    double t6 = monotonicSeconds();
+    size_t rss = residentBytes();
+    int levels = cols.levels, groups = cols.schedule.groups;
+    size_t cyclic = cols.cyclic;
+    freeColumns(&cols);
+
+    FILE *sink = fopen(NULL_DEVICE, "w");
+    if (!sink)
+    {
+        perror(NULL_DEVICE);
+        goto done;
+    }
+    double t7 = monotonicSeconds();
+    listComponents(sink, &loaded);
+    fflush(sink);
+    double t8 = monotonicSeconds();
+    fclose(sink);
+
+    fprintf(report,
+            "{\"kind\":\"%s\",\"components\":%zu,\"compact\":%s,\"file_bytes\":%zu,"
+            "\"levels\":%d,\"groups\":%d,\"cyclic\":%zu,\"unsolved\":%d,"
+            "\"generate_s\":%.6f,\"save_s\":%.6f,\"load_s\":%.6f,"
+            "\"schedule_s\":%.6f,\"eval_s\":%.6f,\"list_s\":%.6f,"
+            "\"save_mb_s\":%.2f,\"load_mb_s\":%.2f,"
+            "\"load_components_s\":%.0f,\"eval_components_s\":%.0f,\"list_components_s\":%.0f,"
+            "\"rss_bytes\":%zu,\"peak_rss_bytes\":%zu}\n",
+            kind_names[kind], n, save->compact ? "true" : "false", bytes, levels, groups, cyclic, unsolved,
+            t1 - t0, t2 - t1, t4 - t3, t5 - t4, t6 - t5, t8 - t7,
+            perSecond(bytes / 1048576.0, t2 - t1), perSecond(bytes / 1048576.0, t4 - t3),
+            perSecond((double)n, t4 - t3), perSecond((double)n, t6 - t5), perSecond((double)n, t8 - t7),
+            rss, peakResidentBytes());
+    fflush(report);
+    ok = true;
+
+done:
+    freeComponentArray(&generated);
+    freeComponentArray(&loaded);
+    if (!keep)
+        remove(path);
+    return ok;
+}
+
+static bool parseKinds(const char *list, bool kinds[KIND_COUNT])
+{
+    memset(kinds, 0, KIND_COUNT * sizeof(bool));
+    while (*list)
+    {
+        size_t len = strcspn(list, ",");
+        int k = 0;
+        while (k < KIND_COUNT && (strlen(kind_names[k]) != len || strncmp(list, kind_names[k], len) != 0))
+            k++;
+        if (k == KIND_COUNT)
+        {
+            fprintf(stderr, "Unknown netlist kind '%.*s'.\n", (int)len, list);
+            return false;
+        }
+        kinds[k] = true;
+        list += len + (list[len] == ',');
+    }
+    return true;
+}
+
+static size_t parseSizes(const char *list, size_t *sizes, size_t max)
+{
+    size_t count = 0;
+    while (*list && count < max)
+    {
+        char *end;
+        double value = strtod(list, &end);
+        if (end == list || value < 1.0 || (*end && *end != ','))
+            return 0;
+        sizes[count++] = (size_t)value;
+        list = *end ? end + 1 : end;
+    }
+    return *list ? 0 : count;
+}
+
+static int runSuite(int argc, char **argv)
+{
+    bool kinds[KIND_COUNT] = {true, true, true, true};
+    size_t sizes[32];
+    size_t size_count = sizeof(default_sizes) / sizeof(default_sizes[0]);
+    const char *dir = ".", *report_file = NULL;
+    bool keep = false;
+    int failed = 0;
+    SaveOptions save = {false, NULL};
+
+    memcpy(sizes, default_sizes, sizeof(default_sizes));
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--kinds") == 0 && i + 1 < argc)
+        {
+            if (!parseKinds(argv[++i], kinds))
+                return EXIT_FAILURE;
+        }
+        else if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc)
+        {
+            if (!(size_count = parseSizes(argv[++i], sizes, sizeof(sizes) / sizeof(sizes[0]))))
+            {
+                fprintf(stderr, "Invalid size list '%s'.\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+            dir = argv[++i];
+        else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc)
+            report_file = argv[++i];
+        else if (strcmp(argv[i], "--keep") == 0)
+            keep = true;
+        else if (strcmp(argv[i], "--compact") == 0)
+            save.compact = true;
+        else
+        {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    FILE *report = report_file ? fopen(report_file, "w") : stdout;
+    if (!report)
+    {
+        perror(report_file);
+        return EXIT_FAILURE;
+    }
+    save.pool = threadPoolCreate(cpuCount());
+    for (size_t s = 0; s < size_count; s++)
+        for (int k = 0; k < KIND_COUNT; k++)
+            if (kinds[k] && !runCase(report, dir, (NetlistKind)k, sizes[s], keep, &save))
+                failed++;
+    threadPoolDestroy(save.pool);
+    if (report != stdout)
+        fclose(report);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static bool generateStripNetlist(size_t n, size_t width, ComponentArray *array)
+{
+    generateStrip(array, n, width);
+    if (array->size != n)
+    {
+        fprintf(stderr, "Out of memory generating %zu components.\n", n);
+        return false;
+    }
+    return true;
+}
+
+static double largestDifference(const ComponentArray *a, const ComponentArray *b)
+{
+    double worst = 0.0;
+    for (size_t i = 0; i < a->size; i++)
+    {
+        double x = componentOutput(&a->data[i]), y = componentOutput(&b->data[i]);
+        double d = fabs(x - y) / (1.0 + fabs(x));
+        if (!(d <= worst))
+            worst = d;
+    }
+    return worst;
+}
+
+/* Solves one strip directly, then split into domains pieces on 1 to
+   domains threads, writing one JSON object per thread count. Every solve
+   starts from a freshly generated netlist, so all begin from the same
+   guess. */
+static bool runScalingCase(FILE *report, size_t n, size_t width, int domains)
+{
+    ComponentArray reference = {0};
+    SolveStats direct;
+    double first = 0.0;
+    bool ok = false;
+
+    fprintf(stderr, "strip %zu x %zu...\n", width, n / width);
+    if (!generateStripNetlist(n, width, &reference))
+        goto done;
+    double t0 = monotonicSeconds();
+    if (solveCircuit(&reference, &direct) < 0)
+        goto done;
+    double direct_s = monotonicSeconds() - t0;
+
+    for (int threads = 1; threads <= domains; threads++)
+    {
+        ComponentArray array = {0};
+        SolveStats stats;
+        ThreadPool *pool = threadPoolCreate(threads);
+        bool solved = generateStripNetlist(n, width, &array);
+        double t1 = monotonicSeconds();
+        solved = solved && solveCircuitDomains(&array, NULL, domains, pool, &stats) >= 0;
+        double solve_s = monotonicSeconds() - t1;
+        threadPoolDestroy(pool);
+        if (!solved)
+        {
+            freeComponentArray(&array);
+            goto done;
+        }
+        if (threads == 1)
+            first = solve_s;
+
+        fprintf(report,
+                "{\"components\":%zu,\"width\":%zu,\"domains\":%d,\"threads\":%d,\"iterations\":%d,"
+                "\"direct_s\":%.6f,\"direct_lu_nnz\":%d,\"solve_s\":%.6f,\"lu_nnz\":%d,"
+                "\"speedup\":%.3f,\"thread_speedup\":%.3f,\"max_rel_diff\":%.3g}\n",
+                n, width, stats.domains, threads, stats.iterations, direct_s, direct.lu_nnz, solve_s,
+                stats.lu_nnz, perSecond(direct_s, solve_s), perSecond(first, solve_s),
+                largestDifference(&reference, &array));
+        fflush(report);
+        freeComponentArray(&array);
+    }
+    ok = true;
+
+done:
+    freeComponentArray(&reference);
+    return ok;
+}
+
+static int runScaling(int argc, char **argv)
+{
+    size_t sizes[32] = {STRIP_COMPONENTS};
+    size_t size_count = 1, width = STRIP_WIDTH;
+    int domains = cpuCount(), failed = 0;
+    const char *report_file = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--scaling") == 0)
+            continue;
+        if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc)
+        {
+            if (!(size_count = parseSizes(argv[++i], sizes, sizeof(sizes) / sizeof(sizes[0]))))
+            {
+                fprintf(stderr, "Invalid size list '%s'.\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[i], "--width") == 0 && i + 1 < argc)
+            width = (size_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+            domains = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--report") == 0 && i + 1 < argc)
+            report_file = argv[++i];
+        else
+        {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (width < 2)
+    {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (domains < 2)
+        domains = 2;
+
+    FILE *report = report_file ? fopen(report_file, "w") : stdout;
+    if (!report)
+    {
+        perror(report_file);
+        return EXIT_FAILURE;
+    }
+    for (size_t s = 0; s < size_count; s++)
+        if (sizes[s] <= width || !runScalingCase(report, sizes[s], width, domains))
+            failed++;
+    if (report != stdout)
+        fclose(report);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Allocation benchmark. Loads, solves and writes the results of the
+   netlists round after round, the way a long-running service would, and
+   reports the heap allocations made, the time and the resident memory.
+   Run it once per mode: peak RSS covers the whole process. */
+static int runAllocations(int argc, char **argv)
+{
+    const char *out = "bench.result.json";
+    int rounds = 100, count = 0, failed = 0;
+    bool use_arena = false;
+    const char **inputs = calloc(argc, sizeof(char *));
+    Arena arena;
+
+    if (!inputs)
+        return EXIT_FAILURE;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--arena") == 0)
+            use_arena = true;
+        else if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc)
+            rounds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            out = argv[++i];
+        else if (argv[i][0] != '-')
+            inputs[count++] = argv[i];
+        else
+            count = -1;
+        if (count < 0)
+            break;
+    }
+    if (count <= 0 || rounds < 1)
+    {
+        printUsage(argv[0]);
+        free(inputs);
+        return EXIT_FAILURE;
+    }
+
+    arenaInit(&arena, ARENA_BLOCK_SIZE);
+    size_t allocations = heapAllocations();
+    double start = monotonicSeconds();
+
+    for (int r = 0; r < rounds; r++)
+    {
+        for (int k = 0; k < count; k++)
+        {
+            ComponentArray array = {0};
+            SolveStats stats;
+            Arena *previous = arenaActivate(use_arena ? &arena : NULL);
+
+            if (!loadCircuit(inputs[k], &array) || solveCircuit(&array, &stats) < 0 ||
+                !writeResults(out, inputs[k], &array, &stats, NULL))
+                failed++;
+            freeComponentArray(&array);
+            arenaActivate(previous);
+            arenaReset(&arena);
+        }
+    }
+
+    double elapsed = monotonicSeconds() - start;
+    size_t circuits = (size_t)rounds * count;
+    allocations = heapAllocations() - allocations;
+    printf("%s: %zu circuits in %.3f s, %zu heap allocations (%.1f per circuit), "
+           "%zu arena blocks, rss %.1f MB, peak rss %.1f MB\n",
+           use_arena ? "arena" : "heap", circuits, elapsed, allocations, (double)allocations / circuits,
+           arena.blocks, residentBytes() / 1048576.0, peakResidentBytes() / 1048576.0);
+
+    arenaDestroy(&arena);
+    free(inputs);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* --scaling selects the domain benchmark, netlist arguments the
+   allocation benchmark, anything else the synthetic suite. */
+int main(int argc, char **argv)
+{
+    installJsonHooks();
+    for (int i = 1; i < argc; i++)
+        if (strcmp(argv[i], "--scaling") == 0)
+            return runScaling(argc, argv);
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--rounds") == 0 || strcmp(argv[i], "--out") == 0 ||
+            strcmp(argv[i], "--kinds") == 0 || strcmp(argv[i], "--sizes") == 0 ||
+            strcmp(argv[i], "--dir") == 0 || strcmp(argv[i], "--report") == 0)
+            i++;
+        else if (argv[i][0] != '-')
+            return runAllocations(argc, argv);
+    }
+    return runSuite(argc, argv);
+}
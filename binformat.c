@@ -0,0 +1,304 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "binformat.h"
+#include "arena.h"
+
+#define BYTE_ORDER_MARK 0x01020304u
+
+static uint64_t align8(uint64_t value)
+{
+    return (value + 7) & ~(uint64_t)7;
+}
+
+/* Offsets follow from the counts alone, so the reader recomputes them
+   and rejects any header that disagrees. */
+static void computeLayout(CircuitBinaryHeader *h)
+{
+    uint64_t s = h->counts[SECTION_SUPPLIES];
+    uint64_t r = h->counts[SECTION_RESISTORS];
+    uint64_t t = h->counts[SECTION_TRANSISTORS];
+    uint64_t offset = align8(sizeof(CircuitBinaryHeader));
+
+    h->section_offset[SECTION_SUPPLIES] = offset;
+    offset = align8(offset + 16 * s);
+    h->section_offset[SECTION_RESISTORS] = offset;
+    offset = align8(offset + 17 * r);
+    h->section_offset[SECTION_TRANSISTORS] = offset;
+    offset = align8(offset + (h->version >= 2 ? 17 : 9) * t);
+    h->pin_offset = offset;
+    h->pin_count = s + 2 * r + 3 * t;
+    h->file_size = align8(offset + 4 * h->pin_count);
+}
+
+bool isCircuitBinary(const char *data, size_t size)
+{
+    return size >= 4 && memcmp(data, CIRCUIT_BINARY_MAGIC, 4) == 0;
+}
+
+bool hasBinaryExtension(const char *file_name)
+{
+    size_t len = strlen(file_name), ext = strlen(CIRCUIT_BINARY_EXTENSION);
+    return len > ext && strcmp(file_name + len - ext, CIRCUIT_BINARY_EXTENSION) == 0;
+}
+
+bool readCircuitView(const char *data, size_t size, const char *name, CircuitView *view)
+{
+    CircuitBinaryHeader expected;
+    const CircuitBinaryHeader *h = (const CircuitBinaryHeader *)data;
+
+    memset(view, 0, sizeof(*view));
+    if (size < sizeof(CircuitBinaryHeader) || !isCircuitBinary(data, size) || ((uintptr_t)data & 7) != 0)
+    {
+        fprintf(stderr, "%s: not a binary circuit file\n", name);
+        return false;
+    }
+    if (h->byte_order != BYTE_ORDER_MARK || h->version < 1 || h->version > CIRCUIT_BINARY_VERSION ||
+        h->header_size != sizeof(CircuitBinaryHeader))
+    {
+        fprintf(stderr, "%s: unsupported binary circuit version or byte order\n", name);
+        return false;
+    }
+
+    memset(&expected, 0, sizeof(expected));
+    expected.version = h->version;
+    uint64_t total = 0;
+    for (int s = 0; s < SECTION_COUNT; s++)
+    {
+        if (h->counts[s] > INT32_MAX)
+            break;
+        expected.counts[s] = h->counts[s];
+        total += h->counts[s];
+    }
+    computeLayout(&expected);
+    if (total != h->component_count || total > INT32_MAX ||
+        memcmp(expected.section_offset, h->section_offset, sizeof(h->section_offset)) != 0 ||
+        expected.pin_offset != h->pin_offset || expected.pin_count != h->pin_count ||
+        expected.file_size != h->file_size || h->file_size > size)
+    {
+        fprintf(stderr, "%s: corrupt binary circuit header\n", name);
+        return false;
+    }
+
+    size_t s = h->counts[SECTION_SUPPLIES];
+    size_t r = h->counts[SECTION_RESISTORS];
+    size_t t = h->counts[SECTION_TRANSISTORS];
+    const char *supplies = data + h->section_offset[SECTION_SUPPLIES];
+    const char *resistors = data + h->section_offset[SECTION_RESISTORS];
+    const char *transistors = data + h->section_offset[SECTION_TRANSISTORS];
+    const int32_t *pins = (const int32_t *)(data + h->pin_offset);
+
+    view->component_count = h->component_count;
+    for (int k = 0; k < SECTION_COUNT; k++)
+        view->counts[k] = h->counts[k];
+    view->voltage = (const double *)supplies;
+    view->supply_index = (const int32_t *)(supplies + 8 * s);
+    view->supply_id = (const int32_t *)(supplies + 12 * s);
+    view->resistance = (const double *)resistors;
+    view->resistor_index = (const int32_t *)(resistors + 8 * r);
+    view->resistor_id = (const int32_t *)(resistors + 12 * r);
+    view->resistor_otype = (const uint8_t *)(resistors + 16 * r);
+    if (h->version >= 2)
+    {
+        view->transistor_beta = (const double *)transistors;
+        transistors += 8 * t;
+    }
+    view->transistor_index = (const int32_t *)transistors;
+    view->transistor_id = (const int32_t *)(transistors + 4 * t);
+    view->transistor_flags = (const uint8_t *)(transistors + 8 * t);
+    view->supply_pins = pins;
+    view->resistor_pins = pins + s;
+    view->transistor_pins = pins + s + 2 * r;
+    return true;
+}
+
+bool openCircuitView(const char *file_name, CircuitView *view)
+{
+    MappedFile map;
+    if (!mapFile(file_name, &map))
+    {
+        perror("Error opening file");
+        return false;
+    }
+    if (!readCircuitView(map.data, map.size, file_name, view))
+    {
+        unmapFile(&map);
+        return false;
+    }
+    view->map = map;
+    view->owns_map = true;
+    return true;
+}
+
+void closeCircuitView(CircuitView *view)
+{
+    if (view->owns_map)
+        unmapFile(&view->map);
+    memset(view, 0, sizeof(*view));
+}
+
+/* Expands the columns back into the tagged ComponentArray layout. */
+bool circuitViewToArray(const CircuitView *view, ComponentArray *array)
+{
+    size_t n = view->component_count;
+    Component *data = cadCalloc(n ? n : 1, sizeof(Component));
+    if (!data)
+        return false;
+
+    for (size_t k = 0; k < view->counts[SECTION_SUPPLIES]; k++)
+    {
+        int32_t p = view->supply_index[k];
+        if (p < 0 || (size_t)p >= n || data[p].type)
+            goto corrupt;
+        Powersupply *s = &data[p].data.powersupply;
+        data[p].type = POWERSUPPLY;
+        s->id = view->supply_id[k];
+        s->voltage = view->voltage[k];
+        s->pin1 = view->supply_pins[k];
+    }
+    for (size_t k = 0; k < view->counts[SECTION_RESISTORS]; k++)
+    {
+        int32_t p = view->resistor_index[k];
+        if (p < 0 || (size_t)p >= n || data[p].type)
+            goto corrupt;
+        Resistor *r = &data[p].data.resistor;
+        data[p].type = RESISTOR;
+        r->id = view->resistor_id[k];
+        r->resistance = view->resistance[k];
+        r->otype = view->resistor_otype[k] ? CALC_CURRENT : CALC_VOLTAGE;
+        r->pin1 = view->resistor_pins[2 * k];
+        r->pin2 = view->resistor_pins[2 * k + 1];
+    }
+    for (size_t k = 0; k < view->counts[SECTION_TRANSISTORS]; k++)
+    {
+        int32_t p = view->transistor_index[k];
+        if (p < 0 || (size_t)p >= n || data[p].type)
+            goto corrupt;
+        Transistor *t = &data[p].data.transistor;
+        data[p].type = TRANSISTOR;
+        t->id = view->transistor_id[k];
+        t->type = (view->transistor_flags[k] & TRANSISTOR_FLAG_PNP) != 0;
+        t->input_type = (view->transistor_flags[k] & TRANSISTOR_FLAG_CURRENT) != 0;
+        t->beta = view->transistor_beta ? view->transistor_beta[k] : TRANSISTOR_BETA;
+        t->pin1 = view->transistor_pins[3 * k];
+        t->pin2 = view->transistor_pins[3 * k + 1];
+        t->pin3 = view->transistor_pins[3 * k + 2];
+    }
+
+    freeComponentArray(array);
+    array->data = data;
+    array->size = array->capacity = n;
+    return true;
+
+corrupt:
+    fprintf(stderr, "Corrupt binary circuit: bad component index\n");
+    cadFree(data);
+    return false;
+}
+
+bool saveCircuitBinary(const char *file_name, const ComponentArray *array)
+{
+    CircuitBinaryHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CIRCUIT_BINARY_MAGIC, 4);
+    h.version = CIRCUIT_BINARY_VERSION;
+    h.byte_order = BYTE_ORDER_MARK;
+    h.header_size = sizeof(CircuitBinaryHeader);
+    h.component_count = array->size;
+    for (size_t i = 0; i < array->size; i++)
+    {
+        switch (array->data[i].type)
+        {
+        case POWERSUPPLY:
+            h.counts[SECTION_SUPPLIES]++;
+            break;
+        case RESISTOR:
+            h.counts[SECTION_RESISTORS]++;
+            break;
+        case TRANSISTOR:
+            h.counts[SECTION_TRANSISTORS]++;
+            break;
+        case INSTANCE:
+            fprintf(stderr, "%s: flatten the design before saving it as binary\n", file_name);
+            return false;
+        }
+    }
+    computeLayout(&h);
+    if (array->waveform_count)
+        fprintf(stderr, "%s: supply waveforms are not stored in binary circuits\n", file_name);
+
+    char *image = calloc(h.file_size, 1);
+    if (!image)
+    {
+        fprintf(stderr, "Binary circuit allocation failed.\n");
+        return false;
+    }
+    memcpy(image, &h, sizeof(h));
+
+    CircuitView view;
+    readCircuitView(image, h.file_size, file_name, &view);
+    double *voltage = (double *)view.voltage;
+    int32_t *supply_index = (int32_t *)view.supply_index, *supply_id = (int32_t *)view.supply_id;
+    double *resistance = (double *)view.resistance;
+    int32_t *resistor_index = (int32_t *)view.resistor_index, *resistor_id = (int32_t *)view.resistor_id;
+    uint8_t *resistor_otype = (uint8_t *)view.resistor_otype;
+    int32_t *transistor_index = (int32_t *)view.transistor_index, *transistor_id = (int32_t *)view.transistor_id;
+    uint8_t *transistor_flags = (uint8_t *)view.transistor_flags;
+    double *transistor_beta = (double *)view.transistor_beta;
+    int32_t *supply_pins = (int32_t *)view.supply_pins, *resistor_pins = (int32_t *)view.resistor_pins;
+    int32_t *transistor_pins = (int32_t *)view.transistor_pins;
+    size_t s = 0, r = 0, t = 0;
+
+    for (size_t i = 0; i < array->size; i++)
+    {
+        const Component *c = &array->data[i];
+        switch (c->type)
+        {
+        case POWERSUPPLY:
+            voltage[s] = c->data.powersupply.voltage;
+            supply_index[s] = (int32_t)i;
+            supply_id[s] = c->data.powersupply.id;
+            supply_pins[s++] = c->data.powersupply.pin1;
+            break;
+        case RESISTOR:
+            resistance[r] = c->data.resistor.resistance;
+            resistor_index[r] = (int32_t)i;
+            resistor_id[r] = c->data.resistor.id;
+            resistor_otype[r] = c->data.resistor.otype == CALC_CURRENT;
+            resistor_pins[2 * r] = c->data.resistor.pin1;
+            resistor_pins[2 * r + 1] = c->data.resistor.pin2;
+            r++;
+            break;
+        case TRANSISTOR:
+            transistor_beta[t] = c->data.transistor.beta;
+            transistor_index[t] = (int32_t)i;
+            transistor_id[t] = c->data.transistor.id;
+            transistor_flags[t] = (c->data.transistor.type ? TRANSISTOR_FLAG_PNP : 0) |
+                                  (c->data.transistor.input_type ? TRANSISTOR_FLAG_CURRENT : 0);
+            transistor_pins[3 * t] = c->data.transistor.pin1;
+            transistor_pins[3 * t + 1] = c->data.transistor.pin2;
+            transistor_pins[3 * t + 2] = c->data.transistor.pin3;
+            t++;
+            break;
+        case INSTANCE:
+            break;
+        }
+    }
+
+    FILE *fp = fopen(file_name, "wb");
+    if (!fp)
+    {
+        perror("File write failed");
+        free(image);
+        return false;
+    }
+    bool ok = fwrite(image, 1, h.file_size, fp) == h.file_size;
+    ok = fclose(fp) == 0 && ok;
+    free(image);
+    if (!ok)
+    {
+        perror("File write failed");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,79 @@
+#ifndef BINFORMAT_H
+#define BINFORMAT_H
+
+#include <stdint.h>
+#include "circuit.h"
+#include "platform.h"
+
+#define CIRCUIT_BINARY_MAGIC "CADB"
+#define CIRCUIT_BINARY_VERSION 2
+#define CIRCUIT_BINARY_EXTENSION ".cadb"
+
+enum
+{
+    SECTION_SUPPLIES,
+    SECTION_RESISTORS,
+    SECTION_TRANSISTORS,
+    SECTION_COUNT
+};
+
+/* All integers are native little-endian; every section starts on an
+   8-byte boundary so the columns can be used straight from the mapping.
+
+   supplies:    double voltage[S], int32 index[S], int32 id[S]
+   resistors:   double resistance[R], int32 index[R], int32 id[R], uint8 otype[R]
+   transistors: double beta[T], int32 index[T], int32 id[T], uint8 flags[T] (bit 0 PNP, bit 1 current)
+   pins:        int32, 1 per supply, then 2 per resistor, then 3 per transistor
+
+   index[] is the component's position in the original ComponentArray.
+   Version 1 files have no beta column; their transistors read back with
+   TRANSISTOR_BETA. */
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t header_size;
+    uint64_t component_count;
+    uint64_t counts[SECTION_COUNT];
+    uint64_t section_offset[SECTION_COUNT];
+    uint64_t pin_offset;
+    uint64_t pin_count;
+    uint64_t file_size;
+} CircuitBinaryHeader;
+
+#define TRANSISTOR_FLAG_PNP 1
+#define TRANSISTOR_FLAG_CURRENT 2
+
+/* Zero-copy view of a binary circuit; the pointers refer into the file. */
+typedef struct
+{
+    MappedFile map;
+    bool owns_map;
+    size_t component_count;
+    size_t counts[SECTION_COUNT];
+    const double *voltage;
+    const int32_t *supply_index;
+    const int32_t *supply_id;
+    const double *resistance;
+    const int32_t *resistor_index;
+    const int32_t *resistor_id;
+    const uint8_t *resistor_otype;
+    const double *transistor_beta;
+    const int32_t *transistor_index;
+    const int32_t *transistor_id;
+    const uint8_t *transistor_flags;
+    const int32_t *supply_pins;
+    const int32_t *resistor_pins;
+    const int32_t *transistor_pins;
+} CircuitView;
+
+bool isCircuitBinary(const char *data, size_t size);
+bool hasBinaryExtension(const char *file_name);
+bool readCircuitView(const char *data, size_t size, const char *name, CircuitView *view);
+bool openCircuitView(const char *file_name, CircuitView *view);
+void closeCircuitView(CircuitView *view);
+bool circuitViewToArray(const CircuitView *view, ComponentArray *array);
+bool saveCircuitBinary(const char *file_name, const ComponentArray *array);
+
+#endif
@@ -0,0 +1,250 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "circuit.h"
+#include "netgraph.h"
+#include "jsonreader.h"
+#include "binformat.h"
+#include "platform.h"
+#include "arena.h"
+#include "profile.h"
+#include "output.h"
+#include "subcircuit.h"
+#include "validate.h"
+
+void addComponent(ComponentArray *arr, Component value)
+{
+    if (arr->size == arr->capacity)
+    {
+        size_t new_capacity = (arr->capacity == 0) ? 1 : arr->capacity * 2;
+        Component *new_data = cadRealloc(arr->data, new_capacity * sizeof(Component));
+        if (!new_data)
+        {
+            perror("Failed to allocate memory");
+            exit(EXIT_FAILURE);
+        }
+        arr->data = new_data;
+        arr->capacity = new_capacity;
+    }
+    arr->data[arr->size++] = value;
+}
+
+Component getComponent(ComponentArray *arr, size_t index)
+{
+    return arr->data[index];
+}
+
+void addWaveform(ComponentArray *arr, Waveform value)
+{
+    if (arr->waveform_count == arr->waveform_capacity)
+    {
+        size_t new_capacity = (arr->waveform_capacity == 0) ? 4 : arr->waveform_capacity * 2;
+        Waveform *new_data = cadRealloc(arr->waveforms, new_capacity * sizeof(Waveform));
+        if (!new_data)
+        {
+            perror("Failed to allocate memory");
+            exit(EXIT_FAILURE);
+        }
+        arr->waveforms = new_data;
+        arr->waveform_capacity = new_capacity;
+    }
+    arr->waveforms[arr->waveform_count++] = value;
+}
+
+/* Waveforms are few, so a linear search is enough. */
+const Waveform *findWaveform(const ComponentArray *arr, int component)
+{
+    for (size_t k = 0; k < arr->waveform_count; k++)
+        if (arr->waveforms[k].component == component)
+            return &arr->waveforms[k];
+    return NULL;
+}
+
+int componentId(const Component *c)
+{
+    switch (c->type)
+    {
+    case POWERSUPPLY:
+        return c->data.powersupply.id;
+    case RESISTOR:
+        return c->data.resistor.id;
+    case TRANSISTOR:
+        return c->data.transistor.id;
+    case INSTANCE:
+        return c->data.instance.id;
+    }
+    return -1;
+}
+
+double componentOutput(const Component *c)
+{
+    switch (c->type)
+    {
+    case POWERSUPPLY:
+        return c->data.powersupply.voltage;
+    case RESISTOR:
+        return c->data.resistor.output;
+    case TRANSISTOR:
+        return c->data.transistor.output;
+    case INSTANCE:
+        return c->data.instance.output;
+    }
+    return 0.0;
+}
+
+void freeComponentArray(ComponentArray *arr)
+{
+    cadFree(arr->data);
+    cadFree(arr->waveforms);
+    freeHierarchy(arr->hierarchy);
+    arr->data = NULL;
+    arr->waveforms = NULL;
+    arr->hierarchy = NULL;
+    arr->size = arr->capacity = 0;
+    arr->waveform_count = arr->waveform_capacity = 0;
+}
+
+double resistor_calc(double resistance, double input, int otype)
+{
+    return otype == CALC_VOLTAGE ? (input * resistance) : (input / resistance);
+}
+
+double transistor_calc(double input, double base, bool is_NPN, bool input_type, double beta)
+{
+    if (is_NPN && base > TRANSISTOR_VBE)
+        return input_type ? beta * base : input - TRANSISTOR_VBE;
+    else if (!is_NPN && base < -TRANSISTOR_VBE)
+        return input_type ? beta * -base : input + TRANSISTOR_VBE;
+    return 0.0;
+}
+
+int led_bulb(double current)
+{
+    if (current < 0.01)
+        return 0;
+    else if (current > 0.02)
+    {
+        printf("LED burned! Current exceeded 20mA: %.3fA\n", current);
+        return 0;
+    }
+    return 1;
+}
+
+bool saveCircuitJson(const char *file_name, const ComponentArray *array, const SaveOptions *options)
+{
+    SaveOptions defaults = {false, NULL};
+    if (!options)
+        options = &defaults;
+
+    PROFILE_BEGIN(PROFILE_SAVE);
+    FILE *fp = fopen(file_name, "w");
+    bool ok = fp != NULL;
+    if (ok)
+    {
+        ok = exportCircuit(fp, array, options->compact, options->pool);
+        if (fclose(fp) != 0)
+            ok = false;
+    }
+    if (!ok)
+        perror("File write failed");
+    else
+        PROFILE_COUNT(PROFILE_COMPONENTS_SAVED, array->size);
+    PROFILE_END(PROFILE_SAVE);
+    return ok;
+}
+
+/* The format follows the file's extension. */
+bool saveCircuit(const char *file_name, const ComponentArray *array)
+{
+    if (!hasBinaryExtension(file_name))
+        return saveCircuitJson(file_name, array, NULL);
+
+    /* The binary format has no hierarchy, so designs are saved flat. */
+    ComponentArray flat;
+    if (isHierarchical(array))
+    {
+        if (!flattenCircuit(array, &flat))
+            return false;
+        array = &flat;
+    }
+
+    PROFILE_BEGIN(PROFILE_SAVE);
+    bool ok = saveCircuitBinary(file_name, array);
+    if (ok)
+        PROFILE_COUNT(PROFILE_COMPONENTS_SAVED, array->size);
+    PROFILE_END(PROFILE_SAVE);
+    if (array == &flat)
+        freeComponentArray(&flat);
+    return ok;
+}
+
+bool loadCircuit(const char *file_name, ComponentArray *array)
+{
+    MappedFile map;
+    ComponentArray loaded = {0};
+    LoadNotes notes = {0};
+
+    PROFILE_BEGIN(PROFILE_LOAD);
+    PROFILE_BEGIN(PROFILE_READ);
+    if (!mapFile(file_name, &map))
+    {
+        perror("Error opening file");
+        PROFILE_END(PROFILE_READ);
+        PROFILE_END(PROFILE_LOAD);
+        return false;
+    }
+    PROFILE_END(PROFILE_READ);
+    PROFILE_COUNT(PROFILE_BYTES_READ, map.size);
+
+    /* The readers build components as they go, so construction is part
+       of the parse phase. */
+    bool ok;
+    PROFILE_BEGIN(PROFILE_PARSE);
+    if (isCircuitBinary(map.data, map.size))
+    {
+        CircuitView view;
+        ok = readCircuitView(map.data, map.size, file_name, &view) && circuitViewToArray(&view, &loaded);
+    }
+    else
+        ok = parseMappedCircuitJson(&map, file_name, &loaded, &notes);
+    unmapFile(&map);
+    PROFILE_END(PROFILE_PARSE);
+
+    /* Nothing past this point checks ids or pins again. */
+    if (ok)
+    {
+        PROFILE_BEGIN(PROFILE_VALIDATE);
+        ok = validateCircuit(&loaded, file_name, &notes) == 0;
+        if (ok)
+            dropLoadLinks(&loaded, file_name, notes.lines);
+        PROFILE_END(PROFILE_VALIDATE);
+    }
+    freeLoadNotes(&notes);
+    if (!ok)
+    {
+        freeComponentArray(&loaded);
+        PROFILE_END(PROFILE_LOAD);
+        return false;
+    }
+
+    PROFILE_COUNT(PROFILE_COMPONENTS_LOADED, loaded.size);
+    freeComponentArray(array);
+    *array = loaded;
+    PROFILE_END(PROFILE_LOAD);
+    return true;
+}
+
+void listComponents(FILE *out, const ComponentArray *component_array)
+{
+    PROFILE_BEGIN(PROFILE_LIST);
+    exportComponents(out, OUTPUT_TEXT, component_array, NULL, NULL, NULL);
+    PROFILE_COUNT(PROFILE_COMPONENTS_LISTED, component_array->size);
+    PROFILE_END(PROFILE_LIST);
+}
+
+void list_components(ComponentArray *component_array)
+{
+    listComponents(stdout, component_array);
+    fflush(stdout);
+}
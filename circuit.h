@@ -0,0 +1,152 @@
+#ifndef CIRCUIT_H
+#define CIRCUIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "threadpool.h"
+
+/* Resistors without a connected input are driven from this value, matching
+   the interactive "Invalid component ID" fallback. */
+#define UNCONNECTED_INPUT 5.0
+#define TRANSISTOR_VBE 0.7
+#define TRANSISTOR_BETA 100.0
+
+typedef enum
+{
+    POWERSUPPLY = 'A',
+    RESISTOR = 'B',
+    TRANSISTOR = 'C',
+    INSTANCE = 'D'
+} ComponentType;
+
+typedef struct
+{
+    int anode;
+    int cathode;
+    int id;
+    double voltage;
+    int pin1;
+} Powersupply;
+
+typedef struct
+{
+    int id;
+    double resistance;
+    enum
+    {
+        CALC_VOLTAGE,
+        CALC_CURRENT
+    } otype;
+    double input;
+    double output;
+    int pin1;
+    int pin2;
+} Resistor;
+
+typedef struct
+{
+    int id;
+    bool type;
+    bool input_type;
+    double beta;
+    double input;
+    double base;
+    double output;
+    int pin1;
+    int pin2;
+    int pin3;
+} Transistor;
+
+/* A placed copy of a subcircuit definition (see subcircuit.h). Its ports
+   are bound to the top-level ids in the hierarchy's port pool from
+   port_start on; output is the value of the definition's output. */
+typedef struct
+{
+    int id;
+    int subcircuit;
+    int port_start;
+    int override_start;
+    int override_count;
+    double output;
+} Instance;
+
+typedef union
+{
+    Powersupply powersupply;
+    Resistor resistor;
+    Transistor transistor;
+    Instance instance;
+} ComponentData;
+
+typedef struct
+{
+    ComponentData data;
+    ComponentType type;
+} Component;
+
+typedef enum
+{
+    WAVEFORM_STEP,
+    WAVEFORM_PULSE,
+    WAVEFORM_SINE
+} WaveformShape;
+
+/* Time-dependent voltage of one power supply, used by transient runs; the
+   static solvers keep using the supply's voltage. Step and pulse move
+   between v1 and v2 with SPICE PULSE timing, sine uses v1 as the offset
+   and v2 as the amplitude with the phase in degrees. */
+typedef struct
+{
+    int component;
+    WaveformShape shape;
+    double v1;
+    double v2;
+    double delay;
+    double rise;
+    double fall;
+    double width;
+    double period;
+    double frequency;
+    double phase;
+} Waveform;
+
+typedef struct Hierarchy Hierarchy;
+
+/* hierarchy is NULL for a flat circuit. */
+typedef struct
+{
+    Component *data;
+    size_t size;
+    size_t capacity;
+    Waveform *waveforms;
+    size_t waveform_count;
+    size_t waveform_capacity;
+    Hierarchy *hierarchy;
+} ComponentArray;
+
+/* JSON output options: compact drops all whitespace, and a pool
+   serializes chunks of components in parallel. */
+typedef struct
+{
+    bool compact;
+    ThreadPool *pool;
+} SaveOptions;
+
+void addComponent(ComponentArray *arr, Component value);
+Component getComponent(ComponentArray *arr, size_t index);
+void addWaveform(ComponentArray *arr, Waveform value);
+const Waveform *findWaveform(const ComponentArray *arr, int component);
+int componentId(const Component *c);
+double componentOutput(const Component *c);
+void freeComponentArray(ComponentArray *arr);
+double resistor_calc(double resistance, double input, int otype);
+double transistor_calc(double input, double base, bool is_NPN, bool input_type, double beta);
+int led_bulb(double current);
+bool saveCircuit(const char *file_name, const ComponentArray *array);
+bool saveCircuitJson(const char *file_name, const ComponentArray *array, const SaveOptions *options);
+bool loadCircuit(const char *file_name, ComponentArray *array);
+void listComponents(FILE *out, const ComponentArray *component_array);
+void list_components(ComponentArray *component_array);
+
+#endif
@@ -0,0 +1,622 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "columns.h"
+#include "arena.h"
+#include "solver.h"
+#include "kernels.h"
+#include "profile.h"
+
+/* Two extra value slots after the components hold the constants that
+   unconnected inputs read from, so gathers never need a branch. */
+#define RESISTOR_DEFAULT_SLOT(n) (n)
+#define TRANSISTOR_DEFAULT_SLOT(n) ((n) + 1)
+
+/* Levels narrower than this are evaluated on the calling thread; the
+   hand-off costs more than the kernels save. */
+#define PARALLEL_LEVEL_WIDTH 8192
+#define LEVEL_GRAIN 2048
+#define MAX_REGION_PASSES 64
+
+/* Counting sort of one component type by level; members of feedback
+   groups go into the bucket after the last level. */
+static size_t *levelRanges(const ComponentArray *array, const int *level, int levels,
+                           ComponentType type, int *order)
+{
+    size_t *start = cadCalloc(levels + 2, sizeof(size_t));
+    if (!start)
+        return NULL;
+    for (size_t i = 0; i < array->size; i++)
+        if (array->data[i].type == type)
+            start[(level[i] < 0 ? levels : level[i]) + 1]++;
+    for (int l = 0; l <= levels; l++)
+        start[l + 1] += start[l];
+
+    size_t *next = cadMalloc((levels + 1) * sizeof(size_t));
+    if (!next)
+    {
+        cadFree(start);
+        return NULL;
+    }
+    memcpy(next, start, (levels + 1) * sizeof(size_t));
+    for (size_t i = 0; i < array->size; i++)
+        if (array->data[i].type == type)
+            order[next[level[i] < 0 ? levels : level[i]]++] = (int)i;
+    cadFree(next);
+    return start;
+}
+
+/* The one input group member i reads and what it adds to the member's
+   value, coef times that input plus offset (for a transistor, in its
+   conducting region). -1 for a member that reads nothing. */
+static int memberInput(const ComponentColumns *cols, int i, double *coef, double *offset)
+{
+    const ResistorColumns *r = &cols->resistors;
+    const TransistorColumns *t = &cols->transistors;
+    const SlotRef *ref = &cols->slots[i];
+    int k = ref->slot;
+
+    *coef = *offset = 0.0;
+    if (ref->type == RESISTOR)
+    {
+        *coef = r->current[k] ? 1.0 / r->resistance[k] : r->resistance[k];
+        return r->input[k];
+    }
+    if (ref->type != TRANSISTOR)
+        return -1;
+    if (t->current[k])
+    {
+        *coef = t->pnp[k] ? -t->beta[k] : t->beta[k];
+        return t->base[k];
+    }
+    *coef = 1.0;
+    *offset = t->pnp[k] ? TRANSISTOR_VBE : -TRANSISTOR_VBE;
+    return t->input[k];
+}
+
+static bool inGroup(const ComponentColumns *cols, int group, int j)
+{
+    return j < (int)cols->n && cols->schedule.group[j] == group;
+}
+
+/* Lays out the system of one group, with an entry for every input a
+   member could read whatever region its transistors are in, and factors
+   it at the identity so that the pivots are the diagonal. */
+static int buildGroupSystem(const ComponentColumns *cols, int group, GroupSystem *sys)
+{
+    const Schedule *s = &cols->schedule;
+    const int *member = s->member + s->group_start[group];
+    int count = s->group_start[group + 1] - s->group_start[group];
+    SparseMatrix *A = &sys->A;
+    double coef, offset;
+
+    A->n = count;
+    A->row_ptr = cadMalloc((count + 1) * sizeof(int));
+    A->col_idx = cadMalloc((2 * (size_t)count + 1) * sizeof(int));
+    A->values = cadMalloc((2 * (size_t)count + 1) * sizeof(double));
+    sys->csc = cadMalloc((2 * (size_t)count + 1) * sizeof(int));
+    sys->ap = cadCalloc(count + 2, sizeof(int));
+    sys->ai = cadMalloc((2 * (size_t)count + 1) * sizeof(int));
+    sys->ax = cadMalloc((2 * (size_t)count + 1) * sizeof(double));
+    sys->x = cadMalloc((count + 1) * sizeof(double));
+    sys->work = cadMalloc((count + 1) * sizeof(double));
+    sys->active = cadCalloc(count + 1, sizeof(bool));
+    if (!A->row_ptr || !A->col_idx || !A->values || !sys->csc || !sys->ap || !sys->ai || !sys->ax || !sys->x ||
+        !sys->work || !sys->active)
+        return -1;
+
+    for (int m = 0; m < count; m++)
+    {
+        int j = memberInput(cols, member[m], &coef, &offset);
+        A->row_ptr[m] = A->nnz;
+        A->col_idx[A->nnz] = m;
+        A->values[A->nnz++] = 1.0;
+        if (j >= 0 && j != member[m] && inGroup(cols, group, j))
+        {
+            A->col_idx[A->nnz] = s->position[j];
+            A->values[A->nnz++] = 0.0;
+        }
+    }
+    A->row_ptr[count] = A->nnz;
+
+    /* Column counts go two ahead, so that after the prefix sum ap[j + 1]
+       is where column j starts and placing the entries advances it to
+       where column j + 1 does. */
+    for (int p = 0; p < A->nnz; p++)
+        sys->ap[A->col_idx[p] + 2]++;
+    for (int j = 1; j <= count + 1; j++)
+        sys->ap[j] += sys->ap[j - 1];
+    for (int m = 0; m < count; m++)
+    {
+        for (int p = A->row_ptr[m]; p < A->row_ptr[m + 1]; p++)
+        {
+            int q = sys->ap[A->col_idx[p] + 1]++;
+            sys->ai[q] = m;
+            sys->ax[q] = A->values[p];
+            sys->csc[p] = q;
+        }
+    }
+    return sparseLUFactor(A, &sys->lu);
+}
+
+static void freeGroupSystem(GroupSystem *sys)
+{
+    freeSparseMatrix(&sys->A);
+    cadFree(sys->csc);
+    cadFree(sys->ap);
+    cadFree(sys->ai);
+    cadFree(sys->ax);
+    freeSparseLU(&sys->lu);
+    cadFree(sys->x);
+    cadFree(sys->work);
+    cadFree(sys->active);
+}
+
+static void *copyArray(const void *src, size_t size)
+{
+    void *p = malloc(size ? size : 1);
+    if (p)
+        memcpy(p, src, size);
+    return p;
+}
+
+GroupSystem *copyGroupSystems(const ComponentColumns *cols)
+{
+    size_t groups = cols->schedule.groups;
+    GroupSystem *copy = calloc(groups + 1, sizeof(GroupSystem));
+    if (!copy)
+        return NULL;
+
+    for (size_t g = 0; g < groups; g++)
+    {
+        const GroupSystem *from = &cols->systems[g];
+        GroupSystem *to = &copy[g];
+        int count = from->A.n;
+
+        *to = *from;
+        to->A.values = copyArray(from->A.values, from->A.nnz * sizeof(double));
+        to->ax = copyArray(from->ax, from->A.nnz * sizeof(double));
+        to->lu.lx = copyArray(from->lu.lx, from->lu.lp[count] * sizeof(double));
+        to->lu.ux = copyArray(from->lu.ux, from->lu.up[count] * sizeof(double));
+        to->x = malloc((count + 1) * sizeof(double));
+        to->work = malloc((count + 1) * sizeof(double));
+        to->active = malloc(count + 1);
+        if (!to->A.values || !to->ax || !to->lu.lx || !to->lu.ux || !to->x || !to->work || !to->active)
+        {
+            freeGroupSystemCopies(copy, g + 1);
+            return NULL;
+        }
+    }
+    return copy;
+}
+
+void freeGroupSystemCopies(GroupSystem *systems, size_t groups)
+{
+    if (!systems)
+        return;
+    for (size_t g = 0; g < groups; g++)
+    {
+        free(systems[g].A.values);
+        free(systems[g].ax);
+        free(systems[g].lu.lx);
+        free(systems[g].lu.ux);
+        free(systems[g].x);
+        free(systems[g].work);
+        free(systems[g].active);
+    }
+    free(systems);
+}
+
+int buildColumns(const ComponentArray *array, ComponentColumns *cols)
+{
+    PROFILE_BEGIN(PROFILE_SCHEDULE);
+    size_t n = array->size;
+    SupplyColumns *s = &cols->supplies;
+    ResistorColumns *r = &cols->resistors;
+    TransistorColumns *t = &cols->transistors;
+    int *level = cadMalloc((n + 1) * sizeof(int));
+    int *order = cadMalloc((n + 1) * sizeof(int));
+
+    memset(cols, 0, sizeof(*cols));
+    cols->n = n;
+    if (!level || !order)
+        goto fail;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        switch (array->data[i].type)
+        {
+        case POWERSUPPLY:
+            s->count++;
+            break;
+        case RESISTOR:
+            r->count++;
+            break;
+        case TRANSISTOR:
+            t->count++;
+            break;
+        case INSTANCE:
+            goto fail;
+        }
+    }
+
+    cols->slots = cadMalloc((n + 1) * sizeof(SlotRef));
+    cols->values = cadCalloc(n + 2, sizeof(double));
+    s->id = cadMalloc((s->count + 1) * sizeof(int));
+    s->voltage = cadMalloc((s->count + 1) * sizeof(double));
+    r->id = cadMalloc((r->count + 1) * sizeof(int));
+    r->input = cadMalloc((r->count + 1) * sizeof(int));
+    r->current = cadMalloc(r->count + 1);
+    r->resistance = cadMalloc((r->count + 1) * sizeof(double));
+    r->input_value = cadMalloc((r->count + 1) * sizeof(double));
+    r->output = cadCalloc(r->count + 1, sizeof(double));
+    t->id = cadMalloc((t->count + 1) * sizeof(int));
+    t->input = cadMalloc((t->count + 1) * sizeof(int));
+    t->base = cadMalloc((t->count + 1) * sizeof(int));
+    t->beta = cadMalloc((t->count + 1) * sizeof(double));
+    t->pnp = cadMalloc(t->count + 1);
+    t->current = cadMalloc(t->count + 1);
+    t->input_value = cadMalloc((t->count + 1) * sizeof(double));
+    t->base_value = cadMalloc((t->count + 1) * sizeof(double));
+    t->output = cadCalloc(t->count + 1, sizeof(double));
+    if (!cols->slots || !cols->values || !s->id || !s->voltage || !r->id || !r->input || !r->current ||
+        !r->resistance || !r->input_value || !r->output || !t->id || !t->input || !t->base || !t->beta || !t->pnp ||
+        !t->current || !t->input_value || !t->base_value || !t->output)
+        goto fail;
+
+    NetGraph graph;
+    if (buildNetGraph(array, &graph) != 0)
+        goto fail;
+    int scheduled = buildSchedule(&graph, &cols->schedule);
+    freeNetGraph(&graph);
+    if (scheduled != 0)
+        goto fail;
+    cols->levels = cols->schedule.levels;
+    for (size_t i = 0; i < n; i++)
+        level[i] = cols->schedule.group[i] >= 0 ? -1 : cols->schedule.level[i];
+    cols->values[RESISTOR_DEFAULT_SLOT(n)] = UNCONNECTED_INPUT;
+    cols->values[TRANSISTOR_DEFAULT_SLOT(n)] = 0.0;
+
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (array->data[i].type != POWERSUPPLY)
+            continue;
+        s->id[k] = (int)i;
+        s->voltage[k] = array->data[i].data.powersupply.voltage;
+        cols->slots[i].type = POWERSUPPLY;
+        cols->slots[i].slot = (int)k++;
+    }
+
+    cols->resistor_level = levelRanges(array, level, cols->levels, RESISTOR, order);
+    if (!cols->resistor_level)
+        goto fail;
+    for (k = 0; k < r->count; k++)
+    {
+        int i = order[k], inputs[2];
+        const Resistor *res = &array->data[i].data.resistor;
+        componentInputs(array, i, inputs);
+        r->id[k] = i;
+        r->input[k] = inputs[0] < 0 ? RESISTOR_DEFAULT_SLOT((int)n) : inputs[0];
+        r->current[k] = res->otype == CALC_CURRENT;
+        r->resistance[k] = res->resistance;
+        cols->slots[i].type = RESISTOR;
+        cols->slots[i].slot = (int)k;
+    }
+
+    cols->transistor_level = levelRanges(array, level, cols->levels, TRANSISTOR, order);
+    if (!cols->transistor_level)
+        goto fail;
+    for (k = 0; k < t->count; k++)
+    {
+        int i = order[k], inputs[2];
+        const Transistor *tr = &array->data[i].data.transistor;
+        componentInputs(array, i, inputs);
+        t->id[k] = i;
+        t->input[k] = inputs[0] < 0 ? TRANSISTOR_DEFAULT_SLOT((int)n) : inputs[0];
+        t->base[k] = inputs[1] < 0 ? TRANSISTOR_DEFAULT_SLOT((int)n) : inputs[1];
+        t->beta[k] = tr->beta;
+        t->pnp[k] = tr->type;
+        t->current[k] = tr->input_type;
+        cols->slots[i].type = TRANSISTOR;
+        cols->slots[i].slot = (int)k;
+    }
+
+    cols->cyclic = (r->count - cols->resistor_level[cols->levels]) +
+                   (t->count - cols->transistor_level[cols->levels]);
+    cols->systems = cadCalloc(cols->schedule.groups + 1, sizeof(GroupSystem));
+    if (!cols->systems)
+        goto fail;
+    for (size_t g = 0; g < cols->schedule.groups; g++)
+        if (buildGroupSystem(cols, (int)g, &cols->systems[g]) != 0)
+            goto fail;
+    cadFree(level);
+    cadFree(order);
+    PROFILE_END(PROFILE_SCHEDULE);
+    return 0;
+
+fail:
+    cadFree(level);
+    cadFree(order);
+    freeColumns(cols);
+    PROFILE_END(PROFILE_SCHEDULE);
+    return -1;
+}
+
+void freeColumns(ComponentColumns *cols)
+{
+    SupplyColumns *s = &cols->supplies;
+    ResistorColumns *r = &cols->resistors;
+    TransistorColumns *t = &cols->transistors;
+    cadFree(s->id);
+    cadFree(s->voltage);
+    cadFree(r->id);
+    cadFree(r->input);
+    cadFree(r->current);
+    cadFree(r->resistance);
+    cadFree(r->input_value);
+    cadFree(r->output);
+    cadFree(t->id);
+    cadFree(t->input);
+    cadFree(t->base);
+    cadFree(t->beta);
+    cadFree(t->pnp);
+    cadFree(t->current);
+    cadFree(t->input_value);
+    cadFree(t->base_value);
+    cadFree(t->output);
+    cadFree(cols->slots);
+    cadFree(cols->values);
+    cadFree(cols->resistor_level);
+    cadFree(cols->transistor_level);
+    if (cols->systems)
+        for (size_t g = 0; g < cols->schedule.groups; g++)
+            freeGroupSystem(&cols->systems[g]);
+    cadFree(cols->systems);
+    freeSchedule(&cols->schedule);
+    memset(cols, 0, sizeof(*cols));
+}
+
+static void evaluateResistors(ComponentColumns *cols, size_t begin, size_t end)
+{
+    ResistorColumns *r = &cols->resistors;
+    double *values = cols->values;
+
+    for (size_t k = begin; k < end; k++)
+        r->input_value[k] = values[r->input[k]];
+    resistor_calc_batch(r->resistance + begin, r->input_value + begin, r->current + begin, r->output + begin,
+                        end - begin);
+    for (size_t k = begin; k < end; k++)
+        values[r->id[k]] = r->output[k];
+}
+
+static void evaluateTransistors(ComponentColumns *cols, size_t begin, size_t end)
+{
+    TransistorColumns *t = &cols->transistors;
+    double *values = cols->values;
+
+    for (size_t k = begin; k < end; k++)
+    {
+        t->input_value[k] = values[t->input[k]];
+        t->base_value[k] = values[t->base[k]];
+    }
+    transistor_calc_batch(t->input_value + begin, t->base_value + begin, t->beta + begin, t->pnp + begin,
+                          t->current + begin, t->output + begin, end - begin);
+    for (size_t k = begin; k < end; k++)
+        values[t->id[k]] = t->output[k];
+}
+
+static void storeResistor(ComponentColumns *cols, size_t k)
+{
+    ResistorColumns *r = &cols->resistors;
+    r->input_value[k] = cols->values[r->input[k]];
+    r->output[k] = cols->values[r->id[k]];
+}
+
+static void storeTransistor(ComponentColumns *cols, size_t k)
+{
+    TransistorColumns *t = &cols->transistors;
+    t->input_value[k] = cols->values[t->input[k]];
+    t->base_value[k] = cols->values[t->base[k]];
+    t->output[k] = cols->values[t->id[k]];
+}
+
+static bool transistorConducts(const TransistorColumns *t, size_t k, double base)
+{
+    return t->pnp[k] ? base < -TRANSISTOR_VBE : base > TRANSISTOR_VBE;
+}
+
+/* Solves one feedback group. With the transistor regions fixed every
+   member is linear in its inputs, so the group is a small sparse system
+   fed by values from earlier levels; it is re-solved until no transistor
+   changes region. Each pass only refills the values of the group's
+   system and refactors it numerically. Returns 0, or -1 when the system
+   is singular or the regions do not settle (the values are then the last
+   iterate). */
+static int solveGroup(ComponentColumns *cols, int group)
+{
+    const Schedule *s = &cols->schedule;
+    const TransistorColumns *t = &cols->transistors;
+    const int *member = s->member + s->group_start[group];
+    int count = s->group_start[group + 1] - s->group_start[group];
+    GroupSystem *sys = &cols->systems[group];
+    SparseMatrix *A = &sys->A;
+    double *x = sys->x;
+    bool *active = sys->active;
+    int status = -1;
+
+    for (int m = 0; m < count; m++)
+    {
+        const SlotRef *ref = &cols->slots[member[m]];
+        active[m] = ref->type != TRANSISTOR ||
+                    transistorConducts(t, ref->slot, cols->values[t->base[ref->slot]]);
+    }
+
+    for (int pass = 0; pass < MAX_REGION_PASSES; pass++)
+    {
+        for (int m = 0; m < count; m++)
+        {
+            double coef, offset;
+            int j = memberInput(cols, member[m], &coef, &offset);
+            int p = A->row_ptr[m];
+
+            A->values[p] = 1.0;
+            if (A->row_ptr[m + 1] > p + 1)
+                A->values[p + 1] = 0.0;
+            x[m] = 0.0;
+            if (j < 0 || !active[m])
+                continue;
+            x[m] = offset;
+            if (!inGroup(cols, group, j))
+                x[m] += coef * cols->values[j];
+            else if (j == member[m])
+                A->values[p] -= coef;
+            else
+                A->values[p + 1] = -coef;
+        }
+        for (int p = 0; p < A->nnz; p++)
+            sys->ax[sys->csc[p]] = A->values[p];
+
+        if (sparseLURefactorCsc(sys->ap, sys->ai, sys->ax, &sys->lu, sys->work) == 0)
+            sparseLUSolve(&sys->lu, x, sys->work);
+        else
+        {
+            /* The diagonal is no longer a usable pivot: this pass factors
+               with pivoting of its own. */
+            SparseLU lu;
+            if (sparseLUFactor(A, &lu) != 0)
+                goto done;
+            sparseLUSolve(&lu, x, sys->work);
+            freeSparseLU(&lu);
+        }
+        for (int m = 0; m < count; m++)
+            cols->values[member[m]] = x[m];
+
+        bool changed = false;
+        for (int m = 0; m < count; m++)
+        {
+            const SlotRef *ref = &cols->slots[member[m]];
+            if (ref->type != TRANSISTOR)
+                continue;
+            bool conducts = transistorConducts(t, ref->slot, cols->values[t->base[ref->slot]]);
+            if (conducts != active[m])
+            {
+                active[m] = conducts;
+                changed = true;
+            }
+        }
+        if (!changed)
+        {
+            status = 0;
+            break;
+        }
+    }
+
+done:
+    for (int m = 0; m < count; m++)
+    {
+        const SlotRef *ref = &cols->slots[member[m]];
+        if (ref->type == RESISTOR)
+            storeResistor(cols, ref->slot);
+        else if (ref->type == TRANSISTOR)
+            storeTransistor(cols, ref->slot);
+    }
+    return status;
+}
+
+typedef struct
+{
+    ComponentColumns *cols;
+    int level;
+    atomic_int unsolved;
+} LevelTask;
+
+/* One index space per level: resistors first, then transistors. */
+static void evaluateLevelRange(void *arg, size_t begin, size_t end, int worker)
+{
+    LevelTask *task = arg;
+    ComponentColumns *cols = task->cols;
+    size_t rb = cols->resistor_level[task->level], re = cols->resistor_level[task->level + 1];
+    size_t tb = cols->transistor_level[task->level];
+    size_t split = re - rb;
+
+    if (begin < split)
+        evaluateResistors(cols, rb + begin, rb + (end < split ? end : split));
+    if (end > split)
+        evaluateTransistors(cols, tb + (begin > split ? begin - split : 0), tb + (end - split));
+}
+
+static void solveGroupTask(void *arg, size_t index, int worker)
+{
+    LevelTask *task = arg;
+    const Schedule *s = &task->cols->schedule;
+    int group = s->level_group[task->level] + (int)index;
+
+    if (solveGroup(task->cols, group) != 0)
+        atomic_fetch_add(&task->unsolved, s->group_start[group + 1] - s->group_start[group]);
+}
+
+/* Evaluates level by level; each level reads only values produced by
+   earlier ones, then solves its feedback groups. Wide levels and
+   independent groups are spread over pool when one is given. Returns how
+   many components sit in groups that did not converge (solveCircuit
+   handles those with damping). */
+int evaluateColumnsParallel(ComponentColumns *cols, ThreadPool *pool)
+{
+    PROFILE_BEGIN(PROFILE_EVALUATE);
+    const SupplyColumns *s = &cols->supplies;
+    LevelTask task;
+    int unsolved = 0;
+
+    task.cols = cols;
+    for (size_t k = 0; k < s->count; k++)
+        cols->values[s->id[k]] = s->voltage[k];
+    for (int l = 0; l < cols->levels; l++)
+    {
+        size_t width = (cols->resistor_level[l + 1] - cols->resistor_level[l]) +
+                       (cols->transistor_level[l + 1] - cols->transistor_level[l]);
+        int groups = cols->schedule.level_group[l + 1] - cols->schedule.level_group[l];
+
+        task.level = l;
+        atomic_init(&task.unsolved, 0);
+        if (pool && width >= PARALLEL_LEVEL_WIDTH)
+            threadPoolRunRanges(pool, evaluateLevelRange, &task, width, LEVEL_GRAIN);
+        else
+        {
+            evaluateResistors(cols, cols->resistor_level[l], cols->resistor_level[l + 1]);
+            evaluateTransistors(cols, cols->transistor_level[l], cols->transistor_level[l + 1]);
+        }
+        threadPoolRun(groups > 1 ? pool : NULL, solveGroupTask, &task, groups);
+        unsolved += atomic_load(&task.unsolved);
+    }
+    PROFILE_COUNT(PROFILE_COMPONENTS_EVALUATED, cols->n);
+    PROFILE_COUNT(PROFILE_GROUPS_SOLVED, cols->schedule.groups);
+    PROFILE_END(PROFILE_EVALUATE);
+    return unsolved;
+}
+
+int evaluateColumns(ComponentColumns *cols)
+{
+    return evaluateColumnsParallel(cols, NULL);
+}
+
+/* Writes the evaluated inputs and outputs back into the tagged array. */
+void storeColumns(const ComponentColumns *cols, ComponentArray *array)
+{
+    const ResistorColumns *r = &cols->resistors;
+    const TransistorColumns *t = &cols->transistors;
+
+    for (size_t k = 0; k < r->count; k++)
+    {
+        Resistor *res = &array->data[r->id[k]].data.resistor;
+        res->input = r->input_value[k];
+        res->output = r->output[k];
+    }
+    for (size_t k = 0; k < t->count; k++)
+    {
+        Transistor *tr = &array->data[t->id[k]].data.transistor;
+        tr->input = t->input_value[k];
+        tr->base = t->base_value[k];
+        tr->output = t->output[k];
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include "circuit.h"
+#include "schedule.h"
+#include "solver.h"
+#include "threadpool.h"
+
+/* Struct-of-arrays copy of a ComponentArray: one dense column per field
+   and per component type. Within each type the slots are ordered by
+   evaluation level, so every level is a contiguous run of slots. */
+typedef struct
+{
+    size_t count;
+    int *id;
+    double *voltage;
+} SupplyColumns;
+
+typedef struct
+{
+    size_t count;
+    int *id;
+    int *input;
+    unsigned char *current;
+    double *resistance;
+    double *input_value;
+    double *output;
+} ResistorColumns;
+
+typedef struct
+{
+    size_t count;
+    int *id;
+    int *input;
+    int *base;
+    double *beta;
+    unsigned char *pnp;
+    unsigned char *current;
+    double *input_value;
+    double *base_value;
+    double *output;
+} TransistorColumns;
+
+typedef struct
+{
+    ComponentType type;
+    int slot;
+} SlotRef;
+
+/* The linear system of one feedback group, set up once by buildColumns
+   so that solving the group again only refills values. Row m of A holds
+   member m's diagonal entry and then, when the one input it reads is
+   another member, that entry; entry p of A is entry csc[p] of the same
+   matrix by columns (ap, ai, ax), which lu was factored from with the
+   diagonal as pivots. */
+typedef struct
+{
+    SparseMatrix A;
+    int *csc;
+    int *ap;
+    int *ai;
+    double *ax;
+    SparseLU lu;
+    double *x;
+    double *work;
+    bool *active;
+} GroupSystem;
+
+typedef struct
+{
+    size_t n;
+    SupplyColumns supplies;
+    ResistorColumns resistors;
+    TransistorColumns transistors;
+    SlotRef *slots;
+    double *values;
+    int levels;
+    size_t *resistor_level;
+    size_t *transistor_level;
+    size_t cyclic;
+    Schedule schedule;
+    GroupSystem *systems;
+} ComponentColumns;
+
+int buildColumns(const ComponentArray *array, ComponentColumns *cols);
+void freeColumns(ComponentColumns *cols);
+int evaluateColumns(ComponentColumns *cols);
+int evaluateColumnsParallel(ComponentColumns *cols, ThreadPool *pool);
+void storeColumns(const ComponentColumns *cols, ComponentArray *array);
+/* Copies, on the C heap, of what solving cols's groups writes to, for a
+   second evaluator of the same columns; the patterns and the pivot order
+   stay shared. NULL when out of memory. */
+GroupSystem *copyGroupSystems(const ComponentColumns *cols);
+void freeGroupSystemCopies(GroupSystem *systems, size_t groups);
+
+#endif
@@ -0,0 +1,542 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "domains.h"
+#include "arena.h"
+#include "ordering.h"
+
+/* One piece of the circuit: its own m components followed by the h
+   separator components it reads or that read it, all as component ids.
+   M is the circuit matrix restricted to those rows and columns, less the
+   separator block, so that a partial factorization leaves minus the
+   piece's contribution to the separator block behind. */
+typedef struct
+{
+    int m;
+    int h;
+    int *node;
+    int *slot;
+    int *source;
+    SparseMatrix M;
+    SparseLU lu;
+    double *x;
+    double *work;
+    int status;
+} Subdomain;
+
+/* The separators are numbered in the order orderCircuitMatrix would
+   eliminate them, as are the components of each piece. Separators whose
+   row is their diagonal alone, the supplies, are fixed: they are solved
+   first and their columns moved to the right-hand side, so they join
+   neither the pieces nor S. */
+typedef struct
+{
+    const ComponentArray *array;
+    ThreadPool *pool;
+    const int *part;
+    int count;
+    Subdomain *domain;
+    int separators;
+    int *separator;
+    int *local;
+    int fixeds;
+    int *fixed;
+    int couplings;
+    int *coupling;
+    int *coupling_row;
+    const SparseMatrix *A;
+    double *b;
+    SparseMatrix S;
+    SparseLU slu;
+    double *rhs;
+    double *work;
+    int *at;
+} DomainSolver;
+
+static int compareInts(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static bool isSeparator(const DomainSolver *s, int i)
+{
+    return s->part[i] < 0 && s->local[i] >= 0;
+}
+
+static bool isFixed(const DomainSolver *s, int i)
+{
+    return s->part[i] < 0 && s->local[i] < 0;
+}
+
+/* Finds the separator components next to piece d. where maps a
+   component to its position in the piece being built; negative values
+   mark what the search has seen. */
+static int collectHalo(DomainSolver *s, const SparseMatrix *A, Subdomain *d, int index, int *where, int *halo)
+{
+    int h = 0, seen = -2 - index;
+    for (int r = 0; r < d->m; r++)
+    {
+        int i = d->node[r];
+        for (int p = A->row_ptr[i]; p < A->row_ptr[i + 1]; p++)
+        {
+            int j = A->col_idx[p];
+            if (isSeparator(s, j) && where[j] != seen)
+            {
+                where[j] = seen;
+                halo[h++] = s->local[j];
+            }
+            else if (s->part[j] >= 0 && s->part[j] != index)
+                return -1;
+        }
+    }
+    for (int t = 0; t < s->separators; t++)
+    {
+        int i = s->separator[t];
+        if (where[i] == seen)
+            continue;
+        for (int p = A->row_ptr[i]; p < A->row_ptr[i + 1]; p++)
+        {
+            if (s->part[A->col_idx[p]] == index)
+            {
+                where[i] = seen;
+                halo[h++] = t;
+                break;
+            }
+        }
+    }
+    qsort(halo, h, sizeof(int), compareInts);
+    return h;
+}
+
+/* Lays out piece d: the halo, M's pattern and where each entry of M
+   comes from in A. */
+static int buildSubdomain(DomainSolver *s, const SparseMatrix *A, Subdomain *d, int index, int *where, int *halo)
+{
+    int h = collectHalo(s, A, d, index, where, halo);
+    if (h < 0)
+        return -1;
+    int size = d->m + h;
+    int *node = cadRealloc(d->node, (size + 1) * sizeof(int));
+    if (!node)
+        return -1;
+    d->node = node;
+    d->h = h;
+    d->slot = cadMalloc((h + 1) * sizeof(int));
+    d->x = cadMalloc((size + 1) * sizeof(double));
+    d->work = cadMalloc((size + 1) * sizeof(double));
+    d->M.n = size;
+    d->M.row_ptr = cadMalloc((size + 1) * sizeof(int));
+    if (!d->slot || !d->x || !d->work || !d->M.row_ptr)
+        return -1;
+    memcpy(d->slot, halo, h * sizeof(int));
+    for (int t = 0; t < h; t++)
+    {
+        int i = s->separator[halo[t]];
+        d->node[d->m + t] = i;
+        where[i] = d->m + t;
+    }
+
+    /* Own rows keep every entry; separator rows only those that read
+       the piece. */
+    int nnz = 0;
+    for (int r = 0; r < size; r++)
+    {
+        int i = d->node[r];
+        for (int p = A->row_ptr[i]; p < A->row_ptr[i + 1]; p++)
+            if (r < d->m ? !isFixed(s, A->col_idx[p]) : s->part[A->col_idx[p]] == index)
+                nnz++;
+    }
+    d->M.nnz = nnz;
+    d->M.col_idx = cadMalloc((nnz + 1) * sizeof(int));
+    d->M.values = cadMalloc((nnz + 1) * sizeof(double));
+    d->source = cadMalloc((nnz + 1) * sizeof(int));
+    if (!d->M.col_idx || !d->M.values || !d->source)
+        return -1;
+
+    nnz = 0;
+    for (int r = 0; r < size; r++)
+    {
+        int i = d->node[r];
+        d->M.row_ptr[r] = nnz;
+        for (int p = A->row_ptr[i]; p < A->row_ptr[i + 1]; p++)
+        {
+            int j = A->col_idx[p];
+            if (s->part[j] == index)
+                d->M.col_idx[nnz] = s->local[j];
+            else if (r < d->m && !isFixed(s, j))
+                d->M.col_idx[nnz] = where[j];
+            else
+                continue;
+            d->source[nnz++] = p;
+        }
+    }
+    d->M.row_ptr[size] = nnz;
+    return 0;
+}
+
+/* Splits the components by piece in elimination order and builds every
+   piece. */
+static int buildDomains(DomainSolver *s, const SparseMatrix *A)
+{
+    int n = A->n;
+    int *order = cadMalloc((n + 1) * sizeof(int));
+    int *where = cadMalloc((n + 1) * sizeof(int));
+    int *halo = cadMalloc((n + 1) * sizeof(int));
+    int status = -1;
+
+    s->domain = cadCalloc(s->count, sizeof(Subdomain));
+    s->separator = cadMalloc((n + 1) * sizeof(int));
+    s->local = cadMalloc((n + 1) * sizeof(int));
+    s->fixed = cadMalloc((n + 1) * sizeof(int));
+    if (!order || !where || !halo || !s->domain || !s->separator || !s->local || !s->fixed ||
+        orderCircuitMatrix(s->array, order) != 0)
+        goto done;
+
+    for (int i = 0; i < n; i++)
+    {
+        where[i] = -1;
+        if (s->part[i] >= 0)
+            s->domain[s->part[i]].m++;
+    }
+    for (int d = 0; d < s->count; d++)
+    {
+        s->domain[d].node = cadMalloc((s->domain[d].m + 1) * sizeof(int));
+        if (!s->domain[d].node)
+            goto done;
+        s->domain[d].m = 0;
+    }
+    s->separators = s->fixeds = 0;
+    for (int k = 0; k < n; k++)
+    {
+        int i = order[k], d = s->part[i];
+        if (d < 0 && A->row_ptr[i + 1] - A->row_ptr[i] == 1)
+        {
+            s->local[i] = -1;
+            s->fixed[s->fixeds++] = i;
+        }
+        else if (d < 0)
+        {
+            s->local[i] = s->separators;
+            s->separator[s->separators++] = i;
+        }
+        else
+        {
+            s->local[i] = s->domain[d].m;
+            s->domain[d].node[s->domain[d].m++] = i;
+        }
+    }
+    for (int d = 0; d < s->count; d++)
+        if (buildSubdomain(s, A, &s->domain[d], d, where, halo) != 0)
+            goto done;
+
+    s->couplings = 0;
+    for (int i = 0; i < n; i++)
+        for (int p = A->row_ptr[i]; p < A->row_ptr[i + 1]; p++)
+            if (A->col_idx[p] != i && isFixed(s, A->col_idx[p]))
+                s->couplings++;
+    s->coupling = cadMalloc((s->couplings + 1) * sizeof(int));
+    s->coupling_row = cadMalloc((s->couplings + 1) * sizeof(int));
+    if (!s->coupling || !s->coupling_row)
+        goto done;
+    s->couplings = 0;
+    for (int i = 0; i < n; i++)
+    {
+        for (int p = A->row_ptr[i]; p < A->row_ptr[i + 1]; p++)
+        {
+            if (A->col_idx[p] != i && isFixed(s, A->col_idx[p]))
+            {
+                s->coupling[s->couplings] = p;
+                s->coupling_row[s->couplings++] = i;
+            }
+        }
+    }
+
+    s->rhs = cadMalloc((s->separators + 1) * sizeof(double));
+    s->work = cadMalloc((s->separators + 1) * sizeof(double));
+    s->at = cadMalloc((s->separators + 1) * sizeof(int));
+    if (!s->rhs || !s->work || !s->at)
+        goto done;
+    for (int t = 0; t < s->separators; t++)
+        s->at[t] = -1;
+    status = 0;
+
+done:
+    cadFree(order);
+    cadFree(where);
+    cadFree(halo);
+    return status;
+}
+
+static void freeDomains(DomainSolver *s)
+{
+    for (int d = 0; s->domain && d < s->count; d++)
+    {
+        Subdomain *sub = &s->domain[d];
+        cadFree(sub->node);
+        cadFree(sub->slot);
+        cadFree(sub->source);
+        cadFree(sub->x);
+        cadFree(sub->work);
+        freeSparseMatrix(&sub->M);
+        freeSparseLU(&sub->lu);
+    }
+    cadFree(s->domain);
+    cadFree(s->separator);
+    cadFree(s->local);
+    cadFree(s->fixed);
+    cadFree(s->coupling);
+    cadFree(s->coupling_row);
+    cadFree(s->rhs);
+    cadFree(s->work);
+    cadFree(s->at);
+    freeSparseMatrix(&s->S);
+    freeSparseLU(&s->slu);
+}
+
+static void factorDomain(void *arg, size_t index, int worker)
+{
+    DomainSolver *s = arg;
+    Subdomain *d = &s->domain[index];
+
+    for (int e = 0; e < d->M.nnz; e++)
+        d->M.values[e] = s->A->values[d->source[e]];
+    d->status = sparseLUFactorPartial(&d->M, d->m, &d->lu);
+}
+
+static void refactorDomain(void *arg, size_t index, int worker)
+{
+    DomainSolver *s = arg;
+    Subdomain *d = &s->domain[index];
+
+    for (int e = 0; e < d->M.nnz; e++)
+        d->M.values[e] = s->A->values[d->source[e]];
+    d->status = sparseLURefactorPartial(&d->M, d->m, &d->lu, d->work);
+}
+
+/* The separator block of A plus what every piece left in the trailing
+   columns of its L, summed into rows of S. Each row is gathered into its
+   own range first and then merged in place. */
+static int assembleSeparators(DomainSolver *s, const SparseMatrix *A)
+{
+    int ns = s->separators;
+    SparseMatrix *S = &s->S;
+    int *next;
+
+    freeSparseMatrix(S);
+    S->n = ns;
+    S->row_ptr = cadCalloc(ns + 1, sizeof(int));
+    if (!S->row_ptr)
+        return -1;
+    for (int t = 0; t < ns; t++)
+    {
+        int i = s->separator[t];
+        for (int p = A->row_ptr[i]; p < A->row_ptr[i + 1]; p++)
+            if (isSeparator(s, A->col_idx[p]))
+                S->row_ptr[t + 1]++;
+    }
+    for (int d = 0; d < s->count; d++)
+    {
+        const Subdomain *sub = &s->domain[d];
+        for (int p = sub->lu.lp[sub->m]; p < sub->lu.lp[sub->M.n]; p++)
+            S->row_ptr[sub->slot[sub->lu.li[p] - sub->m] + 1]++;
+    }
+    for (int t = 0; t < ns; t++)
+        S->row_ptr[t + 1] += S->row_ptr[t];
+
+    int total = S->row_ptr[ns];
+    S->col_idx = cadMalloc((total + 1) * sizeof(int));
+    S->values = cadMalloc((total + 1) * sizeof(double));
+    next = cadMalloc((ns + 1) * sizeof(int));
+    if (!S->col_idx || !S->values || !next)
+    {
+        cadFree(next);
+        return -1;
+    }
+    memcpy(next, S->row_ptr, ns * sizeof(int));
+    for (int t = 0; t < ns; t++)
+    {
+        int i = s->separator[t];
+        for (int p = A->row_ptr[i]; p < A->row_ptr[i + 1]; p++)
+        {
+            int j = A->col_idx[p];
+            if (isSeparator(s, j))
+            {
+                S->col_idx[next[t]] = s->local[j];
+                S->values[next[t]++] = A->values[p];
+            }
+        }
+    }
+    for (int d = 0; d < s->count; d++)
+    {
+        const Subdomain *sub = &s->domain[d];
+        for (int k = sub->m; k < sub->M.n; k++)
+        {
+            for (int p = sub->lu.lp[k]; p < sub->lu.lp[k + 1]; p++)
+            {
+                int t = sub->slot[sub->lu.li[p] - sub->m];
+                S->col_idx[next[t]] = sub->slot[k - sub->m];
+                S->values[next[t]++] = sub->lu.lx[p];
+            }
+        }
+    }
+    cadFree(next);
+
+    int nnz = 0;
+    for (int t = 0; t < ns; t++)
+    {
+        int start = nnz;
+        for (int p = S->row_ptr[t]; p < S->row_ptr[t + 1]; p++)
+        {
+            int j = S->col_idx[p];
+            if (s->at[j] < 0)
+            {
+                s->at[j] = nnz;
+                S->col_idx[nnz] = j;
+                S->values[nnz++] = S->values[p];
+            }
+            else
+                S->values[s->at[j]] += S->values[p];
+        }
+        for (int p = start; p < nnz; p++)
+            s->at[S->col_idx[p]] = -1;
+        S->row_ptr[t] = start;
+    }
+    S->row_ptr[ns] = nnz;
+    S->nnz = nnz;
+    return 0;
+}
+
+/* The pieces refactor over their first pivot order while every one of
+   them can; otherwise all start afresh. S is small and always factored
+   anew. Factors made on the pool threads are freed here, on the thread
+   that owns the active arena. */
+static int domainFactor(void *context, const SparseMatrix *A, SolveStats *stats)
+{
+    DomainSolver *s = context;
+    bool refactored = false;
+    if (!s->domain && buildDomains(s, A) != 0)
+    {
+        fprintf(stderr, "Could not split the circuit matrix.\n");
+        return -1;
+    }
+
+    s->A = A;
+    freeSparseLU(&s->slu);
+    if (s->domain[0].lu.pinv)
+    {
+        threadPoolRun(s->pool, refactorDomain, s, s->count);
+        refactored = true;
+        for (int d = 0; d < s->count; d++)
+            if (s->domain[d].status != 0)
+                refactored = false;
+    }
+    if (!refactored)
+    {
+        for (int d = 0; d < s->count; d++)
+            freeSparseLU(&s->domain[d].lu);
+        threadPoolRun(s->pool, factorDomain, s, s->count);
+    }
+
+    int lu_nnz = 0;
+    for (int d = 0; d < s->count; d++)
+    {
+        const Subdomain *sub = &s->domain[d];
+        if (sub->status != 0)
+        {
+            fprintf(stderr, "Circuit matrix is singular.\n");
+            return -1;
+        }
+        lu_nnz += sub->lu.lp[sub->M.n] + sub->lu.up[sub->M.n];
+    }
+    if (assembleSeparators(s, A) != 0 || sparseLUFactor(&s->S, &s->slu) != 0)
+    {
+        fprintf(stderr, "Circuit matrix is singular.\n");
+        return -1;
+    }
+    if (refactored)
+        stats->refactorizations++;
+    else
+        stats->factorizations++;
+    return lu_nnz + s->slu.lp[s->separators] + s->slu.up[s->separators];
+}
+
+/* Eliminates the piece's own components from its right-hand side,
+   leaving its contribution to the separators' in the halo. */
+static void forwardDomain(void *arg, size_t index, int worker)
+{
+    DomainSolver *s = arg;
+    Subdomain *d = &s->domain[index];
+
+    for (int r = 0; r < d->m; r++)
+        d->x[r] = s->b[d->node[r]];
+    for (int t = 0; t < d->h; t++)
+        d->x[d->m + t] = 0.0;
+    sparseLUForwardPartial(&d->lu, d->m, d->x, d->work);
+}
+
+static void backDomain(void *arg, size_t index, int worker)
+{
+    DomainSolver *s = arg;
+    Subdomain *d = &s->domain[index];
+
+    for (int t = 0; t < d->h; t++)
+        d->x[d->m + t] = s->rhs[d->slot[t]];
+    sparseLUBackPartial(&d->lu, d->m, d->x);
+    for (int r = 0; r < d->m; r++)
+        s->b[d->node[r]] = d->x[r];
+}
+
+static void domainSolve(void *context, double *b)
+{
+    DomainSolver *s = context;
+    const SparseMatrix *A = s->A;
+    for (int f = 0; f < s->fixeds; f++)
+        b[s->fixed[f]] /= A->values[A->row_ptr[s->fixed[f]]];
+    for (int c = 0; c < s->couplings; c++)
+        b[s->coupling_row[c]] -= A->values[s->coupling[c]] * b[A->col_idx[s->coupling[c]]];
+
+    s->b = b;
+    threadPoolRun(s->pool, forwardDomain, s, s->count);
+
+    for (int t = 0; t < s->separators; t++)
+        s->rhs[t] = b[s->separator[t]];
+    for (int d = 0; d < s->count; d++)
+    {
+        const Subdomain *sub = &s->domain[d];
+        for (int t = 0; t < sub->h; t++)
+            s->rhs[sub->slot[t]] += sub->x[sub->m + t];
+    }
+    sparseLUSolve(&s->slu, s->rhs, s->work);
+
+    threadPoolRun(s->pool, backDomain, s, s->count);
+    for (int t = 0; t < s->separators; t++)
+        b[s->separator[t]] = s->rhs[t];
+}
+
+int solveCircuitDomains(ComponentArray *array, const NewtonOptions *options, int domains, ThreadPool *pool,
+                        SolveStats *stats)
+{
+    SolveStats local = {0};
+    DomainSolver s = {0};
+    LinearSolver linear = {&s, domainFactor, domainSolve};
+    int *part = domains > 1 ? cadMalloc((array->size + 1) * sizeof(int)) : NULL;
+    int status;
+
+    s.count = part ? partitionCircuit(array, domains, part) : -1;
+    if (s.count < 2)
+    {
+        cadFree(part);
+        return solveCircuitNewton(array, options, stats);
+    }
+    if (!stats)
+        stats = &local;
+    s.array = array;
+    s.pool = pool;
+    s.part = part;
+    status = solveCircuitWith(array, options, &linear, stats);
+    stats->domains = s.count;
+    freeDomains(&s);
+    cadFree(part);
+    return status;
+}
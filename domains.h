@@ -0,0 +1,16 @@
+#ifndef DOMAINS_H
+#define DOMAINS_H
+
+#include "circuit.h"
+#include "solver.h"
+#include "threadpool.h"
+
+/* solveCircuitNewton with the circuit split by partitionCircuit into at
+   most domains pieces. Each piece is factored on its own pool thread
+   together with the separator components around it, and the separators
+   are then solved through the sum of the pieces' Schur complements.
+   Circuits that do not split solve directly. */
+int solveCircuitDomains(ComponentArray *array, const NewtonOptions *options, int domains, ThreadPool *pool,
+                        SolveStats *stats);
+
+#endif
@@ -0,0 +1,217 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "incremental.h"
+#include "platform.h"
+
+#define MAX_REGION_PASSES 64
+
+/* Frees any previous state, then fully solves the circuit and builds the
+   net graph whose loads give the fan-out of every component. state must
+   be zeroed before first use. */
+int circuitStateInit(CircuitState *state, ComponentArray *array, SolveStats *stats)
+{
+    circuitStateFree(state);
+    if (solveCircuit(array, stats) < 0)
+        return -1;
+    return circuitStateAttach(state, array);
+}
+
+/* As circuitStateInit, for a circuit whose stored outputs are already a
+   solution. */
+int circuitStateAttach(CircuitState *state, ComponentArray *array)
+{
+    circuitStateFree(state);
+    size_t n = array->size;
+    state->n = n;
+    state->values = malloc((n + 1) * sizeof(double));
+    state->local = malloc((n + 1) * sizeof(int));
+    state->affected = malloc((n + 1) * sizeof(int));
+    state->dirty = calloc(n + 1, sizeof(bool));
+    state->dirty_list = malloc((n + 1) * sizeof(int));
+    if (!state->values || !state->local || !state->affected || !state->dirty || !state->dirty_list ||
+        buildNetGraph(array, &state->graph) != 0)
+    {
+        circuitStateFree(state);
+        return -1;
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        state->values[i] = componentOutput(&array->data[i]);
+        state->local[i] = -1;
+    }
+    return 0;
+}
+
+void circuitStateFree(CircuitState *state)
+{
+    free(state->values);
+    freeNetGraph(&state->graph);
+    free(state->local);
+    free(state->affected);
+    free(state->dirty);
+    free(state->dirty_list);
+    memset(state, 0, sizeof(*state));
+}
+
+void markComponentDirty(CircuitState *state, int id)
+{
+    if (id < 0 || (size_t)id >= state->n || state->dirty[id])
+        return;
+    state->dirty[id] = true;
+    state->dirty_list[state->dirty_count++] = id;
+}
+
+int setResistance(CircuitState *state, ComponentArray *array, int id, double resistance)
+{
+    if (id < 0 || (size_t)id >= state->n || array->data[id].type != RESISTOR)
+        return -1;
+    array->data[id].data.resistor.resistance = resistance;
+    markComponentDirty(state, id);
+    return 0;
+}
+
+int setVoltage(CircuitState *state, ComponentArray *array, int id, double voltage)
+{
+    if (id < 0 || (size_t)id >= state->n || array->data[id].type != POWERSUPPLY)
+        return -1;
+    array->data[id].data.powersupply.voltage = voltage;
+    markComponentDirty(state, id);
+    return 0;
+}
+
+int setBeta(CircuitState *state, ComponentArray *array, int id, double beta)
+{
+    if (id < 0 || (size_t)id >= state->n || array->data[id].type != TRANSISTOR)
+        return -1;
+    array->data[id].data.transistor.beta = beta;
+    markComponentDirty(state, id);
+    return 0;
+}
+
+/* Assembles the rows of the affected components only; inputs from outside
+   that set are already solved and move to the right-hand side. */
+static int solveAffected(CircuitState *state, ComponentArray *array, int count, int *nnz)
+{
+    SparseMatrix A = {0};
+    SparseLU lu;
+    double *x = malloc((count + 1) * sizeof(double));
+    double *work = malloc((count + 1) * sizeof(double));
+    A.n = count;
+    A.row_ptr = malloc((count + 1) * sizeof(int));
+    A.col_idx = malloc((3 * (size_t)count + 1) * sizeof(int));
+    A.values = malloc((3 * (size_t)count + 1) * sizeof(double));
+    int status = -1;
+
+    if (!x || !work || !A.row_ptr || !A.col_idx || !A.values)
+        goto done;
+
+    for (int r = 0; r < count; r++)
+    {
+        int cols[3];
+        double vals[3];
+        int k = assembleRow(array, state->affected[r], cols, vals, &x[r]);
+
+        A.row_ptr[r] = A.nnz;
+        for (int t = 0; t < k; t++)
+        {
+            int j = state->local[cols[t]];
+            if (j < 0)
+            {
+                x[r] -= vals[t] * state->values[cols[t]];
+                continue;
+            }
+            A.col_idx[A.nnz] = j;
+            A.values[A.nnz++] = vals[t];
+        }
+    }
+    A.row_ptr[count] = A.nnz;
+    *nnz = A.nnz;
+
+    if (sparseLUFactor(&A, &lu) != 0)
+    {
+        fprintf(stderr, "Circuit matrix is singular.\n");
+        goto done;
+    }
+    sparseLUSolve(&lu, x, work);
+    freeSparseLU(&lu);
+
+    for (int r = 0; r < count; r++)
+        state->values[state->affected[r]] = x[r];
+    status = 0;
+
+done:
+    freeSparseMatrix(&A);
+    free(x);
+    free(work);
+    return status;
+}
+
+/* Re-solves every component reachable from a dirty one through the net
+   loads. The cost follows the size of that downstream set, not the circuit.
+   Returns -1 when the system is singular or the transistor regions have
+   not settled after MAX_REGION_PASSES; the values are then not a
+   solution. */
+int circuitStateUpdate(CircuitState *state, ComponentArray *array, UpdateStats *stats)
+{
+    UpdateStats local = {0};
+    double start = monotonicSeconds();
+    int count = 0;
+    int status = 0;
+
+    if (!stats)
+        stats = &local;
+    memset(stats, 0, sizeof(*stats));
+
+    for (int d = 0; d < state->dirty_count; d++)
+    {
+        int id = state->dirty_list[d];
+        state->dirty[id] = false;
+        state->local[id] = count;
+        state->affected[count++] = id;
+    }
+    state->dirty_count = 0;
+
+    for (int head = 0; head < count; head++)
+    {
+        int i = state->affected[head];
+        for (int p = state->graph.load_start[i]; p < state->graph.load_start[i + 1]; p++)
+        {
+            int k = state->graph.load[p];
+            if (state->local[k] < 0)
+            {
+                state->local[k] = count;
+                state->affected[count++] = k;
+            }
+        }
+    }
+
+    bool region_changed = false;
+    for (int pass = 0; count > 0 && pass < MAX_REGION_PASSES; pass++)
+    {
+        region_changed = false;
+        stats->passes = pass + 1;
+        if (solveAffected(state, array, count, &stats->nnz) != 0)
+        {
+            status = -1;
+            break;
+        }
+        for (int r = 0; r < count; r++)
+            if (storeComponentSolution(array, state->affected[r], state->values))
+                region_changed = true;
+        if (!region_changed)
+            break;
+    }
+    if (status == 0 && region_changed)
+    {
+        fprintf(stderr, "Transistor regions did not settle in %d passes.\n", MAX_REGION_PASSES);
+        status = -1;
+    }
+
+    for (int r = 0; r < count; r++)
+        state->local[state->affected[r]] = -1;
+    stats->affected = count;
+    stats->time = monotonicSeconds() - start;
+    return status;
+}
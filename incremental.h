@@ -0,0 +1,40 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "circuit.h"
+#include "solver.h"
+
+/* Solved values kept alongside a ComponentArray so that parameter edits
+   only re-solve the components downstream of the change. Any change to
+   the pin links requires circuitStateInit again. */
+typedef struct
+{
+    size_t n;
+    double *values;
+    NetGraph graph;
+    int *local;
+    int *affected;
+    bool *dirty;
+    int *dirty_list;
+    int dirty_count;
+} CircuitState;
+
+typedef struct
+{
+    int affected;
+    int nnz;
+    int passes;
+    double time;
+} UpdateStats;
+
+int circuitStateInit(CircuitState *state, ComponentArray *array, SolveStats *stats);
+int circuitStateAttach(CircuitState *state, ComponentArray *array);
+void circuitStateFree(CircuitState *state);
+
+void markComponentDirty(CircuitState *state, int id);
+int setResistance(CircuitState *state, ComponentArray *array, int id, double resistance);
+int setVoltage(CircuitState *state, ComponentArray *array, int id, double voltage);
+int setBeta(CircuitState *state, ComponentArray *array, int id, double beta);
+int circuitStateUpdate(CircuitState *state, ComponentArray *array, UpdateStats *stats);
+
+#endif
@@ -0,0 +1,997 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include "jsonreader.h"
+#include "arena.h"
+#include "subcircuit.h"
+
+#define MAX_NUMBER_LENGTH 64
+#define RELEASE_INTERVAL (64u << 20)
+
+typedef struct
+{
+    const char *p;
+    const char *end;
+    const char *name;
+    int line;
+    bool failed;
+    MappedFile *map;
+    size_t released;
+    bool in_subcircuit;
+    int *ports;
+    size_t port_count;
+    size_t port_capacity;
+    ParameterOverride *overrides;
+    size_t override_count;
+    size_t override_capacity;
+    int subcircuit;
+    LoadNotes *notes;
+    bool rejected;
+} JsonReader;
+
+typedef enum
+{
+    KEY_UNKNOWN,
+    KEY_ID,
+    KEY_TYPE,
+    KEY_VOLTAGE,
+    KEY_RESISTANCE,
+    KEY_OUTPUT_TYPE,
+    KEY_PIN1,
+    KEY_PIN2,
+    KEY_PIN3,
+    KEY_TRANSISTOR_TYPE,
+    KEY_IO_FORMAT,
+    KEY_BETA,
+    KEY_WAVEFORM,
+    KEY_SUBCIRCUIT,
+    KEY_PORTS,
+    KEY_PARAMETERS
+} FieldKey;
+
+typedef struct
+{
+    int line;
+    unsigned present;
+    bool has_id;
+    int id;
+    ComponentType type;
+    char type_name[24];
+    double voltage;
+    double resistance;
+    bool current_output;
+    bool pnp;
+    bool current_io;
+    double beta;
+    int pins[3];
+    bool has_waveform;
+    Waveform waveform;
+    const char *subcircuit;
+    size_t subcircuit_length;
+} ComponentFields;
+
+/* Numeric waveform fields; "offset" and "amplitude" are the sine names
+   for v1 and v2. */
+static const struct
+{
+    const char *name;
+    size_t offset;
+} waveform_fields[] = {
+    {"v1", offsetof(Waveform, v1)},
+    {"v2", offsetof(Waveform, v2)},
+    {"offset", offsetof(Waveform, v1)},
+    {"amplitude", offsetof(Waveform, v2)},
+    {"delay", offsetof(Waveform, delay)},
+    {"rise", offsetof(Waveform, rise)},
+    {"fall", offsetof(Waveform, fall)},
+    {"width", offsetof(Waveform, width)},
+    {"period", offsetof(Waveform, period)},
+    {"frequency", offsetof(Waveform, frequency)},
+    {"phase", offsetof(Waveform, phase)},
+};
+
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static void readerError(JsonReader *r, const char *msg)
+{
+    if (!r->failed)
+        fprintf(stderr, "%s:%d: %s\n", r->name, r->line, msg);
+    r->failed = true;
+}
+
+static void skipSpace(JsonReader *r)
+{
+    while (r->p < r->end)
+    {
+        char c = *r->p;
+        if (c == '\n')
+            r->line++;
+        else if (c != ' ' && c != '\t' && c != '\r')
+            break;
+        r->p++;
+    }
+}
+
+static bool expect(JsonReader *r, char c)
+{
+    skipSpace(r);
+    if (r->p < r->end && *r->p == c)
+    {
+        r->p++;
+        return true;
+    }
+    char msg[32];
+    snprintf(msg, sizeof(msg), "expected '%c'", c);
+    readerError(r, msg);
+    return false;
+}
+
+/* Returns the raw bytes between the quotes; escapes are skipped over but
+   left in place, which is enough for the fixed keys and enum values. */
+static bool readString(JsonReader *r, const char **s, size_t *len)
+{
+    skipSpace(r);
+    if (r->p >= r->end || *r->p != '"')
+    {
+        readerError(r, "expected string");
+        return false;
+    }
+    const char *start = ++r->p;
+    while (r->p < r->end && *r->p != '"')
+    {
+        if (*r->p == '\\' && r->p + 1 < r->end)
+            r->p++;
+        r->p++;
+    }
+    if (r->p >= r->end)
+    {
+        readerError(r, "unterminated string");
+        return false;
+    }
+    *s = start;
+    *len = r->p - start;
+    r->p++;
+    return true;
+}
+
+/* Exact for up to 19 significant digits and |exponent| <= 22, which covers
+   everything saveCircuit writes; anything longer goes through strtod. */
+static bool readNumber(JsonReader *r, double *out)
+{
+    skipSpace(r);
+    const char *start = r->p, *p = r->p, *end = r->end;
+    uint64_t mantissa = 0;
+    int significant = 0, exp10 = 0, digits = 0;
+    bool negative = false, truncated = false;
+
+    if (p < end && *p == '-')
+    {
+        negative = true;
+        p++;
+    }
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+    {
+        if (significant < 19)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa)
+                significant++;
+        }
+        else
+        {
+            exp10++;
+            truncated = true;
+        }
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+        {
+            if (significant < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa)
+                    significant++;
+                exp10--;
+            }
+            else
+                truncated = true;
+        }
+    }
+    if (digits == 0)
+    {
+        readerError(r, "expected number");
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        int sign = 1, e = 0;
+        p++;
+        if (p < end && (*p == '+' || *p == '-'))
+            sign = *p++ == '-' ? -1 : 1;
+        if (p >= end || *p < '0' || *p > '9')
+        {
+            readerError(r, "malformed exponent");
+            return false;
+        }
+        for (; p < end && *p >= '0' && *p <= '9'; p++)
+            if (e < 100000)
+                e = e * 10 + (*p - '0');
+        exp10 += sign * e;
+    }
+    r->p = p;
+
+    if (!truncated && mantissa <= (UINT64_C(1) << 53) && exp10 >= -22 && exp10 <= 22)
+    {
+        double value = (double)mantissa;
+        value = exp10 < 0 ? value / powers_of_ten[-exp10] : value * powers_of_ten[exp10];
+        *out = negative ? -value : value;
+        return true;
+    }
+
+    char buffer[MAX_NUMBER_LENGTH];
+    if (p - start >= MAX_NUMBER_LENGTH)
+    {
+        readerError(r, "number too long");
+        return false;
+    }
+    memcpy(buffer, start, p - start);
+    buffer[p - start] = '\0';
+    *out = strtod(buffer, NULL);
+    return true;
+}
+
+static bool readInt(JsonReader *r, int *out)
+{
+    double value;
+    if (!readNumber(r, &value))
+        return false;
+    *out = value >= 2147483647.0 ? 2147483647 : value <= -2147483648.0 ? (-2147483647 - 1) : (int)value;
+    return true;
+}
+
+/* Skips any JSON value without validating its contents. */
+static bool skipValue(JsonReader *r)
+{
+    int depth = 0;
+    do
+    {
+        skipSpace(r);
+        if (r->p >= r->end)
+        {
+            readerError(r, "unexpected end of file");
+            return false;
+        }
+        char c = *r->p;
+        if (c == '"')
+        {
+            const char *s;
+            size_t len;
+            if (!readString(r, &s, &len))
+                return false;
+        }
+        else if (c == '{' || c == '[')
+        {
+            depth++;
+            r->p++;
+        }
+        else if (depth == 0 && (c == '}' || c == ']' || c == ',' || c == ':'))
+        {
+            readerError(r, "expected value");
+            return false;
+        }
+        else if (c == '}' || c == ']')
+        {
+            depth--;
+            r->p++;
+        }
+        else if (c == ',' || c == ':')
+            r->p++;
+        else
+        {
+            /* strchr would match a NUL byte against the terminator. */
+            const char *start = r->p;
+            while (r->p < r->end && *r->p && !strchr(",:]} \t\r\n", *r->p))
+                r->p++;
+            if (r->p == start)
+            {
+                readerError(r, "unexpected character");
+                return false;
+            }
+        }
+    } while (depth > 0);
+    return true;
+}
+
+static FieldKey classifyKey(const char *s, size_t len)
+{
+    switch (len)
+    {
+    case 2:
+        return memcmp(s, "id", 2) == 0 ? KEY_ID : KEY_UNKNOWN;
+    case 4:
+        if (memcmp(s, "type", 4) == 0)
+            return KEY_TYPE;
+        if (memcmp(s, "beta", 4) == 0)
+            return KEY_BETA;
+        if (memcmp(s, "pin", 3) == 0)
+        {
+            switch (s[3])
+            {
+            case '1':
+                return KEY_PIN1;
+            case '2':
+                return KEY_PIN2;
+            case '3':
+                return KEY_PIN3;
+            }
+        }
+        return KEY_UNKNOWN;
+    case 5:
+        return memcmp(s, "ports", 5) == 0 ? KEY_PORTS : KEY_UNKNOWN;
+    case 7:
+        return memcmp(s, "voltage", 7) == 0 ? KEY_VOLTAGE : KEY_UNKNOWN;
+    case 8:
+        return memcmp(s, "waveform", 8) == 0 ? KEY_WAVEFORM : KEY_UNKNOWN;
+    case 10:
+        if (memcmp(s, "resistance", 10) == 0)
+            return KEY_RESISTANCE;
+        if (memcmp(s, "subcircuit", 10) == 0)
+            return KEY_SUBCIRCUIT;
+        return memcmp(s, "parameters", 10) == 0 ? KEY_PARAMETERS : KEY_UNKNOWN;
+    case 11:
+        return memcmp(s, "output_type", 11) == 0 ? KEY_OUTPUT_TYPE : KEY_UNKNOWN;
+    case 15:
+        return memcmp(s, "transistor_type", 15) == 0 ? KEY_TRANSISTOR_TYPE : KEY_UNKNOWN;
+    case 19:
+        return memcmp(s, "input_output_format", 19) == 0 ? KEY_IO_FORMAT : KEY_UNKNOWN;
+    }
+    return KEY_UNKNOWN;
+}
+
+static ComponentType classifyType(const char *s, size_t len)
+{
+    switch (len)
+    {
+    case 11:
+        return memcmp(s, "PowerSupply", 11) == 0 ? POWERSUPPLY : 0;
+    case 8:
+        if (memcmp(s, "Resistor", 8) == 0)
+            return RESISTOR;
+        return memcmp(s, "Instance", 8) == 0 ? INSTANCE : 0;
+    case 10:
+        return memcmp(s, "Transistor", 10) == 0 ? TRANSISTOR : 0;
+    }
+    return 0;
+}
+
+static bool readWaveformField(JsonReader *r, const char *key, size_t len, Waveform *w)
+{
+    const char *s;
+    size_t n;
+
+    if (len == 5 && memcmp(key, "shape", 5) == 0)
+    {
+        if (!readString(r, &s, &n))
+            return false;
+        if (n == 4 && memcmp(s, "step", 4) == 0)
+            w->shape = WAVEFORM_STEP;
+        else if (n == 5 && memcmp(s, "pulse", 5) == 0)
+            w->shape = WAVEFORM_PULSE;
+        else if (n == 4 && memcmp(s, "sine", 4) == 0)
+            w->shape = WAVEFORM_SINE;
+        else
+        {
+            readerError(r, "unknown waveform shape");
+            return false;
+        }
+        return true;
+    }
+    for (size_t k = 0; k < sizeof(waveform_fields) / sizeof(waveform_fields[0]); k++)
+        if (strlen(waveform_fields[k].name) == len && memcmp(waveform_fields[k].name, key, len) == 0)
+            return readNumber(r, (double *)((char *)w + waveform_fields[k].offset));
+    return skipValue(r);
+}
+
+static bool readWaveform(JsonReader *r, Waveform *w)
+{
+    if (!expect(r, '{'))
+        return false;
+    skipSpace(r);
+    if (r->p < r->end && *r->p == '}')
+    {
+        r->p++;
+        return true;
+    }
+    for (;;)
+    {
+        const char *key;
+        size_t len;
+        if (!readString(r, &key, &len) || !expect(r, ':') || !readWaveformField(r, key, len, w))
+            return false;
+        skipSpace(r);
+        if (r->p < r->end && *r->p == ',')
+        {
+            r->p++;
+            continue;
+        }
+        return expect(r, '}');
+    }
+}
+
+/* Calls item once per element of an array, with the reader on the
+   element. */
+static bool readArray(JsonReader *r, bool (*item)(JsonReader *r))
+{
+    if (!expect(r, '['))
+        return false;
+    skipSpace(r);
+    if (r->p < r->end && *r->p == ']')
+    {
+        r->p++;
+        return true;
+    }
+    for (;;)
+    {
+        if (!item(r))
+            return false;
+        skipSpace(r);
+        if (r->p < r->end && *r->p == ',')
+        {
+            r->p++;
+            continue;
+        }
+        return expect(r, ']');
+    }
+}
+
+static bool readPort(JsonReader *r)
+{
+    if (r->port_count == r->port_capacity)
+    {
+        size_t capacity = r->port_capacity ? r->port_capacity * 2 : 8;
+        int *ports = cadRealloc(r->ports, capacity * sizeof(int));
+        if (!ports)
+        {
+            readerError(r, "out of memory");
+            return false;
+        }
+        r->ports = ports;
+        r->port_capacity = capacity;
+    }
+    return readInt(r, &r->ports[r->port_count++]);
+}
+
+/* One [component, value] pair. */
+static bool readOverride(JsonReader *r)
+{
+    if (r->override_count == r->override_capacity)
+    {
+        size_t capacity = r->override_capacity ? r->override_capacity * 2 : 4;
+        ParameterOverride *overrides = cadRealloc(r->overrides, capacity * sizeof(ParameterOverride));
+        if (!overrides)
+        {
+            readerError(r, "out of memory");
+            return false;
+        }
+        r->overrides = overrides;
+        r->override_capacity = capacity;
+    }
+    ParameterOverride *o = &r->overrides[r->override_count++];
+    return expect(r, '[') && readInt(r, &o->component) && expect(r, ',') && readNumber(r, &o->value) &&
+           expect(r, ']');
+}
+
+static bool readField(JsonReader *r, FieldKey key, ComponentFields *f)
+{
+    const char *s;
+    size_t len;
+    double id;
+
+    f->present |= 1u << key;
+    switch (key)
+    {
+    case KEY_ID:
+        skipSpace(r);
+        if (r->p < r->end && (*r->p == '-' || (*r->p >= '0' && *r->p <= '9')))
+        {
+            if (!readNumber(r, &id))
+                return false;
+            f->has_id = true;
+            f->id = (int)id;
+            return true;
+        }
+        return skipValue(r);
+    case KEY_TYPE:
+        skipSpace(r);
+        if (r->p < r->end && *r->p == '"')
+        {
+            if (!readString(r, &s, &len))
+                return false;
+            f->type = classifyType(s, len);
+            snprintf(f->type_name, sizeof(f->type_name), "%.*s", (int)len, s);
+            return true;
+        }
+        return skipValue(r);
+    case KEY_VOLTAGE:
+        return readNumber(r, &f->voltage);
+    case KEY_RESISTANCE:
+        return readNumber(r, &f->resistance);
+    case KEY_BETA:
+        return readNumber(r, &f->beta);
+    case KEY_WAVEFORM:
+        f->has_waveform = true;
+        return readWaveform(r, &f->waveform);
+    case KEY_PIN1:
+    case KEY_PIN2:
+    case KEY_PIN3:
+        return readInt(r, &f->pins[key - KEY_PIN1]);
+    case KEY_OUTPUT_TYPE:
+        if (!readString(r, &s, &len))
+            return false;
+        f->current_output = len == 7 && memcmp(s, "Current", 7) == 0;
+        return true;
+    case KEY_TRANSISTOR_TYPE:
+        if (!readString(r, &s, &len))
+            return false;
+        f->pnp = len == 3 && memcmp(s, "PNP", 3) == 0;
+        return true;
+    case KEY_IO_FORMAT:
+        if (!readString(r, &s, &len))
+            return false;
+        f->current_io = len == 7 && memcmp(s, "Current", 7) == 0;
+        return true;
+    case KEY_SUBCIRCUIT:
+        return readString(r, &f->subcircuit, &f->subcircuit_length);
+    case KEY_PORTS:
+        r->port_count = 0;
+        return readArray(r, readPort);
+    case KEY_PARAMETERS:
+        r->override_count = 0;
+        return readArray(r, readOverride);
+    case KEY_UNKNOWN:
+        break;
+    }
+    return skipValue(r);
+}
+
+/* Instances refer to their definition by name, so the subcircuits must
+   come before the components. */
+static bool addInstanceFields(JsonReader *r, ComponentArray *out, const ComponentFields *f, int id)
+{
+    if (r->in_subcircuit)
+    {
+        readerError(r, "instances inside subcircuits are not supported");
+        return false;
+    }
+    int s = f->subcircuit ? findSubcircuit(out, f->subcircuit, f->subcircuit_length) : -1;
+    if (s < 0)
+    {
+        readerError(r, "instance of an unknown subcircuit");
+        return false;
+    }
+    const Subcircuit *def = &out->hierarchy->subcircuits[s];
+    if (r->port_count != (size_t)def->ports)
+    {
+        readerError(r, "instance ports do not match its subcircuit");
+        return false;
+    }
+    for (size_t k = 0; k < r->override_count; k++)
+        if (r->overrides[k].component < 0 || (size_t)r->overrides[k].component >= def->body.size)
+        {
+            readerError(r, "parameter for a component outside the subcircuit");
+            return false;
+        }
+    addInstance(out, s, r->ports, r->overrides, (int)r->override_count);
+    /* Kept as written so that validateCircuit sees a misplaced id. */
+    out->data[out->size - 1].data.instance.id = id;
+    return true;
+}
+
+/* Top-level components only; bodies are located by definition. */
+static void addLine(JsonReader *r, int line)
+{
+    LoadNotes *notes = r->notes;
+    if (!notes || r->in_subcircuit)
+        return;
+    if (notes->line_count == notes->line_capacity)
+    {
+        size_t new_capacity = notes->line_capacity ? 2 * notes->line_capacity : 1024;
+        int *new_lines = cadRealloc(notes->lines, new_capacity * sizeof(int));
+        if (!new_lines)
+        {
+            perror("Failed to allocate memory");
+            exit(EXIT_FAILURE);
+        }
+        notes->lines = new_lines;
+        notes->line_capacity = new_capacity;
+    }
+    notes->lines[notes->line_count++] = line;
+}
+
+/* Left for validateCircuit to report with everything else it finds;
+   without notes it is printed here and the file is rejected. */
+static void addProblem(JsonReader *r, int component, int line, const char *format, ...)
+{
+    LoadNotes *notes = r->notes;
+    char message[sizeof(((LoadProblem *)0)->message)];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    r->rejected = true;
+    if (!notes)
+    {
+        fprintf(stderr, "%s:%d: %s\n", r->name, line, message);
+        return;
+    }
+    if (notes->problem_count == notes->problem_capacity)
+    {
+        size_t new_capacity = notes->problem_capacity ? 2 * notes->problem_capacity : 16;
+        LoadProblem *problems = cadRealloc(notes->problems, new_capacity * sizeof(LoadProblem));
+        if (!problems)
+        {
+            perror("Failed to allocate memory");
+            exit(EXIT_FAILURE);
+        }
+        notes->problems = problems;
+        notes->problem_capacity = new_capacity;
+    }
+    LoadProblem *p = &notes->problems[notes->problem_count++];
+    p->subcircuit = r->in_subcircuit ? r->subcircuit : -1;
+    p->component = component;
+    p->line = line;
+    memcpy(p->message, message, sizeof(message));
+}
+
+/* Fields every component of a type must have, as the first versions of
+   the loader required them. */
+static unsigned requiredFields(ComponentType type)
+{
+    switch (type)
+    {
+    case POWERSUPPLY:
+        return 1u << KEY_VOLTAGE | 1u << KEY_PIN1;
+    case RESISTOR:
+        return 1u << KEY_RESISTANCE | 1u << KEY_PIN1 | 1u << KEY_PIN2;
+    case TRANSISTOR:
+        return 1u << KEY_PIN1 | 1u << KEY_PIN2 | 1u << KEY_PIN3;
+    case INSTANCE:
+        break;
+    }
+    return 0;
+}
+
+static const char *const required_names[] = {
+    [KEY_VOLTAGE] = "voltage", [KEY_RESISTANCE] = "resistance", [KEY_PIN1] = "pin1",
+    [KEY_PIN2] = "pin2",       [KEY_PIN3] = "pin3",
+};
+
+/* An entry without an id or a known type is reported and still takes
+   its position, so that the ones after it are not shifted: a missing id
+   is taken to be the position, an unknown type leaves a component of
+   type zero that validateCircuit passes over. */
+static bool addFields(JsonReader *r, ComponentArray *out, const ComponentFields *f)
+{
+    Component c = {0};
+    int position = (int)out->size;
+    int id = f->has_id ? f->id : position;
+
+    if (!f->has_id)
+        addProblem(r, position, f->line, "no id");
+    if (!f->type)
+    {
+        if (f->present & 1u << KEY_TYPE)
+            addProblem(r, position, f->line, "unknown type \"%s\"", f->type_name);
+        else
+            addProblem(r, position, f->line, "no type");
+        addComponent(out, c);
+        addLine(r, f->line);
+        return true;
+    }
+    unsigned missing = requiredFields(f->type) & ~f->present;
+    for (int key = KEY_VOLTAGE; key <= KEY_PIN3; key++)
+        if (missing & 1u << key)
+            addProblem(r, position, f->line, "no %s", required_names[key]);
+
+    c.type = f->type;
+    switch (f->type)
+    {
+    case POWERSUPPLY:
+        c.data.powersupply.id = id;
+        c.data.powersupply.voltage = f->voltage;
+        c.data.powersupply.pin1 = f->pins[0];
+        if (f->has_waveform)
+        {
+            Waveform w = f->waveform;
+            w.component = position;
+            addWaveform(out, w);
+        }
+        break;
+    case RESISTOR:
+        /* A missing resistance is already reported; 1 keeps validation
+           from reporting it again as not positive. */
+        c.data.resistor.id = id;
+        c.data.resistor.resistance = missing & 1u << KEY_RESISTANCE ? 1.0 : f->resistance;
+        c.data.resistor.otype = f->current_output ? CALC_CURRENT : CALC_VOLTAGE;
+        c.data.resistor.pin1 = f->pins[0];
+        c.data.resistor.pin2 = f->pins[1];
+        break;
+    case TRANSISTOR:
+        c.data.transistor.id = id;
+        c.data.transistor.type = f->pnp;
+        c.data.transistor.input_type = f->current_io;
+        c.data.transistor.beta = f->beta;
+        c.data.transistor.pin1 = f->pins[0];
+        c.data.transistor.pin2 = f->pins[1];
+        c.data.transistor.pin3 = f->pins[2];
+        break;
+    case INSTANCE:
+        if (!addInstanceFields(r, out, f, id))
+            return false;
+        addLine(r, f->line);
+        return true;
+    }
+    addComponent(out, c);
+    addLine(r, f->line);
+    return true;
+}
+
+static bool readComponent(JsonReader *r, ComponentArray *out)
+{
+    ComponentFields fields = {.beta = TRANSISTOR_BETA, .pins = {-1, -1, -1}};
+
+    r->port_count = r->override_count = 0;
+    if (!expect(r, '{'))
+        return false;
+    fields.line = r->line;
+    skipSpace(r);
+    if (r->p < r->end && *r->p == '}')
+    {
+        r->p++;
+        return addFields(r, out, &fields);
+    }
+    for (;;)
+    {
+        const char *key;
+        size_t len;
+        if (!readString(r, &key, &len) || !expect(r, ':') ||
+            !readField(r, classifyKey(key, len), &fields))
+            return false;
+        skipSpace(r);
+        if (r->p < r->end && *r->p == ',')
+        {
+            r->p++;
+            continue;
+        }
+        if (!expect(r, '}'))
+            return false;
+        break;
+    }
+    return addFields(r, out, &fields);
+}
+
+static bool readComponents(JsonReader *r, ComponentArray *out)
+{
+    if (!expect(r, '['))
+        return false;
+    skipSpace(r);
+    if (r->p < r->end && *r->p == ']')
+    {
+        r->p++;
+        return true;
+    }
+    for (;;)
+    {
+        if (!readComponent(r, out))
+            return false;
+        /* A definition's name is still needed after its components. */
+        if (r->map && !r->in_subcircuit && (size_t)(r->p - r->map->data) - r->released >= RELEASE_INTERVAL)
+        {
+            r->released = r->p - r->map->data;
+            releaseMappedRange(r->map, r->released);
+        }
+        skipSpace(r);
+        if (r->p < r->end && *r->p == ',')
+        {
+            r->p++;
+            continue;
+        }
+        return expect(r, ']');
+    }
+}
+
+/* Input pins that name a port must name one the definition has. */
+static bool checkPorts(const ComponentArray *body, int ports)
+{
+    for (size_t j = 0; j < body->size; j++)
+    {
+        const Component *c = &body->data[j];
+        int pins[2] = {-1, -1};
+        if (c->type == RESISTOR)
+            pins[0] = c->data.resistor.pin1;
+        else if (c->type == TRANSISTOR)
+        {
+            pins[0] = c->data.transistor.pin1;
+            pins[1] = c->data.transistor.pin2;
+        }
+        for (int k = 0; k < 2; k++)
+            if (pins[k] <= -2 && PIN_PORT(pins[k]) >= ports)
+                return false;
+    }
+    return true;
+}
+
+static bool readSubcircuit(JsonReader *r, ComponentArray *out)
+{
+    ComponentArray body = {0};
+    const char *name = NULL;
+    size_t name_length = 0;
+    int ports = 0, output = -1;
+    bool ok = expect(r, '{');
+
+    skipSpace(r);
+    if (ok && r->p < r->end && *r->p == '}')
+        r->p++;
+    else
+    {
+        while (ok)
+        {
+            const char *key;
+            size_t len;
+            if (!readString(r, &key, &len) || !expect(r, ':'))
+                ok = false;
+            else if (len == 4 && memcmp(key, "name", 4) == 0)
+                ok = readString(r, &name, &name_length);
+            else if (len == 5 && memcmp(key, "ports", 5) == 0)
+                ok = readInt(r, &ports);
+            else if (len == 6 && memcmp(key, "output", 6) == 0)
+                ok = readInt(r, &output);
+            else if (len == 10 && memcmp(key, "components", 10) == 0)
+            {
+                r->in_subcircuit = true;
+                r->subcircuit = out->hierarchy ? (int)out->hierarchy->count : 0;
+                ok = readComponents(r, &body);
+                r->in_subcircuit = false;
+            }
+            else
+                ok = skipValue(r);
+            if (!ok)
+                break;
+            skipSpace(r);
+            if (r->p < r->end && *r->p == ',')
+            {
+                r->p++;
+                continue;
+            }
+            ok = expect(r, '}');
+            break;
+        }
+    }
+
+    if (ok && !name)
+    {
+        readerError(r, "subcircuit without a name");
+        ok = false;
+    }
+    if (ok && !checkPorts(&body, ports))
+    {
+        readerError(r, "subcircuit pin refers to a port it does not have");
+        ok = false;
+    }
+    if (ok && addSubcircuit(out, name, name_length, ports, output, &body) < 0)
+    {
+        readerError(r, "duplicate subcircuit or output outside its components");
+        ok = false;
+    }
+    freeComponentArray(&body);
+    return ok;
+}
+
+static bool readSubcircuits(JsonReader *r, ComponentArray *out)
+{
+    if (!expect(r, '['))
+        return false;
+    skipSpace(r);
+    if (r->p < r->end && *r->p == ']')
+    {
+        r->p++;
+        return true;
+    }
+    for (;;)
+    {
+        if (!readSubcircuit(r, out))
+            return false;
+        skipSpace(r);
+        if (r->p < r->end && *r->p == ',')
+        {
+            r->p++;
+            continue;
+        }
+        return expect(r, ']');
+    }
+}
+
+static bool readCircuit(JsonReader *r, ComponentArray *out)
+{
+    bool found = false;
+
+    if (!expect(r, '{'))
+        return false;
+    skipSpace(r);
+    if (r->p < r->end && *r->p == '}')
+        r->p++;
+    else
+    {
+        for (;;)
+        {
+            const char *key;
+            size_t len;
+            if (!readString(r, &key, &len) || !expect(r, ':'))
+                return false;
+            if (len == 10 && memcmp(key, "components", 10) == 0)
+            {
+                skipSpace(r);
+                if (r->p < r->end && *r->p != '[')
+                {
+                    fprintf(stderr, "Invalid JSON format: components not array\n");
+                    return false;
+                }
+                if (!readComponents(r, out))
+                    return false;
+                found = true;
+            }
+            else if (len == 11 && memcmp(key, "subcircuits", 11) == 0)
+            {
+                if (!readSubcircuits(r, out))
+                    return false;
+            }
+            else if (!skipValue(r))
+                return false;
+
+            skipSpace(r);
+            if (r->p < r->end && *r->p == ',')
+            {
+                r->p++;
+                continue;
+            }
+            if (!expect(r, '}'))
+                return false;
+            break;
+        }
+    }
+
+    if (!found)
+    {
+        fprintf(stderr, "Invalid JSON format: components not array\n");
+        return false;
+    }
+    return true;
+}
+
+static bool runReader(JsonReader *r, ComponentArray *out)
+{
+    bool ok = readCircuit(r, out);
+    cadFree(r->ports);
+    cadFree(r->overrides);
+    return ok && (r->notes || !r->rejected);
+}
+
+bool parseCircuitJson(const char *data, size_t size, const char *name, ComponentArray *out)
+{
+    JsonReader r = {.p = data, .end = data + size, .name = name, .line = 1};
+    return runReader(&r, out);
+}
+
+bool parseMappedCircuitJson(MappedFile *map, const char *name, ComponentArray *out, LoadNotes *notes)
+{
+    JsonReader r = {.p = map->data, .end = map->data + map->size, .name = name, .line = 1, .map = map,
+                    .notes = notes};
+    return runReader(&r, out);
+}
@@ -0,0 +1,17 @@
+#ifndef JSONREADER_H
+#define JSONREADER_H
+
+#include "circuit.h"
+#include "platform.h"
+#include "validate.h"
+
+/* Single-pass reader for the saveCircuit JSON schema. Components are
+   appended to out as they are read; no document tree is built. Entries
+   with an unknown type or missing fields still take their position; with
+   notes, they and the line each top-level component starts on are left
+   for validateCircuit (freeLoadNotes them), and without, they are
+   printed and the file is rejected. */
+bool parseCircuitJson(const char *data, size_t size, const char *name, ComponentArray *out);
+bool parseMappedCircuitJson(MappedFile *map, const char *name, ComponentArray *out, LoadNotes *notes);
+
+#endif
@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "kernels.h"
+#include "solver.h"
+#include "platform.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+enum
+{
+    ISA_SCALAR,
+    ISA_AVX2,
+    ISA_AVX512
+};
+
+static const char *isa_names[] = {"scalar", "avx2", "avx512"};
+
+static void resistorScalar(const double *resistance, const double *input, const unsigned char *current,
+                           double *output, size_t n)
+{
+    for (size_t k = 0; k < n; k++)
+        output[k] = current[k] ? input[k] / resistance[k] : input[k] * resistance[k];
+}
+
+static void transistorScalar(const double *input, const double *base, const double *beta,
+                             const unsigned char *pnp, const unsigned char *current, double *output, size_t n)
+{
+    for (size_t k = 0; k < n; k++)
+    {
+        double sign = pnp[k] ? -1.0 : 1.0;
+        bool active = sign * base[k] > TRANSISTOR_VBE;
+        double out = current[k] ? sign * beta[k] * base[k] : input[k] - sign * TRANSISTOR_VBE;
+        output[k] = active ? out : 0.0;
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("avx2"))) static __m256d flagMask4(const unsigned char *flags)
+{
+    int32_t packed;
+    memcpy(&packed, flags, sizeof(packed));
+    __m256i wide = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(packed));
+    return _mm256_castsi256_pd(_mm256_cmpgt_epi64(wide, _mm256_setzero_si256()));
+}
+
+__attribute__((target("avx2"))) static void resistorAvx2(const double *resistance, const double *input,
+                                                         const unsigned char *current, double *output, size_t n)
+{
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4)
+    {
+        __m256d in = _mm256_loadu_pd(input + k);
+        __m256d res = _mm256_loadu_pd(resistance + k);
+        __m256d mask = flagMask4(current + k);
+        _mm256_storeu_pd(output + k, _mm256_blendv_pd(_mm256_mul_pd(in, res), _mm256_div_pd(in, res), mask));
+    }
+    resistorScalar(resistance + k, input + k, current + k, output + k, n - k);
+}
+
+__attribute__((target("avx2"))) static void transistorAvx2(const double *input, const double *base,
+                                                           const double *beta, const unsigned char *pnp,
+                                                           const unsigned char *current, double *output, size_t n)
+{
+    const __m256d one = _mm256_set1_pd(1.0), minus_one = _mm256_set1_pd(-1.0);
+    const __m256d vbe = _mm256_set1_pd(TRANSISTOR_VBE);
+    size_t k = 0;
+    for (; k + 4 <= n; k += 4)
+    {
+        __m256d in = _mm256_loadu_pd(input + k);
+        __m256d b = _mm256_loadu_pd(base + k);
+        __m256d sign = _mm256_blendv_pd(one, minus_one, flagMask4(pnp + k));
+        __m256d active = _mm256_cmp_pd(_mm256_mul_pd(sign, b), vbe, _CMP_GT_OQ);
+        __m256d amplified = _mm256_mul_pd(_mm256_mul_pd(sign, _mm256_loadu_pd(beta + k)), b);
+        __m256d shifted = _mm256_sub_pd(in, _mm256_mul_pd(sign, vbe));
+        __m256d out = _mm256_blendv_pd(shifted, amplified, flagMask4(current + k));
+        _mm256_storeu_pd(output + k, _mm256_and_pd(out, active));
+    }
+    transistorScalar(input + k, base + k, beta + k, pnp + k, current + k, output + k, n - k);
+}
+
+__attribute__((target("avx512f"))) static __mmask8 flagMask8(const unsigned char *flags)
+{
+    __m512i wide = _mm512_cvtepu8_epi64(_mm_loadl_epi64((const __m128i *)flags));
+    return _mm512_test_epi64_mask(wide, wide);
+}
+
+__attribute__((target("avx512f"))) static void resistorAvx512(const double *resistance, const double *input,
+                                                              const unsigned char *current, double *output,
+                                                              size_t n)
+{
+    size_t k = 0;
+    for (; k + 8 <= n; k += 8)
+    {
+        __m512d in = _mm512_loadu_pd(input + k);
+        __m512d res = _mm512_loadu_pd(resistance + k);
+        __mmask8 mask = flagMask8(current + k);
+        _mm512_storeu_pd(output + k, _mm512_mask_div_pd(_mm512_mul_pd(in, res), mask, in, res));
+    }
+    resistorScalar(resistance + k, input + k, current + k, output + k, n - k);
+}
+
+__attribute__((target("avx512f"))) static void transistorAvx512(const double *input, const double *base,
+                                                                const double *beta, const unsigned char *pnp,
+                                                                const unsigned char *current, double *output,
+                                                                size_t n)
+{
+    const __m512d one = _mm512_set1_pd(1.0), minus_one = _mm512_set1_pd(-1.0);
+    const __m512d vbe = _mm512_set1_pd(TRANSISTOR_VBE);
+    size_t k = 0;
+    for (; k + 8 <= n; k += 8)
+    {
+        __m512d in = _mm512_loadu_pd(input + k);
+        __m512d b = _mm512_loadu_pd(base + k);
+        __m512d sign = _mm512_mask_blend_pd(flagMask8(pnp + k), one, minus_one);
+        __mmask8 active = _mm512_cmp_pd_mask(_mm512_mul_pd(sign, b), vbe, _CMP_GT_OQ);
+        __m512d amplified = _mm512_mul_pd(_mm512_mul_pd(sign, _mm512_loadu_pd(beta + k)), b);
+        __m512d shifted = _mm512_sub_pd(in, _mm512_mul_pd(sign, vbe));
+        __m512d out = _mm512_mask_blend_pd(flagMask8(current + k), shifted, amplified);
+        _mm512_storeu_pd(output + k, _mm512_maskz_mov_pd(active, out));
+    }
+    transistorScalar(input + k, base + k, beta + k, pnp + k, current + k, output + k, n - k);
+}
+#endif
+
+/* Written once per process; concurrent first calls store the same value. */
+static atomic_int selected_isa = -1;
+
+static int kernelLevel(void)
+{
+    int level = atomic_load_explicit(&selected_isa, memory_order_relaxed);
+    if (level < 0)
+    {
+        int isa = ISA_SCALAR;
+#ifdef HAVE_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+            isa = ISA_AVX512;
+        else if (__builtin_cpu_supports("avx2"))
+            isa = ISA_AVX2;
+#endif
+        atomic_store_explicit(&selected_isa, isa, memory_order_relaxed);
+        level = isa;
+    }
+    return level;
+}
+
+const char *kernelIsa(void)
+{
+    return isa_names[kernelLevel()];
+}
+
+void resistor_calc_batch(const double *resistance, const double *input, const unsigned char *current,
+                         double *output, size_t n)
+{
+    switch (kernelLevel())
+    {
+#ifdef HAVE_X86_KERNELS
+    case ISA_AVX512:
+        resistorAvx512(resistance, input, current, output, n);
+        return;
+    case ISA_AVX2:
+        resistorAvx2(resistance, input, current, output, n);
+        return;
+#endif
+    default:
+        resistorScalar(resistance, input, current, output, n);
+    }
+}
+
+void transistor_calc_batch(const double *input, const double *base, const double *beta,
+                           const unsigned char *pnp, const unsigned char *current, double *output, size_t n)
+{
+    switch (kernelLevel())
+    {
+#ifdef HAVE_X86_KERNELS
+    case ISA_AVX512:
+        transistorAvx512(input, base, beta, pnp, current, output, n);
+        return;
+    case ISA_AVX2:
+        transistorAvx2(input, base, beta, pnp, current, output, n);
+        return;
+#endif
+    default:
+        transistorScalar(input, base, beta, pnp, current, output, n);
+    }
+}
+
+/* Runs random columns through the scalar model (resistor_calc and
+   transistor_calc) and every vector path the CPU supports, and reports
+   any result that is not bit-identical. */
+bool checkKernels(size_t n)
+{
+    double *res = malloc(n * sizeof(double)), *in = malloc(n * sizeof(double));
+    double *base = malloc(n * sizeof(double)), *expected = malloc(n * sizeof(double));
+    double *got = malloc(n * sizeof(double)), *beta = malloc(n * sizeof(double));
+    unsigned char *pnp = malloc(n), *current = malloc(n);
+    size_t mismatches = 0;
+    int best = kernelLevel();
+
+    if (!res || !in || !base || !expected || !got || !beta || !pnp || !current)
+    {
+        mismatches = n + 1;
+        goto done;
+    }
+
+    srand(1);
+    for (size_t k = 0; k < n; k++)
+    {
+        res[k] = 0.5 + rand() / (double)RAND_MAX * 1000.0;
+        in[k] = (rand() / (double)RAND_MAX - 0.5) * 20.0;
+        base[k] = (rand() / (double)RAND_MAX - 0.5) * 4.0;
+        beta[k] = 50.0 + rand() / (double)RAND_MAX * 250.0;
+        pnp[k] = rand() & 1;
+        current[k] = rand() & 1;
+    }
+
+    for (int isa = ISA_SCALAR; isa <= best; isa++)
+    {
+        size_t bad = 0;
+        double start, elapsed;
+        selected_isa = isa;
+        for (size_t k = 0; k < n; k++)
+            expected[k] = resistor_calc(res[k], in[k], current[k]);
+        start = monotonicSeconds();
+        resistor_calc_batch(res, in, current, got, n);
+        elapsed = monotonicSeconds() - start;
+        for (size_t k = 0; k < n; k++)
+            bad += memcmp(&expected[k], &got[k], sizeof(double)) != 0;
+
+        for (size_t k = 0; k < n; k++)
+            expected[k] = transistor_calc(in[k], base[k], !pnp[k], current[k], beta[k]);
+        start = monotonicSeconds();
+        transistor_calc_batch(in, base, beta, pnp, current, got, n);
+        elapsed += monotonicSeconds() - start;
+        for (size_t k = 0; k < n; k++)
+            bad += memcmp(&expected[k], &got[k], sizeof(double)) != 0;
+
+        printf("%-7s %zu mismatches in %zu evaluations, %.2f ns each\n", isa_names[isa], bad, 2 * n,
+               elapsed * 1e9 / (2 * n));
+        mismatches += bad;
+    }
+    selected_isa = -1;
+
+done:
+    free(res);
+    free(in);
+    free(base);
+    free(expected);
+    free(got);
+    free(beta);
+    free(pnp);
+    free(current);
+    return mismatches == 0;
+}
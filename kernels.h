@@ -0,0 +1,18 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Batch versions of resistor_calc and transistor_calc over columns.
+   The widest instruction set the CPU supports is picked at run time;
+   every path produces bit-identical results. */
+void resistor_calc_batch(const double *resistance, const double *input, const unsigned char *current,
+                         double *output, size_t n);
+void transistor_calc_batch(const double *input, const double *base, const double *beta,
+                           const unsigned char *pnp, const unsigned char *current, double *output, size_t n);
+
+const char *kernelIsa(void);
+bool checkKernels(size_t n);
+
+#endif
@@ -3,336 +3,32 @@
 #include <stdbool.h>
 #include <string.h>
 #include <ctype.h>
-#include "cJSON/cJSON.h"
-
-typedef enum
-{
-    POWERSUPPLY = 'A',
-    RESISTOR = 'B',
-    TRANSISTOR = 'C'
-} ComponentType;
-
-typedef struct
-{
-    int anode;
-    int cathode;
-    int id;
-    double voltage;
-    int pin1;
-} Powersupply;
-
-typedef struct
-{
-    int id;
-    double resistance;
-    enum
-    {
-        CALC_VOLTAGE,
-        CALC_CURRENT
-    } otype;
-    double input;
-    double output;
-    int pin1;
-    int pin2;
-} Resistor;
-
-typedef struct
-{
-    int id;
-    bool type;
-    bool input_type;
-    double input;
-    double base;
-    double output;
-    int pin1;
-    int pin2;
-    int pin3;
-} Transistor;
-
-typedef union
-{
-    Powersupply powersupply;
-    Resistor resistor;
-    Transistor transistor;
-} ComponentData;
-
-typedef struct
-{
-    ComponentData data;
-    ComponentType type;
-} Component;
-
-typedef struct
-{
-    Component *data;
-    size_t size;
-    size_t capacity;
-} ComponentArray;
-
-void addComponent(ComponentArray *arr, Component value)
-{
-    if (arr->size == arr->capacity)
-    {
-        size_t new_capacity = (arr->capacity == 0) ? 1 : arr->capacity * 2;
-        Component *new_data = realloc(arr->data, new_capacity * sizeof(Component));
-        if (!new_data)
-        {
-            perror("Failed to allocate memory");
-            exit(EXIT_FAILURE);
-        }
-        arr->data = new_data;
-        arr->capacity = new_capacity;
-    }
-    arr->data[arr->size++] = value;
-}
-
-Component getComponent(ComponentArray *arr, size_t index)
-{
-    return arr->data[index];
-}
-
-void freeComponentArray(ComponentArray *arr)
+#include "circuit.h"
+#include "solver.h"
+#include "incremental.h"
+#include "batch.h"
+#include "arena.h"
+#include "subcircuit.h"
+#include "snapshot.h"
+
+int main(int argc, char **argv)
 {
-    free(arr->data);
-    arr->data = NULL;
-    arr->size = arr->capacity = 0;
-}
-
-double resistor_calc(double resistance, double input, int otype)
-{
-    return otype == CALC_VOLTAGE ? (input * resistance) : (input / resistance);
-}
-
-double transistor_calc(double input, double base, bool is_NPN, bool input_type)
-{
-    double beta = 100.0;
-    if (is_NPN && base > 0.7)
-        return input_type ? beta * base : input - 0.7;
-    else if (!is_NPN && base < -0.7)
-        return input_type ? beta * -base : input + 0.7;
-    return 0.0;
-}
-
-int led_bulb(double current)
-{
-    if (current < 0.01)
-        return 0;
-    else if (current > 0.02)
-    {
-        printf("LED burned! Current exceeded 20mA: %.3fA\n", current);
-        return 0;
-    }
-    return 1;
-}
-
-void saveCircuit(char *file_name, ComponentArray *array)
-{
-    cJSON *root = cJSON_CreateObject();
-    cJSON *components = cJSON_CreateArray();
-    if (!root || !components)
-    {
-        fprintf(stderr, "JSON allocation failed.\n");
-        return;
-    }
-
-    for (size_t i = 0; i < array->size; i++)
-    {
-        Component *comp = &array->data[i];
-        cJSON *obj = cJSON_CreateObject();
-
-        if (!obj)
-            continue;
-
-        cJSON_AddNumberToObject(obj, "id", i);
-
-        switch (comp->type)
-        {
-        case POWERSUPPLY:
-            cJSON_AddStringToObject(obj, "type", "PowerSupply");
-            cJSON_AddNumberToObject(obj, "voltage", comp->data.powersupply.voltage);
-            cJSON_AddNumberToObject(obj, "pin1", comp->data.powersupply.pin1);
-            break;
-        case RESISTOR:
-            cJSON_AddStringToObject(obj, "type", "Resistor");
-            cJSON_AddNumberToObject(obj, "resistance", comp->data.resistor.resistance);
-            cJSON_AddStringToObject(obj, "output_type", comp->data.resistor.otype == CALC_VOLTAGE ? "Voltage" : "Current");
-            cJSON_AddNumberToObject(obj, "pin1", comp->data.resistor.pin1);
-            cJSON_AddNumberToObject(obj, "pin2", comp->data.resistor.pin2);
-            break;
-        case TRANSISTOR:
-            cJSON_AddStringToObject(obj, "type", "Transistor");
-            cJSON_AddStringToObject(obj, "transistor_type", comp->data.transistor.type ? "PNP" : "NPN");
-            cJSON_AddStringToObject(obj, "input_output_format", comp->data.transistor.input_type ? "Current" : "Voltage");
-            cJSON_AddNumberToObject(obj, "pin1", comp->data.transistor.pin1);
-            cJSON_AddNumberToObject(obj, "pin2", comp->data.transistor.pin2);
-            cJSON_AddNumberToObject(obj, "pin3", comp->data.transistor.pin3);
-            break;
-        }
-
-        cJSON_AddItemToArray(components, obj);
-    }
-
-    cJSON_AddItemToObject(root, "components", components);
-
-    char *json_str = cJSON_Print(root);
-    if (!json_str)
-    {
-        fprintf(stderr, "Failed to print JSON.\n");
-        cJSON_Delete(root);
-        return;
-    }
-
-    FILE *fp = fopen(file_name, "w");
-    if (!fp)
-    {
-        perror("File write failed");
-        free(json_str);
-        cJSON_Delete(root);
-        return;
-    }
-
-    fputs(json_str, fp);
-    fclose(fp);
-    free(json_str);
-    cJSON_Delete(root);
-    printf("Circuit saved to '%s'\n", file_name);
-}
-
-void loadCircuit(const char *file_name, ComponentArray *array)
-{
-    FILE *fp = fopen(file_name, "r");
-    if (!fp)
-    {
-        perror("Error opening file");
-        return;
-    }
-
-    fseek(fp, 0, SEEK_END);
-    long len = ftell(fp);
-    rewind(fp);
-
-    char *buffer = malloc(len + 1);
-    fread(buffer, 1, len, fp);
-    buffer[len] = '\0';
-    fclose(fp);
-
-    cJSON *root = cJSON_Parse(buffer);
-    free(buffer);
-
-    if (!root)
-    {
-        fprintf(stderr, "JSON Parse Error: %s\n", cJSON_GetErrorPtr());
-        return;
-    }
-
-    cJSON *components = cJSON_GetObjectItem(root, "components");
-    if (!cJSON_IsArray(components))
-    {
-        fprintf(stderr, "Invalid JSON format: components not array\n");
-        cJSON_Delete(root);
-        return;
-    }
-
-    freeComponentArray(array);
-    array->capacity = cJSON_GetArraySize(components) + 1;
-    array->data = malloc(array->capacity * sizeof(Component));
-    array->size = 0;
-
-    cJSON *item;
-    cJSON_ArrayForEach(item, components)
-    {
-        Component new_comp = {0};
-        cJSON *id = cJSON_GetObjectItem(item, "id");
-        cJSON *type = cJSON_GetObjectItem(item, "type");
-
-        if (!cJSON_IsNumber(id) || !cJSON_IsString(type))
-            continue;
-
-        if (strcmp(type->valuestring, "PowerSupply") == 0)
-        {
-            new_comp.type = POWERSUPPLY;
-            new_comp.data.powersupply.id = id->valueint;
-            new_comp.data.powersupply.voltage = cJSON_GetObjectItem(item, "voltage")->valuedouble;
-            new_comp.data.powersupply.pin1 = cJSON_GetObjectItem(item, "pin1")->valueint;
-        }
-        else if (strcmp(type->valuestring, "Resistor") == 0)
-        {
-            new_comp.type = RESISTOR;
-            new_comp.data.resistor.id = id->valueint;
-            new_comp.data.resistor.resistance = cJSON_GetObjectItem(item, "resistance")->valuedouble;
-            cJSON *out = cJSON_GetObjectItem(item, "output_type");
-            new_comp.data.resistor.otype = (out && strcmp(out->valuestring, "Current") == 0) ? CALC_CURRENT : CALC_VOLTAGE;
-            new_comp.data.resistor.pin1 = cJSON_GetObjectItem(item, "pin1")->valueint;
-            new_comp.data.resistor.pin2 = cJSON_GetObjectItem(item, "pin2")->valueint;
-        }
-        else if (strcmp(type->valuestring, "Transistor") == 0)
-        {
-            new_comp.type = TRANSISTOR;
-            new_comp.data.transistor.id = id->valueint;
-            cJSON *ttype = cJSON_GetObjectItem(item, "transistor_type");
-            new_comp.data.transistor.type = (ttype && strcmp(ttype->valuestring, "PNP") == 0);
-            cJSON *io = cJSON_GetObjectItem(item, "input_output_format");
-            new_comp.data.transistor.input_type = (io && strcmp(io->valuestring, "Current") == 0);
-            new_comp.data.transistor.pin1 = cJSON_GetObjectItem(item, "pin1")->valueint;
-            new_comp.data.transistor.pin2 = cJSON_GetObjectItem(item, "pin2")->valueint;
-            new_comp.data.transistor.pin3 = cJSON_GetObjectItem(item, "pin3")->valueint;
-        }
-
-        addComponent(array, new_comp);
-    }
-
-    cJSON_Delete(root);
-    printf("Circuit loaded from '%s'\n", file_name);
-}
+    installJsonHooks();
+    if (argc > 1)
+        return runBatch(argc, argv);
 
-void list_components(ComponentArray *component_array)
-{
-    for (size_t i = 0; i < component_array->size; i++)
-    {
-        Component *c = &component_array->data[i];
-        printf("ID %zu - ", i);
-
-        switch(c->type)
-        {
-        case POWERSUPPLY:
-            printf("PowerSupply: %.2fV", c->data.powersupply.voltage);
-            if (c->data.powersupply.pin1 != -1)
-                printf(" (Connected to ID: %d)", c->data.powersupply.pin1);
-            break;
-        case RESISTOR:
-            printf("Resistor: %.2f Ohms, Output: %.2f %s",
-                           c->data.resistor.resistance,
-                           c->data.resistor.output,
-                           c->data.resistor.otype == CALC_VOLTAGE ? "V" : "A");
-            if (c->data.resistor.pin1 != -1 || c->data.resistor.pin2 != -1)
-                printf(" (Pins: %d, %d)", c->data.resistor.pin1, c->data.resistor.pin2);
-            break;
-        case TRANSISTOR:
-            printf("Transistor: %s, Output: %.2f",
-                           c->data.transistor.type ? "PNP" : "NPN",
-                           c->data.transistor.output);
-            if (c->data.transistor.pin1 != -1 || c->data.transistor.pin2 != -1 || c->data.transistor.pin3 != -1)
-                printf(" (Pins: %d, %d, %d)",
-                               c->data.transistor.pin1,
-                               c->data.transistor.pin2,
-                               c->data.transistor.pin3);
-            break;
-        }
-        printf("\n");
-    }
-}
-
-int main()
-{
     ComponentArray component_array = {0};
+    CircuitState circuit_state = {0};
+    EditHistory history;
     char input_buffer[256];
     bool quit = false;
 
+    historyInit(&history);
     printf("Welcome to Electronic CAD\n");
 
     while (!quit)
     {
-        printf("\nA: Power Supply\nB: Resistor\nC: Transistor\nD: LED\nL: List\nS: Save\nF: Load\nQ: Quit\n> ");
+        printf("\nA: Power Supply\nB: Resistor\nC: Transistor\nD: LED\nE: Solve\nM: Modify\nU: Undo\nR: Redo\nV: Variants\nL: List\nS: Save\nF: Load\nQ: Quit\n> ");
 
         if (!fgets(input_buffer, sizeof(input_buffer), stdin))
             break;
@@ -350,6 +46,9 @@ int main()
                     new_component.data.powersupply.pin1 = -1;
                     new_component.type = POWERSUPPLY;
                     addComponent(&component_array, new_component);
+                    historyCheckpoint(&history);
+                    historyRecord(&history, &component_array, component_array.size - 1);
+                    circuitStateInit(&circuit_state, &component_array, NULL);
                     printf("Power Supply added.\n");
                 }
                 break;
@@ -373,62 +72,22 @@ int main()
                     if (fgets(input_buffer, sizeof(input_buffer), stdin))
                         sscanf(input_buffer, "%d", &iid);
                     
+                    /* Only the new part's input is set; who it loads is
+                       derived from the net graph, not written back into
+                       the upstream part. */
                     if (iid >= 0 && iid < component_array.size)
-                    {
-                        Component *c = &component_array.data[iid];
                         new_component.data.resistor.pin1 = iid;
-                        
-                        double input_value = 0.0;
-                        switch(c->type)
-                        {
-                        case POWERSUPPLY:
-                            input_value = c->data.powersupply.voltage;
-                            break;
-                        case TRANSISTOR:
-                            input_value = c->data.transistor.output;
-                            break;
-                        case RESISTOR:
-                            input_value = c->data.resistor.output;
-                            break;
-                        }
-                        
-                        new_component.data.resistor.input = input_value;
-                        new_component.data.resistor.output = resistor_calc(
-                            new_component.data.resistor.resistance,
-                            input_value,
-                            new_component.data.resistor.otype
-                        );
-                        
-                        switch(c->type)
-                        {
-                        case POWERSUPPLY:
-                            c->data.powersupply.pin1 = component_array.size;
-                            break;
-                        case TRANSISTOR:
-                            if (c->data.transistor.pin1 == -1) c->data.transistor.pin1 = component_array.size;
-                            else if (c->data.transistor.pin2 == -1) c->data.transistor.pin2 = component_array.size;
-                            else if (c->data.transistor.pin3 == -1) c->data.transistor.pin3 = component_array.size;
-                            break;
-                        case RESISTOR:
-                            if (c->data.resistor.pin1 == -1) c->data.resistor.pin1 = component_array.size;
-                            else if (c->data.resistor.pin2 == -1) c->data.resistor.pin2 = component_array.size;
-                            break;
-                        }
-                    }
                     else
                     {
                         printf("Invalid component ID, using default input value\n");
-                        new_component.data.resistor.input = 5.0;
-                        new_component.data.resistor.output = resistor_calc(
-                            new_component.data.resistor.resistance,
-                            5.0,
-                            new_component.data.resistor.otype
-                        );
                         new_component.data.resistor.pin1 = -1;
                     }
                     
                     new_component.data.resistor.pin2 = -1;
                     addComponent(&component_array, new_component);
+                    historyCheckpoint(&history);
+                    historyRecord(&history, &component_array, component_array.size - 1);
+                    circuitStateInit(&circuit_state, &component_array, NULL);
                     printf("Resistor added.\n");
                 }
                 break;
@@ -454,98 +113,16 @@ int main()
                 new_component.data.transistor.id = component_array.size;
                 new_component.data.transistor.type = ttype;
                 new_component.data.transistor.input_type = io;
+                new_component.data.transistor.beta = TRANSISTOR_BETA;
                 new_component.data.transistor.pin1 = iid;
                 new_component.data.transistor.pin2 = bid;
                 new_component.data.transistor.pin3 = -1;
                 new_component.type = TRANSISTOR;
 
-                double input_value = 0.0;
-                double base_value = 0.0;
-                
-                if (iid >= 0 && iid < component_array.size)
-                {
-                    Component *c = &component_array.data[iid];
-                    switch(c->type)
-                    {
-                    case POWERSUPPLY:
-                        input_value = c->data.powersupply.voltage;
-                        break;
-                    case TRANSISTOR:
-                        input_value = c->data.transistor.output;
-                        break;
-                    case RESISTOR:
-                        input_value = c->data.resistor.output;
-                        break;
-                    }
-                }
-                
-                if (bid >= 0 && bid < component_array.size)
-                {
-                    Component *c = &component_array.data[bid];
-                    switch(c->type)
-                    {
-                    case POWERSUPPLY:
-                        base_value = c->data.powersupply.voltage;
-                        break;
-                    case TRANSISTOR:
-                        base_value = c->data.transistor.output;
-                        break;
-                    case RESISTOR:
-                        base_value = c->data.resistor.output;
-                        break;
-                    }
-                }
-                
-                new_component.data.transistor.input = input_value;
-                new_component.data.transistor.base = base_value;
-                new_component.data.transistor.output = transistor_calc(
-                    input_value,
-                    base_value,
-                    new_component.data.transistor.type,
-                    new_component.data.transistor.input_type
-                );
-                
-                if (iid >= 0 && iid < component_array.size)
-                {
-                    Component *c = &component_array.data[iid];
-                    switch(c->type)
-                    {
-                    case POWERSUPPLY:
-                        c->data.powersupply.pin1 = component_array.size;
-                        break;
-                    case TRANSISTOR:
-                        if (c->data.transistor.pin1 == -1) c->data.transistor.pin1 = component_array.size;
-                        else if (c->data.transistor.pin2 == -1) c->data.transistor.pin2 = component_array.size;
-                        else if (c->data.transistor.pin3 == -1) c->data.transistor.pin3 = component_array.size;
-                        break;
-                    case RESISTOR:
-                        if (c->data.resistor.pin1 == -1) c->data.resistor.pin1 = component_array.size;
-                        else if (c->data.resistor.pin2 == -1) c->data.resistor.pin2 = component_array.size;
-                        break;
-                    }
-                }
-                
-                if (bid >= 0 && bid < component_array.size)
-                {
-                    Component *c = &component_array.data[bid];
-                    switch(c->type)
-                    {
-                    case POWERSUPPLY:
-                        c->data.powersupply.pin1 = component_array.size;
-                        break;
-                    case TRANSISTOR:
-                        if (c->data.transistor.pin1 == -1) c->data.transistor.pin1 = component_array.size;
-                        else if (c->data.transistor.pin2 == -1) c->data.transistor.pin2 = component_array.size;
-                        else if (c->data.transistor.pin3 == -1) c->data.transistor.pin3 = component_array.size;
-                        break;
-                    case RESISTOR:
-                        if (c->data.resistor.pin1 == -1) c->data.resistor.pin1 = component_array.size;
-                        else if (c->data.resistor.pin2 == -1) c->data.resistor.pin2 = component_array.size;
-                        break;
-                    }
-                }
-                
                 addComponent(&component_array, new_component);
+                historyCheckpoint(&history);
+                historyRecord(&history, &component_array, component_array.size - 1);
+                circuitStateInit(&circuit_state, &component_array, NULL);
                 printf("Transistor added.\n");
                 break;
 
@@ -570,6 +147,9 @@ int main()
                         case RESISTOR:
                             led_current = c->data.resistor.output;
                             break;
+                        case INSTANCE:
+                            led_current = c->data.instance.output;
+                            break;
                         }
                     }
                 }
@@ -578,6 +158,108 @@ int main()
                 printf(led_bulb(led_current) ? "LED ON\n" : "LED OFF or Burned\n");
                 break;
 
+            case 'E':
+            {
+                SolveStats stats;
+                if (circuitStateInit(&circuit_state, &component_array, &stats) == 0)
+                    printf("Solved %d components: %d nonzeros (%d in LU), %d iterations, %.3f ms\n",
+                           stats.n, stats.nnz, stats.lu_nnz, stats.iterations,
+                           (stats.assemble_time + stats.factor_time + stats.solve_time) * 1e3);
+                break;
+            }
+
+            case 'M':
+            {
+                int mid = -1;
+                double value = 0.0;
+                UpdateStats update;
+
+                list_components(&component_array);
+                printf("Enter component ID to modify: ");
+                if (!fgets(input_buffer, sizeof(input_buffer), stdin) || sscanf(input_buffer, "%d", &mid) != 1 ||
+                    mid < 0 || mid >= component_array.size || component_array.data[mid].type == TRANSISTOR)
+                {
+                    printf("Only power supplies and resistors can be modified.\n");
+                    break;
+                }
+
+                printf(component_array.data[mid].type == POWERSUPPLY ? "Enter voltage: " : "Enter resistance (Ohms): ");
+                if (!fgets(input_buffer, sizeof(input_buffer), stdin) || sscanf(input_buffer, "%lf", &value) != 1)
+                    break;
+                Component *c = &component_array.data[mid];
+                int set = c->type == POWERSUPPLY ? setVoltage(&circuit_state, &component_array, mid, value)
+                                                 : setResistance(&circuit_state, &component_array, mid, value);
+                if (set != 0)
+                {
+                    /* The last solve failed, so there is no solved state
+                       to update: the value goes in as it is and the whole
+                       circuit is solved again. */
+                    if (c->type == POWERSUPPLY)
+                        c->data.powersupply.voltage = value;
+                    else
+                        c->data.resistor.resistance = value;
+                }
+                historyCheckpoint(&history);
+                historyRecord(&history, &component_array, mid);
+
+                if (set != 0)
+                {
+                    if (circuitStateInit(&circuit_state, &component_array, NULL) == 0)
+                        printf("Solved all %zu components again.\n", component_array.size);
+                    else
+                        printf("Value set, but the circuit still does not solve.\n");
+                }
+                else if (circuitStateUpdate(&circuit_state, &component_array, &update) == 0)
+                    printf("Re-solved %d affected components in %.3f ms\n", update.affected, update.time * 1e3);
+                else
+                    printf("Re-solve failed; the values listed are not a solution.\n");
+                break;
+            }
+
+            case 'U':
+            case 'R':
+                if (cmd == 'U' ? historyUndo(&history, &component_array) : historyRedo(&history, &component_array))
+                {
+                    circuitStateInit(&circuit_state, &component_array, NULL);
+                    printf(cmd == 'U' ? "Undone.\n" : "Redone.\n");
+                }
+                else
+                    printf(cmd == 'U' ? "Nothing to undo.\n" : "Nothing to redo.\n");
+                break;
+
+            case 'V':
+            {
+                /* Variants share every chunk of components they have in
+                   common, so keeping one costs nothing until it is edited. */
+                for (size_t k = 0; k < history.variant_count; k++)
+                    printf("%zu: %s (%zu components)\n", k, history.variants[k].name,
+                           snapshotSize(history.variants[k].snapshot));
+                printf("Enter a number to switch to, or a name to keep the current design as: ");
+                if (!fgets(input_buffer, sizeof(input_buffer), stdin))
+                    break;
+                input_buffer[strcspn(input_buffer, "\n")] = 0;
+                char *end;
+                unsigned long index = strtoul(input_buffer, &end, 10);
+                if (!input_buffer[0])
+                    break;
+                if (*end == '\0')
+                {
+                    if (historySwitch(&history, index, &component_array))
+                    {
+                        circuitStateInit(&circuit_state, &component_array, NULL);
+                        printf("Switched to '%s'.\n", history.variants[index].name);
+                    }
+                    else
+                        printf("No such variant.\n");
+                }
+                else
+                {
+                    historyKeep(&history, input_buffer);
+                    printf("Kept as '%s'.\n", input_buffer);
+                }
+                break;
+            }
+
             case 'L':
                 list_components(&component_array);
                 break;
@@ -587,7 +269,8 @@ int main()
                 if (fgets(input_buffer, sizeof(input_buffer), stdin))
                 {
                     input_buffer[strcspn(input_buffer, "\n")] = 0;
-                    saveCircuit(input_buffer, &component_array);
+                    if (saveCircuit(input_buffer, &component_array))
+                        printf("Circuit saved to '%s'\n", input_buffer);
                 }
                 break;
 
@@ -596,7 +279,17 @@ int main()
                 if (fgets(input_buffer, sizeof(input_buffer), stdin))
                 {
                     input_buffer[strcspn(input_buffer, "\n")] = 0;
-                    loadCircuit(input_buffer, &component_array);
+                    /* The editor works on primitives, so subcircuits are
+                       expanded on load. */
+                    if (loadCircuit(input_buffer, &component_array) && flattenInPlace(&component_array))
+                    {
+                        historyCheckpoint(&history);
+                        historyReplace(&history, &component_array);
+                        printf("Circuit loaded from '%s' (U to go back)\n", input_buffer);
+                    }
+                    else
+                        snapshotToArray(history.current, &component_array);
+                    circuitStateInit(&circuit_state, &component_array, NULL);
                 }
                 break;
 
@@ -609,6 +302,8 @@ int main()
                 break;
         }
     }
+    circuitStateFree(&circuit_state);
+    historyFree(&history);
     freeComponentArray(&component_array);
     printf("Goodbye!\n");
     return 0;
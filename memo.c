@@ -0,0 +1,451 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "memo.h"
+#include "platform.h"
+
+#define MEMO_BYTE_ORDER 0x01020304u
+/* Bookkeeping charged to every entry on top of its values. */
+#define ENTRY_OVERHEAD (sizeof(MemoEntry) + 2 * sizeof(int))
+/* Longest vector a cache file may hold; anything longer is corrupt. */
+#define MAX_FILE_VALUES ((uint64_t)1 << 28)
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t count;
+} MemoFileHeader;
+
+typedef struct
+{
+    uint64_t hi;
+    uint64_t lo;
+    uint64_t count;
+} MemoFileEntry;
+
+/* Entries live in one array and are linked by index: next chains a
+   bucket (or the free slots), older/newer form the recency list. */
+typedef struct
+{
+    MemoKey key;
+    double *values;
+    size_t count;
+    int next;
+    int older;
+    int newer;
+} MemoEntry;
+
+struct MemoCache
+{
+    pthread_mutex_t lock;
+    size_t max_bytes;
+    MemoEntry *entries;
+    size_t slots;
+    size_t capacity;
+    int free_slot;
+    int *buckets;
+    size_t bucket_count;
+    int oldest;
+    int newest;
+    MemoStats stats;
+};
+
+static uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 30;
+    h *= UINT64_C(0xbf58476d1ce4e5b9);
+    h ^= h >> 27;
+    h *= UINT64_C(0x94d049bb133111eb);
+    return h ^ (h >> 31);
+}
+
+void memoKeyInit(MemoKey *key, uint64_t domain)
+{
+    key->hi = mix64(domain ^ UINT64_C(0x243f6a8885a308d3));
+    key->lo = mix64(domain ^ UINT64_C(0x13198a2e03707344));
+}
+
+void memoKeyAddInt(MemoKey *key, int64_t value)
+{
+    uint64_t v = (uint64_t)value;
+    key->hi = mix64(key->hi ^ v);
+    key->lo = mix64(key->lo + ((v << 31) | (v >> 33)) + UINT64_C(0x9e3779b97f4a7c15));
+}
+
+void memoKeyAddDouble(MemoKey *key, double value)
+{
+    int64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    memoKeyAddInt(key, bits);
+}
+
+void memoKeyAddCircuit(MemoKey *key, const ComponentArray *array)
+{
+    memoKeyAddInt(key, (int64_t)array->size);
+    for (size_t i = 0; i < array->size; i++)
+    {
+        const Component *c = &array->data[i];
+        memoKeyAddInt(key, c->type);
+        switch (c->type)
+        {
+        case POWERSUPPLY:
+            memoKeyAddDouble(key, c->data.powersupply.voltage);
+            memoKeyAddInt(key, c->data.powersupply.pin1);
+            break;
+        case RESISTOR:
+            memoKeyAddDouble(key, c->data.resistor.resistance);
+            memoKeyAddInt(key, c->data.resistor.otype);
+            memoKeyAddInt(key, c->data.resistor.pin1);
+            memoKeyAddInt(key, c->data.resistor.pin2);
+            break;
+        case TRANSISTOR:
+            memoKeyAddDouble(key, c->data.transistor.beta);
+            memoKeyAddInt(key, c->data.transistor.type | c->data.transistor.input_type << 1);
+            memoKeyAddInt(key, c->data.transistor.pin1);
+            memoKeyAddInt(key, c->data.transistor.pin2);
+            memoKeyAddInt(key, c->data.transistor.pin3);
+            break;
+        case INSTANCE:
+            memoKeyAddInt(key, c->data.instance.subcircuit);
+            break;
+        }
+    }
+}
+
+MemoCache *memoCreate(size_t max_bytes)
+{
+    MemoCache *cache = calloc(1, sizeof(MemoCache));
+    if (!cache)
+        return NULL;
+    cache->bucket_count = 64;
+    cache->buckets = malloc(cache->bucket_count * sizeof(int));
+    if (!cache->buckets)
+    {
+        free(cache);
+        return NULL;
+    }
+    for (size_t b = 0; b < cache->bucket_count; b++)
+        cache->buckets[b] = -1;
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->max_bytes = max_bytes;
+    cache->free_slot = cache->oldest = cache->newest = -1;
+    return cache;
+}
+
+void memoDestroy(MemoCache *cache)
+{
+    if (!cache)
+        return;
+    for (int e = cache->oldest; e >= 0; e = cache->entries[e].newer)
+        free(cache->entries[e].values);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->entries);
+    free(cache->buckets);
+    free(cache);
+}
+
+static size_t entryBytes(size_t count)
+{
+    return ENTRY_OVERHEAD + count * sizeof(double);
+}
+
+static int *bucketOf(MemoCache *cache, const MemoKey *key)
+{
+    return &cache->buckets[key->lo & (cache->bucket_count - 1)];
+}
+
+static int findEntry(MemoCache *cache, const MemoKey *key)
+{
+    for (int e = *bucketOf(cache, key); e >= 0; e = cache->entries[e].next)
+        if (cache->entries[e].key.hi == key->hi && cache->entries[e].key.lo == key->lo)
+            return e;
+    return -1;
+}
+
+static void unlinkRecency(MemoCache *cache, int e)
+{
+    MemoEntry *entry = &cache->entries[e];
+    if (entry->older >= 0)
+        cache->entries[entry->older].newer = entry->newer;
+    else
+        cache->oldest = entry->newer;
+    if (entry->newer >= 0)
+        cache->entries[entry->newer].older = entry->older;
+    else
+        cache->newest = entry->older;
+}
+
+static void linkNewest(MemoCache *cache, int e)
+{
+    cache->entries[e].older = cache->newest;
+    cache->entries[e].newer = -1;
+    if (cache->newest >= 0)
+        cache->entries[cache->newest].newer = e;
+    else
+        cache->oldest = e;
+    cache->newest = e;
+}
+
+static void evictOldest(MemoCache *cache)
+{
+    int e = cache->oldest;
+    MemoEntry *entry = &cache->entries[e];
+    int *link = bucketOf(cache, &entry->key);
+
+    while (*link != e)
+        link = &cache->entries[*link].next;
+    *link = entry->next;
+    unlinkRecency(cache, e);
+    cache->stats.bytes -= entryBytes(entry->count);
+    cache->stats.entries--;
+    cache->stats.evictions++;
+    free(entry->values);
+    entry->values = NULL;
+    entry->next = cache->free_slot;
+    cache->free_slot = e;
+}
+
+/* One bucket per entry on average. */
+static void growBuckets(MemoCache *cache)
+{
+    size_t count = cache->bucket_count * 2;
+    int *buckets = malloc(count * sizeof(int));
+    if (!buckets)
+        return;
+    for (size_t b = 0; b < count; b++)
+        buckets[b] = -1;
+    for (int e = cache->oldest; e >= 0; e = cache->entries[e].newer)
+    {
+        int *bucket = &buckets[cache->entries[e].key.lo & (count - 1)];
+        cache->entries[e].next = *bucket;
+        *bucket = e;
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucket_count = count;
+}
+
+static int allocateSlot(MemoCache *cache)
+{
+    if (cache->free_slot >= 0)
+    {
+        int e = cache->free_slot;
+        cache->free_slot = cache->entries[e].next;
+        return e;
+    }
+    if (cache->slots == cache->capacity)
+    {
+        size_t capacity = cache->capacity ? cache->capacity * 2 : 64;
+        MemoEntry *entries = realloc(cache->entries, capacity * sizeof(MemoEntry));
+        if (!entries)
+            return -1;
+        cache->entries = entries;
+        cache->capacity = capacity;
+    }
+    return (int)cache->slots++;
+}
+
+/* Inserts or replaces; caller holds the lock. A vector larger than the
+   whole budget is not kept. */
+static void insertEntry(MemoCache *cache, const MemoKey *key, const double *values, size_t count)
+{
+    size_t bytes = entryBytes(count);
+    int e = findEntry(cache, key);
+
+    if (e >= 0)
+    {
+        MemoEntry *entry = &cache->entries[e];
+        if (entry->count != count)
+        {
+            double *resized = realloc(entry->values, count * sizeof(double) + 1);
+            if (!resized)
+                return;
+            cache->stats.bytes += bytes - entryBytes(entry->count);
+            entry->values = resized;
+            entry->count = count;
+        }
+        memcpy(entry->values, values, count * sizeof(double));
+        unlinkRecency(cache, e);
+        linkNewest(cache, e);
+        return;
+    }
+    if (bytes > cache->max_bytes)
+        return;
+    while (cache->oldest >= 0 && cache->stats.bytes + bytes > cache->max_bytes)
+        evictOldest(cache);
+
+    double *copy = malloc(count * sizeof(double) + 1);
+    e = copy ? allocateSlot(cache) : -1;
+    if (e < 0)
+    {
+        free(copy);
+        return;
+    }
+    memcpy(copy, values, count * sizeof(double));
+    MemoEntry *entry = &cache->entries[e];
+    entry->key = *key;
+    entry->values = copy;
+    entry->count = count;
+    int *bucket = bucketOf(cache, key);
+    entry->next = *bucket;
+    *bucket = e;
+    linkNewest(cache, e);
+    cache->stats.bytes += bytes;
+    if (++cache->stats.entries > cache->bucket_count)
+        growBuckets(cache);
+}
+
+bool memoLookup(MemoCache *cache, const MemoKey *key, double *values, size_t count)
+{
+    pthread_mutex_lock(&cache->lock);
+    int e = findEntry(cache, key);
+    bool hit = e >= 0 && cache->entries[e].count == count;
+    if (hit)
+    {
+        memcpy(values, cache->entries[e].values, count * sizeof(double));
+        if (e != cache->newest)
+        {
+            unlinkRecency(cache, e);
+            linkNewest(cache, e);
+        }
+        cache->stats.hits++;
+    }
+    else
+        cache->stats.misses++;
+    pthread_mutex_unlock(&cache->lock);
+    return hit;
+}
+
+void memoStore(MemoCache *cache, const MemoKey *key, const double *values, size_t count)
+{
+    pthread_mutex_lock(&cache->lock);
+    insertEntry(cache, key, values, count);
+    cache->stats.stores++;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+MemoStats memoStats(MemoCache *cache)
+{
+    pthread_mutex_lock(&cache->lock);
+    MemoStats stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+    return stats;
+}
+
+bool memoLoad(MemoCache *cache, const char *file_name)
+{
+    MemoFileHeader h;
+    FILE *fp = fopen(file_name, "rb");
+    double *values = NULL;
+    size_t capacity = 0;
+    bool ok = true;
+
+    if (!fp)
+    {
+        if (errno == ENOENT)
+            return true;
+        perror(file_name);
+        return false;
+    }
+    if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, MEMO_FILE_MAGIC, sizeof(h.magic)) != 0 ||
+        h.byte_order != MEMO_BYTE_ORDER || h.version != MEMO_FILE_VERSION)
+    {
+        fprintf(stderr, "%s: not a cache file of this version, starting empty\n", file_name);
+        fclose(fp);
+        return true;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    for (uint64_t k = 0; k < h.count; k++)
+    {
+        MemoFileEntry entry;
+        if (fread(&entry, sizeof(entry), 1, fp) != 1 || entry.count > MAX_FILE_VALUES)
+        {
+            ok = false;
+            break;
+        }
+        if (entry.count > capacity)
+        {
+            double *grown = realloc(values, entry.count * sizeof(double));
+            if (!grown)
+            {
+                ok = false;
+                break;
+            }
+            values = grown;
+            capacity = entry.count;
+        }
+        if (fread(values, sizeof(double), entry.count, fp) != entry.count)
+        {
+            ok = false;
+            break;
+        }
+        MemoKey key = {entry.hi, entry.lo};
+        insertEntry(cache, &key, values, entry.count);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    free(values);
+    fclose(fp);
+    if (!ok)
+        fprintf(stderr, "%s: truncated cache file, keeping what was read\n", file_name);
+    return true;
+}
+
+/* Tells apart the temporary files of saves running at the same time, in
+   this process or another. */
+static atomic_uint save_counter;
+
+/* Written beside the target and renamed over it, so that a run loading
+   the cache at the same time, or after a failed save, never sees a
+   partial file. */
+bool memoSave(MemoCache *cache, const char *file_name)
+{
+    MemoFileHeader h;
+    size_t length = strlen(file_name) + 48;
+    char *temp = malloc(length);
+    if (!temp)
+        return false;
+    snprintf(temp, length, "%s.%lu.%u.tmp", file_name, processId(), atomic_fetch_add(&save_counter, 1));
+    FILE *fp = fopen(temp, "wb");
+    if (!fp)
+    {
+        perror(temp);
+        free(temp);
+        return false;
+    }
+
+    memset(&h, 0, sizeof(h));
+    pthread_mutex_lock(&cache->lock);
+    memcpy(h.magic, MEMO_FILE_MAGIC, sizeof(h.magic));
+    h.version = MEMO_FILE_VERSION;
+    h.byte_order = MEMO_BYTE_ORDER;
+    h.count = cache->stats.entries;
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+    for (int e = cache->oldest; ok && e >= 0; e = cache->entries[e].newer)
+    {
+        const MemoEntry *entry = &cache->entries[e];
+        MemoFileEntry out = {entry->key.hi, entry->key.lo, entry->count};
+        ok = fwrite(&out, sizeof(out), 1, fp) == 1 &&
+             fwrite(entry->values, sizeof(double), entry->count, fp) == entry->count;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    if (fclose(fp) != 0)
+        ok = false;
+    if (!ok)
+        perror(temp);
+    else if (!replaceFile(temp, file_name))
+    {
+        perror(file_name);
+        ok = false;
+    }
+    if (!ok)
+        remove(temp);
+    free(temp);
+    return ok;
+}
@@ -0,0 +1,66 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "circuit.h"
+
+#define MEMO_FILE_MAGIC "CADMEMO"
+/* Bump when a model change makes cached results stale. */
+#define MEMO_FILE_VERSION 1
+#define MEMO_DEFAULT_BYTES ((size_t)64 << 20)
+
+/* What a key addresses; keys of different domains never collide. */
+enum
+{
+    MEMO_DOMAIN_SUBCIRCUIT = 1,
+    MEMO_DOMAIN_SWEEP = 2,
+    MEMO_DOMAIN_PATTERN = 3
+};
+
+/* Content address of a piece of work: two independent 64-bit hashes of
+   everything the result depends on, built up field by field. */
+typedef struct
+{
+    uint64_t hi;
+    uint64_t lo;
+} MemoKey;
+
+typedef struct
+{
+    size_t hits;
+    size_t misses;
+    size_t stores;
+    size_t evictions;
+    size_t entries;
+    size_t bytes;
+} MemoStats;
+
+typedef struct MemoCache MemoCache;
+
+void memoKeyInit(MemoKey *key, uint64_t domain);
+void memoKeyAddInt(MemoKey *key, int64_t value);
+/* Doubles are hashed by their bits, so -0.0 and 0.0 are different keys. */
+void memoKeyAddDouble(MemoKey *key, double value);
+/* Every model parameter and pin of a flat circuit; outputs, ids and
+   waveforms are left out. */
+void memoKeyAddCircuit(MemoKey *key, const ComponentArray *array);
+
+/* A cache of result vectors holding at most max_bytes, evicting the least
+   recently used entries first. Safe to share between threads. */
+MemoCache *memoCreate(size_t max_bytes);
+void memoDestroy(MemoCache *cache);
+/* Copies the count values stored under key; false on a miss or when the
+   stored vector has another length. */
+bool memoLookup(MemoCache *cache, const MemoKey *key, double *values, size_t count);
+void memoStore(MemoCache *cache, const MemoKey *key, const double *values, size_t count);
+MemoStats memoStats(MemoCache *cache);
+
+/* A missing file leaves the cache empty; one written by another version
+   is ignored with a warning. Entries are saved oldest first, so loading
+   restores their recency. */
+bool memoLoad(MemoCache *cache, const char *file_name);
+bool memoSave(MemoCache *cache, const char *file_name);
+
+#endif
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+#include "netgraph.h"
+#include "arena.h"
+
+int componentInputs(const ComponentArray *array, size_t index, int inputs[2])
+{
+    const Component *c = &array->data[index];
+    int n = (int)array->size;
+    inputs[0] = inputs[1] = -1;
+
+    switch (c->type)
+    {
+    case POWERSUPPLY:
+        return 0;
+    case RESISTOR:
+        if (c->data.resistor.pin1 >= 0 && c->data.resistor.pin1 < n)
+            inputs[0] = c->data.resistor.pin1;
+        return 1;
+    case TRANSISTOR:
+        if (c->data.transistor.pin1 >= 0 && c->data.transistor.pin1 < n)
+            inputs[0] = c->data.transistor.pin1;
+        if (c->data.transistor.pin2 >= 0 && c->data.transistor.pin2 < n)
+            inputs[1] = c->data.transistor.pin2;
+        return 2;
+    case INSTANCE:
+        /* Designs are flattened before they are scheduled or solved. */
+        return 0;
+    }
+    return 0;
+}
+
+/* One pass over the pins fills the input side and counts the loads per
+   net; a second pass over the input side scatters the loads. */
+int buildNetGraph(const ComponentArray *array, NetGraph *g)
+{
+    size_t n = array->size;
+
+    memset(g, 0, sizeof(*g));
+    g->nets = n;
+    g->input_start = cadMalloc((n + 1) * sizeof(int));
+    g->input_net = cadMalloc((2 * n + 1) * sizeof(int));
+    g->load_start = cadCalloc(n + 2, sizeof(int));
+    if (!g->input_start || !g->input_net || !g->load_start)
+    {
+        freeNetGraph(g);
+        return -1;
+    }
+
+    int count = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        int inputs[2];
+        componentInputs(array, i, inputs);
+        if (inputs[1] == inputs[0])
+            inputs[1] = -1;
+        g->input_start[i] = count;
+        for (int k = 0; k < 2; k++)
+        {
+            if (inputs[k] < 0)
+                continue;
+            g->input_net[count++] = inputs[k];
+            g->load_start[inputs[k] + 2]++;
+        }
+    }
+    g->input_start[n] = count;
+
+    for (size_t k = 0; k < n; k++)
+        g->load_start[k + 2] += g->load_start[k + 1];
+    g->load = cadMalloc((count + 1) * sizeof(int));
+    if (!g->load)
+    {
+        freeNetGraph(g);
+        return -1;
+    }
+    /* load_start is shifted by one while scattering so that afterwards
+       load_start[k] is the first load of net k. */
+    for (size_t i = 0; i < n; i++)
+        for (int p = g->input_start[i]; p < g->input_start[i + 1]; p++)
+            g->load[g->load_start[g->input_net[p] + 1]++] = (int)i;
+    return 0;
+}
+
+void freeNetGraph(NetGraph *g)
+{
+    cadFree(g->input_start);
+    cadFree(g->input_net);
+    cadFree(g->load_start);
+    cadFree(g->load);
+    memset(g, 0, sizeof(*g));
+}
@@ -0,0 +1,31 @@
+#ifndef NETGRAPH_H
+#define NETGRAPH_H
+
+#include "circuit.h"
+
+/* Connectivity of a netlist as nets. Net k is the output node of
+   component k: component k drives it, and every component whose input or
+   base pin names k loads it. Both directions are CSR arrays, so the nets
+   a component reads and the components loading a net are contiguous runs
+   found in O(1):
+
+       inputs of component i:  input_net[input_start[i] .. input_start[i + 1])
+       loads of net k:         load[load_start[k] .. load_start[k + 1])
+
+   A component reading the same net on two pins lists it once. Loads come
+   out in ascending component order. */
+typedef struct
+{
+    size_t nets;
+    int *input_start;
+    int *input_net;
+    int *load_start;
+    int *load;
+} NetGraph;
+
+int componentInputs(const ComponentArray *array, size_t index, int inputs[2]);
+
+int buildNetGraph(const ComponentArray *array, NetGraph *g);
+void freeNetGraph(NetGraph *g);
+
+#endif
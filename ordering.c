@@ -0,0 +1,353 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ordering.h"
+#include "arena.h"
+#include "netgraph.h"
+#include "schedule.h"
+
+/* Pieces this small keep ascending id order; dissecting them further
+   saves less than it costs. */
+#define DISSECTION_LEAF 64
+
+/* Components carry the label of the piece they are in; a piece is
+   searched only through its own label, and separators get none. */
+typedef struct
+{
+    const NetGraph *graph;
+    int *label;
+    int *level;
+    int *queue;
+    int *stack;
+    int labels;
+} Dissection;
+
+static int compareIds(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static void visit(Dissection *d, int v, int level, int *tail)
+{
+    d->level[v] = level;
+    d->queue[(*tail)++] = v;
+}
+
+/* Breadth-first search within one piece, treating inputs and loads alike,
+   with root at the given level and the queue continuing from tail. Leaves
+   the level of every reached component set and returns the new tail. */
+static int levelStructure(Dissection *d, int root, int label, int level, int tail)
+{
+    const NetGraph *g = d->graph;
+    int head = tail;
+    visit(d, root, level, &tail);
+    while (head < tail)
+    {
+        int v = d->queue[head++];
+        for (int p = g->input_start[v]; p < g->input_start[v + 1]; p++)
+        {
+            int w = g->input_net[p];
+            if (d->label[w] == label && d->level[w] < 0)
+                visit(d, w, d->level[v] + 1, &tail);
+        }
+        for (int p = g->load_start[v]; p < g->load_start[v + 1]; p++)
+        {
+            int w = g->load[p];
+            if (d->label[w] == label && d->level[w] < 0)
+                visit(d, w, d->level[v] + 1, &tail);
+        }
+    }
+    return tail;
+}
+
+static void clearLevels(Dissection *d, const int *nodes, int count)
+{
+    for (int i = 0; i < count; i++)
+        d->level[nodes[i]] = -1;
+}
+
+/* Moves the members of nodes[0..count) with a level in [first, last] to
+   the front under a new label and returns how many there were. */
+static int gather(Dissection *d, int *nodes, int count, int first, int last)
+{
+    int label = d->labels++, moved = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int v = nodes[i];
+        if (d->level[v] >= first && d->level[v] <= last)
+        {
+            nodes[i] = nodes[moved];
+            nodes[moved++] = v;
+            d->label[v] = label;
+        }
+    }
+    return moved;
+}
+
+/* Orders nodes[0..count) in place: each piece becomes its two halves
+   followed by the middle level of a level structure rooted at a
+   pseudo-peripheral component, which separates them. Disconnected pieces
+   are split apart first. The pieces still to order live on an explicit
+   stack as (offset, count) pairs. */
+static void dissect(Dissection *d, int *nodes, int count)
+{
+    int *stack = d->stack, sp = 0;
+    stack[sp++] = 0;
+    stack[sp++] = count;
+
+    while (sp > 0)
+    {
+        int size = stack[--sp];
+        int *piece = nodes + stack[--sp];
+        int label = d->label[piece[0]];
+
+        if (size <= DISSECTION_LEAF)
+        {
+            qsort(piece, size, sizeof(int), compareIds);
+            continue;
+        }
+
+        int reached = levelStructure(d, piece[0], label, 0, 0);
+        if (reached < size)
+        {
+            int part = gather(d, piece, size, 0, reached);
+            clearLevels(d, piece, size);
+            stack[sp++] = piece - nodes;
+            stack[sp++] = part;
+            stack[sp++] = piece - nodes + part;
+            stack[sp++] = size - part;
+            continue;
+        }
+
+        int root = d->queue[reached - 1];
+        clearLevels(d, piece, size);
+        levelStructure(d, root, label, 0, 0);
+        int depth = d->level[d->queue[size - 1]] + 1;
+        if (depth < 3)
+        {
+            clearLevels(d, piece, size);
+            qsort(piece, size, sizeof(int), compareIds);
+            continue;
+        }
+
+        /* The first level holding the median component, kept off the
+           ends so both halves are non-empty. */
+        int middle = d->level[d->queue[size / 2]];
+        if (middle == 0)
+            middle = 1;
+        if (middle == depth - 1)
+            middle = depth - 2;
+
+        int before = gather(d, piece, size, 0, middle - 1);
+        int after = gather(d, piece + before, size - before, middle + 1, depth);
+        int *separator = piece + before + after;
+        int separator_size = size - before - after;
+        for (int i = 0; i < separator_size; i++)
+            d->label[separator[i]] = -1;
+        qsort(separator, separator_size, sizeof(int), compareIds);
+        clearLevels(d, piece, size);
+
+        stack[sp++] = piece - nodes;
+        stack[sp++] = before;
+        stack[sp++] = piece - nodes + before;
+        stack[sp++] = after;
+    }
+}
+
+int orderCircuitMatrix(const ComponentArray *array, int *q)
+{
+    int n = (int)array->size;
+    NetGraph graph;
+    Schedule schedule;
+    Dissection d = {0};
+    int *by_level = NULL, *level_start = NULL;
+    int status = -1;
+
+    if (buildNetGraph(array, &graph) != 0)
+        return -1;
+    if (buildSchedule(&graph, &schedule) != 0)
+    {
+        freeNetGraph(&graph);
+        return -1;
+    }
+
+    d.graph = &graph;
+    d.label = cadMalloc((n + 1) * sizeof(int));
+    d.level = cadMalloc((n + 1) * sizeof(int));
+    d.queue = cadMalloc((n + 1) * sizeof(int));
+    d.stack = cadMalloc((2 * (size_t)n + 2) * sizeof(int));
+    by_level = cadMalloc((n + 1) * sizeof(int));
+    level_start = cadCalloc(schedule.levels + 2, sizeof(int));
+    if (!d.label || !d.level || !d.queue || !d.stack || !by_level || !level_start)
+        goto done;
+
+    for (int i = 0; i < n; i++)
+    {
+        d.label[i] = schedule.group[i];
+        d.level[i] = -1;
+        level_start[schedule.level[i] + 1]++;
+    }
+    d.labels = (int)schedule.groups;
+    for (int l = 0; l < schedule.levels; l++)
+        level_start[l + 1] += level_start[l];
+    for (int i = 0; i < n; i++)
+        by_level[level_start[schedule.level[i]]++] = i;
+
+    /* A loop is placed whole where its lowest member comes up. */
+    int k = 0;
+    for (int p = 0; p < n; p++)
+    {
+        int i = by_level[p];
+        int g = schedule.group[i];
+        if (g < 0)
+            q[k++] = i;
+        else if (schedule.position[i] == 0)
+        {
+            int size = schedule.group_start[g + 1] - schedule.group_start[g];
+            memcpy(q + k, schedule.member + schedule.group_start[g], size * sizeof(int));
+            dissect(&d, q + k, size);
+            k += size;
+        }
+    }
+    status = 0;
+
+done:
+    cadFree(d.label);
+    cadFree(d.level);
+    cadFree(d.queue);
+    cadFree(d.stack);
+    cadFree(by_level);
+    cadFree(level_start);
+    freeSchedule(&schedule);
+    freeNetGraph(&graph);
+    return status;
+}
+
+/* Level structure of a whole piece, connected or not: each connected
+   part is searched from a pseudo-peripheral root, with one empty level
+   between parts so that no pin crosses the gap. Returns the depth; the
+   queue ends up in level order. */
+static int pieceLevels(Dissection *d, const int *nodes, int count)
+{
+    int label = d->label[nodes[0]], tail = 0, depth = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (d->level[nodes[i]] >= 0)
+            continue;
+        int start = tail;
+        tail = levelStructure(d, nodes[i], label, depth, start);
+        int root = d->queue[tail - 1];
+        clearLevels(d, d->queue + start, tail - start);
+        tail = levelStructure(d, root, label, depth, start);
+        depth = d->level[d->queue[tail - 1]] + 2;
+    }
+    return depth - 1;
+}
+
+/* Whether an empty level comes just before queue position t > 0. */
+static bool isGap(const Dissection *d, int t)
+{
+    return d->level[d->queue[t]] > d->level[d->queue[t - 1]] + 1;
+}
+
+int partitionCircuit(const ComponentArray *array, int parts, int *part)
+{
+    int n = (int)array->size;
+    NetGraph graph;
+    Dissection d = {0};
+    int *nodes = NULL;
+    int count = -1;
+
+    if (parts < 1 || buildNetGraph(array, &graph) != 0)
+        return -1;
+    d.graph = &graph;
+    d.label = cadCalloc(n + 1, sizeof(int));
+    d.level = cadMalloc((n + 1) * sizeof(int));
+    d.queue = cadMalloc((n + 1) * sizeof(int));
+    d.stack = cadMalloc((3 * (size_t)parts + 3) * sizeof(int));
+    nodes = cadMalloc((n + 1) * sizeof(int));
+    if (!d.label || !d.level || !d.queue || !d.stack || !nodes)
+        goto done;
+
+    /* Components without inputs pass on a fixed value and link nothing;
+       left in, a supply read from all over would cut every search
+       short. */
+    int m = 0;
+    for (int i = 0; i < n; i++)
+    {
+        d.level[i] = -1;
+        part[i] = -1;
+        if (graph.input_start[i + 1] > graph.input_start[i])
+            nodes[m++] = i;
+        else
+            d.label[i] = -1;
+    }
+    d.labels = 1;
+
+    /* Each piece on the stack is (offset, count, parts) and is cut where
+       its share of the parts puts it, so odd counts stay balanced. */
+    int sp = 0;
+    count = 0;
+    if (m > 0)
+    {
+        d.stack[sp++] = 0;
+        d.stack[sp++] = m;
+        d.stack[sp++] = parts;
+    }
+    while (sp > 0)
+    {
+        int share = d.stack[--sp];
+        int size = d.stack[--sp];
+        int *piece = nodes + d.stack[--sp];
+        int depth = share > 1 && size > 2 ? pieceLevels(&d, piece, size) : 0;
+
+        if (depth < 3)
+        {
+            clearLevels(&d, piece, size);
+            for (int i = 0; i < size; i++)
+                part[piece[i]] = count;
+            count++;
+            continue;
+        }
+        int first = share / 2;
+        int cut = (int)((long long)size * first / share);
+        int middle = d.level[d.queue[cut]];
+        if (middle == 0)
+            middle = 1;
+        if (middle == depth - 1)
+            middle = depth - 2;
+
+        /* A gap between connected parts close to the cut splits for
+           free. */
+        for (int k = 0, slack = size / (32 * share); k <= slack; k++)
+        {
+            int t = cut - k > 0 && isGap(&d, cut - k) ? cut - k : cut + k < size && isGap(&d, cut + k) ? cut + k : 0;
+            if (t > 0)
+            {
+                middle = d.level[d.queue[t]] - 1;
+                break;
+            }
+        }
+
+        int before = gather(&d, piece, size, 0, middle - 1);
+        int after = gather(&d, piece + before, size - before, middle + 1, depth);
+        for (int i = before + after; i < size; i++)
+            d.label[piece[i]] = -1;
+        clearLevels(&d, piece, size);
+        d.stack[sp++] = piece - nodes;
+        d.stack[sp++] = before;
+        d.stack[sp++] = first;
+        d.stack[sp++] = piece - nodes + before;
+        d.stack[sp++] = after;
+        d.stack[sp++] = share - first;
+    }
+
+done:
+    cadFree(d.label);
+    cadFree(d.level);
+    cadFree(d.queue);
+    cadFree(d.stack);
+    cadFree(nodes);
+    freeNetGraph(&graph);
+    return count;
+}
@@ -0,0 +1,21 @@
+#ifndef ORDERING_H
+#define ORDERING_H
+
+#include "circuit.h"
+
+/* Fill-reducing elimination order for the circuit matrix, q[k] being the
+   component eliminated at step k. Components come in schedule order, so
+   the permuted matrix is block lower triangular with one diagonal block
+   per feedback loop, and the members of a large loop are ordered by
+   nested dissection of its connectivity. Depends only on the pin links. */
+int orderCircuitMatrix(const ComponentArray *array, int *q);
+
+/* Splits the circuit into at most parts pieces with no pin linking two
+   of them: part[i] is the piece of component i, or -1 for the separators
+   between pieces. The largest piece is split in two until there are
+   enough, through the middle level of a level structure, or apart when
+   it is not connected. Components without inputs are always separators.
+   Returns the number of pieces. */
+int partitionCircuit(const ComponentArray *array, int parts, int *part);
+
+#endif
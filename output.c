@@ -0,0 +1,954 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "output.h"
+#include "netgraph.h"
+#include "profile.h"
+#include "subcircuit.h"
+
+/* Components formatted per chunk; a chunk is written with one fwrite. */
+#define EXPORT_CHUNK 16384
+/* Chunks formatted per pool run, per thread. */
+#define CHUNKS_PER_THREAD 2
+/* Prints up to this many driven components per line of the listing. */
+#define LIST_LOADS 8
+
+/* Grisu2 after Loitsch, "Printing Floating-Point Numbers Quickly and
+   Accurately with Integers". Always round-trips; the result is the
+   shortest possible in all but a tiny fraction of cases. */
+typedef struct
+{
+    uint64_t f;
+    int e;
+} DiyFp;
+
+#define DP_HIDDEN_BIT ((uint64_t)1 << 52)
+#define DP_SIGNIFICAND_MASK (DP_HIDDEN_BIT - 1)
+#define DP_EXPONENT_BIAS 1075
+
+/* Normalized 64-bit significands and binary exponents of 10^k for
+   k = -348, -340, ..., 340. */
+static const uint64_t cached_powers_f[] = {
+    0xfa8fd5a0081c0288ull, 0xbaaee17fa23ebf76ull, 0x8b16fb203055ac76ull,
+    0xcf42894a5dce35eaull, 0x9a6bb0aa55653b2dull, 0xe61acf033d1a45dfull,
+    0xab70fe17c79ac6caull, 0xff77b1fcbebcdc4full, 0xbe5691ef416bd60cull,
+    0x8dd01fad907ffc3cull, 0xd3515c2831559a83ull, 0x9d71ac8fada6c9b5ull,
+    0xea9c227723ee8bcbull, 0xaecc49914078536dull, 0x823c12795db6ce57ull,
+    0xc21094364dfb5637ull, 0x9096ea6f3848984full, 0xd77485cb25823ac7ull,
+    0xa086cfcd97bf97f4ull, 0xef340a98172aace5ull, 0xb23867fb2a35b28eull,
+    0x84c8d4dfd2c63f3bull, 0xc5dd44271ad3cdbaull, 0x936b9fcebb25c996ull,
+    0xdbac6c247d62a584ull, 0xa3ab66580d5fdaf6ull, 0xf3e2f893dec3f126ull,
+    0xb5b5ada8aaff80b8ull, 0x87625f056c7c4a8bull, 0xc9bcff6034c13053ull,
+    0x964e858c91ba2655ull, 0xdff9772470297ebdull, 0xa6dfbd9fb8e5b88full,
+    0xf8a95fcf88747d94ull, 0xb94470938fa89bcfull, 0x8a08f0f8bf0f156bull,
+    0xcdb02555653131b6ull, 0x993fe2c6d07b7facull, 0xe45c10c42a2b3b06ull,
+    0xaa242499697392d3ull, 0xfd87b5f28300ca0eull, 0xbce5086492111aebull,
+    0x8cbccc096f5088ccull, 0xd1b71758e219652cull, 0x9c40000000000000ull,
+    0xe8d4a51000000000ull, 0xad78ebc5ac620000ull, 0x813f3978f8940984ull,
+    0xc097ce7bc90715b3ull, 0x8f7e32ce7bea5c70ull, 0xd5d238a4abe98068ull,
+    0x9f4f2726179a2245ull, 0xed63a231d4c4fb27ull, 0xb0de65388cc8ada8ull,
+    0x83c7088e1aab65dbull, 0xc45d1df942711d9aull, 0x924d692ca61be758ull,
+    0xda01ee641a708deaull, 0xa26da3999aef774aull, 0xf209787bb47d6b85ull,
+    0xb454e4a179dd1877ull, 0x865b86925b9bc5c2ull, 0xc83553c5c8965d3dull,
+    0x952ab45cfa97a0b3ull, 0xde469fbd99a05fe3ull, 0xa59bc234db398c25ull,
+    0xf6c69a72a3989f5cull, 0xb7dcbf5354e9beceull, 0x88fcf317f22241e2ull,
+    0xcc20ce9bd35c78a5ull, 0x98165af37b2153dfull, 0xe2a0b5dc971f303aull,
+    0xa8d9d1535ce3b396ull, 0xfb9b7cd9a4a7443cull, 0xbb764c4ca7a44410ull,
+    0x8bab8eefb6409c1aull, 0xd01fef10a657842cull, 0x9b10a4e5e9913129ull,
+    0xe7109bfba19c0c9dull, 0xac2820d9623bf429ull, 0x80444b5e7aa7cf85ull,
+    0xbf21e44003acdd2dull, 0x8e679c2f5e44ff8full, 0xd433179d9c8cb841ull,
+    0x9e19db92b4e31ba9ull, 0xeb96bf6ebadf77d9ull, 0xaf87023b9bf0ee6bull,
+};
+
+static const int16_t cached_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954,
+    -927, -901, -874, -847, -821, -794, -768, -741, -715, -688, -661,
+    -635, -608, -582, -555, -529, -502, -475, -449, -422, -396, -369,
+    -343, -316, -289, -263, -236, -210, -183, -157, -130, -103, -77,
+    -50, -24, 3, 30, 56, 83, 109, 136, 162, 189, 216,
+    242, 269, 295, 322, 348, 375, 402, 428, 455, 481, 508,
+    534, 561, 588, 614, 641, 667, 694, 720, 747, 774, 800,
+    827, 853, 880, 907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+static const uint32_t pow10_32[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+static DiyFp diyFromDouble(double d)
+{
+    uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+    int biased = (int)((u >> 52) & 0x7ff);
+    DiyFp r;
+    r.f = u & DP_SIGNIFICAND_MASK;
+    if (biased)
+    {
+        r.f += DP_HIDDEN_BIT;
+        r.e = biased - DP_EXPONENT_BIAS;
+    }
+    else
+        r.e = 1 - DP_EXPONENT_BIAS;
+    return r;
+}
+
+/* Upper 64 bits of the 128-bit product, rounded. */
+static DiyFp diyMultiply(DiyFp x, DiyFp y)
+{
+    const uint64_t mask = 0xffffffffu;
+    uint64_t a = x.f >> 32, b = x.f & mask, c = y.f >> 32, d = y.f & mask;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & mask) + (bc & mask) + ((uint64_t)1 << 31);
+    DiyFp r = {ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64};
+    return r;
+}
+
+static DiyFp diyNormalize(DiyFp x)
+{
+    while (!(x.f & ((uint64_t)1 << 63)))
+    {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+/* The neighbours halfway to the next and previous doubles, with the
+   same exponent. */
+static void normalizedBoundaries(DiyFp v, DiyFp *minus, DiyFp *plus)
+{
+    DiyFp pl = {(v.f << 1) + 1, v.e - 1};
+    while (!(pl.f & (DP_HIDDEN_BIT << 1)))
+    {
+        pl.f <<= 1;
+        pl.e--;
+    }
+    pl.f <<= 10;
+    pl.e -= 10;
+
+    DiyFp mi;
+    if (v.f == DP_HIDDEN_BIT)
+    {
+        mi.f = (v.f << 2) - 1;
+        mi.e = v.e - 2;
+    }
+    else
+    {
+        mi.f = (v.f << 1) - 1;
+        mi.e = v.e - 1;
+    }
+    mi.f <<= mi.e - pl.e;
+    mi.e = pl.e;
+    *minus = mi;
+    *plus = pl;
+}
+
+/* A power of ten c = 10^-k that brings e into [-60, -32] once multiplied. */
+static DiyFp cachedPower(int e, int *k)
+{
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int index = (int)dk;
+    if (dk - index > 0.0)
+        index++;
+    index = (index >> 3) + 1;
+    *k = -(-348 + index * 8);
+    DiyFp r = {cached_powers_f[index], cached_powers_e[index]};
+    return r;
+}
+
+static int decimalDigits(uint32_t n)
+{
+    int digits = 1;
+    while (digits < 10 && n >= pow10_32[digits])
+        digits++;
+    return digits;
+}
+
+static void grisuRound(char *buf, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w))
+    {
+        buf[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int digitGen(DiyFp w, DiyFp mp, uint64_t delta, char *buf, int *k)
+{
+    DiyFp one = {(uint64_t)1 << -mp.e, mp.e};
+    uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = decimalDigits(p1);
+    int len = 0;
+
+    while (kappa > 0)
+    {
+        uint32_t d = p1 / pow10_32[kappa - 1];
+        p1 %= pow10_32[kappa - 1];
+        if (d || len)
+            buf[len++] = (char)('0' + d);
+        kappa--;
+        uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+        if (rest <= delta)
+        {
+            *k += kappa;
+            grisuRound(buf, len, delta, rest, (uint64_t)pow10_32[kappa] << -one.e, wp_w);
+            return len;
+        }
+    }
+    for (;;)
+    {
+        p2 *= 10;
+        delta *= 10;
+        char d = (char)(p2 >> -one.e);
+        if (d || len)
+            buf[len++] = (char)('0' + d);
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta)
+        {
+            *k += kappa;
+            int index = -kappa;
+            grisuRound(buf, len, delta, p2, one.f, wp_w * (index < 10 ? pow10_32[index] : 0));
+            return len;
+        }
+    }
+}
+
+/* Digits of a positive finite v; v = digits * 10^k. */
+static int grisu2(double value, char *buf, int *k)
+{
+    DiyFp v = diyFromDouble(value), w_m, w_p;
+    normalizedBoundaries(v, &w_m, &w_p);
+    DiyFp c_mk = cachedPower(w_p.e, k);
+    DiyFp w = diyMultiply(diyNormalize(v), c_mk);
+    DiyFp wp = diyMultiply(w_p, c_mk);
+    DiyFp wm = diyMultiply(w_m, c_mk);
+    wm.f++;
+    wp.f--;
+    return digitGen(w, wp, wp.f - wm.f, buf, k);
+}
+
+static int writeExponent(int e, char *buf)
+{
+    int len = 0;
+    buf[len++] = e < 0 ? '-' : '+';
+    if (e < 0)
+        e = -e;
+    if (e >= 100)
+    {
+        buf[len++] = (char)('0' + e / 100);
+        e %= 100;
+        buf[len++] = (char)('0' + e / 10);
+    }
+    else
+        buf[len++] = (char)('0' + e / 10);
+    buf[len++] = (char)('0' + e % 10);
+    return len;
+}
+
+int formatShortest(double v, char *buf)
+{
+    int len = 0;
+    if (isnan(v))
+    {
+        memcpy(buf, "nan", 3);
+        return 3;
+    }
+    if (signbit(v))
+    {
+        buf[len++] = '-';
+        v = -v;
+    }
+    if (isinf(v))
+    {
+        memcpy(buf + len, "inf", 3);
+        return len + 3;
+    }
+    if (v == 0.0)
+    {
+        buf[len++] = '0';
+        return len;
+    }
+
+    char *d = buf + len;
+    int k = 0;
+    int n = grisu2(v, d, &k);
+    int kk = n + k; /* 10^(kk-1) <= v < 10^kk */
+
+    if (k >= 0 && kk <= 15)
+    {
+        /* 1234e7 -> 12340000000; longer integers would overflow readers
+           that parse integers as 64-bit. */
+        memset(d + n, '0', k);
+        return len + kk;
+    }
+    if (k < 0 && kk > 0 && kk <= 21)
+    {
+        /* 1234e-2 -> 12.34 */
+        memmove(d + kk + 1, d + kk, n - kk);
+        d[kk] = '.';
+        return len + n + 1;
+    }
+    if (kk > -6 && kk <= 0)
+    {
+        /* 1234e-6 -> 0.001234 */
+        int offset = 2 - kk;
+        memmove(d + offset, d, n);
+        d[0] = '0';
+        d[1] = '.';
+        memset(d + 2, '0', offset - 2);
+        return len + n + offset;
+    }
+    if (n == 1)
+    {
+        /* 1e30 */
+        d[1] = 'e';
+        return len + 2 + writeExponent(kk - 1, d + 2);
+    }
+    /* 1234e30 -> 1.234e+33 */
+    memmove(d + 2, d + 1, n - 1);
+    d[1] = '.';
+    d[n + 1] = 'e';
+    return len + n + 2 + writeExponent(kk - 1, d + n + 2);
+}
+
+void outFree(OutBuffer *b)
+{
+    free(b->data);
+    memset(b, 0, sizeof(*b));
+}
+
+/* Output buffers are filled on pool threads, which have no arena, so they
+   come straight from the heap. */
+bool outReserve(OutBuffer *b, size_t extra)
+{
+    if (b->capacity - b->size >= extra)
+        return true;
+    if (b->failed)
+        return false;
+    size_t capacity = b->capacity ? b->capacity : 4096;
+    while (capacity - b->size < extra)
+        capacity *= 2;
+    char *data = realloc(b->data, capacity);
+    if (!data)
+    {
+        b->failed = true;
+        return false;
+    }
+    b->data = data;
+    b->capacity = capacity;
+    return true;
+}
+
+void outBytes(OutBuffer *b, const char *s, size_t n)
+{
+    if (!outReserve(b, n))
+        return;
+    memcpy(b->data + b->size, s, n);
+    b->size += n;
+}
+
+void outString(OutBuffer *b, const char *s)
+{
+    outBytes(b, s, strlen(s));
+}
+
+void outInt(OutBuffer *b, long long v)
+{
+    char tmp[24];
+    int len = 0;
+    unsigned long long u = v < 0 ? 0ull - (unsigned long long)v : (unsigned long long)v;
+    do
+    {
+        tmp[sizeof(tmp) - 1 - len++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u);
+    if (v < 0)
+        tmp[sizeof(tmp) - 1 - len++] = '-';
+    outBytes(b, tmp + sizeof(tmp) - len, len);
+}
+
+void outDouble(OutBuffer *b, double v)
+{
+    if (!outReserve(b, SHORTEST_DOUBLE_LENGTH))
+        return;
+    b->size += formatShortest(v, b->data + b->size);
+}
+
+/* Same text as printf("%.2f"). Values whose scaled fraction is too close
+   to one half to round reliably from the product, and very large ones,
+   go through snprintf. */
+void outFixed2(OutBuffer *b, double v)
+{
+    double scaled = fabs(v) * 100.0;
+    double fraction = scaled - floor(scaled);
+
+    if (!(scaled < 1e15) || fabs(fraction - 0.5) < 1e-6)
+    {
+        char tmp[400];
+        int len = snprintf(tmp, sizeof(tmp), "%.2f", v);
+        outBytes(b, tmp, len < (int)sizeof(tmp) ? (size_t)len : sizeof(tmp) - 1);
+        return;
+    }
+
+    long long cents = (long long)(fraction < 0.5 ? floor(scaled) : floor(scaled) + 1.0);
+    char tmp[24];
+    int len = 0;
+    tmp[sizeof(tmp) - 1 - len++] = (char)('0' + cents % 10);
+    tmp[sizeof(tmp) - 1 - len++] = (char)('0' + cents / 10 % 10);
+    tmp[sizeof(tmp) - 1 - len++] = '.';
+    cents /= 100;
+    do
+    {
+        tmp[sizeof(tmp) - 1 - len++] = (char)('0' + cents % 10);
+        cents /= 10;
+    } while (cents);
+    if (signbit(v))
+        tmp[sizeof(tmp) - 1 - len++] = '-';
+    outBytes(b, tmp + sizeof(tmp) - len, len);
+}
+
+/* JSON has no NaN or infinity; they are written as null. */
+void outJsonNumber(OutBuffer *b, double v)
+{
+    if (isfinite(v))
+        outDouble(b, v);
+    else
+        outBytes(b, "null", 4);
+}
+
+void outJsonString(OutBuffer *b, const char *s)
+{
+    outBytes(b, "\"", 1);
+    for (; *s; s++)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+        {
+            char esc[2] = {'\\', (char)c};
+            outBytes(b, esc, 2);
+        }
+        else if (c < 0x20)
+        {
+            char esc[7];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            outBytes(b, esc, 6);
+        }
+        else
+            outBytes(b, (const char *)&c, 1);
+    }
+    outBytes(b, "\"", 1);
+}
+
+bool outWrite(OutBuffer *b, FILE *fp)
+{
+    if (b->failed)
+    {
+        fprintf(stderr, "Output buffer allocation failed.\n");
+        return false;
+    }
+    bool ok = b->size == 0 || fwrite(b->data, 1, b->size, fp) == b->size;
+    if (ok)
+        PROFILE_COUNT(PROFILE_BYTES_WRITTEN, b->size);
+    b->size = 0;
+    return ok;
+}
+
+OutputFormat outputFormatFor(const char *file_name)
+{
+    size_t len = strlen(file_name);
+    if (len >= 4 && strcmp(file_name + len - 4, ".csv") == 0)
+        return OUTPUT_CSV;
+    if (len >= 4 && strcmp(file_name + len - 4, ".txt") == 0)
+        return OUTPUT_TEXT;
+    return OUTPUT_JSON;
+}
+
+static const char *componentTypeName(ComponentType type)
+{
+    switch (type)
+    {
+    case POWERSUPPLY:
+        return "PowerSupply";
+    case RESISTOR:
+        return "Resistor";
+    case TRANSISTOR:
+        return "Transistor";
+    case INSTANCE:
+        return "Instance";
+    }
+    return "Unknown";
+}
+
+static void formatListing(OutBuffer *b, const ComponentArray *array, const NetGraph *graph, size_t i)
+{
+    const Component *c = &array->data[i];
+
+    outBytes(b, "ID ", 3);
+    outInt(b, componentId(c));
+    outBytes(b, " - ", 3);
+    switch (c->type)
+    {
+    case POWERSUPPLY:
+        outString(b, "PowerSupply: ");
+        outFixed2(b, c->data.powersupply.voltage);
+        outBytes(b, "V", 1);
+        if (c->data.powersupply.pin1 != -1)
+        {
+            outString(b, " (Connected to ID: ");
+            outInt(b, c->data.powersupply.pin1);
+            outBytes(b, ")", 1);
+        }
+        break;
+    case RESISTOR:
+        outString(b, "Resistor: ");
+        outFixed2(b, c->data.resistor.resistance);
+        outString(b, " Ohms, Output: ");
+        outFixed2(b, c->data.resistor.output);
+        outString(b, c->data.resistor.otype == CALC_VOLTAGE ? " V" : " A");
+        if (c->data.resistor.pin1 != -1 || c->data.resistor.pin2 != -1)
+        {
+            outString(b, " (Pins: ");
+            outInt(b, c->data.resistor.pin1);
+            outBytes(b, ", ", 2);
+            outInt(b, c->data.resistor.pin2);
+            outBytes(b, ")", 1);
+        }
+        break;
+    case TRANSISTOR:
+        outString(b, "Transistor: ");
+        outString(b, c->data.transistor.type ? "PNP" : "NPN");
+        outString(b, ", Output: ");
+        outFixed2(b, c->data.transistor.output);
+        if (c->data.transistor.pin1 != -1 || c->data.transistor.pin2 != -1 || c->data.transistor.pin3 != -1)
+        {
+            outString(b, " (Pins: ");
+            outInt(b, c->data.transistor.pin1);
+            outBytes(b, ", ", 2);
+            outInt(b, c->data.transistor.pin2);
+            outBytes(b, ", ", 2);
+            outInt(b, c->data.transistor.pin3);
+            outBytes(b, ")", 1);
+        }
+        break;
+    case INSTANCE:
+    {
+        const Subcircuit *def = instanceSubcircuit(array, &c->data.instance);
+        const int *ports = array->hierarchy->ports + c->data.instance.port_start;
+        outString(b, "Instance of ");
+        outString(b, def->name);
+        outString(b, ", Output: ");
+        outFixed2(b, c->data.instance.output);
+        for (int p = 0; p < def->ports; p++)
+        {
+            outString(b, p ? ", " : " (Ports: ");
+            outInt(b, ports[p]);
+        }
+        if (def->ports)
+            outBytes(b, ")", 1);
+        break;
+    }
+    }
+    if (graph && graph->load_start[i] < graph->load_start[i + 1])
+    {
+        int first = graph->load_start[i], last = graph->load_start[i + 1];
+        outString(b, " -> drives");
+        for (int p = first; p < last && p < first + LIST_LOADS; p++)
+        {
+            outBytes(b, p == first ? " " : ", ", p == first ? 1 : 2);
+            outInt(b, graph->load[p]);
+        }
+        if (last - first > LIST_LOADS)
+        {
+            outString(b, " and ");
+            outInt(b, last - first - LIST_LOADS);
+            outString(b, " more");
+        }
+    }
+    outBytes(b, "\n", 1);
+}
+
+typedef struct ExportTask ExportTask;
+typedef void (*FormatFn)(OutBuffer *b, const ExportTask *task, size_t i);
+
+struct ExportTask
+{
+    const ComponentArray *array;
+    FormatFn format;
+    OutputFormat output;
+    const NetGraph *graph;
+    bool compact;
+    int depth;
+    const int *waveform_of;
+    size_t first_chunk;
+    OutBuffer *buffers;
+};
+
+static void formatResult(OutBuffer *b, const ExportTask *task, size_t i)
+{
+    const Component *c = &task->array->data[i];
+    switch (task->output)
+    {
+    case OUTPUT_TEXT:
+        formatListing(b, task->array, task->graph, i);
+        break;
+    case OUTPUT_CSV:
+        outInt(b, (long long)i);
+        outBytes(b, ",", 1);
+        outString(b, componentTypeName(c->type));
+        outBytes(b, ",", 1);
+        outDouble(b, componentOutput(c));
+        outBytes(b, "\n", 1);
+        break;
+    case OUTPUT_JSON:
+        outString(b, i ? ",\n    {\"id\": " : "\n    {\"id\": ");
+        outInt(b, (long long)i);
+        outString(b, ", \"type\": \"");
+        outString(b, componentTypeName(c->type));
+        outString(b, "\", \"output\": ");
+        outJsonNumber(b, componentOutput(c));
+        outBytes(b, "}", 1);
+        break;
+    }
+}
+
+static void formatChunk(void *arg, size_t index, int worker)
+{
+    ExportTask *task = arg;
+    OutBuffer *b = &task->buffers[index];
+    size_t begin = (task->first_chunk + index) * EXPORT_CHUNK;
+    size_t end = begin + EXPORT_CHUNK < task->array->size ? begin + EXPORT_CHUNK : task->array->size;
+
+    for (size_t i = begin; i < end; i++)
+        task->format(b, task, i);
+}
+
+/* Writes head, every component in order, then tail, reusing one batch of
+   chunk buffers. */
+static bool writeChunks(FILE *fp, ExportTask *task, ThreadPool *pool, OutBuffer *head, const char *tail)
+{
+    size_t chunks = (task->array->size + EXPORT_CHUNK - 1) / EXPORT_CHUNK;
+    size_t batch = pool ? (size_t)threadPoolSize(pool) * CHUNKS_PER_THREAD : 1;
+    bool ok = outWrite(head, fp);
+
+    task->buffers = calloc(batch, sizeof(OutBuffer));
+    if (!task->buffers)
+        return false;
+    for (size_t first = 0; ok && first < chunks; first += batch)
+    {
+        size_t count = chunks - first < batch ? chunks - first : batch;
+        task->first_chunk = first;
+        threadPoolRun(pool, formatChunk, task, count);
+        for (size_t c = 0; c < count; c++)
+            ok = outWrite(&task->buffers[c], fp) && ok;
+    }
+    for (size_t c = 0; c < batch; c++)
+        outFree(&task->buffers[c]);
+    free(task->buffers);
+    task->buffers = NULL;
+
+    if (ok && tail)
+    {
+        outString(head, tail);
+        ok = outWrite(head, fp);
+    }
+    return ok;
+}
+
+static void formatHeader(OutBuffer *b, OutputFormat format, const char *netlist, const SolveStats *stats)
+{
+    if (format == OUTPUT_CSV)
+        outString(b, "id,type,output\n");
+    if (format != OUTPUT_JSON)
+        return;
+
+    outString(b, "{\n");
+    if (netlist)
+    {
+        outString(b, "  \"netlist\": ");
+        outJsonString(b, netlist);
+        outString(b, ",\n");
+    }
+    if (stats)
+    {
+        outString(b, "  \"solve\": {\"nnz\": ");
+        outInt(b, stats->nnz);
+        outString(b, ", \"lu_nnz\": ");
+        outInt(b, stats->lu_nnz);
+        outString(b, ", \"iterations\": ");
+        outInt(b, stats->iterations);
+        outString(b, ", \"factorizations\": ");
+        outInt(b, stats->factorizations);
+        outString(b, stats->converged ? ", \"converged\": true" : ", \"converged\": false");
+        outString(b, ", \"residual\": ");
+        outJsonNumber(b, stats->residual);
+        outString(b, ", \"time\": ");
+        outJsonNumber(b, stats->assemble_time + stats->factor_time + stats->solve_time);
+        outString(b, "},\n");
+    }
+    outString(b, "  \"components\": [");
+}
+
+bool exportComponents(FILE *fp, OutputFormat format, const ComponentArray *array, const char *netlist,
+                      const SolveStats *stats, ThreadPool *pool)
+{
+    NetGraph graph;
+    bool have_graph = format == OUTPUT_TEXT && buildNetGraph(array, &graph) == 0;
+    ExportTask task = {array, formatResult, format, have_graph ? &graph : NULL, false, 0, NULL, 0, NULL};
+    OutBuffer head = {0};
+
+    formatHeader(&head, format, netlist, stats);
+    bool ok = writeChunks(fp, &task, pool, &head, format == OUTPUT_JSON ? "\n  ]\n}\n" : NULL);
+    outFree(&head);
+    if (have_graph)
+        freeNetGraph(&graph);
+    return ok;
+}
+
+/* Starts a member of an object whose members sit at the given depth. The
+   pretty layout is the one cJSON_Print produces. */
+static void outKey(OutBuffer *b, const char *key, bool first, bool compact, int depth)
+{
+    static const char tabs[] = "\t\t\t\t\t\t\t\t";
+    if (!first)
+        outBytes(b, ",", 1);
+    if (!compact)
+    {
+        outBytes(b, "\n", 1);
+        outBytes(b, tabs, depth);
+    }
+    outBytes(b, "\"", 1);
+    outString(b, key);
+    outBytes(b, compact ? "\":" : "\":\t", compact ? 2 : 3);
+}
+
+static void outCloseObject(OutBuffer *b, bool compact, int depth)
+{
+    static const char tabs[] = "\t\t\t\t\t\t\t\t";
+    if (!compact)
+    {
+        outBytes(b, "\n", 1);
+        outBytes(b, tabs, depth - 1);
+    }
+    outBytes(b, "}", 1);
+}
+
+static void outStringField(OutBuffer *b, const char *key, const char *value, bool compact, int depth)
+{
+    outKey(b, key, false, compact, depth);
+    outJsonString(b, value);
+}
+
+static void outNumberField(OutBuffer *b, const char *key, double value, bool compact, int depth)
+{
+    outKey(b, key, false, compact, depth);
+    outJsonNumber(b, value);
+}
+
+static void outIntField(OutBuffer *b, const char *key, int value, bool compact, int depth)
+{
+    outKey(b, key, false, compact, depth);
+    outInt(b, value);
+}
+
+static void formatWaveform(OutBuffer *b, const Waveform *w, bool compact, int depth)
+{
+    outBytes(b, "{", 1);
+    outKey(b, "shape", true, compact, depth);
+    switch (w->shape)
+    {
+    case WAVEFORM_STEP:
+        outJsonString(b, "step");
+        outNumberField(b, "v1", w->v1, compact, depth);
+        outNumberField(b, "v2", w->v2, compact, depth);
+        outNumberField(b, "delay", w->delay, compact, depth);
+        outNumberField(b, "rise", w->rise, compact, depth);
+        break;
+    case WAVEFORM_PULSE:
+        outJsonString(b, "pulse");
+        outNumberField(b, "v1", w->v1, compact, depth);
+        outNumberField(b, "v2", w->v2, compact, depth);
+        outNumberField(b, "delay", w->delay, compact, depth);
+        outNumberField(b, "rise", w->rise, compact, depth);
+        outNumberField(b, "fall", w->fall, compact, depth);
+        outNumberField(b, "width", w->width, compact, depth);
+        outNumberField(b, "period", w->period, compact, depth);
+        break;
+    case WAVEFORM_SINE:
+        outJsonString(b, "sine");
+        outNumberField(b, "offset", w->v1, compact, depth);
+        outNumberField(b, "amplitude", w->v2, compact, depth);
+        outNumberField(b, "frequency", w->frequency, compact, depth);
+        outNumberField(b, "delay", w->delay, compact, depth);
+        outNumberField(b, "phase", w->phase, compact, depth);
+        break;
+    }
+    outCloseObject(b, compact, depth);
+}
+
+/* Number arrays stay on one line, as cJSON_Print writes them. */
+static void formatInstance(OutBuffer *b, const ComponentArray *array, const Instance *inst, bool compact, int depth)
+{
+    const Hierarchy *h = array->hierarchy;
+    const Subcircuit *def = instanceSubcircuit(array, inst);
+    const char *separator = compact ? "," : ", ";
+
+    outStringField(b, "type", "Instance", compact, depth);
+    outStringField(b, "subcircuit", def->name, compact, depth);
+    outKey(b, "ports", false, compact, depth);
+    outBytes(b, "[", 1);
+    for (int p = 0; p < def->ports; p++)
+    {
+        if (p)
+            outString(b, separator);
+        outInt(b, h->ports[inst->port_start + p]);
+    }
+    outBytes(b, "]", 1);
+    if (!inst->override_count)
+        return;
+    outKey(b, "parameters", false, compact, depth);
+    outBytes(b, "[", 1);
+    for (int k = 0; k < inst->override_count; k++)
+    {
+        const ParameterOverride *o = &h->overrides[inst->override_start + k];
+        if (k)
+            outString(b, separator);
+        outBytes(b, "[", 1);
+        outInt(b, o->component);
+        outString(b, separator);
+        outJsonNumber(b, o->value);
+        outBytes(b, "]", 1);
+    }
+    outBytes(b, "]", 1);
+}
+
+static void formatCircuitComponent(OutBuffer *b, const ExportTask *task, size_t i)
+{
+    const Component *c = &task->array->data[i];
+    bool compact = task->compact;
+    int depth = task->depth;
+
+    if (i)
+        outBytes(b, ", ", compact ? 1 : 2);
+    outBytes(b, "{", 1);
+    outKey(b, "id", true, compact, depth);
+    outInt(b, (long long)i);
+    switch (c->type)
+    {
+    case POWERSUPPLY:
+        outStringField(b, "type", "PowerSupply", compact, depth);
+        outNumberField(b, "voltage", c->data.powersupply.voltage, compact, depth);
+        outIntField(b, "pin1", c->data.powersupply.pin1, compact, depth);
+        if (task->waveform_of && task->waveform_of[i] >= 0)
+        {
+            outKey(b, "waveform", false, compact, depth);
+            formatWaveform(b, &task->array->waveforms[task->waveform_of[i]], compact, depth + 1);
+        }
+        break;
+    case RESISTOR:
+        outStringField(b, "type", "Resistor", compact, depth);
+        outNumberField(b, "resistance", c->data.resistor.resistance, compact, depth);
+        outStringField(b, "output_type", c->data.resistor.otype == CALC_VOLTAGE ? "Voltage" : "Current", compact,
+                       depth);
+        outIntField(b, "pin1", c->data.resistor.pin1, compact, depth);
+        outIntField(b, "pin2", c->data.resistor.pin2, compact, depth);
+        break;
+    case TRANSISTOR:
+        outStringField(b, "type", "Transistor", compact, depth);
+        outStringField(b, "transistor_type", c->data.transistor.type ? "PNP" : "NPN", compact, depth);
+        outStringField(b, "input_output_format", c->data.transistor.input_type ? "Current" : "Voltage", compact,
+                       depth);
+        if (c->data.transistor.beta != TRANSISTOR_BETA)
+            outNumberField(b, "beta", c->data.transistor.beta, compact, depth);
+        outIntField(b, "pin1", c->data.transistor.pin1, compact, depth);
+        outIntField(b, "pin2", c->data.transistor.pin2, compact, depth);
+        outIntField(b, "pin3", c->data.transistor.pin3, compact, depth);
+        break;
+    case INSTANCE:
+        formatInstance(b, task->array, &c->data.instance, compact, depth);
+        break;
+    }
+    outCloseObject(b, compact, depth);
+}
+
+/* Index the waveforms by component so each supply finds its own in
+   constant time; the first one listed wins, as with findWaveform. */
+static int *indexWaveforms(const ComponentArray *array, bool *ok)
+{
+    *ok = true;
+    if (!array->waveform_count)
+        return NULL;
+    int *waveform_of = malloc((array->size + 1) * sizeof(int));
+    if (!waveform_of)
+    {
+        *ok = false;
+        return NULL;
+    }
+    for (size_t i = 0; i < array->size; i++)
+        waveform_of[i] = -1;
+    for (size_t k = array->waveform_count; k-- > 0;)
+    {
+        int id = array->waveforms[k].component;
+        if (id >= 0 && (size_t)id < array->size)
+            waveform_of[id] = (int)k;
+    }
+    return waveform_of;
+}
+
+/* Definitions are few and small next to the top level, so they are
+   formatted on the calling thread into the head. */
+static bool formatSubcircuits(OutBuffer *b, const Hierarchy *h, bool compact)
+{
+    const int depth = 3;
+
+    outString(b, compact ? "\"subcircuits\":[" : "\n\t\"subcircuits\":\t[");
+    for (size_t k = 0; k < h->count; k++)
+    {
+        const Subcircuit *def = &h->subcircuits[k];
+        bool ok;
+        ExportTask body = {&def->body, formatCircuitComponent, OUTPUT_JSON, NULL, compact, depth + 2,
+                           indexWaveforms(&def->body, &ok), 0, NULL};
+        if (!ok)
+            return false;
+
+        if (k)
+            outBytes(b, ", ", compact ? 1 : 2);
+        outBytes(b, "{", 1);
+        outKey(b, "name", true, compact, depth);
+        outJsonString(b, def->name);
+        outIntField(b, "ports", def->ports, compact, depth);
+        outIntField(b, "output", def->output, compact, depth);
+        outKey(b, "components", false, compact, depth);
+        outBytes(b, "[", 1);
+        for (size_t i = 0; i < def->body.size; i++)
+            formatCircuitComponent(b, &body, i);
+        outBytes(b, "]", 1);
+        outCloseObject(b, compact, depth);
+        free((void *)body.waveform_of);
+    }
+    outBytes(b, "],", 2);
+    return true;
+}
+
+bool exportCircuit(FILE *fp, const ComponentArray *array, bool compact, ThreadPool *pool)
+{
+    ExportTask task = {array, formatCircuitComponent, OUTPUT_JSON, NULL, compact, 3, NULL, 0, NULL};
+    OutBuffer head = {0};
+    bool ok;
+
+    task.waveform_of = indexWaveforms(array, &ok);
+    if (!ok)
+        return false;
+
+    outBytes(&head, "{", 1);
+    if (array->hierarchy && array->hierarchy->count)
+        ok = formatSubcircuits(&head, array->hierarchy, compact);
+    outString(&head, compact ? "\"components\":[" : "\n\t\"components\":\t[");
+    ok = ok && writeChunks(fp, &task, pool, &head, compact ? "]}" : "]\n}");
+    outFree(&head);
+    free((void *)task.waveform_of);
+    return ok;
+}
@@ -0,0 +1,64 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "circuit.h"
+#include "solver.h"
+#include "threadpool.h"
+
+/* Growable byte buffer that the writers below format into; it is written
+   out with one fwrite instead of a printf per field. A failed allocation
+   is remembered and reported by outWrite. */
+typedef struct
+{
+    char *data;
+    size_t size;
+    size_t capacity;
+    bool failed;
+} OutBuffer;
+
+/* Longest text formatShortest produces. */
+#define SHORTEST_DOUBLE_LENGTH 32
+
+/* Shortest decimal text that reads back as exactly v (Grisu2): plain
+   notation from 1e-6 to 1e21, except integers from 1e15 on, and d.ddde+XX
+   otherwise. Returns the length; buf is not terminated. */
+int formatShortest(double v, char *buf);
+
+void outFree(OutBuffer *b);
+bool outReserve(OutBuffer *b, size_t extra);
+void outBytes(OutBuffer *b, const char *s, size_t n);
+void outString(OutBuffer *b, const char *s);
+void outInt(OutBuffer *b, long long v);
+void outDouble(OutBuffer *b, double v);
+void outFixed2(OutBuffer *b, double v);
+/* JSON values: non-finite numbers as null, strings quoted and escaped. */
+void outJsonNumber(OutBuffer *b, double v);
+void outJsonString(OutBuffer *b, const char *s);
+bool outWrite(OutBuffer *b, FILE *fp);
+
+typedef enum
+{
+    OUTPUT_TEXT,
+    OUTPUT_CSV,
+    OUTPUT_JSON
+} OutputFormat;
+
+/* .csv and .txt select CSV and text, anything else JSON. */
+OutputFormat outputFormatFor(const char *file_name);
+
+/* Writes every component's result. Text is the interactive listing; CSV
+   is id,type,output; JSON is the result-file schema, with netlist and
+   stats when given. With a pool, chunks of components are formatted in
+   parallel and written in order. */
+bool exportComponents(FILE *fp, OutputFormat format, const ComponentArray *array, const char *netlist,
+                      const SolveStats *stats, ThreadPool *pool);
+
+/* Writes the circuit in the saveCircuit JSON schema without building a
+   document: pretty in cJSON_Print's layout, or compact with no
+   whitespace. With a pool, chunks are serialized in parallel. */
+bool exportCircuit(FILE *fp, const ComponentArray *array, bool compact, ThreadPool *pool);
+
+#endif
@@ -0,0 +1,190 @@
+#include "platform.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+
+double monotonicSeconds(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+}
+
+int cpuCount(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+
+bool mapFile(const char *path, MappedFile *map)
+{
+    LARGE_INTEGER size;
+    map->data = "";
+    map->size = 0;
+    map->mapping = NULL;
+    map->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (map->file == INVALID_HANDLE_VALUE)
+        return false;
+    if (!GetFileSizeEx(map->file, &size))
+    {
+        CloseHandle(map->file);
+        return false;
+    }
+    if (size.QuadPart == 0)
+        return true;
+
+    map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (map->mapping)
+        map->data = MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!map->mapping || !map->data)
+    {
+        if (map->mapping)
+            CloseHandle(map->mapping);
+        CloseHandle(map->file);
+        return false;
+    }
+    map->size = (size_t)size.QuadPart;
+    return true;
+}
+
+void releaseMappedRange(MappedFile *map, size_t end)
+{
+    (void)map;
+    (void)end;
+}
+
+void unmapFile(MappedFile *map)
+{
+    if (map->size)
+        UnmapViewOfFile(map->data);
+    if (map->mapping)
+        CloseHandle(map->mapping);
+    CloseHandle(map->file);
+    map->data = NULL;
+    map->size = 0;
+}
+
+bool replaceFile(const char *from, const char *to)
+{
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+}
+
+unsigned long processId(void)
+{
+    return GetCurrentProcessId();
+}
+
+size_t residentBytes(void)
+{
+    PROCESS_MEMORY_COUNTERS pmc;
+    return K32GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)) ? pmc.WorkingSetSize : 0;
+}
+
+size_t peakResidentBytes(void)
+{
+    PROCESS_MEMORY_COUNTERS pmc;
+    return K32GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)) ? pmc.PeakWorkingSetSize : 0;
+}
+#else
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+double monotonicSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int cpuCount(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+bool mapFile(const char *path, MappedFile *map)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    map->data = "";
+    map->size = 0;
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    if (st.st_size > 0)
+    {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            return false;
+        }
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+        map->data = data;
+        map->size = st.st_size;
+    }
+    close(fd);
+    return true;
+}
+
+/* Drops the already-consumed pages before end so a sequential pass over
+   a large file keeps a bounded resident set. */
+void releaseMappedRange(MappedFile *map, size_t end)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    end -= end % page;
+    if (end > 0 && end <= map->size)
+        madvise((void *)map->data, end, MADV_DONTNEED);
+}
+
+void unmapFile(MappedFile *map)
+{
+    if (map->size)
+        munmap((void *)map->data, map->size);
+    map->data = NULL;
+    map->size = 0;
+}
+
+bool replaceFile(const char *from, const char *to)
+{
+    return rename(from, to) == 0;
+}
+
+unsigned long processId(void)
+{
+    return (unsigned long)getpid();
+}
+
+size_t residentBytes(void)
+{
+    long pages = 0, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (!fp)
+        return 0;
+    if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(fp);
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+size_t peakResidentBytes(void)
+{
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? (size_t)usage.ru_maxrss * 1024 : 0;
+}
+#endif
@@ -0,0 +1,33 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Read-only view of a whole file. */
+typedef struct
+{
+    const char *data;
+    size_t size;
+#ifdef _WIN32
+    void *file;
+    void *mapping;
+#endif
+} MappedFile;
+
+double monotonicSeconds(void);
+int cpuCount(void);
+bool mapFile(const char *path, MappedFile *map);
+void releaseMappedRange(MappedFile *map, size_t end);
+void unmapFile(MappedFile *map);
+
+/* Moves from over to, replacing an existing file in one step, so readers
+   see either the old contents or the new. */
+bool replaceFile(const char *from, const char *to);
+unsigned long processId(void);
+
+/* Current and peak resident memory of the process, 0 if unknown. */
+size_t residentBytes(void);
+size_t peakResidentBytes(void);
+
+#endif
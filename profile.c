@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include "profile.h"
+#include "platform.h"
+
+#ifdef CAD_PROFILE
+
+#define TRACE_CAPACITY ((size_t)1 << 20)
+
+static const char *const phase_names[PROFILE_PHASES] = {
+    "load", "read", "parse", "validate", "save", "schedule", "evaluate", "solve", "list", "output"};
+
+static const char *const counter_names[PROFILE_COUNTERS] = {
+    "bytes_read", "bytes_written", "components_loaded", "components_saved",
+    "components_evaluated", "groups_solved", "components_listed"};
+
+typedef struct
+{
+    ProfilePhase phase;
+    int thread;
+    double start;
+    double duration;
+} TraceEvent;
+
+/* Totals are kept in nanoseconds so they can be added atomically. */
+static atomic_ullong phase_calls[PROFILE_PHASES];
+static atomic_ullong phase_nanos[PROFILE_PHASES];
+static atomic_ullong phase_max_nanos[PROFILE_PHASES];
+static atomic_ullong counters[PROFILE_COUNTERS];
+
+static TraceEvent *trace;
+static atomic_size_t trace_count;
+static double trace_origin;
+static atomic_int next_thread;
+static _Thread_local int thread_id = -1;
+
+double profileBegin(void)
+{
+    return monotonicSeconds();
+}
+
+void profileEnd(ProfilePhase phase, double start)
+{
+    double end = monotonicSeconds();
+    unsigned long long nanos = (unsigned long long)((end - start) * 1e9);
+    unsigned long long max = atomic_load_explicit(&phase_max_nanos[phase], memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&phase_calls[phase], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&phase_nanos[phase], nanos, memory_order_relaxed);
+    while (nanos > max &&
+           !atomic_compare_exchange_weak_explicit(&phase_max_nanos[phase], &max, nanos,
+                                                  memory_order_relaxed, memory_order_relaxed))
+        ;
+
+    if (!trace)
+        return;
+    size_t slot = atomic_fetch_add_explicit(&trace_count, 1, memory_order_relaxed);
+    if (slot >= TRACE_CAPACITY)
+        return;
+    if (thread_id < 0)
+        thread_id = atomic_fetch_add(&next_thread, 1);
+    trace[slot].phase = phase;
+    trace[slot].thread = thread_id;
+    trace[slot].start = start - trace_origin;
+    trace[slot].duration = end - start;
+}
+
+void profileCount(ProfileCounter counter, size_t amount)
+{
+    atomic_fetch_add_explicit(&counters[counter], amount, memory_order_relaxed);
+}
+
+bool profileEnabled(void)
+{
+    return true;
+}
+
+/* Must be called before the work it should see starts. */
+bool profileStartTrace(void)
+{
+    if (trace)
+        return true;
+    trace_origin = monotonicSeconds();
+    trace = calloc(TRACE_CAPACITY, sizeof(TraceEvent));
+    if (!trace)
+    {
+        fprintf(stderr, "Cannot allocate the profile trace.\n");
+        return false;
+    }
+    return true;
+}
+
+bool profileWriteJson(const char *file_name)
+{
+    FILE *fp = fopen(file_name, "w");
+    if (!fp)
+    {
+        perror(file_name);
+        return false;
+    }
+
+    fprintf(fp, "{\n  \"phases\": {\n");
+    for (int p = 0; p < PROFILE_PHASES; p++)
+    {
+        unsigned long long calls = atomic_load(&phase_calls[p]);
+        double total = atomic_load(&phase_nanos[p]) / 1e9;
+        fprintf(fp, "    \"%s\": {\"calls\": %llu, \"seconds\": %.9f, \"mean_seconds\": %.9f, \"max_seconds\": %.9f}%s\n",
+                phase_names[p], calls, total, calls ? total / calls : 0.0,
+                atomic_load(&phase_max_nanos[p]) / 1e9, p + 1 < PROFILE_PHASES ? "," : "");
+    }
+    fprintf(fp, "  },\n  \"counters\": {\n");
+    for (int c = 0; c < PROFILE_COUNTERS; c++)
+        fprintf(fp, "    \"%s\": %llu%s\n", counter_names[c], atomic_load(&counters[c]),
+                c + 1 < PROFILE_COUNTERS ? "," : "");
+    fprintf(fp, "  },\n  \"peak_rss_bytes\": %zu\n}\n", peakResidentBytes());
+
+    bool ok = !ferror(fp);
+    if (fclose(fp) != 0)
+        ok = false;
+    if (!ok)
+        perror(file_name);
+    return ok;
+}
+
+/* Complete ("X") events in microseconds; counters go in the metadata. */
+bool profileWriteTrace(const char *file_name)
+{
+    if (!trace)
+    {
+        fprintf(stderr, "No profile trace was recorded.\n");
+        return false;
+    }
+    FILE *fp = fopen(file_name, "w");
+    if (!fp)
+    {
+        perror(file_name);
+        return false;
+    }
+
+    size_t count = atomic_load(&trace_count);
+    size_t kept = count < TRACE_CAPACITY ? count : TRACE_CAPACITY;
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (size_t i = 0; i < kept; i++)
+    {
+        const TraceEvent *e = &trace[i];
+        fprintf(fp, "{\"name\":\"%s\",\"cat\":\"cad\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f},\n",
+                phase_names[e->phase], e->thread, e->start * 1e6, e->duration * 1e6);
+    }
+    fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"cad\"}}\n],\n");
+    fprintf(fp, "\"metadata\":{\"dropped_events\":%zu", count - kept);
+    for (int c = 0; c < PROFILE_COUNTERS; c++)
+        fprintf(fp, ",\"%s\":%llu", counter_names[c], atomic_load(&counters[c]));
+    fprintf(fp, "}}\n");
+
+    bool ok = !ferror(fp);
+    if (fclose(fp) != 0)
+        ok = false;
+    if (!ok)
+        perror(file_name);
+    return ok;
+}
+
+#else
+
+double profileBegin(void)
+{
+    return 0.0;
+}
+
+void profileEnd(ProfilePhase phase, double start)
+{
+}
+
+void profileCount(ProfileCounter counter, size_t amount)
+{
+}
+
+bool profileEnabled(void)
+{
+    return false;
+}
+
+static bool notCompiled(void)
+{
+    fprintf(stderr, "Profiling is not compiled in; rebuild with -DCAD_PROFILE.\n");
+    return false;
+}
+
+bool profileStartTrace(void)
+{
+    return notCompiled();
+}
+
+bool profileWriteJson(const char *file_name)
+{
+    return notCompiled();
+}
+
+bool profileWriteTrace(const char *file_name)
+{
+    return notCompiled();
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Timers and counters around the expensive phases of a run. Built with
+   -DCAD_PROFILE the macros below record into process-wide totals and,
+   once profileStartTrace has been called, into a trace; without it they
+   expand to nothing. Phases may nest and may run on any thread. */
+typedef enum
+{
+    PROFILE_LOAD,
+    PROFILE_READ,
+    PROFILE_PARSE,
+    PROFILE_VALIDATE,
+    PROFILE_SAVE,
+    PROFILE_SCHEDULE,
+    PROFILE_EVALUATE,
+    PROFILE_SOLVE,
+    PROFILE_LIST,
+    PROFILE_OUTPUT,
+    PROFILE_PHASES
+} ProfilePhase;
+
+typedef enum
+{
+    PROFILE_BYTES_READ,
+    PROFILE_BYTES_WRITTEN,
+    PROFILE_COMPONENTS_LOADED,
+    PROFILE_COMPONENTS_SAVED,
+    PROFILE_COMPONENTS_EVALUATED,
+    PROFILE_GROUPS_SOLVED,
+    PROFILE_COMPONENTS_LISTED,
+    PROFILE_COUNTERS
+} ProfileCounter;
+
+#ifdef CAD_PROFILE
+#define PROFILE_BEGIN(phase) double profile_start_##phase = profileBegin()
+#define PROFILE_END(phase) profileEnd(phase, profile_start_##phase)
+#define PROFILE_COUNT(counter, amount) profileCount(counter, (size_t)(amount))
+#else
+#define PROFILE_BEGIN(phase) ((void)0)
+#define PROFILE_END(phase) ((void)0)
+#define PROFILE_COUNT(counter, amount) ((void)0)
+#endif
+
+double profileBegin(void);
+void profileEnd(ProfilePhase phase, double start);
+void profileCount(ProfileCounter counter, size_t amount);
+
+/* Reports fail with a message when profiling is compiled out. The trace
+   is in Chrome's trace-event format and keeps the first events up to a
+   fixed capacity; later ones are counted as dropped. */
+bool profileEnabled(void);
+bool profileStartTrace(void);
+bool profileWriteJson(const char *file_name);
+bool profileWriteTrace(const char *file_name);
+
+#endif
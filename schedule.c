@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <string.h>
+#include "schedule.h"
+#include "arena.h"
+
+/* Tarjan's algorithm with an explicit call stack, so million-component
+   chains do not overflow the C stack. Edges run from a net to its loads;
+   components are numbered sinks first, the reverse of evaluation order.
+   Returns the number of strongly connected components. */
+static int strongComponents(const NetGraph *g, int *component)
+{
+    int n = (int)g->nets;
+    int *index = cadMalloc((n + 1) * sizeof(int));
+    int *low = cadMalloc((n + 1) * sizeof(int));
+    int *stack = cadMalloc((n + 1) * sizeof(int));
+    int *call = cadMalloc((n + 1) * sizeof(int));
+    int *edge = cadMalloc((n + 1) * sizeof(int));
+    int count = -1;
+
+    if (!index || !low || !stack || !call || !edge)
+        goto done;
+
+    for (int i = 0; i < n; i++)
+    {
+        index[i] = -1;
+        component[i] = -1;
+    }
+
+    int counter = 0, sp = 0;
+    count = 0;
+    for (int root = 0; root < n; root++)
+    {
+        if (index[root] >= 0)
+            continue;
+        int cp = 0;
+        index[root] = low[root] = counter++;
+        stack[sp++] = root;
+        call[cp] = root;
+        edge[cp++] = g->load_start[root];
+
+        while (cp > 0)
+        {
+            int v = call[cp - 1];
+            if (edge[cp - 1] < g->load_start[v + 1])
+            {
+                int w = g->load[edge[cp - 1]++];
+                if (index[w] < 0)
+                {
+                    index[w] = low[w] = counter++;
+                    stack[sp++] = w;
+                    call[cp] = w;
+                    edge[cp++] = g->load_start[w];
+                }
+                else if (component[w] < 0 && index[w] < low[v])
+                    low[v] = index[w];
+                continue;
+            }
+
+            cp--;
+            if (cp > 0 && low[v] < low[call[cp - 1]])
+                low[call[cp - 1]] = low[v];
+            if (low[v] == index[v])
+            {
+                int w;
+                do
+                {
+                    w = stack[--sp];
+                    component[w] = count;
+                } while (w != v);
+                count++;
+            }
+        }
+    }
+
+done:
+    cadFree(index);
+    cadFree(low);
+    cadFree(stack);
+    cadFree(call);
+    cadFree(edge);
+    return count;
+}
+
+int buildSchedule(const NetGraph *g, Schedule *s)
+{
+    int n = (int)g->nets;
+    int *component = cadMalloc((n + 1) * sizeof(int));
+    int *comp_start = NULL, *comp_member = NULL, *comp_level = NULL, *comp_group = NULL;
+    int comps = -1;
+
+    memset(s, 0, sizeof(*s));
+    s->n = n;
+    s->level = cadMalloc((n + 1) * sizeof(int));
+    s->group = cadMalloc((n + 1) * sizeof(int));
+    s->position = cadMalloc((n + 1) * sizeof(int));
+    if (!component || !s->level || !s->group || !s->position)
+        goto fail;
+    comps = strongComponents(g, component);
+    if (comps < 0)
+        goto fail;
+
+    comp_start = cadCalloc(comps + 2, sizeof(int));
+    comp_member = cadMalloc((n + 1) * sizeof(int));
+    comp_level = cadMalloc((comps + 1) * sizeof(int));
+    comp_group = cadMalloc((comps + 1) * sizeof(int));
+    if (!comp_start || !comp_member || !comp_level || !comp_group)
+        goto fail;
+    for (int i = 0; i < n; i++)
+        comp_start[component[i] + 2]++;
+    for (int c = 0; c < comps; c++)
+        comp_start[c + 2] += comp_start[c + 1];
+    for (int i = 0; i < n; i++)
+        comp_member[comp_start[component[i] + 1]++] = i;
+
+    /* Components come sinks first, so walking them backwards visits every
+       input before the things it feeds. */
+    int group_count = 0;
+    s->levels = n > 0 ? 1 : 0;
+    for (int c = comps - 1; c >= 0; c--)
+    {
+        int level = 0;
+        bool cyclic = comp_start[c + 1] - comp_start[c] > 1;
+        for (int m = comp_start[c]; m < comp_start[c + 1]; m++)
+        {
+            int i = comp_member[m];
+            for (int p = g->input_start[i]; p < g->input_start[i + 1]; p++)
+            {
+                int j = g->input_net[p];
+                if (component[j] == c)
+                    cyclic = true;
+                else if (comp_level[component[j]] + 1 > level)
+                    level = comp_level[component[j]] + 1;
+            }
+        }
+        comp_level[c] = level;
+        comp_group[c] = cyclic ? group_count++ : -1;
+        if (level + 1 > s->levels)
+            s->levels = level + 1;
+    }
+
+    /* Renumber the groups by level with a counting sort. */
+    s->groups = group_count;
+    s->level_group = cadCalloc(s->levels + 2, sizeof(int));
+    s->group_start = cadCalloc(group_count + 2, sizeof(int));
+    s->member = cadMalloc((n + 1) * sizeof(int));
+    if (!s->level_group || !s->group_start || !s->member)
+        goto fail;
+    for (int c = 0; c < comps; c++)
+        if (comp_group[c] >= 0)
+            s->level_group[comp_level[c] + 2]++;
+    for (int l = 0; l < s->levels; l++)
+        s->level_group[l + 2] += s->level_group[l + 1];
+    for (int c = comps - 1; c >= 0; c--)
+        if (comp_group[c] >= 0)
+            comp_group[c] = s->level_group[comp_level[c] + 1]++;
+
+    for (int i = 0; i < n; i++)
+    {
+        s->level[i] = comp_level[component[i]];
+        s->group[i] = comp_group[component[i]];
+        if (s->group[i] >= 0)
+            s->group_start[s->group[i] + 2]++;
+    }
+    for (int k = 0; k < group_count; k++)
+        s->group_start[k + 2] += s->group_start[k + 1];
+    for (int i = 0; i < n; i++)
+    {
+        s->position[i] = -1;
+        if (s->group[i] >= 0)
+            s->member[s->group_start[s->group[i] + 1]++] = i;
+    }
+    for (int k = 0; k < group_count; k++)
+        for (int m = s->group_start[k]; m < s->group_start[k + 1]; m++)
+            s->position[s->member[m]] = m - s->group_start[k];
+
+    cadFree(component);
+    cadFree(comp_start);
+    cadFree(comp_member);
+    cadFree(comp_level);
+    cadFree(comp_group);
+    return 0;
+
+fail:
+    cadFree(component);
+    cadFree(comp_start);
+    cadFree(comp_member);
+    cadFree(comp_level);
+    cadFree(comp_group);
+    freeSchedule(s);
+    return -1;
+}
+
+void freeSchedule(Schedule *s)
+{
+    cadFree(s->level);
+    cadFree(s->group);
+    cadFree(s->position);
+    cadFree(s->group_start);
+    cadFree(s->member);
+    cadFree(s->level_group);
+    memset(s, 0, sizeof(*s));
+}
@@ -0,0 +1,32 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include "netgraph.h"
+
+/* Evaluation order of a netlist. Strongly connected components of the
+   net graph (feedback loops, including a component reading itself) are
+   collapsed into groups and the condensed graph is levelized, so every
+   component reads only values produced in earlier levels or, inside a
+   group, by the other members of its group.
+
+   group[i] is -1 for components outside any loop. Members of group g are
+   member[group_start[g] .. group_start[g + 1]) in ascending id order and
+   position[i] is the index of component i within its group. Groups are
+   numbered by level; those of level l are [level_group[l], level_group[l + 1]). */
+typedef struct
+{
+    size_t n;
+    int levels;
+    int *level;
+    size_t groups;
+    int *group;
+    int *position;
+    int *group_start;
+    int *member;
+    int *level_group;
+} Schedule;
+
+int buildSchedule(const NetGraph *g, Schedule *s);
+void freeSchedule(Schedule *s);
+
+#endif
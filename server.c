@@ -0,0 +1,574 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "server.h"
+#include "cJSON/cJSON.h"
+#include "circuit.h"
+#include "incremental.h"
+#include "output.h"
+#include "platform.h"
+#include "subcircuit.h"
+#include "symbolic.h"
+
+typedef enum
+{
+    OP_LOAD,
+    OP_SET,
+    OP_SOLVE,
+    OP_QUERY,
+    OP_SAVE,
+    OP_CLOSE,
+    OP_PING,
+    OP_STATS
+} Operation;
+
+static const struct
+{
+    const char *name;
+    Operation op;
+} OPERATIONS[] = {
+    {"load", OP_LOAD}, {"set", OP_SET},     {"solve", OP_SOLVE}, {"query", OP_QUERY},
+    {"save", OP_SAVE}, {"close", OP_CLOSE}, {"ping", OP_PING},   {"stats", OP_STATS},
+};
+
+/* A parsed request line, queued on the session it addresses until a
+   worker runs it. */
+typedef struct Request
+{
+    struct Request *next;
+    cJSON *json;
+    Operation op;
+} Request;
+
+/* A resident circuit. Its requests run one at a time in arrival order;
+   scheduled is set while the session is on the ready queue or being run,
+   so at most one worker touches it. */
+typedef struct Session
+{
+    int handle;
+    bool loaded;
+    ComponentArray array;
+    CircuitState state;
+    Request *head;
+    Request *tail;
+    bool scheduled;
+    struct Session *next_ready;
+} Session;
+
+typedef struct
+{
+    FILE *out;
+    pthread_mutex_t out_lock;
+
+    /* Guards everything below; session queues and scheduled flags too. */
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t space;
+    pthread_cond_t idle;
+    Session *ready_head;
+    Session *ready_tail;
+    size_t pending;
+    size_t max_pending;
+    bool stopping;
+
+    /* Only the reader thread touches the handle table. A closed handle's
+       slot is NULL; handles are never reused. */
+    Session **sessions;
+    size_t session_count;
+    size_t session_capacity;
+    size_t open_sessions;
+    size_t requests;
+} Server;
+
+static void freeSession(Session *s)
+{
+    circuitStateFree(&s->state);
+    freeComponentArray(&s->array);
+    free(s);
+}
+
+static void beginResponse(OutBuffer *b, const cJSON *json, bool ok)
+{
+    const cJSON *id = cJSON_GetObjectItem(json, "id");
+    b->size = 0;
+    outString(b, "{\"id\":");
+    if (cJSON_IsNumber(id))
+        outJsonNumber(b, id->valuedouble);
+    else if (cJSON_IsString(id))
+        outJsonString(b, id->valuestring);
+    else
+        outString(b, "null");
+    outString(b, ok ? ",\"ok\":true" : ",\"ok\":false");
+}
+
+/* Responses from different workers interleave by whole lines. */
+static void endResponse(Server *server, OutBuffer *b)
+{
+    outString(b, "}\n");
+    pthread_mutex_lock(&server->out_lock);
+    if (outWrite(b, server->out))
+        fflush(server->out);
+    pthread_mutex_unlock(&server->out_lock);
+}
+
+static void respondError(Server *server, OutBuffer *b, const cJSON *json, const char *message)
+{
+    beginResponse(b, json, false);
+    outString(b, ",\"error\":");
+    outJsonString(b, message);
+    endResponse(server, b);
+}
+
+static bool intField(const cJSON *json, const char *name, int *value)
+{
+    const cJSON *item = cJSON_GetObjectItem(json, name);
+    if (!cJSON_IsNumber(item))
+        return false;
+    *value = item->valueint;
+    return true;
+}
+
+static void runLoad(Server *server, OutBuffer *b, Session *s, const cJSON *json)
+{
+    const cJSON *file = cJSON_GetObjectItem(json, "file");
+    SolveStats stats = {0};
+    double start = monotonicSeconds();
+
+    if (!cJSON_IsString(file))
+    {
+        respondError(server, b, json, "missing file");
+        return;
+    }
+    if (!loadCircuit(file->valuestring, &s->array) || !flattenInPlace(&s->array))
+    {
+        respondError(server, b, json, "cannot load circuit");
+        return;
+    }
+    if (solveCircuitCached(&s->array, file->valuestring, &stats) < 0 ||
+        circuitStateAttach(&s->state, &s->array) != 0)
+    {
+        respondError(server, b, json, "solve failed");
+        return;
+    }
+    s->loaded = true;
+
+    beginResponse(b, json, true);
+    outString(b, ",\"handle\":");
+    outInt(b, s->handle);
+    outString(b, ",\"components\":");
+    outInt(b, (long long)s->array.size);
+    outString(b, ",\"converged\":");
+    outString(b, stats.converged ? "true" : "false");
+    outString(b, ",\"time\":");
+    outJsonNumber(b, monotonicSeconds() - start);
+    endResponse(server, b);
+}
+
+/* One parameter per request: a resistance, a supply voltage or a beta. */
+static void runSet(Server *server, OutBuffer *b, Session *s, const cJSON *json)
+{
+    static const struct
+    {
+        const char *field;
+        int (*set)(CircuitState *, ComponentArray *, int, double);
+        const char *error;
+    } SETTERS[] = {
+        {"resistance", setResistance, "component is not a resistor"},
+        {"voltage", setVoltage, "component is not a power supply"},
+        {"beta", setBeta, "component is not a transistor"},
+    };
+    int id;
+
+    if (!intField(json, "component", &id))
+    {
+        respondError(server, b, json, "missing component");
+        return;
+    }
+    for (size_t i = 0; i < sizeof(SETTERS) / sizeof(SETTERS[0]); i++)
+    {
+        const cJSON *value = cJSON_GetObjectItem(json, SETTERS[i].field);
+        if (!value)
+            continue;
+        if (!cJSON_IsNumber(value))
+            respondError(server, b, json, "value is not a number");
+        else if (SETTERS[i].set(&s->state, &s->array, id, value->valuedouble) != 0)
+            respondError(server, b, json, SETTERS[i].error);
+        else
+        {
+            beginResponse(b, json, true);
+            endResponse(server, b);
+        }
+        return;
+    }
+    respondError(server, b, json, "missing resistance, voltage or beta");
+}
+
+static void runSolve(Server *server, OutBuffer *b, Session *s, const cJSON *json)
+{
+    UpdateStats stats;
+    if (circuitStateUpdate(&s->state, &s->array, &stats) != 0)
+    {
+        respondError(server, b, json, "solve failed");
+        return;
+    }
+    beginResponse(b, json, true);
+    outString(b, ",\"affected\":");
+    outInt(b, stats.affected);
+    outString(b, ",\"passes\":");
+    outInt(b, stats.passes);
+    outString(b, ",\"time\":");
+    outJsonNumber(b, stats.time);
+    endResponse(server, b);
+}
+
+/* The outputs of the listed components, or of all of them. */
+static void runQuery(Server *server, OutBuffer *b, Session *s, const cJSON *json)
+{
+    const cJSON *components = cJSON_GetObjectItem(json, "components");
+    const cJSON *item;
+
+    if (components)
+    {
+        if (!cJSON_IsArray(components))
+        {
+            respondError(server, b, json, "components is not an array");
+            return;
+        }
+        cJSON_ArrayForEach(item, components)
+        {
+            if (!cJSON_IsNumber(item) || item->valueint < 0 || (size_t)item->valueint >= s->array.size)
+            {
+                respondError(server, b, json, "component out of range");
+                return;
+            }
+        }
+    }
+
+    beginResponse(b, json, true);
+    outString(b, ",\"outputs\":[");
+    if (components)
+    {
+        bool first = true;
+        cJSON_ArrayForEach(item, components)
+        {
+            if (!first)
+                outBytes(b, ",", 1);
+            outJsonNumber(b, componentOutput(&s->array.data[item->valueint]));
+            first = false;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < s->array.size; i++)
+        {
+            if (i > 0)
+                outBytes(b, ",", 1);
+            outJsonNumber(b, componentOutput(&s->array.data[i]));
+        }
+    }
+    outString(b, "]");
+    endResponse(server, b);
+}
+
+static void runSave(Server *server, OutBuffer *b, Session *s, const cJSON *json)
+{
+    const cJSON *file = cJSON_GetObjectItem(json, "file");
+    if (!cJSON_IsString(file))
+        respondError(server, b, json, "missing file");
+    else if (!saveCircuit(file->valuestring, &s->array))
+        respondError(server, b, json, "cannot save circuit");
+    else
+    {
+        beginResponse(b, json, true);
+        endResponse(server, b);
+    }
+}
+
+static void runRequest(Server *server, OutBuffer *b, Session *s, const Request *r)
+{
+    if (r->op == OP_LOAD)
+        runLoad(server, b, s, r->json);
+    else if (r->op == OP_CLOSE)
+    {
+        beginResponse(b, r->json, true);
+        endResponse(server, b);
+    }
+    else if (!s->loaded)
+        respondError(server, b, r->json, "circuit not loaded");
+    else if (r->op == OP_SET)
+        runSet(server, b, s, r->json);
+    else if (r->op == OP_SOLVE)
+        runSolve(server, b, s, r->json);
+    else if (r->op == OP_QUERY)
+        runQuery(server, b, s, r->json);
+    else
+        runSave(server, b, s, r->json);
+}
+
+/* Takes a ready session, runs its oldest request, and puts the session
+   back at the end of the ready queue while it has more, so that a long
+   pipeline on one handle does not starve the others. */
+static void *serverWorker(void *arg)
+{
+    Server *server = arg;
+    OutBuffer b = {0};
+
+    pthread_mutex_lock(&server->lock);
+    for (;;)
+    {
+        while (!server->ready_head && !server->stopping)
+            pthread_cond_wait(&server->work, &server->lock);
+        if (!server->ready_head)
+            break;
+
+        Session *s = server->ready_head;
+        server->ready_head = s->next_ready;
+        if (!server->ready_head)
+            server->ready_tail = NULL;
+        Request *r = s->head;
+        s->head = r->next;
+        if (!s->head)
+            s->tail = NULL;
+        pthread_mutex_unlock(&server->lock);
+
+        runRequest(server, &b, s, r);
+        bool closed = r->op == OP_CLOSE;
+        cJSON_Delete(r->json);
+        free(r);
+        if (closed)
+            freeSession(s);
+
+        pthread_mutex_lock(&server->lock);
+        if (!closed && s->head)
+        {
+            s->next_ready = NULL;
+            if (server->ready_tail)
+                server->ready_tail->next_ready = s;
+            else
+                server->ready_head = s;
+            server->ready_tail = s;
+        }
+        else if (!closed)
+            s->scheduled = false;
+        if (server->pending-- == server->max_pending)
+            pthread_cond_signal(&server->space);
+        if (server->pending == 0)
+            pthread_cond_signal(&server->idle);
+    }
+    pthread_mutex_unlock(&server->lock);
+    outFree(&b);
+    return NULL;
+}
+
+/* Queues r on s, waiting first while the server is at its limit. */
+static void dispatch(Server *server, Session *s, Request *r)
+{
+    pthread_mutex_lock(&server->lock);
+    while (server->pending >= server->max_pending)
+        pthread_cond_wait(&server->space, &server->lock);
+    server->pending++;
+    r->next = NULL;
+    if (s->tail)
+        s->tail->next = r;
+    else
+        s->head = r;
+    s->tail = r;
+    if (!s->scheduled)
+    {
+        s->scheduled = true;
+        s->next_ready = NULL;
+        if (server->ready_tail)
+            server->ready_tail->next_ready = s;
+        else
+            server->ready_head = s;
+        server->ready_tail = s;
+        pthread_cond_signal(&server->work);
+    }
+    pthread_mutex_unlock(&server->lock);
+}
+
+static Session *openSession(Server *server)
+{
+    if (server->session_count == server->session_capacity)
+    {
+        size_t capacity = server->session_capacity ? server->session_capacity * 2 : 16;
+        Session **sessions = realloc(server->sessions, capacity * sizeof(Session *));
+        if (!sessions)
+            return NULL;
+        server->sessions = sessions;
+        server->session_capacity = capacity;
+    }
+    Session *s = calloc(1, sizeof(Session));
+    if (!s)
+        return NULL;
+    server->sessions[server->session_count++] = s;
+    s->handle = (int)server->session_count;
+    server->open_sessions++;
+    return s;
+}
+
+static Session *findSession(Server *server, const cJSON *json)
+{
+    int handle;
+    if (!intField(json, "handle", &handle) || handle < 1 || (size_t)handle > server->session_count)
+        return NULL;
+    return server->sessions[handle - 1];
+}
+
+/* Reads one line of any length into *line; false at end of input. */
+static bool readLine(FILE *in, char **line, size_t *capacity, size_t *length)
+{
+    *length = 0;
+    for (;;)
+    {
+        if (*capacity - *length < 2)
+        {
+            size_t grown = *capacity ? *capacity * 2 : 4096;
+            char *p = realloc(*line, grown);
+            if (!p)
+                return false;
+            *line = p;
+            *capacity = grown;
+        }
+        if (!fgets(*line + *length, (int)(*capacity - *length), in))
+            return *length > 0;
+        *length += strlen(*line + *length);
+        if ((*line)[*length - 1] == '\n')
+            return true;
+    }
+}
+
+static void handleLine(Server *server, OutBuffer *b, const char *line, size_t length)
+{
+    cJSON *json = cJSON_ParseWithLength(line, length);
+    const cJSON *op_name = cJSON_GetObjectItem(json, "op");
+    Session *s = NULL;
+    Operation op = OP_PING;
+    size_t i;
+
+    server->requests++;
+    if (!cJSON_IsObject(json))
+    {
+        respondError(server, b, NULL, "invalid JSON");
+        cJSON_Delete(json);
+        return;
+    }
+    for (i = 0; i < sizeof(OPERATIONS) / sizeof(OPERATIONS[0]); i++)
+    {
+        if (cJSON_IsString(op_name) && strcmp(op_name->valuestring, OPERATIONS[i].name) == 0)
+        {
+            op = OPERATIONS[i].op;
+            break;
+        }
+    }
+    if (i == sizeof(OPERATIONS) / sizeof(OPERATIONS[0]))
+    {
+        respondError(server, b, json, "unknown op");
+        cJSON_Delete(json);
+        return;
+    }
+
+    /* Answered here, in order with the reading. */
+    if (op == OP_PING || op == OP_STATS)
+    {
+        beginResponse(b, json, true);
+        if (op == OP_STATS)
+        {
+            pthread_mutex_lock(&server->lock);
+            size_t pending = server->pending;
+            pthread_mutex_unlock(&server->lock);
+            outString(b, ",\"handles\":");
+            outInt(b, (long long)server->open_sessions);
+            outString(b, ",\"pending\":");
+            outInt(b, (long long)pending);
+            outString(b, ",\"requests\":");
+            outInt(b, (long long)server->requests);
+        }
+        endResponse(server, b);
+        cJSON_Delete(json);
+        return;
+    }
+
+    /* A load takes its handle now, so a pipelined client can address the
+       circuit before the load has run. */
+    s = op == OP_LOAD ? openSession(server) : findSession(server, json);
+    Request *r = s ? malloc(sizeof(Request)) : NULL;
+    if (!r)
+    {
+        respondError(server, b, json, s ? "out of memory" : "unknown handle");
+        cJSON_Delete(json);
+        return;
+    }
+    if (op == OP_CLOSE)
+    {
+        server->sessions[s->handle - 1] = NULL;
+        server->open_sessions--;
+    }
+    r->json = json;
+    r->op = op;
+    dispatch(server, s, r);
+}
+
+int runServer(FILE *in, FILE *out, int threads, size_t max_pending)
+{
+    Server server = {0};
+    pthread_t *workers;
+    OutBuffer b = {0};
+    char *line = NULL;
+    size_t capacity = 0;
+    size_t length;
+    int started = 0;
+
+    if (threads < 1)
+        threads = 1;
+    server.out = out;
+    server.max_pending = max_pending ? max_pending : SERVER_DEFAULT_QUEUE;
+    pthread_mutex_init(&server.out_lock, NULL);
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.work, NULL);
+    pthread_cond_init(&server.space, NULL);
+    pthread_cond_init(&server.idle, NULL);
+
+    workers = malloc(threads * sizeof(pthread_t));
+    for (; workers && started < threads; started++)
+        if (pthread_create(&workers[started], NULL, serverWorker, &server) != 0)
+            break;
+    if (started == 0)
+    {
+        fprintf(stderr, "Cannot start server threads.\n");
+        free(workers);
+        return EXIT_FAILURE;
+    }
+
+    while (readLine(in, &line, &capacity, &length))
+    {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+            length--;
+        if (length > 0)
+            handleLine(&server, &b, line, length);
+    }
+
+    pthread_mutex_lock(&server.lock);
+    while (server.pending > 0)
+        pthread_cond_wait(&server.idle, &server.lock);
+    server.stopping = true;
+    pthread_cond_broadcast(&server.work);
+    pthread_mutex_unlock(&server.lock);
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+
+    for (size_t i = 0; i < server.session_count; i++)
+        if (server.sessions[i])
+            freeSession(server.sessions[i]);
+    free(server.sessions);
+    free(workers);
+    free(line);
+    outFree(&b);
+    pthread_cond_destroy(&server.idle);
+    pthread_cond_destroy(&server.space);
+    pthread_cond_destroy(&server.work);
+    pthread_mutex_destroy(&server.lock);
+    pthread_mutex_destroy(&server.out_lock);
+    return EXIT_SUCCESS;
+}
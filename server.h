@@ -0,0 +1,16 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define SERVER_DEFAULT_QUEUE 256
+
+/* Serves JSON-lines requests read from in until end of input, one JSON
+   response line per request on out. Loaded circuits stay resident under
+   the handle their load returned; requests on one handle run in arrival
+   order, requests on different handles run in parallel on threads
+   workers. Reading stops while max_pending requests are unanswered. */
+int runServer(FILE *in, FILE *out, int threads, size_t max_pending);
+
+#endif
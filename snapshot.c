@@ -0,0 +1,320 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "snapshot.h"
+#include "arena.h"
+
+/* Versions live as long as the editor session, past any arena scope, so
+   they are kept on the C heap. */
+typedef struct
+{
+    size_t refs;
+    Component data[SNAPSHOT_CHUNK];
+} SnapshotChunk;
+
+typedef struct
+{
+    size_t refs;
+    size_t count;
+    Waveform data[];
+} WaveformBlock;
+
+struct CircuitSnapshot
+{
+    size_t refs;
+    size_t size;
+    SnapshotChunk **chunks;
+    size_t chunk_count;
+    size_t chunk_capacity;
+    WaveformBlock *waveforms;
+};
+
+static void *snapshotAlloc(size_t size)
+{
+    void *p = malloc(size ? size : 1);
+    if (!p)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static void reserveChunks(CircuitSnapshot *s, size_t count)
+{
+    if (count <= s->chunk_capacity)
+        return;
+    size_t capacity = s->chunk_capacity ? s->chunk_capacity : 4;
+    while (capacity < count)
+        capacity *= 2;
+    SnapshotChunk **chunks = realloc(s->chunks, capacity * sizeof(SnapshotChunk *));
+    if (!chunks)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+    s->chunks = chunks;
+    s->chunk_capacity = capacity;
+}
+
+static CircuitSnapshot *newSnapshot(size_t chunks)
+{
+    CircuitSnapshot *s = snapshotAlloc(sizeof(CircuitSnapshot));
+    memset(s, 0, sizeof(*s));
+    s->refs = 1;
+    reserveChunks(s, chunks);
+    return s;
+}
+
+CircuitSnapshot *snapshotFromArray(const ComponentArray *array)
+{
+    size_t n = array->size;
+    CircuitSnapshot *s = newSnapshot((n + SNAPSHOT_CHUNK - 1) / SNAPSHOT_CHUNK);
+
+    for (size_t first = 0; first < n; first += SNAPSHOT_CHUNK)
+    {
+        size_t count = n - first < SNAPSHOT_CHUNK ? n - first : SNAPSHOT_CHUNK;
+        SnapshotChunk *chunk = snapshotAlloc(sizeof(SnapshotChunk));
+        chunk->refs = 1;
+        memcpy(chunk->data, array->data + first, count * sizeof(Component));
+        s->chunks[s->chunk_count++] = chunk;
+    }
+    s->size = n;
+    if (array->waveform_count)
+    {
+        s->waveforms = snapshotAlloc(sizeof(WaveformBlock) + array->waveform_count * sizeof(Waveform));
+        s->waveforms->refs = 1;
+        s->waveforms->count = array->waveform_count;
+        memcpy(s->waveforms->data, array->waveforms, array->waveform_count * sizeof(Waveform));
+    }
+    return s;
+}
+
+CircuitSnapshot *snapshotRetain(CircuitSnapshot *s)
+{
+    s->refs++;
+    return s;
+}
+
+void snapshotRelease(CircuitSnapshot *s)
+{
+    if (!s || --s->refs > 0)
+        return;
+    for (size_t k = 0; k < s->chunk_count; k++)
+        if (--s->chunks[k]->refs == 0)
+            free(s->chunks[k]);
+    if (s->waveforms && --s->waveforms->refs == 0)
+        free(s->waveforms);
+    free(s->chunks);
+    free(s);
+}
+
+size_t snapshotSize(const CircuitSnapshot *s)
+{
+    return s->size;
+}
+
+const Component *snapshotGet(const CircuitSnapshot *s, size_t index)
+{
+    return &s->chunks[index / SNAPSHOT_CHUNK]->data[index % SNAPSHOT_CHUNK];
+}
+
+/* A version only the caller holds: a shared one is replaced by a copy of
+   its chunk table, which takes a reference to every chunk. */
+static CircuitSnapshot *makePrivate(CircuitSnapshot **s)
+{
+    CircuitSnapshot *old = *s;
+    if (old->refs == 1)
+        return old;
+
+    CircuitSnapshot *copy = newSnapshot(old->chunk_count);
+    for (size_t k = 0; k < old->chunk_count; k++)
+    {
+        copy->chunks[k] = old->chunks[k];
+        copy->chunks[k]->refs++;
+    }
+    copy->chunk_count = old->chunk_count;
+    copy->size = old->size;
+    copy->waveforms = old->waveforms;
+    if (copy->waveforms)
+        copy->waveforms->refs++;
+    old->refs--;
+    *s = copy;
+    return copy;
+}
+
+Component *snapshotEdit(CircuitSnapshot **s, size_t index)
+{
+    CircuitSnapshot *v = makePrivate(s);
+    SnapshotChunk **chunk = &v->chunks[index / SNAPSHOT_CHUNK];
+    if ((*chunk)->refs > 1)
+    {
+        SnapshotChunk *copy = snapshotAlloc(sizeof(SnapshotChunk));
+        memcpy(copy->data, (*chunk)->data, sizeof(copy->data));
+        copy->refs = 1;
+        (*chunk)->refs--;
+        *chunk = copy;
+    }
+    return &(*chunk)->data[index % SNAPSHOT_CHUNK];
+}
+
+void snapshotAppend(CircuitSnapshot **s, Component value)
+{
+    CircuitSnapshot *v = makePrivate(s);
+    if (v->size == v->chunk_count * SNAPSHOT_CHUNK)
+    {
+        reserveChunks(v, v->chunk_count + 1);
+        SnapshotChunk *chunk = snapshotAlloc(sizeof(SnapshotChunk));
+        chunk->refs = 1;
+        v->chunks[v->chunk_count++] = chunk;
+    }
+    v->size++;
+    *snapshotEdit(s, v->size - 1) = value;
+}
+
+bool snapshotToArray(const CircuitSnapshot *s, ComponentArray *array)
+{
+    size_t n = s->size, waveform_count = s->waveforms ? s->waveforms->count : 0;
+    Component *data = cadMalloc((n ? n : 1) * sizeof(Component));
+    Waveform *waveforms = waveform_count ? cadMalloc(waveform_count * sizeof(Waveform)) : NULL;
+    if (!data || (waveform_count && !waveforms))
+    {
+        cadFree(data);
+        cadFree(waveforms);
+        return false;
+    }
+
+    for (size_t k = 0; k < s->chunk_count; k++)
+    {
+        size_t first = k * SNAPSHOT_CHUNK;
+        size_t count = n - first < SNAPSHOT_CHUNK ? n - first : SNAPSHOT_CHUNK;
+        memcpy(data + first, s->chunks[k]->data, count * sizeof(Component));
+    }
+    if (waveform_count)
+        memcpy(waveforms, s->waveforms->data, waveform_count * sizeof(Waveform));
+
+    freeComponentArray(array);
+    array->data = data;
+    array->size = array->capacity = n;
+    array->waveforms = waveforms;
+    array->waveform_count = array->waveform_capacity = waveform_count;
+    return true;
+}
+
+void historyInit(EditHistory *h)
+{
+    ComponentArray empty = {0};
+    memset(h, 0, sizeof(*h));
+    h->current = snapshotFromArray(&empty);
+}
+
+static void clearSteps(CircuitSnapshot **steps, size_t *count)
+{
+    while (*count > 0)
+        snapshotRelease(steps[--*count]);
+}
+
+void historyFree(EditHistory *h)
+{
+    clearSteps(h->undo, &h->undo_count);
+    clearSteps(h->redo, &h->redo_count);
+    for (size_t k = 0; k < h->variant_count; k++)
+    {
+        free(h->variants[k].name);
+        snapshotRelease(h->variants[k].snapshot);
+    }
+    free(h->variants);
+    snapshotRelease(h->current);
+    memset(h, 0, sizeof(*h));
+}
+
+/* The oldest step makes room when the stack is full. */
+static void pushStep(CircuitSnapshot **steps, size_t *count, CircuitSnapshot *s)
+{
+    if (*count == HISTORY_DEPTH)
+    {
+        snapshotRelease(steps[0]);
+        memmove(steps, steps + 1, (HISTORY_DEPTH - 1) * sizeof(CircuitSnapshot *));
+        (*count)--;
+    }
+    steps[(*count)++] = s;
+}
+
+void historyCheckpoint(EditHistory *h)
+{
+    pushStep(h->undo, &h->undo_count, snapshotRetain(h->current));
+    clearSteps(h->redo, &h->redo_count);
+}
+
+void historyRecord(EditHistory *h, const ComponentArray *array, size_t index)
+{
+    if (index < snapshotSize(h->current))
+        *snapshotEdit(&h->current, index) = array->data[index];
+    else
+        snapshotAppend(&h->current, array->data[index]);
+}
+
+void historyReplace(EditHistory *h, const ComponentArray *array)
+{
+    snapshotRelease(h->current);
+    h->current = snapshotFromArray(array);
+}
+
+/* Moves current onto one stack and the top of the other into current. */
+static bool step(EditHistory *h, CircuitSnapshot **from, size_t *from_count, CircuitSnapshot **to,
+                 size_t *to_count, ComponentArray *array)
+{
+    if (*from_count == 0 || !snapshotToArray(from[*from_count - 1], array))
+        return false;
+    pushStep(to, to_count, h->current);
+    h->current = from[--*from_count];
+    return true;
+}
+
+bool historyUndo(EditHistory *h, ComponentArray *array)
+{
+    return step(h, h->undo, &h->undo_count, h->redo, &h->redo_count, array);
+}
+
+bool historyRedo(EditHistory *h, ComponentArray *array)
+{
+    return step(h, h->redo, &h->redo_count, h->undo, &h->undo_count, array);
+}
+
+void historyKeep(EditHistory *h, const char *name)
+{
+    for (size_t k = 0; k < h->variant_count; k++)
+        if (strcmp(h->variants[k].name, name) == 0)
+        {
+            snapshotRelease(h->variants[k].snapshot);
+            h->variants[k].snapshot = snapshotRetain(h->current);
+            return;
+        }
+
+    if (h->variant_count == h->variant_capacity)
+    {
+        size_t capacity = h->variant_capacity ? 2 * h->variant_capacity : 8;
+        Variant *variants = realloc(h->variants, capacity * sizeof(Variant));
+        if (!variants)
+        {
+            perror("Failed to allocate memory");
+            exit(EXIT_FAILURE);
+        }
+        h->variants = variants;
+        h->variant_capacity = capacity;
+    }
+    Variant *v = &h->variants[h->variant_count++];
+    v->name = snapshotAlloc(strlen(name) + 1);
+    strcpy(v->name, name);
+    v->snapshot = snapshotRetain(h->current);
+}
+
+bool historySwitch(EditHistory *h, size_t index, ComponentArray *array)
+{
+    if (index >= h->variant_count || !snapshotToArray(h->variants[index].snapshot, array))
+        return false;
+    historyCheckpoint(h);
+    snapshotRelease(h->current);
+    h->current = snapshotRetain(h->variants[index].snapshot);
+    return true;
+}
@@ -0,0 +1,75 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "circuit.h"
+
+/* Components per storage chunk. Editing a shared version copies the one
+   chunk the component is in; the others stay shared. */
+#define SNAPSHOT_CHUNK 1024
+/* Undo steps kept; older ones are dropped. */
+#define HISTORY_DEPTH 100
+
+/* An immutable-by-default version of a flat circuit, stored in reference
+   counted chunks. Retaining one is the O(1) snapshot; an edit through
+   snapshotEdit first gives the caller a private version that shares
+   every chunk but the one it writes to. Not safe to share between
+   threads. */
+typedef struct CircuitSnapshot CircuitSnapshot;
+
+CircuitSnapshot *snapshotFromArray(const ComponentArray *array);
+CircuitSnapshot *snapshotRetain(CircuitSnapshot *s);
+void snapshotRelease(CircuitSnapshot *s);
+size_t snapshotSize(const CircuitSnapshot *s);
+const Component *snapshotGet(const CircuitSnapshot *s, size_t index);
+/* Writable component index of *s, which is replaced by a private version
+   first when it is shared. */
+Component *snapshotEdit(CircuitSnapshot **s, size_t index);
+void snapshotAppend(CircuitSnapshot **s, Component value);
+/* Replaces the contents of array with a contiguous copy of s. */
+bool snapshotToArray(const CircuitSnapshot *s, ComponentArray *array);
+
+typedef struct
+{
+    char *name;
+    CircuitSnapshot *snapshot;
+} Variant;
+
+/* Undo and redo for the interactive editor, plus named variants of the
+   design. current follows the editor's working array: every edit made to
+   the array is recorded into it, after a checkpoint that keeps the
+   version before. All of them share the chunks they have in common. */
+typedef struct
+{
+    CircuitSnapshot *current;
+    CircuitSnapshot *undo[HISTORY_DEPTH];
+    size_t undo_count;
+    CircuitSnapshot *redo[HISTORY_DEPTH];
+    size_t redo_count;
+    Variant *variants;
+    size_t variant_count;
+    size_t variant_capacity;
+} EditHistory;
+
+void historyInit(EditHistory *h);
+void historyFree(EditHistory *h);
+/* Keeps the current version as the undo step for the edits that follow
+   and forgets what could be redone. */
+void historyCheckpoint(EditHistory *h);
+/* Copies array->data[index] into the current version, appending when it
+   is one past its end. */
+void historyRecord(EditHistory *h, const ComponentArray *array, size_t index);
+/* Makes a whole new circuit, such as a loaded file, the current version. */
+void historyReplace(EditHistory *h, const ComponentArray *array);
+/* Step back or forward, leaving the version reached in array. False when
+   there is nothing to step to. */
+bool historyUndo(EditHistory *h, ComponentArray *array);
+bool historyRedo(EditHistory *h, ComponentArray *array);
+/* Keeps the current version under name, replacing a variant of that
+   name. */
+void historyKeep(EditHistory *h, const char *name);
+/* Makes variant index current, as an edit that can be undone. */
+bool historySwitch(EditHistory *h, size_t index, ComponentArray *array);
+
+#endif
@@ -0,0 +1,880 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "solver.h"
+#include "arena.h"
+#include "ordering.h"
+#include "platform.h"
+#include "profile.h"
+
+#define PIVOT_TOLERANCE 0.1
+#define NEWTON_PIVOT_TOLERANCE 1e-3
+#define REFACTOR_PIVOT_TOLERANCE 1e-10
+
+static const NewtonOptions default_newton = {100, 1e-9, 8};
+
+static bool transistorActive(const Transistor *t)
+{
+    return t->type ? t->base < -TRANSISTOR_VBE : t->base > TRANSISTOR_VBE;
+}
+
+/* Each component contributes one row: its output minus the linearized
+   contribution of its inputs. Transistor rows always reserve both the
+   input and base columns so the pattern does not depend on the region.
+   Columns come back sorted; returns the number of entries. */
+int assembleRow(const ComponentArray *array, int i, int cols[3], double vals[3], double *rhs)
+{
+    const Component *c = &array->data[i];
+    int inputs[2];
+    double coef[2] = {0.0, 0.0};
+    double diag = 1.0;
+    int count = componentInputs(array, i, inputs);
+
+    *rhs = 0.0;
+    switch (c->type)
+    {
+    case POWERSUPPLY:
+        *rhs = c->data.powersupply.voltage;
+        break;
+    case RESISTOR:
+    {
+        const Resistor *r = &c->data.resistor;
+        double gain = r->otype == CALC_VOLTAGE ? r->resistance : 1.0 / r->resistance;
+        if (inputs[0] < 0)
+            *rhs = gain * UNCONNECTED_INPUT;
+        else
+            coef[0] = gain;
+        break;
+    }
+    case TRANSISTOR:
+    {
+        const Transistor *t = &c->data.transistor;
+        if (!transistorActive(t))
+            break;
+        if (t->input_type)
+            coef[1] = t->type ? -t->beta : t->beta;
+        else
+        {
+            coef[0] = 1.0;
+            *rhs = t->type ? TRANSISTOR_VBE : -TRANSISTOR_VBE;
+        }
+        break;
+    }
+    case INSTANCE:
+        break;
+    }
+
+    /* Inputs are stored as -coef; self references fold into the diagonal
+       and a repeated pin collapses into a single entry. */
+    for (int k = 0; k < count; k++)
+    {
+        if (inputs[k] == i)
+        {
+            diag -= coef[k];
+            inputs[k] = -1;
+        }
+    }
+    if (count == 2 && inputs[0] >= 0 && inputs[0] == inputs[1])
+    {
+        coef[0] += coef[1];
+        inputs[1] = -1;
+    }
+
+    int nnz = 0;
+    cols[nnz] = i;
+    vals[nnz++] = diag;
+    for (int k = 0; k < count; k++)
+    {
+        if (inputs[k] < 0)
+            continue;
+        int p = nnz;
+        while (p > 0 && cols[p - 1] > inputs[k])
+        {
+            cols[p] = cols[p - 1];
+            vals[p] = vals[p - 1];
+            p--;
+        }
+        cols[p] = inputs[k];
+        vals[p] = -coef[k];
+        nnz++;
+    }
+    return nnz;
+}
+
+int assembleCircuitMatrix(const ComponentArray *array, SparseMatrix *A, double *rhs)
+{
+    int n = (int)array->size;
+    A->n = n;
+    A->nnz = 0;
+    A->row_ptr = cadMalloc((n + 1) * sizeof(int));
+    A->col_idx = cadMalloc((3 * (size_t)n + 1) * sizeof(int));
+    A->values = cadMalloc((3 * (size_t)n + 1) * sizeof(double));
+    if (!A->row_ptr || !A->col_idx || !A->values)
+    {
+        freeSparseMatrix(A);
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        A->row_ptr[i] = A->nnz;
+        A->nnz += assembleRow(array, i, A->col_idx + A->nnz, A->values + A->nnz, &rhs[i]);
+    }
+    A->row_ptr[n] = A->nnz;
+    return 0;
+}
+
+void freeSparseMatrix(SparseMatrix *A)
+{
+    cadFree(A->row_ptr);
+    cadFree(A->col_idx);
+    cadFree(A->values);
+    A->row_ptr = A->col_idx = NULL;
+    A->values = NULL;
+    A->n = A->nnz = 0;
+}
+
+/* Column-oriented copy of a CSR matrix. */
+static int transposeToCsc(const SparseMatrix *A, int **cp, int **ci, double **cx)
+{
+    int n = A->n;
+    int *colp = cadCalloc(n + 1, sizeof(int));
+    int *rowi = cadMalloc((A->nnz + 1) * sizeof(int));
+    double *val = cadMalloc((A->nnz + 1) * sizeof(double));
+    int *next = cadMalloc((n + 1) * sizeof(int));
+    if (!colp || !rowi || !val || !next)
+    {
+        cadFree(colp);
+        cadFree(rowi);
+        cadFree(val);
+        cadFree(next);
+        return -1;
+    }
+
+    for (int p = 0; p < A->nnz; p++)
+        colp[A->col_idx[p] + 1]++;
+    for (int j = 0; j < n; j++)
+        colp[j + 1] += colp[j];
+    memcpy(next, colp, n * sizeof(int));
+    for (int i = 0; i < n; i++)
+    {
+        for (int p = A->row_ptr[i]; p < A->row_ptr[i + 1]; p++)
+        {
+            int q = next[A->col_idx[p]]++;
+            rowi[q] = i;
+            val[q] = A->values[p];
+        }
+    }
+    cadFree(next);
+    *cp = colp;
+    *ci = rowi;
+    *cx = val;
+    return 0;
+}
+
+/* Depth-first search over the columns of L, producing the nodes reachable
+   from j in topological order at xi[top..n-1]. */
+static int reachDfs(int j, const int *lp, const int *li, const int *pinv,
+                    int top, int *xi, int *pstack, int *mark, int stamp)
+{
+    int head = 0;
+    xi[0] = j;
+    while (head >= 0)
+    {
+        j = xi[head];
+        int jnew = pinv[j];
+        if (mark[j] != stamp)
+        {
+            mark[j] = stamp;
+            pstack[head] = jnew < 0 ? 0 : lp[jnew];
+        }
+        bool done = true;
+        int end = jnew < 0 ? 0 : lp[jnew + 1];
+        for (int p = pstack[head]; p < end; p++)
+        {
+            int i = li[p];
+            if (mark[i] == stamp)
+                continue;
+            pstack[head] = p;
+            xi[++head] = i;
+            done = false;
+            break;
+        }
+        if (done)
+        {
+            head--;
+            xi[--top] = j;
+        }
+    }
+    return top;
+}
+
+static bool growFactor(int **idx, double **val, int *cap, int needed)
+{
+    if (needed <= *cap)
+        return true;
+    int new_cap = *cap * 2 > needed ? *cap * 2 : needed;
+    int *new_idx = cadRealloc(*idx, new_cap * sizeof(int));
+    if (!new_idx)
+        return false;
+    *idx = new_idx;
+    double *new_val = cadRealloc(*val, new_cap * sizeof(double));
+    if (!new_val)
+        return false;
+    *val = new_val;
+    *cap = new_cap;
+    return true;
+}
+
+/* Left-looking (Gilbert-Peierls) LU with threshold partial pivoting that
+   prefers the diagonal, so work stays proportional to the flop count. The
+   diagonal is kept while it is at least tolerance times the largest
+   candidate. Columns are taken in the order q when given. Only the first
+   pivots steps choose a pivot, from rows below pivots; later columns keep
+   what is left in the other rows as their L column (see
+   sparseLUFactorPartial). */
+static int factorColumns(const SparseMatrix *A, SparseLU *lu, double tolerance, const int *q, int pivots)
+{
+    int n = A->n;
+    int *ap, *ai;
+    double *ax;
+    memset(lu, 0, sizeof(*lu));
+    if (transposeToCsc(A, &ap, &ai, &ax) != 0)
+        return -1;
+
+    int lcap = 2 * A->nnz + n + 1, ucap = 2 * A->nnz + n + 1;
+    int lnz = 0, unz = 0;
+    lu->n = n;
+    lu->pinv = cadMalloc((n + 1) * sizeof(int));
+    lu->lp = cadMalloc((n + 1) * sizeof(int));
+    lu->up = cadMalloc((n + 1) * sizeof(int));
+    lu->li = cadMalloc(lcap * sizeof(int));
+    lu->lx = cadMalloc(lcap * sizeof(double));
+    lu->ui = cadMalloc(ucap * sizeof(int));
+    lu->ux = cadMalloc(ucap * sizeof(double));
+    int *xi = cadMalloc((2 * (size_t)n + 1) * sizeof(int));
+    int *mark = cadCalloc(n + 1, sizeof(int));
+    double *x = cadCalloc(n + 1, sizeof(double));
+    int status = -1;
+
+    if (!lu->pinv || !lu->lp || !lu->up || !lu->li || !lu->lx || !lu->ui || !lu->ux || !xi || !mark || !x)
+        goto done;
+    if (q)
+    {
+        if (!(lu->q = cadMalloc((n + 1) * sizeof(int))))
+            goto done;
+        memcpy(lu->q, q, n * sizeof(int));
+    }
+
+    for (int i = 0; i < n; i++)
+        lu->pinv[i] = -1;
+
+    for (int k = 0; k < n; k++)
+    {
+        lu->lp[k] = lnz;
+        lu->up[k] = unz;
+        if (!growFactor(&lu->li, &lu->lx, &lcap, lnz + n + 1) ||
+            !growFactor(&lu->ui, &lu->ux, &ucap, unz + n + 1))
+            goto done;
+
+        /* x = L \ A(:,col) restricted to the reach of A(:,col). */
+        int col = q ? q[k] : k;
+        int top = n;
+        for (int p = ap[col]; p < ap[col + 1]; p++)
+            if (mark[ai[p]] != k + 1)
+                top = reachDfs(ai[p], lu->lp, lu->li, lu->pinv, top, xi, xi + n, mark, k + 1);
+        for (int p = top; p < n; p++)
+            x[xi[p]] = 0.0;
+        for (int p = ap[col]; p < ap[col + 1]; p++)
+            x[ai[p]] = ax[p];
+        for (int px = top; px < n; px++)
+        {
+            int j = xi[px];
+            int J = lu->pinv[j];
+            if (J < 0)
+                continue;
+            for (int p = lu->lp[J] + 1; p < lu->lp[J + 1]; p++)
+                x[lu->li[p]] -= lu->lx[p] * x[j];
+        }
+
+        int ipiv = -1;
+        double best = -1.0;
+        for (int p = top; p < n; p++)
+        {
+            int i = xi[p];
+            if (lu->pinv[i] < 0)
+            {
+                if (i >= pivots)
+                    continue;
+                double t = fabs(x[i]);
+                if (t > best)
+                {
+                    best = t;
+                    ipiv = i;
+                }
+            }
+            else
+            {
+                lu->ui[unz] = lu->pinv[i];
+                lu->ux[unz++] = x[i];
+            }
+        }
+        if (k >= pivots)
+        {
+            for (int p = top; p < n; p++)
+            {
+                int i = xi[p];
+                if (lu->pinv[i] < 0)
+                {
+                    lu->li[lnz] = i;
+                    lu->lx[lnz++] = x[i];
+                }
+                x[i] = 0.0;
+            }
+            continue;
+        }
+        if (ipiv < 0 || best <= 0.0)
+            goto done;
+        if (lu->pinv[col] < 0 && mark[col] == k + 1 && fabs(x[col]) >= best * tolerance)
+            ipiv = col;
+
+        double pivot = x[ipiv];
+        lu->ui[unz] = k;
+        lu->ux[unz++] = pivot;
+        lu->pinv[ipiv] = k;
+        lu->li[lnz] = ipiv;
+        lu->lx[lnz++] = 1.0;
+        for (int p = top; p < n; p++)
+        {
+            int i = xi[p];
+            if (lu->pinv[i] < 0)
+            {
+                lu->li[lnz] = i;
+                lu->lx[lnz++] = x[i] / pivot;
+            }
+            x[i] = 0.0;
+        }
+    }
+    lu->lp[n] = lnz;
+    lu->up[n] = unz;
+    for (int i = 0, next = pivots; i < n && pivots < n; i++)
+        if (lu->pinv[i] < 0)
+            lu->pinv[i] = next++;
+    for (int p = 0; p < lnz; p++)
+        lu->li[p] = lu->pinv[lu->li[p]];
+    status = 0;
+
+done:
+    cadFree(ap);
+    cadFree(ai);
+    cadFree(ax);
+    cadFree(xi);
+    cadFree(mark);
+    cadFree(x);
+    if (status != 0)
+        freeSparseLU(lu);
+    return status;
+}
+
+int sparseLUFactor(const SparseMatrix *A, SparseLU *lu)
+{
+    return factorColumns(A, lu, PIVOT_TOLERANCE, NULL, A->n);
+}
+
+int sparseLUFactorPartial(const SparseMatrix *A, int m, SparseLU *lu)
+{
+    return factorColumns(A, lu, NEWTON_PIVOT_TOLERANCE, NULL, m);
+}
+
+/* Recomputes the values of lu for a matrix with the pattern it was
+   factored from, keeping the pivot order and the L and U patterns. Each
+   U column lists its entries in the order they were eliminated, so a
+   single pass per column is enough. Columns from pivots on are those of
+   a partial factorization, with no pivot of their own. */
+static int refactorCsc(const int *ap, const int *ai, const double *ax, SparseLU *lu, double *work, int pivots)
+{
+    int n = lu->n;
+    int status = 0;
+
+    memset(work, 0, n * sizeof(double));
+
+    for (int k = 0; k < n && status == 0; k++)
+    {
+        int col = lu->q ? lu->q[k] : k;
+        for (int p = ap[col]; p < ap[col + 1]; p++)
+            work[lu->pinv[ai[p]]] = ax[p];
+
+        int diag = k < pivots ? lu->up[k + 1] - 1 : lu->up[k + 1];
+        for (int p = lu->up[k]; p < diag; p++)
+        {
+            int j = lu->ui[p];
+            double u = work[j];
+            lu->ux[p] = u;
+            work[j] = 0.0;
+            for (int q = lu->lp[j] + 1; q < lu->lp[j + 1]; q++)
+                work[lu->li[q]] -= lu->lx[q] * u;
+        }
+        if (k >= pivots)
+        {
+            for (int q = lu->lp[k]; q < lu->lp[k + 1]; q++)
+            {
+                lu->lx[q] = work[lu->li[q]];
+                work[lu->li[q]] = 0.0;
+            }
+            continue;
+        }
+
+        double pivot = work[k], largest = fabs(pivot);
+        work[k] = 0.0;
+        for (int q = lu->lp[k] + 1; q < lu->lp[k + 1]; q++)
+            if (fabs(work[lu->li[q]]) > largest)
+                largest = fabs(work[lu->li[q]]);
+        if (pivot == 0.0 || fabs(pivot) < REFACTOR_PIVOT_TOLERANCE * largest)
+            status = -1;
+        lu->ux[diag] = pivot;
+        for (int q = lu->lp[k] + 1; q < lu->lp[k + 1]; q++)
+        {
+            lu->lx[q] = work[lu->li[q]] / pivot;
+            work[lu->li[q]] = 0.0;
+        }
+    }
+    return status;
+}
+
+static int refactorColumns(const SparseMatrix *A, SparseLU *lu, double *work, int pivots)
+{
+    int *ap, *ai;
+    double *ax;
+
+    if (A->n != lu->n || transposeToCsc(A, &ap, &ai, &ax) != 0)
+        return -1;
+    int status = refactorCsc(ap, ai, ax, lu, work, pivots);
+    cadFree(ap);
+    cadFree(ai);
+    cadFree(ax);
+    return status;
+}
+
+/* work must hold n doubles. Returns -1 if a pivot has become too small;
+   factor afresh in that case. */
+int sparseLURefactor(const SparseMatrix *A, SparseLU *lu, double *work)
+{
+    return refactorColumns(A, lu, work, lu->n);
+}
+
+int sparseLURefactorPartial(const SparseMatrix *A, int m, SparseLU *lu, double *work)
+{
+    return refactorColumns(A, lu, work, m);
+}
+
+int sparseLURefactorCsc(const int *ap, const int *ai, const double *ax, SparseLU *lu, double *work)
+{
+    return refactorCsc(ap, ai, ax, lu, work, lu->n);
+}
+
+/* Solves A*x = b in place; work must hold n doubles. */
+void sparseLUSolve(const SparseLU *lu, double *b, double *work)
+{
+    int n = lu->n;
+    for (int i = 0; i < n; i++)
+        work[lu->pinv[i]] = b[i];
+    for (int j = 0; j < n; j++)
+        for (int p = lu->lp[j] + 1; p < lu->lp[j + 1]; p++)
+            work[lu->li[p]] -= lu->lx[p] * work[j];
+    for (int j = n - 1; j >= 0; j--)
+    {
+        work[j] /= lu->ux[lu->up[j + 1] - 1];
+        for (int p = lu->up[j]; p < lu->up[j + 1] - 1; p++)
+            work[lu->ui[p]] -= lu->ux[p] * work[j];
+    }
+    if (lu->q)
+        for (int k = 0; k < n; k++)
+            b[lu->q[k]] = work[k];
+    else
+        memcpy(b, work, n * sizeof(double));
+}
+
+void sparseLUForwardPartial(const SparseLU *lu, int m, double *b, double *work)
+{
+    int n = lu->n;
+    for (int i = 0; i < n; i++)
+        work[lu->pinv[i]] = b[i];
+    for (int j = 0; j < m; j++)
+        for (int p = lu->lp[j] + 1; p < lu->lp[j + 1]; p++)
+            work[lu->li[p]] -= lu->lx[p] * work[j];
+    memcpy(b, work, n * sizeof(double));
+}
+
+void sparseLUBackPartial(const SparseLU *lu, int m, double *b)
+{
+    for (int j = lu->n - 1; j >= m; j--)
+        for (int p = lu->up[j]; p < lu->up[j + 1]; p++)
+            b[lu->ui[p]] -= lu->ux[p] * b[j];
+    for (int j = m - 1; j >= 0; j--)
+    {
+        b[j] /= lu->ux[lu->up[j + 1] - 1];
+        for (int p = lu->up[j]; p < lu->up[j + 1] - 1; p++)
+            b[lu->ui[p]] -= lu->ux[p] * b[j];
+    }
+}
+
+void freeSparseLU(SparseLU *lu)
+{
+    cadFree(lu->q);
+    cadFree(lu->pinv);
+    cadFree(lu->lp);
+    cadFree(lu->li);
+    cadFree(lu->lx);
+    cadFree(lu->up);
+    cadFree(lu->ui);
+    cadFree(lu->ux);
+    memset(lu, 0, sizeof(*lu));
+}
+
+void freeSymbolicLU(SymbolicLU *symbolic)
+{
+    free(symbolic->q);
+    free(symbolic->pinv);
+    free(symbolic->lp);
+    free(symbolic->li);
+    free(symbolic->up);
+    free(symbolic->ui);
+    memset(symbolic, 0, sizeof(*symbolic));
+}
+
+/* Replaces symbolic by the order and patterns of lu. */
+static bool keepSymbolic(const SparseLU *lu, SymbolicLU *symbolic)
+{
+    int n = lu->n, lnz = lu->lp[n], unz = lu->up[n];
+    SymbolicLU kept = {0};
+    kept.n = n;
+    kept.q = malloc((n + 1) * sizeof(int));
+    kept.pinv = malloc((n + 1) * sizeof(int));
+    kept.lp = malloc((n + 1) * sizeof(int));
+    kept.li = malloc((lnz + 1) * sizeof(int));
+    kept.up = malloc((n + 1) * sizeof(int));
+    kept.ui = malloc((unz + 1) * sizeof(int));
+    if (!kept.q || !kept.pinv || !kept.lp || !kept.li || !kept.up || !kept.ui)
+    {
+        freeSymbolicLU(&kept);
+        return false;
+    }
+    for (int k = 0; k < n; k++)
+        kept.q[k] = lu->q ? lu->q[k] : k;
+    memcpy(kept.pinv, lu->pinv, n * sizeof(int));
+    memcpy(kept.lp, lu->lp, (n + 1) * sizeof(int));
+    memcpy(kept.li, lu->li, lnz * sizeof(int));
+    memcpy(kept.up, lu->up, (n + 1) * sizeof(int));
+    memcpy(kept.ui, lu->ui, unz * sizeof(int));
+    freeSymbolicLU(symbolic);
+    *symbolic = kept;
+    return true;
+}
+
+/* Lays out lu with the order and patterns of symbolic, ready for
+   sparseLURefactor to fill in the values. */
+static int luFromSymbolic(const SymbolicLU *symbolic, SparseLU *lu)
+{
+    int n = symbolic->n, lnz = symbolic->lp[n], unz = symbolic->up[n];
+    memset(lu, 0, sizeof(*lu));
+    lu->n = n;
+    lu->q = cadMalloc((n + 1) * sizeof(int));
+    lu->pinv = cadMalloc((n + 1) * sizeof(int));
+    lu->lp = cadMalloc((n + 1) * sizeof(int));
+    lu->li = cadMalloc((lnz + 1) * sizeof(int));
+    lu->lx = cadMalloc((lnz + 1) * sizeof(double));
+    lu->up = cadMalloc((n + 1) * sizeof(int));
+    lu->ui = cadMalloc((unz + 1) * sizeof(int));
+    lu->ux = cadMalloc((unz + 1) * sizeof(double));
+    if (!lu->q || !lu->pinv || !lu->lp || !lu->li || !lu->lx || !lu->up || !lu->ui || !lu->ux)
+    {
+        freeSparseLU(lu);
+        return -1;
+    }
+    memcpy(lu->q, symbolic->q, n * sizeof(int));
+    memcpy(lu->pinv, symbolic->pinv, n * sizeof(int));
+    memcpy(lu->lp, symbolic->lp, (n + 1) * sizeof(int));
+    memcpy(lu->li, symbolic->li, lnz * sizeof(int));
+    memcpy(lu->up, symbolic->up, (n + 1) * sizeof(int));
+    memcpy(lu->ui, symbolic->ui, unz * sizeof(int));
+    return 0;
+}
+
+/* Copies the solved value of component i back into its fields. Returns
+   true if a transistor moved between cutoff and active. */
+bool storeComponentSolution(ComponentArray *array, size_t i, const double *x)
+{
+    Component *c = &array->data[i];
+    int inputs[2];
+    componentInputs(array, i, inputs);
+
+    switch (c->type)
+    {
+    case POWERSUPPLY:
+        break;
+    case RESISTOR:
+        c->data.resistor.input = inputs[0] < 0 ? UNCONNECTED_INPUT : x[inputs[0]];
+        c->data.resistor.output = x[i];
+        break;
+    case TRANSISTOR:
+    {
+        Transistor *t = &c->data.transistor;
+        bool was_active = transistorActive(t);
+        t->input = inputs[0] < 0 ? 0.0 : x[inputs[0]];
+        t->base = inputs[1] < 0 ? 0.0 : x[inputs[1]];
+        t->output = x[i];
+        return transistorActive(t) != was_active;
+    }
+    case INSTANCE:
+        break;
+    }
+    return false;
+}
+
+static bool storeSolution(ComponentArray *array, const double *x)
+{
+    bool region_changed = false;
+    for (size_t i = 0; i < array->size; i++)
+        if (storeComponentSolution(array, i, x))
+            region_changed = true;
+    return region_changed;
+}
+
+/* Largest distance between a component's value in x and what its model
+   gives for its inputs in x, relative to the model value with an absolute
+   floor of 1. Every transistor is in the region its base value selects. */
+static double residualNorm(const ComponentArray *array, const double *x)
+{
+    double worst = 0.0;
+    for (size_t i = 0; i < array->size; i++)
+    {
+        const Component *c = &array->data[i];
+        int inputs[2];
+        double model = 0.0;
+        componentInputs(array, i, inputs);
+
+        switch (c->type)
+        {
+        case POWERSUPPLY:
+            model = c->data.powersupply.voltage;
+            break;
+        case RESISTOR:
+            model = resistor_calc(c->data.resistor.resistance, inputs[0] < 0 ? UNCONNECTED_INPUT : x[inputs[0]],
+                                  c->data.resistor.otype);
+            break;
+        case TRANSISTOR:
+        {
+            const Transistor *t = &c->data.transistor;
+            model = transistor_calc(inputs[0] < 0 ? 0.0 : x[inputs[0]], inputs[1] < 0 ? 0.0 : x[inputs[1]],
+                                    !t->type, t->input_type, t->beta);
+            break;
+        }
+        case INSTANCE:
+            break;
+        }
+        double r = fabs(x[i] - model) / (1.0 + fabs(model));
+        if (!(r <= worst))
+            worst = r;
+    }
+    return worst;
+}
+
+/* A circuit whose components only read lower ids factors without fill in
+   its own order. Columns are sorted, so the last one of a row is enough. */
+static bool lowerTriangular(const SparseMatrix *A)
+{
+    for (int i = 0; i < A->n; i++)
+        if (A->row_ptr[i + 1] > A->row_ptr[i] && A->col_idx[A->row_ptr[i + 1] - 1] > i)
+            return false;
+    return true;
+}
+
+/* Refills the values of a matrix assembled from the same circuit; the
+   pattern does not depend on the transistor regions. */
+static void reassembleCircuitMatrix(const ComponentArray *array, SparseMatrix *A, double *rhs)
+{
+    for (int i = 0; i < A->n; i++)
+        assembleRow(array, i, A->col_idx + A->row_ptr[i], A->values + A->row_ptr[i], &rhs[i]);
+}
+
+/* Damped Newton iteration on x = model(x), starting from the stored
+   outputs. The transistor model is piecewise linear, so each Newton step
+   solves the circuit with the transistors held in the regions their
+   current base values select. The matrix keeps its pattern throughout,
+   so linear can reuse its analysis from one step to the next. Returns 0
+   once converged, 1 if the iteration limit was hit (the last iterate is
+   stored), -1 on failure. */
+int solveCircuitWith(ComponentArray *array, const NewtonOptions *options, const LinearSolver *linear,
+                     SolveStats *stats)
+{
+    PROFILE_BEGIN(PROFILE_SOLVE);
+    const NewtonOptions *opts = options ? options : &default_newton;
+    SolveStats local = {0};
+    SparseMatrix A = {0};
+    int n = (int)array->size;
+    int status = -1;
+    double *x = cadMalloc((n + 1) * sizeof(double));
+    double *b = cadMalloc((n + 1) * sizeof(double));
+    double *target = cadMalloc((n + 1) * sizeof(double));
+
+    if (!stats)
+        stats = &local;
+    memset(stats, 0, sizeof(*stats));
+    stats->n = n;
+    if (!x || !b || !target)
+        goto done;
+
+    for (int i = 0; i < n; i++)
+        x[i] = componentOutput(&array->data[i]);
+    storeSolution(array, x);
+    double residual = residualNorm(array, x);
+
+    for (int iteration = 0; iteration < opts->max_iterations; iteration++)
+    {
+        double t0 = monotonicSeconds();
+        if (!A.row_ptr)
+        {
+            if (assembleCircuitMatrix(array, &A, b) != 0)
+                goto done;
+        }
+        else
+            reassembleCircuitMatrix(array, &A, b);
+
+        double t1 = monotonicSeconds();
+        int lu_nnz = linear->factor(linear->context, &A, stats);
+        if (lu_nnz < 0)
+            goto done;
+        stats->lu_nnz = lu_nnz;
+
+        double t2 = monotonicSeconds();
+        memcpy(target, b, n * sizeof(double));
+        linear->solve(linear->context, target);
+
+        /* b is free until the next assembly and holds the damped update. */
+        double lambda = 1.0, next_residual;
+        for (int damping = 0;; damping++)
+        {
+            for (int i = 0; i < n; i++)
+                b[i] = x[i] + lambda * (target[i] - x[i]);
+            next_residual = residualNorm(array, b);
+            if (next_residual < residual || damping >= opts->max_damping_steps)
+                break;
+            lambda *= 0.5;
+        }
+
+        double *swap = x;
+        x = b;
+        b = swap;
+        residual = next_residual;
+        storeSolution(array, x);
+        double t3 = monotonicSeconds();
+
+        stats->iterations = iteration + 1;
+        stats->assemble_time += t1 - t0;
+        stats->factor_time += t2 - t1;
+        stats->solve_time += t3 - t2;
+        if (residual <= opts->tolerance)
+        {
+            stats->converged = true;
+            break;
+        }
+    }
+
+    stats->nnz = A.nnz;
+    stats->residual = residual;
+    status = stats->converged ? 0 : 1;
+    if (!stats->converged)
+        fprintf(stderr, "Solve did not converge in %d iterations (residual %g).\n", stats->iterations, residual);
+
+done:
+    freeSparseMatrix(&A);
+    cadFree(x);
+    cadFree(b);
+    cadFree(target);
+    PROFILE_END(PROFILE_SOLVE);
+    return status;
+}
+
+/* One LU of the whole matrix. */
+typedef struct
+{
+    const ComponentArray *array;
+    SymbolicLU *symbolic;
+    SparseLU lu;
+    int *order;
+    double *work;
+} DirectSolver;
+
+/* The first factorization pivots over a fill-reducing column order,
+   unless a symbolic analysis is at hand; later ones only refactor
+   numerically over the same pivot order and patterns. */
+static int directFactor(void *context, const SparseMatrix *A, SolveStats *stats)
+{
+    DirectSolver *d = context;
+    int n = A->n;
+    SymbolicLU *symbolic = d->symbolic;
+
+    if (d->lu.n == n && d->lu.pinv && sparseLURefactor(A, &d->lu, d->work) == 0)
+        stats->refactorizations++;
+    else if (!d->lu.pinv && symbolic && symbolic->n == n && luFromSymbolic(symbolic, &d->lu) == 0 &&
+             sparseLURefactor(A, &d->lu, d->work) == 0)
+    {
+        stats->refactorizations++;
+        stats->symbolic_reused = true;
+    }
+    else
+    {
+        freeSparseLU(&d->lu);
+        if (!d->order && (!symbolic || symbolic->n != n) && !lowerTriangular(A) &&
+            (d->order = cadMalloc((n + 1) * sizeof(int))) && orderCircuitMatrix(d->array, d->order) != 0)
+        {
+            cadFree(d->order);
+            d->order = NULL;
+        }
+        const int *q = symbolic && symbolic->n == n ? symbolic->q : d->order;
+        if (factorColumns(A, &d->lu, NEWTON_PIVOT_TOLERANCE, q, n) != 0)
+        {
+            fprintf(stderr, "Circuit matrix is singular.\n");
+            return -1;
+        }
+        stats->factorizations++;
+        if (symbolic)
+            keepSymbolic(&d->lu, symbolic);
+    }
+    return d->lu.lp[n] + d->lu.up[n];
+}
+
+static void directSolve(void *context, double *b)
+{
+    DirectSolver *d = context;
+    sparseLUSolve(&d->lu, b, d->work);
+}
+
+int solveCircuitSymbolic(ComponentArray *array, const NewtonOptions *options, SymbolicLU *symbolic,
+                         SolveStats *stats)
+{
+    DirectSolver d = {0};
+    LinearSolver linear = {&d, directFactor, directSolve};
+    int status = -1;
+
+    d.array = array;
+    d.symbolic = symbolic;
+    d.work = cadMalloc((array->size + 1) * sizeof(double));
+    if (d.work)
+        status = solveCircuitWith(array, options, &linear, stats);
+    freeSparseLU(&d.lu);
+    cadFree(d.order);
+    cadFree(d.work);
+    return status;
+}
+
+int solveCircuitNewton(ComponentArray *array, const NewtonOptions *options, SolveStats *stats)
+{
+    return solveCircuitSymbolic(array, options, NULL, stats);
+}
+
+int solveCircuit(ComponentArray *array, SolveStats *stats)
+{
+    return solveCircuitNewton(array, NULL, stats);
+}
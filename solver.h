@@ -0,0 +1,124 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include "circuit.h"
+#include "netgraph.h"
+
+/* Compressed sparse row matrix, one row per component. */
+typedef struct
+{
+    int n;
+    int nnz;
+    int *row_ptr;
+    int *col_idx;
+    double *values;
+} SparseMatrix;
+
+/* P*A*Q = L*U with L unit lower triangular (diagonal stored first in each
+   column) and U upper triangular (diagonal stored last), both CSC. Step k
+   eliminates column q[k]; a NULL q is the natural order. */
+typedef struct
+{
+    int n;
+    int *q;
+    int *pinv;
+    int *lp;
+    int *li;
+    double *lx;
+    int *up;
+    int *ui;
+    double *ux;
+} SparseLU;
+
+typedef struct
+{
+    int n;
+    int nnz;
+    int lu_nnz;
+    int iterations;
+    int factorizations;
+    int refactorizations;
+    double residual;
+    bool converged;
+    double assemble_time;
+    double factor_time;
+    double solve_time;
+    bool symbolic_reused;
+    int domains;
+} SolveStats;
+
+/* The value-independent half of a factorization: the column order and the
+   pivot rows and L and U patterns the first factorization chose. Any
+   circuit with the same pin links can start from it with a numeric
+   refactorization. Allocated with malloc; n is 0 while empty. */
+typedef struct
+{
+    int n;
+    int *q;
+    int *pinv;
+    int *lp;
+    int *li;
+    int *up;
+    int *ui;
+} SymbolicLU;
+
+/* Limits for the damped Newton iteration in solveCircuitNewton. The
+   solve has converged once every component is within tolerance (relative,
+   with an absolute floor of tolerance) of what its model gives for its
+   inputs. Each update is halved up to max_damping_steps times until the
+   residual drops; 0 takes full Newton steps. */
+typedef struct
+{
+    int max_iterations;
+    double tolerance;
+    int max_damping_steps;
+} NewtonOptions;
+
+int assembleRow(const ComponentArray *array, int i, int cols[3], double vals[3], double *rhs);
+int assembleCircuitMatrix(const ComponentArray *array, SparseMatrix *A, double *rhs);
+void freeSparseMatrix(SparseMatrix *A);
+
+int sparseLUFactor(const SparseMatrix *A, SparseLU *lu);
+/* Eliminates only the first m columns, with pivots from the first m rows,
+   for A = [A11 A12; A21 A22]. The trailing columns of L then hold the
+   Schur complement A22 - A21 A11^-1 A12 in rows m and up, and those of U
+   hold U12, with no diagonal. */
+int sparseLUFactorPartial(const SparseMatrix *A, int m, SparseLU *lu);
+/* Replaces b by [L11^-1 P b1, b2 - L21 L11^-1 P b1]; work holds n doubles. */
+void sparseLUForwardPartial(const SparseLU *lu, int m, double *b, double *work);
+/* Given the first m entries of sparseLUForwardPartial and x2 in the rest,
+   solves for x1 in place. */
+void sparseLUBackPartial(const SparseLU *lu, int m, double *b);
+int sparseLURefactor(const SparseMatrix *A, SparseLU *lu, double *work);
+/* sparseLURefactor for a factorization from sparseLUFactorPartial. */
+int sparseLURefactorPartial(const SparseMatrix *A, int m, SparseLU *lu, double *work);
+/* sparseLURefactor for a matrix already stored by columns, column j in
+   rows ai[ap[j] .. ap[j + 1]) with values ax; it allocates nothing. */
+int sparseLURefactorCsc(const int *ap, const int *ai, const double *ax, SparseLU *lu, double *work);
+void sparseLUSolve(const SparseLU *lu, double *b, double *work);
+void freeSparseLU(SparseLU *lu);
+
+bool storeComponentSolution(ComponentArray *array, size_t i, const double *x);
+/* The linear algebra of a Newton solve. factor is called with each
+   reassembled matrix, whose pattern never changes, and returns the
+   entries in its factors or -1 once it has reported a failure; solve
+   then overwrites right-hand sides with the solution. */
+typedef struct
+{
+    void *context;
+    int (*factor)(void *context, const SparseMatrix *A, SolveStats *stats);
+    void (*solve)(void *context, double *b);
+} LinearSolver;
+
+int solveCircuitWith(ComponentArray *array, const NewtonOptions *options, const LinearSolver *linear,
+                     SolveStats *stats);
+int solveCircuitNewton(ComponentArray *array, const NewtonOptions *options, SolveStats *stats);
+/* solveCircuitNewton starting from symbolic when it fits the circuit.
+   Whenever the solve has to factor afresh, symbolic is replaced by the
+   new analysis. */
+int solveCircuitSymbolic(ComponentArray *array, const NewtonOptions *options, SymbolicLU *symbolic,
+                         SolveStats *stats);
+void freeSymbolicLU(SymbolicLU *symbolic);
+int solveCircuit(ComponentArray *array, SolveStats *stats);
+
+#endif
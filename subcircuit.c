@@ -0,0 +1,599 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "subcircuit.h"
+#include "arena.h"
+#include "columns.h"
+#include "netgraph.h"
+
+/* Grows a pool so that it holds at least needed items; exits on failure
+   like addComponent. */
+static void *growPool(void *data, size_t *capacity, size_t needed, size_t item)
+{
+    if (needed <= *capacity)
+        return data;
+    size_t new_capacity = *capacity ? *capacity : 4;
+    while (new_capacity < needed)
+        new_capacity *= 2;
+    void *new_data = cadRealloc(data, new_capacity * item);
+    if (!new_data)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+    *capacity = new_capacity;
+    return new_data;
+}
+
+static Hierarchy *hierarchyOf(ComponentArray *arr)
+{
+    if (!arr->hierarchy)
+    {
+        arr->hierarchy = cadCalloc(1, sizeof(Hierarchy));
+        if (!arr->hierarchy)
+        {
+            perror("Failed to allocate memory");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return arr->hierarchy;
+}
+
+int findSubcircuit(const ComponentArray *arr, const char *name, size_t name_length)
+{
+    const Hierarchy *h = arr->hierarchy;
+    if (!h)
+        return -1;
+    for (size_t k = 0; k < h->count; k++)
+        if (strlen(h->subcircuits[k].name) == name_length && memcmp(h->subcircuits[k].name, name, name_length) == 0)
+            return (int)k;
+    return -1;
+}
+
+int addSubcircuit(ComponentArray *arr, const char *name, size_t name_length, int ports, int output,
+                  ComponentArray *body)
+{
+    if (findSubcircuit(arr, name, name_length) >= 0 || output < 0 || (size_t)output >= body->size || ports < 0)
+        return -1;
+
+    Hierarchy *h = hierarchyOf(arr);
+    h->subcircuits = growPool(h->subcircuits, &h->capacity, h->count + 1, sizeof(Subcircuit));
+    Subcircuit *def = &h->subcircuits[h->count];
+    def->name = cadMalloc(name_length + 1);
+    if (!def->name)
+    {
+        perror("Failed to allocate memory");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(def->name, name, name_length);
+    def->name[name_length] = '\0';
+    def->ports = ports;
+    def->output = output;
+    def->body = *body;
+    memset(body, 0, sizeof(*body));
+    return (int)h->count++;
+}
+
+void addInstance(ComponentArray *arr, int subcircuit, const int *ports, const ParameterOverride *overrides,
+                 int override_count)
+{
+    Hierarchy *h = hierarchyOf(arr);
+    int port_count = h->subcircuits[subcircuit].ports;
+    Component c = {0};
+
+    c.type = INSTANCE;
+    c.data.instance.id = (int)arr->size;
+    c.data.instance.subcircuit = subcircuit;
+    c.data.instance.port_start = (int)h->port_count;
+    c.data.instance.override_start = (int)h->override_count;
+    c.data.instance.override_count = override_count;
+
+    h->ports = growPool(h->ports, &h->port_capacity, h->port_count + port_count, sizeof(int));
+    h->overrides = growPool(h->overrides, &h->override_capacity, h->override_count + override_count,
+                            sizeof(ParameterOverride));
+    if (port_count)
+        memcpy(h->ports + h->port_count, ports, port_count * sizeof(int));
+    if (override_count)
+        memcpy(h->overrides + h->override_count, overrides, override_count * sizeof(ParameterOverride));
+    h->port_count += port_count;
+    h->override_count += override_count;
+    h->instances++;
+    addComponent(arr, c);
+}
+
+bool isHierarchical(const ComponentArray *arr)
+{
+    return arr->hierarchy && arr->hierarchy->instances > 0;
+}
+
+const Subcircuit *instanceSubcircuit(const ComponentArray *arr, const Instance *instance)
+{
+    return &arr->hierarchy->subcircuits[instance->subcircuit];
+}
+
+void freeHierarchy(Hierarchy *h)
+{
+    if (!h)
+        return;
+    for (size_t k = 0; k < h->count; k++)
+    {
+        cadFree(h->subcircuits[k].name);
+        freeComponentArray(&h->subcircuits[k].body);
+    }
+    cadFree(h->subcircuits);
+    cadFree(h->ports);
+    cadFree(h->overrides);
+    cadFree(h);
+}
+
+/* Body pin to placed id: local components go through local, ports on
+   input pins through the port bindings. Loads on ports and dangling pins
+   become unconnected. */
+static int placePin(int pin, bool input, const int *local, size_t local_count, const int *ports, int port_count)
+{
+    if (pin >= 0 && (size_t)pin < local_count)
+        return local[pin];
+    if (input && pin <= -2 && PIN_PORT(pin) < port_count)
+        return ports[PIN_PORT(pin)];
+    return -1;
+}
+
+static Component placeComponent(const Component *c, int id, const int *local, size_t local_count, const int *ports,
+                                int port_count)
+{
+    Component placed = *c;
+
+    switch (c->type)
+    {
+    case POWERSUPPLY:
+        placed.data.powersupply.id = id;
+        placed.data.powersupply.pin1 = placePin(c->data.powersupply.pin1, false, local, local_count, ports, port_count);
+        break;
+    case RESISTOR:
+        placed.data.resistor.id = id;
+        placed.data.resistor.pin1 = placePin(c->data.resistor.pin1, true, local, local_count, ports, port_count);
+        placed.data.resistor.pin2 = placePin(c->data.resistor.pin2, false, local, local_count, ports, port_count);
+        break;
+    case TRANSISTOR:
+        placed.data.transistor.id = id;
+        placed.data.transistor.pin1 = placePin(c->data.transistor.pin1, true, local, local_count, ports, port_count);
+        placed.data.transistor.pin2 = placePin(c->data.transistor.pin2, true, local, local_count, ports, port_count);
+        placed.data.transistor.pin3 = placePin(c->data.transistor.pin3, false, local, local_count, ports, port_count);
+        break;
+    case INSTANCE:
+        break;
+    }
+    return placed;
+}
+
+static void applyOverride(Component *c, double value)
+{
+    switch (c->type)
+    {
+    case POWERSUPPLY:
+        c->data.powersupply.voltage = value;
+        break;
+    case RESISTOR:
+        c->data.resistor.resistance = value;
+        break;
+    case TRANSISTOR:
+        c->data.transistor.beta = value;
+        break;
+    case INSTANCE:
+        break;
+    }
+}
+
+bool flattenCircuit(const ComponentArray *design, ComponentArray *flat)
+{
+    const Hierarchy *h = design->hierarchy;
+    size_t n = design->size, total = n, widest = 0;
+
+    memset(flat, 0, sizeof(*flat));
+    for (size_t i = 0; i < n; i++)
+    {
+        if (design->data[i].type != INSTANCE)
+            continue;
+        const Subcircuit *def = instanceSubcircuit(design, &design->data[i].data.instance);
+        total += def->body.size - 1;
+        if (def->body.size > widest)
+            widest = def->body.size;
+    }
+
+    flat->data = cadMalloc((total + 1) * sizeof(Component));
+    int *local = cadMalloc((widest + 1) * sizeof(int));
+    if (!flat->data || !local)
+    {
+        perror("Failed to allocate memory");
+        cadFree(flat->data);
+        cadFree(local);
+        flat->data = NULL;
+        return false;
+    }
+    flat->capacity = total + 1;
+    flat->size = n;
+    for (size_t i = 0; i < n; i++)
+        if (design->data[i].type != INSTANCE)
+            flat->data[i] = design->data[i];
+    for (size_t k = 0; k < design->waveform_count; k++)
+        addWaveform(flat, design->waveforms[k]);
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (design->data[i].type != INSTANCE)
+            continue;
+        const Instance *inst = &design->data[i].data.instance;
+        const Subcircuit *def = instanceSubcircuit(design, inst);
+        const ComponentArray *body = &def->body;
+        const int *ports = h->ports + inst->port_start;
+        int base = (int)flat->size;
+
+        for (int j = 0; (size_t)j < body->size; j++)
+            local[j] = j == def->output ? (int)i : base + (j < def->output ? j : j - 1);
+        for (size_t j = 0; j < body->size; j++)
+            flat->data[local[j]] = placeComponent(&body->data[j], local[j], local, body->size, ports, def->ports);
+        for (int k = 0; k < inst->override_count; k++)
+        {
+            const ParameterOverride *o = &h->overrides[inst->override_start + k];
+            applyOverride(&flat->data[local[o->component]], o->value);
+        }
+        for (size_t k = 0; k < body->waveform_count; k++)
+        {
+            Waveform w = body->waveforms[k];
+            if (w.component < 0 || (size_t)w.component >= body->size)
+                continue;
+            w.component = local[w.component];
+            addWaveform(flat, w);
+        }
+        flat->size += body->size - 1;
+    }
+    cadFree(local);
+    return true;
+}
+
+bool flattenInPlace(ComponentArray *array)
+{
+    ComponentArray flat;
+
+    if (!isHierarchical(array))
+        return true;
+    if (!flattenCircuit(array, &flat))
+        return false;
+    freeComponentArray(array);
+    *array = flat;
+    return true;
+}
+
+void storeFlatResults(const ComponentArray *flat, ComponentArray *design)
+{
+    for (size_t i = 0; i < design->size; i++)
+    {
+        if (design->data[i].type == INSTANCE)
+            design->data[i].data.instance.output = componentOutput(&flat->data[i]);
+        else
+            design->data[i] = flat->data[i];
+    }
+}
+
+/* One definition compiled with one parameter set: the body as columns
+   behind a supply per port, so an evaluation only sets the port
+   voltages. key addresses the compiled content, so identical bodies
+   share results whatever their names. */
+typedef struct
+{
+    int subcircuit;
+    int override_start;
+    int override_count;
+    uint64_t hash;
+    MemoKey key;
+    ComponentColumns cols;
+} CompiledBody;
+
+typedef struct
+{
+    const ComponentArray *design;
+    CompiledBody *bodies;
+    size_t body_count;
+    size_t body_capacity;
+    int *body_table;
+    size_t body_table_size;
+    MemoCache *memo;
+    DesignStats *stats;
+} DesignCache;
+
+static uint64_t mixHash(uint64_t h, uint64_t v)
+{
+    h = (h ^ v) * UINT64_C(0xff51afd7ed558ccd);
+    return h ^ (h >> 33);
+}
+
+static uint64_t doubleBits(double v)
+{
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+static bool sameParameters(const Hierarchy *h, const CompiledBody *body, const Instance *inst)
+{
+    if (body->subcircuit != inst->subcircuit || body->override_count != inst->override_count)
+        return false;
+    for (int k = 0; k < inst->override_count; k++)
+    {
+        const ParameterOverride *a = &h->overrides[body->override_start + k];
+        const ParameterOverride *b = &h->overrides[inst->override_start + k];
+        if (a->component != b->component || doubleBits(a->value) != doubleBits(b->value))
+            return false;
+    }
+    return true;
+}
+
+static bool compileBody(const Hierarchy *h, const Instance *inst, CompiledBody *body)
+{
+    const Subcircuit *def = &h->subcircuits[inst->subcircuit];
+    size_t count = def->ports + def->body.size;
+    ComponentArray tiny = {0};
+    int *map = cadMalloc((count + 1) * sizeof(int));
+    bool ok = false;
+
+    tiny.data = cadMalloc((count + 1) * sizeof(Component));
+    if (!map || !tiny.data)
+        goto done;
+    tiny.capacity = count + 1;
+    for (int k = 0; k < def->ports; k++)
+    {
+        Component port = {0};
+        port.type = POWERSUPPLY;
+        port.data.powersupply.id = k;
+        port.data.powersupply.pin1 = -1;
+        tiny.data[tiny.size++] = port;
+        map[k] = k;
+    }
+    int *local = map + def->ports;
+    for (size_t j = 0; j < def->body.size; j++)
+        local[j] = def->ports + (int)j;
+    for (size_t j = 0; j < def->body.size; j++)
+        tiny.data[tiny.size++] = placeComponent(&def->body.data[j], local[j], local, def->body.size, map, def->ports);
+    for (int k = 0; k < inst->override_count; k++)
+    {
+        const ParameterOverride *o = &h->overrides[inst->override_start + k];
+        applyOverride(&tiny.data[local[o->component]], o->value);
+    }
+    memoKeyInit(&body->key, MEMO_DOMAIN_SUBCIRCUIT);
+    memoKeyAddInt(&body->key, def->ports + def->output);
+    memoKeyAddCircuit(&body->key, &tiny);
+    ok = buildColumns(&tiny, &body->cols) == 0;
+
+done:
+    cadFree(map);
+    cadFree(tiny.data);
+    return ok;
+}
+
+/* Index of the compiled body for an instance's definition and parameter
+   set, compiling it on first use; -1 on failure. */
+static int findBody(DesignCache *cache, const Instance *inst)
+{
+    const Hierarchy *h = cache->design->hierarchy;
+    uint64_t hash = mixHash(UINT64_C(0x9e3779b97f4a7c15), (uint64_t)inst->subcircuit);
+    for (int k = 0; k < inst->override_count; k++)
+    {
+        const ParameterOverride *o = &h->overrides[inst->override_start + k];
+        hash = mixHash(mixHash(hash, (uint64_t)o->component), doubleBits(o->value));
+    }
+
+    if ((cache->body_count + 1) * 2 > cache->body_table_size)
+    {
+        size_t size = cache->body_table_size ? cache->body_table_size * 2 : 16;
+        int *table = cadMalloc(size * sizeof(int));
+        if (!table)
+            return -1;
+        for (size_t s = 0; s < size; s++)
+            table[s] = -1;
+        for (size_t b = 0; b < cache->body_count; b++)
+        {
+            size_t s = cache->bodies[b].hash & (size - 1);
+            while (table[s] >= 0)
+                s = (s + 1) & (size - 1);
+            table[s] = (int)b;
+        }
+        cadFree(cache->body_table);
+        cache->body_table = table;
+        cache->body_table_size = size;
+    }
+
+    size_t s = hash & (cache->body_table_size - 1);
+    for (; cache->body_table[s] >= 0; s = (s + 1) & (cache->body_table_size - 1))
+    {
+        const CompiledBody *body = &cache->bodies[cache->body_table[s]];
+        if (body->hash == hash && sameParameters(h, body, inst))
+            return cache->body_table[s];
+    }
+
+    cache->bodies = growPool(cache->bodies, &cache->body_capacity, cache->body_count + 1, sizeof(CompiledBody));
+    CompiledBody *body = &cache->bodies[cache->body_count];
+    if (!compileBody(h, inst, body))
+        return -1;
+    body->subcircuit = inst->subcircuit;
+    body->override_start = inst->override_start;
+    body->override_count = inst->override_count;
+    body->hash = hash;
+    cache->body_table[s] = (int)cache->body_count;
+    cache->stats->definitions++;
+    return (int)cache->body_count++;
+}
+
+/* Output of one instance for the given port values, from the memo cache
+   when this body has seen them before. */
+static bool evaluateInstance(DesignCache *cache, const Instance *inst, const double *ports, double *output)
+{
+    const Subcircuit *def = instanceSubcircuit(cache->design, inst);
+    int b = findBody(cache, inst);
+    if (b < 0)
+        return false;
+
+    MemoKey key = cache->bodies[b].key;
+    for (int k = 0; k < def->ports; k++)
+        memoKeyAddDouble(&key, ports[k]);
+    if (memoLookup(cache->memo, &key, output, 1))
+    {
+        cache->stats->hits++;
+        return true;
+    }
+
+    ComponentColumns *cols = &cache->bodies[b].cols;
+    for (int k = 0; k < def->ports; k++)
+        cols->supplies.voltage[k] = ports[k];
+    if (evaluateColumns(cols) != 0)
+        return false;
+    *output = cols->values[def->ports + def->output];
+    cache->stats->misses++;
+    memoStore(cache->memo, &key, output, 1);
+    return true;
+}
+
+/* The components a top-level entry reads: an instance's ports, or the
+   connected inputs of a primitive. Returns -1 for a port bound outside
+   the design. */
+static int designInputs(const ComponentArray *design, size_t i, int pair[2], const int **list)
+{
+    const Component *c = &design->data[i];
+
+    if (c->type == INSTANCE)
+    {
+        const Subcircuit *def = instanceSubcircuit(design, &c->data.instance);
+        *list = design->hierarchy->ports + c->data.instance.port_start;
+        for (int k = 0; k < def->ports; k++)
+            if ((*list)[k] < 0 || (size_t)(*list)[k] >= design->size)
+                return -1;
+        return def->ports;
+    }
+
+    int inputs[2], count = 0;
+    componentInputs(design, i, inputs);
+    for (int k = 0; k < 2; k++)
+        if (inputs[k] >= 0)
+            pair[count++] = inputs[k];
+    *list = pair;
+    return count;
+}
+
+int evaluateDesign(ComponentArray *design, MemoCache *memo, DesignStats *stats)
+{
+    size_t n = design->size, head = 0, tail = 0;
+    int *load_start = cadCalloc(n + 2, sizeof(int));
+    int *pending = cadCalloc(n + 1, sizeof(int));
+    int *order = cadMalloc((n + 1) * sizeof(int));
+    double *value = cadMalloc((n + 1) * sizeof(double));
+    double *port_values = NULL;
+    int *load = NULL;
+    DesignCache cache = {0};
+    int status = -1;
+
+    memset(stats, 0, sizeof(*stats));
+    cache.design = design;
+    cache.stats = stats;
+    cache.memo = memo ? memo : memoCreate(MEMO_DEFAULT_BYTES);
+    if (!load_start || !pending || !order || !value || !cache.memo)
+        goto done;
+
+    /* Loads of every entry in CSR form, then Kahn's order over them. */
+    size_t widest = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        int pair[2];
+        const int *list;
+        int count = designInputs(design, i, pair, &list);
+        if (count < 0)
+            goto done;
+        for (int k = 0; k < count; k++)
+            load_start[list[k] + 2]++;
+        pending[i] = count;
+        if ((size_t)count > widest)
+            widest = count;
+        if (design->data[i].type == INSTANCE)
+            stats->instances++;
+    }
+    for (size_t i = 0; i < n; i++)
+        load_start[i + 2] += load_start[i + 1];
+    load = cadMalloc((load_start[n + 1] + 1) * sizeof(int));
+    port_values = cadMalloc((widest + 1) * sizeof(double));
+    if (!load || !port_values)
+        goto done;
+    for (size_t i = 0; i < n; i++)
+    {
+        int pair[2];
+        const int *list;
+        int count = designInputs(design, i, pair, &list);
+        for (int k = 0; k < count; k++)
+            load[load_start[list[k] + 1]++] = (int)i;
+    }
+    for (size_t i = 0; i < n; i++)
+        if (pending[i] == 0)
+            order[tail++] = (int)i;
+    while (head < tail)
+    {
+        int i = order[head++];
+        for (int p = load_start[i]; p < load_start[i + 1]; p++)
+            if (--pending[load[p]] == 0)
+                order[tail++] = load[p];
+    }
+    if (tail < n)
+        goto done;
+
+    for (size_t k = 0; k < n; k++)
+    {
+        int i = order[k], inputs[2];
+        Component *c = &design->data[i];
+        switch (c->type)
+        {
+        case POWERSUPPLY:
+            value[i] = c->data.powersupply.voltage;
+            break;
+        case RESISTOR:
+            componentInputs(design, i, inputs);
+            c->data.resistor.input = inputs[0] < 0 ? UNCONNECTED_INPUT : value[inputs[0]];
+            c->data.resistor.output =
+                resistor_calc(c->data.resistor.resistance, c->data.resistor.input, c->data.resistor.otype);
+            value[i] = c->data.resistor.output;
+            break;
+        case TRANSISTOR:
+            componentInputs(design, i, inputs);
+            c->data.transistor.input = inputs[0] < 0 ? 0.0 : value[inputs[0]];
+            c->data.transistor.base = inputs[1] < 0 ? 0.0 : value[inputs[1]];
+            c->data.transistor.output =
+                transistor_calc(c->data.transistor.input, c->data.transistor.base, !c->data.transistor.type,
+                                c->data.transistor.input_type, c->data.transistor.beta);
+            value[i] = c->data.transistor.output;
+            break;
+        case INSTANCE:
+        {
+            const Instance *inst = &c->data.instance;
+            const int *ports = design->hierarchy->ports + inst->port_start;
+            for (int p = 0; p < instanceSubcircuit(design, inst)->ports; p++)
+                port_values[p] = value[ports[p]];
+            if (!evaluateInstance(&cache, inst, port_values, &c->data.instance.output))
+                goto done;
+            value[i] = c->data.instance.output;
+            break;
+        }
+        }
+    }
+    status = 0;
+
+done:
+    for (size_t b = 0; b < cache.body_count; b++)
+        freeColumns(&cache.bodies[b].cols);
+    cadFree(cache.bodies);
+    cadFree(cache.body_table);
+    if (cache.memo != memo)
+        memoDestroy(cache.memo);
+    cadFree(load_start);
+    cadFree(pending);
+    cadFree(order);
+    cadFree(value);
+    cadFree(port_values);
+    cadFree(load);
+    return status;
+}
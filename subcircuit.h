@@ -0,0 +1,86 @@
+#ifndef SUBCIRCUIT_H
+#define SUBCIRCUIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "circuit.h"
+#include "memo.h"
+
+/* Body pins below -1 refer to the definition's ports: -2 is port 0, -3
+   port 1 and so on. */
+#define PORT_PIN(port) (-2 - (port))
+#define PIN_PORT(pin) (-2 - (pin))
+
+/* Per-instance replacement for the primary value of one component of the
+   definition: a supply's voltage, a resistance or a transistor's beta. */
+typedef struct
+{
+    int component;
+    double value;
+} ParameterOverride;
+
+/* A block stored once and referenced by every instance of it. The body
+   holds primitives only; its output component is what the instance
+   drives. */
+typedef struct
+{
+    char *name;
+    int ports;
+    int output;
+    ComponentArray body;
+} Subcircuit;
+
+/* The definitions of a hierarchical design, with pools for the port
+   bindings and overrides its instances point into. */
+struct Hierarchy
+{
+    Subcircuit *subcircuits;
+    size_t count;
+    size_t capacity;
+    int *ports;
+    size_t port_count;
+    size_t port_capacity;
+    ParameterOverride *overrides;
+    size_t override_count;
+    size_t override_capacity;
+    size_t instances;
+};
+
+typedef struct
+{
+    size_t instances;
+    size_t definitions;
+    size_t hits;
+    size_t misses;
+} DesignStats;
+
+/* Takes ownership of body. Returns the definition's index, or -1 when a
+   definition of that name exists. */
+int addSubcircuit(ComponentArray *arr, const char *name, size_t name_length, int ports, int output,
+                  ComponentArray *body);
+int findSubcircuit(const ComponentArray *arr, const char *name, size_t name_length);
+/* Appends an instance of a definition; ports holds one top-level id per
+   port of the definition. */
+void addInstance(ComponentArray *arr, int subcircuit, const int *ports, const ParameterOverride *overrides,
+                 int override_count);
+bool isHierarchical(const ComponentArray *arr);
+const Subcircuit *instanceSubcircuit(const ComponentArray *arr, const Instance *instance);
+void freeHierarchy(Hierarchy *h);
+
+/* Expands every instance into a flat array of primitives. Top-level ids
+   are kept: an instance's slot holds its definition's output component
+   and the rest of the body is appended. */
+bool flattenCircuit(const ComponentArray *design, ComponentArray *flat);
+/* Replaces a hierarchical design by its flattened form. */
+bool flattenInPlace(ComponentArray *array);
+/* Copies the results of an evaluated flat array back into the design. */
+void storeFlatResults(const ComponentArray *flat, ComponentArray *design);
+
+/* Evaluates the top level in dependency order without flattening. Each
+   definition/parameter set is compiled once, and an instance whose
+   compiled body and port values are already in memo reuses the cached
+   output; without a memo cache one lives for the call. Returns -1 when the design needs flattening instead: a top-level
+   feedback loop, an unconnected port, or a body that does not settle. */
+int evaluateDesign(ComponentArray *design, MemoCache *memo, DesignStats *stats);
+
+#endif
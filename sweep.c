@@ -0,0 +1,515 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "cJSON/cJSON.h"
+#include "sweep.h"
+#include "columns.h"
+#include "platform.h"
+#include "threadpool.h"
+
+#define FLUSH_SIZE (64u << 10)
+#define NUMBER_WIDTH 32
+#define TWO_PI 6.283185307179586
+
+/* A sweep parameter resolved to one column entry. */
+typedef struct
+{
+    const SweepParam *param;
+    ComponentType type;
+    int slot;
+    double nominal;
+} SweepTarget;
+
+/* Per-worker scratch. cols shares the level schedule and connectivity
+   with the base columns but owns every column a variant writes. */
+typedef struct
+{
+    ComponentColumns cols;
+    double *row;
+    char *buffer;
+    size_t length;
+    size_t unsolved;
+    size_t cached;
+} SweepWorker;
+
+typedef struct
+{
+    const SweepSpec *spec;
+    SweepTarget *targets;
+    size_t target_count;
+    size_t reported;
+    int *outputs;
+    size_t output_count;
+    SweepWorker *workers;
+    MemoCache *memo;
+    MemoKey circuit_key;
+    FILE *out;
+    pthread_mutex_t out_lock;
+    bool write_failed;
+} SweepRun;
+
+static const char *parameter_names[] = {"resistance", "voltage", "beta"};
+static const ComponentType parameter_types[] = {RESISTOR, POWERSUPPLY, TRANSISTOR};
+
+static bool parseParam(const cJSON *item, SweepParam *p)
+{
+    const cJSON *parameter = cJSON_GetObjectItem(item, "parameter");
+    const cJSON *id = cJSON_GetObjectItem(item, "id");
+    const cJSON *distribution = cJSON_GetObjectItem(item, "distribution");
+    const cJSON *tolerance = cJSON_GetObjectItem(item, "tolerance");
+    const cJSON *min = cJSON_GetObjectItem(item, "min");
+    const cJSON *max = cJSON_GetObjectItem(item, "max");
+
+    if (!cJSON_IsString(parameter))
+        return false;
+    if (strcmp(parameter->valuestring, "resistance") == 0)
+        p->parameter = SWEEP_RESISTANCE;
+    else if (strcmp(parameter->valuestring, "voltage") == 0)
+        p->parameter = SWEEP_VOLTAGE;
+    else if (strcmp(parameter->valuestring, "beta") == 0)
+        p->parameter = SWEEP_BETA;
+    else
+        return false;
+
+    p->component = cJSON_IsNumber(id) ? id->valueint : -1;
+    p->distribution = SWEEP_UNIFORM;
+    if (cJSON_IsString(distribution))
+    {
+        if (strcmp(distribution->valuestring, "gaussian") == 0)
+            p->distribution = SWEEP_GAUSSIAN;
+        else if (strcmp(distribution->valuestring, "linear") == 0)
+            p->distribution = SWEEP_LINEAR;
+        else if (strcmp(distribution->valuestring, "uniform") != 0)
+            return false;
+    }
+
+    if (cJSON_IsNumber(tolerance) && tolerance->valuedouble > 0)
+    {
+        p->tolerance = tolerance->valuedouble;
+        return true;
+    }
+    if (!cJSON_IsNumber(min) || !cJSON_IsNumber(max))
+        return false;
+    p->min = min->valuedouble;
+    p->max = max->valuedouble;
+    return true;
+}
+
+bool loadSweepSpec(const char *file_name, SweepSpec *spec)
+{
+    MappedFile map;
+    cJSON *root;
+
+    memset(spec, 0, sizeof(*spec));
+    if (!mapFile(file_name, &map))
+    {
+        perror("Error opening file");
+        return false;
+    }
+    root = cJSON_ParseWithLength(map.data, map.size);
+    unmapFile(&map);
+    if (!root)
+    {
+        fprintf(stderr, "%s: invalid JSON\n", file_name);
+        return false;
+    }
+
+    const cJSON *variants = cJSON_GetObjectItem(root, "variants");
+    const cJSON *seed = cJSON_GetObjectItem(root, "seed");
+    const cJSON *params = cJSON_GetObjectItem(root, "parameters");
+    const cJSON *outputs = cJSON_GetObjectItem(root, "outputs");
+    const cJSON *item;
+
+    if (!cJSON_IsNumber(variants) || variants->valuedouble < 1 || !cJSON_IsArray(params))
+    {
+        fprintf(stderr, "%s: a sweep needs \"variants\" and a \"parameters\" array\n", file_name);
+        goto fail;
+    }
+    spec->variants = (size_t)variants->valuedouble;
+    spec->seed = cJSON_IsNumber(seed) ? (uint64_t)seed->valuedouble : 1;
+
+    spec->params = calloc(cJSON_GetArraySize(params) + 1, sizeof(SweepParam));
+    if (!spec->params)
+        goto fail;
+    cJSON_ArrayForEach(item, params)
+    {
+        if (!parseParam(item, &spec->params[spec->param_count]))
+        {
+            fprintf(stderr, "%s: parameter %zu needs a known \"parameter\", a known \"distribution\" "
+                            "and either \"tolerance\" or \"min\" and \"max\"\n",
+                    file_name, spec->param_count);
+            goto fail;
+        }
+        spec->param_count++;
+    }
+
+    if (cJSON_IsArray(outputs))
+    {
+        spec->outputs = malloc((cJSON_GetArraySize(outputs) + 1) * sizeof(int));
+        if (!spec->outputs)
+            goto fail;
+        cJSON_ArrayForEach(item, outputs)
+        {
+            if (cJSON_IsNumber(item))
+                spec->outputs[spec->output_count++] = item->valueint;
+        }
+    }
+
+    cJSON_Delete(root);
+    return true;
+
+fail:
+    cJSON_Delete(root);
+    freeSweepSpec(spec);
+    return false;
+}
+
+void freeSweepSpec(SweepSpec *spec)
+{
+    free(spec->params);
+    free(spec->outputs);
+    memset(spec, 0, sizeof(*spec));
+}
+
+static uint64_t splitmix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+static double unitInterval(uint64_t x)
+{
+    return (x >> 11) * 0x1.0p-53;
+}
+
+/* Counter-based, so a variant's values do not depend on which worker
+   evaluates it or in what order. */
+static double sampleTarget(const SweepRun *run, size_t target, size_t variant)
+{
+    const SweepTarget *t = &run->targets[target];
+    const SweepParam *p = t->param;
+    uint64_t key = splitmix64(run->spec->seed ^ splitmix64((uint64_t)variant * run->target_count + target));
+    double lo = p->tolerance > 0 ? t->nominal * (1.0 - p->tolerance) : p->min;
+    double hi = p->tolerance > 0 ? t->nominal * (1.0 + p->tolerance) : p->max;
+
+    switch (p->distribution)
+    {
+    case SWEEP_LINEAR:
+        if (run->spec->variants < 2)
+            return 0.5 * (lo + hi);
+        return lo + (hi - lo) * variant / (run->spec->variants - 1);
+    case SWEEP_GAUSSIAN:
+    {
+        double u1 = 1.0 - unitInterval(key), u2 = unitInterval(splitmix64(key));
+        return 0.5 * (lo + hi) + sqrt(-2.0 * log(u1)) * cos(TWO_PI * u2) * (hi - lo) / 6.0;
+    }
+    case SWEEP_UNIFORM:
+        break;
+    }
+    return lo + (hi - lo) * unitInterval(key);
+}
+
+static double *targetValue(ComponentColumns *cols, const SweepTarget *t)
+{
+    switch (t->type)
+    {
+    case POWERSUPPLY:
+        return &cols->supplies.voltage[t->slot];
+    case RESISTOR:
+        return &cols->resistors.resistance[t->slot];
+    case TRANSISTOR:
+        return &cols->transistors.beta[t->slot];
+    case INSTANCE:
+        break;
+    }
+    return NULL;
+}
+
+static bool resolveTargets(SweepRun *run, ComponentColumns *base)
+{
+    const SweepSpec *spec = run->spec;
+    size_t total = 0;
+
+    for (size_t p = 0; p < spec->param_count; p++)
+    {
+        const SweepParam *param = &spec->params[p];
+        ComponentType type = parameter_types[param->parameter];
+        if (param->component < 0)
+        {
+            total += type == POWERSUPPLY ? base->supplies.count
+                   : type == RESISTOR    ? base->resistors.count
+                                         : base->transistors.count;
+            continue;
+        }
+        if ((size_t)param->component >= base->n || base->slots[param->component].type != type)
+        {
+            fprintf(stderr, "Sweep: component %d has no %s\n", param->component, parameter_names[param->parameter]);
+            return false;
+        }
+        total++;
+        run->reported++;
+    }
+
+    run->targets = malloc((total + 1) * sizeof(SweepTarget));
+    if (!run->targets)
+        return false;
+    for (size_t p = 0; p < spec->param_count; p++)
+    {
+        const SweepParam *param = &spec->params[p];
+        ComponentType type = parameter_types[param->parameter];
+        size_t first = 0, last = 0;
+        if (param->component >= 0)
+        {
+            first = base->slots[param->component].slot;
+            last = first + 1;
+        }
+        else
+            last = type == POWERSUPPLY ? base->supplies.count
+                 : type == RESISTOR    ? base->resistors.count
+                                       : base->transistors.count;
+        for (size_t k = first; k < last; k++)
+        {
+            SweepTarget *t = &run->targets[run->target_count++];
+            t->param = param;
+            t->type = type;
+            t->slot = (int)k;
+            t->nominal = *targetValue(base, t);
+        }
+    }
+    return true;
+}
+
+static double *copyColumn(const double *src, size_t count)
+{
+    double *column = malloc((count + 1) * sizeof(double));
+    if (column)
+        memcpy(column, src, count * sizeof(double));
+    return column;
+}
+
+static void freeWorker(SweepWorker *w)
+{
+    free(w->cols.values);
+    free(w->cols.supplies.voltage);
+    free(w->cols.resistors.resistance);
+    free(w->cols.resistors.input_value);
+    free(w->cols.resistors.output);
+    free(w->cols.transistors.beta);
+    free(w->cols.transistors.input_value);
+    free(w->cols.transistors.base_value);
+    free(w->cols.transistors.output);
+    freeGroupSystemCopies(w->cols.systems, w->cols.schedule.groups);
+    free(w->row);
+    free(w->buffer);
+}
+
+static bool initWorker(SweepWorker *w, const ComponentColumns *base, size_t outputs, size_t buffer_size)
+{
+    size_t s = base->supplies.count, r = base->resistors.count, t = base->transistors.count;
+
+    w->cols = *base;
+    w->cols.values = copyColumn(base->values, base->n + 2);
+    w->cols.supplies.voltage = copyColumn(base->supplies.voltage, s);
+    w->cols.resistors.resistance = copyColumn(base->resistors.resistance, r);
+    w->cols.resistors.input_value = copyColumn(base->resistors.input_value, r);
+    w->cols.resistors.output = copyColumn(base->resistors.output, r);
+    w->cols.transistors.beta = copyColumn(base->transistors.beta, t);
+    w->cols.transistors.input_value = copyColumn(base->transistors.input_value, t);
+    w->cols.transistors.base_value = copyColumn(base->transistors.base_value, t);
+    w->cols.transistors.output = copyColumn(base->transistors.output, t);
+    w->cols.systems = copyGroupSystems(base);
+    w->row = malloc((outputs + 1) * sizeof(double));
+    w->buffer = malloc(buffer_size);
+    w->length = 0;
+    w->unsolved = 0;
+    w->cached = 0;
+    return w->row && w->cols.values && w->cols.supplies.voltage && w->cols.resistors.resistance &&
+           w->cols.resistors.input_value && w->cols.resistors.output && w->cols.transistors.beta &&
+           w->cols.transistors.input_value && w->cols.transistors.base_value && w->cols.transistors.output &&
+           w->cols.systems && w->buffer;
+}
+
+static void flushWorker(SweepRun *run, SweepWorker *w)
+{
+    if (w->length == 0)
+        return;
+    pthread_mutex_lock(&run->out_lock);
+    if (fwrite(w->buffer, 1, w->length, run->out) != w->length)
+        run->write_failed = true;
+    pthread_mutex_unlock(&run->out_lock);
+    w->length = 0;
+}
+
+/* Outputs of one variant, from the memo cache when the same circuit has
+   been evaluated with the same parameter values before. Variants that do
+   not settle are not cached. */
+static void evaluateVariant(SweepRun *run, SweepWorker *w)
+{
+    MemoKey key = run->circuit_key;
+
+    if (run->memo)
+    {
+        for (size_t k = 0; k < run->target_count; k++)
+            memoKeyAddDouble(&key, *targetValue(&w->cols, &run->targets[k]));
+        if (memoLookup(run->memo, &key, w->row, run->output_count))
+        {
+            w->cached++;
+            return;
+        }
+    }
+    bool settled = evaluateColumns(&w->cols) == 0;
+    if (!settled)
+        w->unsolved++;
+    for (size_t k = 0; k < run->output_count; k++)
+        w->row[k] = w->cols.values[run->outputs[k]];
+    if (run->memo && settled)
+        memoStore(run->memo, &key, w->row, run->output_count);
+}
+
+/* Rows are written in whatever order the workers finish them; the first
+   column identifies the variant. */
+static void sweepRange(void *arg, size_t begin, size_t end, int worker)
+{
+    SweepRun *run = arg;
+    SweepWorker *w = &run->workers[worker];
+
+    for (size_t v = begin; v < end; v++)
+    {
+        for (size_t k = 0; k < run->target_count; k++)
+            *targetValue(&w->cols, &run->targets[k]) = sampleTarget(run, k, v);
+        evaluateVariant(run, w);
+
+        char *line = w->buffer + w->length;
+        int len = sprintf(line, "%zu", v);
+        for (size_t k = 0; k < run->target_count; k++)
+            if (run->targets[k].param->component >= 0)
+                len += sprintf(line + len, ",%.15g", *targetValue(&w->cols, &run->targets[k]));
+        for (size_t k = 0; k < run->output_count; k++)
+            len += sprintf(line + len, ",%.15g", w->row[k]);
+        line[len++] = '\n';
+        w->length += len;
+        if (w->length >= FLUSH_SIZE)
+            flushWorker(run, w);
+    }
+}
+
+static void writeHeader(const SweepRun *run)
+{
+    fputs("variant", run->out);
+    for (size_t k = 0; k < run->target_count; k++)
+    {
+        const SweepParam *p = run->targets[k].param;
+        if (p->component >= 0)
+            fprintf(run->out, ",%d.%s", p->component, parameter_names[p->parameter]);
+    }
+    for (size_t k = 0; k < run->output_count; k++)
+        fprintf(run->out, ",%d.output", run->outputs[k]);
+    fputc('\n', run->out);
+}
+
+/* Evaluates spec->variants copies of the netlist with the swept
+   parameters redrawn for each, writing one CSV row per variant. Feedback
+   loops are solved per group; variants where one does not settle are
+   still written and counted in stats->unsolved. With a memo cache,
+   variants are keyed by the circuit, the reported outputs and every
+   swept value. */
+int runSweep(const ComponentArray *array, const SweepSpec *spec, int threads, MemoCache *memo, FILE *out,
+             SweepStats *stats)
+{
+    ComponentColumns base;
+    SweepRun run = {.spec = spec, .memo = memo, .out = out};
+    ThreadPool *pool = NULL;
+    int workers = 0, status = -1;
+    double start = monotonicSeconds();
+
+    if (buildColumns(array, &base) != 0)
+    {
+        fprintf(stderr, "Sweep: column allocation failed\n");
+        return -1;
+    }
+    if (!resolveTargets(&run, &base))
+        goto done;
+
+    run.output_count = spec->output_count ? spec->output_count : base.n;
+    run.outputs = malloc((run.output_count + 1) * sizeof(int));
+    if (!run.outputs)
+        goto done;
+    for (size_t k = 0; k < run.output_count; k++)
+    {
+        run.outputs[k] = spec->output_count ? spec->outputs[k] : (int)k;
+        if (run.outputs[k] < 0 || (size_t)run.outputs[k] >= base.n)
+        {
+            fprintf(stderr, "Sweep: output %d is not a component\n", run.outputs[k]);
+            goto done;
+        }
+    }
+    if (memo)
+    {
+        memoKeyInit(&run.circuit_key, MEMO_DOMAIN_SWEEP);
+        memoKeyAddCircuit(&run.circuit_key, array);
+        for (size_t k = 0; k < run.output_count; k++)
+            memoKeyAddInt(&run.circuit_key, run.outputs[k]);
+        for (size_t k = 0; k < run.target_count; k++)
+            memoKeyAddInt(&run.circuit_key, run.targets[k].type * 0x10000000 + run.targets[k].slot);
+    }
+
+    if (threads < 1)
+        threads = 1;
+    if ((size_t)threads > spec->variants)
+        threads = (int)spec->variants;
+    pool = threadPoolCreate(threads);
+    workers = threadPoolSize(pool);
+    run.workers = calloc(workers, sizeof(SweepWorker));
+    if (!run.workers)
+        goto done;
+    size_t line_size = (run.reported + run.output_count + 1) * NUMBER_WIDTH;
+    for (int w = 0; w < workers; w++)
+    {
+        if (!initWorker(&run.workers[w], &base, run.output_count, FLUSH_SIZE + line_size))
+        {
+            fprintf(stderr, "Sweep: scratch allocation failed\n");
+            goto done;
+        }
+    }
+
+    writeHeader(&run);
+    size_t grain = spec->variants / ((size_t)workers * 16);
+    pthread_mutex_init(&run.out_lock, NULL);
+    threadPoolRunRanges(pool, sweepRange, &run, spec->variants, grain < 1 ? 1 : grain > 256 ? 256 : grain);
+    for (int w = 0; w < workers; w++)
+        flushWorker(&run, &run.workers[w]);
+    pthread_mutex_destroy(&run.out_lock);
+
+    if (run.write_failed || ferror(out))
+        perror("Sweep output failed");
+    else
+        status = 0;
+    if (stats)
+    {
+        stats->variants = spec->variants;
+        stats->threads = workers;
+        stats->unsolved = stats->cached = 0;
+        for (int w = 0; w < workers; w++)
+        {
+            stats->unsolved += run.workers[w].unsolved;
+            stats->cached += run.workers[w].cached;
+        }
+        stats->time = monotonicSeconds() - start;
+    }
+
+done:
+    threadPoolDestroy(pool);
+    if (run.workers)
+    {
+        for (int w = 0; w < workers; w++)
+            freeWorker(&run.workers[w]);
+        free(run.workers);
+    }
+    free(run.targets);
+    free(run.outputs);
+    freeColumns(&base);
+    return status;
+}
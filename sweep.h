@@ -0,0 +1,67 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "circuit.h"
+#include "memo.h"
+
+typedef enum
+{
+    SWEEP_RESISTANCE,
+    SWEEP_VOLTAGE,
+    SWEEP_BETA
+} SweepParameter;
+
+typedef enum
+{
+    SWEEP_UNIFORM,
+    SWEEP_GAUSSIAN,
+    SWEEP_LINEAR
+} SweepDistribution;
+
+/* One varied parameter. component is an index into the netlist, or -1 to
+   vary every component the parameter applies to independently. A
+   positive tolerance spreads around each nominal value (gaussian treats
+   it as three sigma); otherwise values come from [min, max]. */
+typedef struct
+{
+    int component;
+    SweepParameter parameter;
+    SweepDistribution distribution;
+    double tolerance;
+    double min;
+    double max;
+} SweepParam;
+
+/* Spec file:
+   {"variants": 1000, "seed": 1,
+    "parameters": [{"id": 2, "parameter": "resistance", "tolerance": 0.05},
+                   {"parameter": "beta", "distribution": "gaussian", "min": 80, "max": 120}],
+    "outputs": [4, 7]}
+   Omitting "outputs" reports every component. */
+typedef struct
+{
+    size_t variants;
+    uint64_t seed;
+    SweepParam *params;
+    size_t param_count;
+    int *outputs;
+    size_t output_count;
+} SweepSpec;
+
+typedef struct
+{
+    size_t variants;
+    size_t unsolved;
+    size_t cached;
+    int threads;
+    double time;
+} SweepStats;
+
+bool loadSweepSpec(const char *file_name, SweepSpec *spec);
+void freeSweepSpec(SweepSpec *spec);
+int runSweep(const ComponentArray *array, const SweepSpec *spec, int threads, MemoCache *memo, FILE *out,
+             SweepStats *stats);
+
+#endif
@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "symbolic.h"
+#include "netgraph.h"
+#include "platform.h"
+
+#define SYMBOLIC_BYTE_ORDER 0x01020304u
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t hi;
+    uint64_t lo;
+    uint64_t n;
+    uint64_t lnz;
+    uint64_t unz;
+} SymbolicFileHeader;
+
+void circuitPatternKey(const ComponentArray *array, MemoKey *key)
+{
+    memoKeyInit(key, MEMO_DOMAIN_PATTERN);
+    memoKeyAddInt(key, (int64_t)array->size);
+    for (size_t i = 0; i < array->size; i++)
+    {
+        int inputs[2];
+        int count = componentInputs(array, i, inputs);
+        memoKeyAddInt(key, array->data[i].type);
+        memoKeyAddInt(key, count);
+        memoKeyAddInt(key, inputs[0]);
+        memoKeyAddInt(key, inputs[1]);
+    }
+}
+
+static bool readInts(FILE *fp, int **values, uint64_t count)
+{
+    *values = malloc((count + 1) * sizeof(int));
+    return *values && fread(*values, sizeof(int), count, fp) == count;
+}
+
+static bool inRange(const int *values, uint64_t count, int n)
+{
+    for (uint64_t i = 0; i < count; i++)
+        if (values[i] < 0 || values[i] >= n)
+            return false;
+    return true;
+}
+
+/* Checks everything sparseLURefactor and sparseLUSolve index with, and
+   that each column of L starts and each column of U ends on its pivot. */
+static bool validSymbolic(const SymbolicLU *s, uint64_t lnz, uint64_t unz)
+{
+    int n = s->n;
+    if (s->lp[0] != 0 || s->up[0] != 0 || (uint64_t)s->lp[n] != lnz || (uint64_t)s->up[n] != unz ||
+        !inRange(s->q, n, n) || !inRange(s->pinv, n, n) || !inRange(s->li, lnz, n) || !inRange(s->ui, unz, n))
+        return false;
+    for (int k = 0; k < n; k++)
+    {
+        if (s->lp[k + 1] <= s->lp[k] || s->up[k + 1] <= s->up[k] || s->lp[k + 1] > s->lp[n] ||
+            s->up[k + 1] > s->up[n] || s->li[s->lp[k]] != k || s->ui[s->up[k + 1] - 1] != k)
+            return false;
+    }
+    return true;
+}
+
+bool loadSymbolic(const char *file_name, const MemoKey *key, SymbolicLU *symbolic)
+{
+    SymbolicFileHeader h;
+    SymbolicLU loaded = {0};
+    FILE *fp = fopen(file_name, "rb");
+    bool ok;
+
+    if (!fp)
+    {
+        if (errno != ENOENT)
+            perror(file_name);
+        return false;
+    }
+    if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, SYMBOLIC_FILE_MAGIC, sizeof(SYMBOLIC_FILE_MAGIC)) != 0 ||
+        h.byte_order != SYMBOLIC_BYTE_ORDER || h.version != SYMBOLIC_FILE_VERSION)
+    {
+        fprintf(stderr, "%s: not a symbolic analysis of this version, ignoring it\n", file_name);
+        fclose(fp);
+        return false;
+    }
+    /* Written for another circuit; the solve will replace it. */
+    if (h.hi != key->hi || h.lo != key->lo)
+    {
+        fclose(fp);
+        return false;
+    }
+
+    ok = h.n > 0 && h.n < INT_MAX && h.lnz < INT_MAX && h.unz < INT_MAX;
+    if (ok)
+    {
+        loaded.n = (int)h.n;
+        ok = readInts(fp, &loaded.q, h.n) && readInts(fp, &loaded.pinv, h.n) && readInts(fp, &loaded.lp, h.n + 1) &&
+             readInts(fp, &loaded.li, h.lnz) && readInts(fp, &loaded.up, h.n + 1) &&
+             readInts(fp, &loaded.ui, h.unz) && validSymbolic(&loaded, h.lnz, h.unz);
+    }
+    fclose(fp);
+    if (!ok)
+    {
+        fprintf(stderr, "%s: damaged symbolic analysis, ignoring it\n", file_name);
+        freeSymbolicLU(&loaded);
+        return false;
+    }
+    freeSymbolicLU(symbolic);
+    *symbolic = loaded;
+    return true;
+}
+
+/* Tells apart the temporary files of saves running at the same time, in
+   this process or another. */
+static atomic_uint save_counter;
+
+/* Written beside the target and renamed over it, so that a load running
+   at the same time, or after a failed save, never sees a partial file. */
+bool saveSymbolic(const char *file_name, const MemoKey *key, const SymbolicLU *symbolic)
+{
+    SymbolicFileHeader h;
+    int n = symbolic->n;
+    size_t lnz = symbolic->lp[n], unz = symbolic->up[n];
+    size_t length = strlen(file_name) + 48;
+    char *temp = malloc(length);
+    if (!temp)
+        return false;
+    snprintf(temp, length, "%s.%lu.%u.tmp", file_name, processId(), atomic_fetch_add(&save_counter, 1));
+    FILE *fp = fopen(temp, "wb");
+    if (!fp)
+    {
+        perror(temp);
+        free(temp);
+        return false;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SYMBOLIC_FILE_MAGIC, sizeof(SYMBOLIC_FILE_MAGIC));
+    h.version = SYMBOLIC_FILE_VERSION;
+    h.byte_order = SYMBOLIC_BYTE_ORDER;
+    h.hi = key->hi;
+    h.lo = key->lo;
+    h.n = n;
+    h.lnz = lnz;
+    h.unz = unz;
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1 && fwrite(symbolic->q, sizeof(int), n, fp) == (size_t)n &&
+              fwrite(symbolic->pinv, sizeof(int), n, fp) == (size_t)n &&
+              fwrite(symbolic->lp, sizeof(int), n + 1, fp) == (size_t)n + 1 &&
+              fwrite(symbolic->li, sizeof(int), lnz, fp) == lnz &&
+              fwrite(symbolic->up, sizeof(int), n + 1, fp) == (size_t)n + 1 &&
+              fwrite(symbolic->ui, sizeof(int), unz, fp) == unz;
+    if (fclose(fp) != 0)
+        ok = false;
+    if (!ok)
+        perror(temp);
+    else if (!replaceFile(temp, file_name))
+    {
+        perror(file_name);
+        ok = false;
+    }
+    if (!ok)
+        remove(temp);
+    free(temp);
+    return ok;
+}
+
+int solveCircuitCached(ComponentArray *array, const char *netlist, SolveStats *stats)
+{
+    SolveStats local = {0};
+    SymbolicLU symbolic = {0};
+    MemoKey key;
+    char *file = malloc(strlen(netlist) + sizeof(SYMBOLIC_FILE_EXTENSION));
+
+    if (!stats)
+        stats = &local;
+    if (!file)
+        return solveCircuit(array, stats);
+    sprintf(file, "%s" SYMBOLIC_FILE_EXTENSION, netlist);
+
+    circuitPatternKey(array, &key);
+    loadSymbolic(file, &key, &symbolic);
+    int status = solveCircuitSymbolic(array, NULL, &symbolic, stats);
+    if (status >= 0 && stats->factorizations > 0 && symbolic.n > 0)
+        saveSymbolic(file, &key, &symbolic);
+    freeSymbolicLU(&symbolic);
+    free(file);
+    return status;
+}
@@ -0,0 +1,29 @@
+#ifndef SYMBOLIC_H
+#define SYMBOLIC_H
+
+#include <stdbool.h>
+#include "circuit.h"
+#include "memo.h"
+#include "solver.h"
+
+#define SYMBOLIC_FILE_EXTENSION ".sym"
+#define SYMBOLIC_FILE_MAGIC "CADSYM"
+/* Bump when the ordering or the factorization layout changes. */
+#define SYMBOLIC_FILE_VERSION 1
+
+/* Hash of everything the circuit matrix pattern depends on: the size,
+   and each component's type and input pins. Values are left out. */
+void circuitPatternKey(const ComponentArray *array, MemoKey *key);
+
+/* False when the file is missing or was written for other connectivity;
+   a damaged file is reported as well. */
+bool loadSymbolic(const char *file_name, const MemoKey *key, SymbolicLU *symbolic);
+bool saveSymbolic(const char *file_name, const MemoKey *key, const SymbolicLU *symbolic);
+
+/* Solves starting from the analysis in NETLIST.sym when its key matches
+   the circuit, and saves the analysis there whenever the solve had to
+   make a fresh one. Failing to save is reported but does not fail the
+   solve. */
+int solveCircuitCached(ComponentArray *array, const char *netlist, SolveStats *stats);
+
+#endif
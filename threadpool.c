@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "threadpool.h"
+
+typedef struct
+{
+    ThreadPool *pool;
+    int index;
+} WorkerArgs;
+
+struct ThreadPool
+{
+    int threads;
+    pthread_t *workers;
+    WorkerArgs *args;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    TaskFn fn;
+    void *arg;
+    size_t count;
+    atomic_size_t next;
+    int active;
+    unsigned long generation;
+    bool shutdown;
+};
+
+static void runTasks(ThreadPool *pool, int worker)
+{
+    size_t i;
+    while ((i = atomic_fetch_add(&pool->next, 1)) < pool->count)
+        pool->fn(pool->arg, i, worker);
+}
+
+static void *workerMain(void *data)
+{
+    WorkerArgs *args = data;
+    ThreadPool *pool = args->pool;
+    unsigned long seen = 0;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->shutdown && pool->generation == seen)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->shutdown)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        runTasks(pool, args->index);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0)
+            pthread_cond_signal(&pool->finished);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/* The calling thread takes part in every run, so a pool of one thread
+   starts no workers at all. */
+ThreadPool *threadPoolCreate(int threads)
+{
+    ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+    if (!pool)
+        return NULL;
+    pool->threads = threads < 1 ? 1 : threads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+    atomic_init(&pool->next, 0);
+
+    pool->workers = calloc(pool->threads, sizeof(pthread_t));
+    pool->args = calloc(pool->threads, sizeof(WorkerArgs));
+    if (!pool->workers || !pool->args)
+    {
+        pool->threads = 1;
+        threadPoolDestroy(pool);
+        return NULL;
+    }
+    for (int i = 1; i < pool->threads; i++)
+    {
+        pool->args[i].pool = pool;
+        pool->args[i].index = i;
+        if (pthread_create(&pool->workers[i], NULL, workerMain, &pool->args[i]) != 0)
+        {
+            pool->threads = i;
+            break;
+        }
+    }
+    return pool;
+}
+
+int threadPoolSize(const ThreadPool *pool)
+{
+    return pool ? pool->threads : 1;
+}
+
+/* Runs fn for every index in [0, count) and returns once all are done.
+   Indices are handed out dynamically, so uneven tasks balance out. */
+void threadPoolRun(ThreadPool *pool, TaskFn fn, void *arg, size_t count)
+{
+    if (count == 0)
+        return;
+    if (!pool || pool->threads == 1 || count == 1)
+    {
+        for (size_t i = 0; i < count; i++)
+            fn(arg, i, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->count = count;
+    atomic_store(&pool->next, 0);
+    pool->active = pool->threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    runTasks(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active > 0)
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* One contiguous run of indices per worker, padded to its own cache line.
+   The owner takes from the front, thieves split off the back half. */
+typedef struct
+{
+    pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+    char pad[64];
+} StealRange;
+
+typedef struct
+{
+    StealRange *ranges;
+    int workers;
+    size_t grain;
+    RangeFn fn;
+    void *arg;
+} StealRun;
+
+static bool takeWork(StealRange *range, size_t grain, size_t *begin, size_t *end)
+{
+    pthread_mutex_lock(&range->lock);
+    bool found = range->begin < range->end;
+    if (found)
+    {
+        *begin = range->begin;
+        *end = range->end - range->begin > grain ? range->begin + grain : range->end;
+        range->begin = *end;
+    }
+    pthread_mutex_unlock(&range->lock);
+    return found;
+}
+
+static bool stealWork(StealRun *run, int thief)
+{
+    for (int k = 1; k < run->workers; k++)
+    {
+        StealRange *victim = &run->ranges[(thief + k) % run->workers];
+        size_t begin = 0, end = 0;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->end > victim->begin)
+        {
+            end = victim->end;
+            begin = victim->end - (victim->end - victim->begin + 1) / 2;
+            victim->end = begin;
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (begin < end)
+        {
+            StealRange *own = &run->ranges[thief];
+            pthread_mutex_lock(&own->lock);
+            own->begin = begin;
+            own->end = end;
+            pthread_mutex_unlock(&own->lock);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Ranges only ever shrink, so a worker that finds every range empty can
+   stop: nothing new will appear. */
+static void stealTask(void *arg, size_t index, int worker)
+{
+    StealRun *run = arg;
+    size_t begin, end;
+    (void)index;
+
+    do
+    {
+        while (takeWork(&run->ranges[worker], run->grain, &begin, &end))
+            run->fn(run->arg, begin, end, worker);
+    } while (stealWork(run, worker));
+}
+
+/* Runs fn over [0, count) in chunks of at most grain indices. Each worker
+   starts on an equal share and steals from the others once it runs dry,
+   which keeps neighbouring indices on the same thread. */
+void threadPoolRunRanges(ThreadPool *pool, RangeFn fn, void *arg, size_t count, size_t grain)
+{
+    int workers = threadPoolSize(pool);
+    StealRun run = {NULL, workers, grain ? grain : 1, fn, arg};
+
+    if (count == 0)
+        return;
+    if (workers == 1 || !(run.ranges = calloc(workers, sizeof(StealRange))))
+    {
+        for (size_t begin = 0; begin < count; begin += run.grain)
+            fn(arg, begin, count - begin > run.grain ? begin + run.grain : count, 0);
+        return;
+    }
+    for (int w = 0; w < workers; w++)
+    {
+        pthread_mutex_init(&run.ranges[w].lock, NULL);
+        run.ranges[w].begin = count * w / workers;
+        run.ranges[w].end = count * (w + 1) / workers;
+    }
+
+    threadPoolRun(pool, stealTask, &run, workers);
+
+    for (int w = 0; w < workers; w++)
+        pthread_mutex_destroy(&run.ranges[w].lock);
+    free(run.ranges);
+}
+
+void threadPoolDestroy(ThreadPool *pool)
+{
+    if (!pool)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->threads; i++)
+        pthread_join(pool->workers[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->finished);
+    free(pool->workers);
+    free(pool->args);
+    free(pool);
+}
@@ -0,0 +1,21 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stddef.h>
+
+/* Called once per index; worker is in [0, threadPoolSize) so callers can
+   keep per-thread scratch buffers. */
+typedef void (*TaskFn)(void *arg, size_t index, int worker);
+
+/* Called with a half-open run of indices [begin, end). */
+typedef void (*RangeFn)(void *arg, size_t begin, size_t end, int worker);
+
+typedef struct ThreadPool ThreadPool;
+
+ThreadPool *threadPoolCreate(int threads);
+int threadPoolSize(const ThreadPool *pool);
+void threadPoolRun(ThreadPool *pool, TaskFn fn, void *arg, size_t count);
+void threadPoolRunRanges(ThreadPool *pool, RangeFn fn, void *arg, size_t count, size_t grain);
+void threadPoolDestroy(ThreadPool *pool);
+
+#endif
@@ -0,0 +1,360 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "cJSON/cJSON.h"
+#include "transient.h"
+#include "columns.h"
+#include "arena.h"
+#include "platform.h"
+
+#define CHUNK_SIZE (1u << 20)
+#define NUMBER_WIDTH 32
+#define TWO_PI 6.283185307179586
+
+double waveformValue(const Waveform *w, double t)
+{
+    double tau = t - w->delay;
+
+    switch (w->shape)
+    {
+    case WAVEFORM_STEP:
+        if (tau <= 0)
+            return w->v1;
+        if (tau < w->rise)
+            return w->v1 + (w->v2 - w->v1) * tau / w->rise;
+        return w->v2;
+    case WAVEFORM_PULSE:
+        if (tau < 0)
+            return w->v1;
+        if (w->period > 0)
+            tau = fmod(tau, w->period);
+        if (tau < w->rise)
+            return w->v1 + (w->v2 - w->v1) * tau / w->rise;
+        tau -= w->rise;
+        if (tau < w->width)
+            return w->v2;
+        tau -= w->width;
+        if (tau < w->fall)
+            return w->v2 + (w->v1 - w->v2) * tau / w->fall;
+        return w->v1;
+    case WAVEFORM_SINE:
+        if (tau < 0)
+            tau = 0;
+        return w->v1 + w->v2 * sin(TWO_PI * (w->frequency * tau + w->phase / 360.0));
+    }
+    return w->v1;
+}
+
+/* Next corner of the waveform strictly after t, or INFINITY. Adaptive
+   runs land on these so edges are never stepped over. */
+double waveformBreakpoint(const Waveform *w, double t)
+{
+    if (t < w->delay)
+        return w->delay;
+
+    switch (w->shape)
+    {
+    case WAVEFORM_STEP:
+        return t < w->delay + w->rise ? w->delay + w->rise : INFINITY;
+    case WAVEFORM_PULSE:
+    {
+        double base = w->delay;
+        if (w->period > 0)
+            base += floor((t - w->delay) / w->period) * w->period;
+        double corners[4] = {base + w->rise, base + w->rise + w->width, base + w->rise + w->width + w->fall,
+                             w->period > 0 ? base + w->period : INFINITY};
+        for (int k = 0; k < 4; k++)
+            if (corners[k] > t)
+                return corners[k];
+        return INFINITY;
+    }
+    case WAVEFORM_SINE:
+        break;
+    }
+    return INFINITY;
+}
+
+static double numberOr(const cJSON *root, const char *name, double fallback)
+{
+    const cJSON *item = cJSON_GetObjectItem(root, name);
+    return cJSON_IsNumber(item) ? item->valuedouble : fallback;
+}
+
+bool loadTransientSpec(const char *file_name, TransientSpec *spec)
+{
+    MappedFile map;
+    cJSON *root;
+
+    memset(spec, 0, sizeof(*spec));
+    if (!mapFile(file_name, &map))
+    {
+        perror("Error opening file");
+        return false;
+    }
+    root = cJSON_ParseWithLength(map.data, map.size);
+    unmapFile(&map);
+    if (!root)
+    {
+        fprintf(stderr, "%s: invalid JSON\n", file_name);
+        return false;
+    }
+
+    spec->stop = numberOr(root, "stop", 0.0);
+    spec->step = numberOr(root, "step", 0.0);
+    spec->adaptive = cJSON_IsTrue(cJSON_GetObjectItem(root, "adaptive"));
+    spec->min_step = numberOr(root, "min_step", spec->step * 1e-3);
+    spec->max_step = numberOr(root, "max_step", spec->step * 100.0);
+    spec->tolerance = numberOr(root, "tolerance", 1e-3);
+    if (!(spec->stop > 0) || !(spec->step > 0) || !(spec->min_step > 0) || spec->max_step < spec->min_step ||
+        !(spec->tolerance > 0))
+    {
+        fprintf(stderr, "%s: a transient run needs positive \"stop\", \"step\" and \"tolerance\" "
+                        "and min_step <= max_step\n",
+                file_name);
+        cJSON_Delete(root);
+        return false;
+    }
+
+    const cJSON *outputs = cJSON_GetObjectItem(root, "outputs"), *item;
+    if (cJSON_IsArray(outputs))
+    {
+        spec->outputs = malloc((cJSON_GetArraySize(outputs) + 1) * sizeof(int));
+        if (!spec->outputs)
+        {
+            cJSON_Delete(root);
+            return false;
+        }
+        cJSON_ArrayForEach(item, outputs)
+        {
+            if (cJSON_IsNumber(item))
+                spec->outputs[spec->output_count++] = item->valueint;
+        }
+    }
+    cJSON_Delete(root);
+    return true;
+}
+
+void freeTransientSpec(TransientSpec *spec)
+{
+    free(spec->outputs);
+    memset(spec, 0, sizeof(*spec));
+}
+
+typedef struct
+{
+    FILE *out;
+    bool binary;
+    char *buffer;
+    size_t length;
+    bool failed;
+} TransientWriter;
+
+static void flushWriter(TransientWriter *w)
+{
+    if (w->length && fwrite(w->buffer, 1, w->length, w->out) != w->length)
+        w->failed = true;
+    w->length = 0;
+}
+
+static void writeRecord(TransientWriter *w, double t, const double *values, const int *outputs, size_t count)
+{
+    char *p = w->buffer + w->length;
+
+    if (w->binary)
+    {
+        memcpy(p, &t, sizeof(double));
+        p += sizeof(double);
+        for (size_t k = 0; k < count; k++, p += sizeof(double))
+            memcpy(p, &values[outputs[k]], sizeof(double));
+    }
+    else
+    {
+        p += sprintf(p, "%.15g", t);
+        for (size_t k = 0; k < count; k++)
+            p += sprintf(p, ",%.15g", values[outputs[k]]);
+        *p++ = '\n';
+    }
+    w->length = p - w->buffer;
+    if (w->length >= CHUNK_SIZE)
+        flushWriter(w);
+}
+
+static bool writeTransientHeader(TransientWriter *w, const int *outputs, size_t count)
+{
+    if (w->binary)
+    {
+        TransientHeader h;
+        uint64_t zero = 0;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, TRANSIENT_MAGIC, 4);
+        h.version = TRANSIENT_VERSION;
+        h.header_size = sizeof(h);
+        h.output_count = (uint32_t)count;
+        fwrite(&h, sizeof(h), 1, w->out);
+        for (size_t k = 0; k < count; k++)
+        {
+            int32_t id = outputs[k];
+            fwrite(&id, sizeof(id), 1, w->out);
+        }
+        if (count & 1)
+            fwrite(&zero, 4, 1, w->out);
+    }
+    else
+    {
+        fputs("time", w->out);
+        for (size_t k = 0; k < count; k++)
+            fprintf(w->out, ",%d.output", outputs[k]);
+        fputc('\n', w->out);
+    }
+    return !ferror(w->out);
+}
+
+/* Largest output change relative to what the tolerance allows. */
+static double stepError(const double *before, const double *after, size_t n, double tolerance)
+{
+    double worst = 0.0;
+    for (size_t i = 0; i < n; i++)
+    {
+        double scale = fabs(before[i]) > fabs(after[i]) ? fabs(before[i]) : fabs(after[i]);
+        double error = fabs(after[i] - before[i]) / (tolerance * (scale + 1.0));
+        if (error > worst)
+            worst = error;
+    }
+    return worst;
+}
+
+/* The component models have no state, so each time point is one level
+   evaluation with the supply waveforms applied; feedback groups start
+   from the previous step's values. Only two value vectors
+   and one output chunk are held, whatever the run length. */
+int runTransient(const ComponentArray *array, const TransientSpec *spec, FILE *out, bool binary,
+                 TransientStats *stats)
+{
+    ComponentColumns cols;
+    TransientWriter writer = {out, binary, NULL, 0, false};
+    const Waveform **waves = NULL;
+    int *wave_slot = NULL, *outputs = NULL;
+    double *current = NULL, *trial = NULL;
+    size_t wave_count = 0, output_count, steps = 0, rejected = 0, unsolved = 0;
+    int status = -1;
+    double start = monotonicSeconds();
+
+    if (buildColumns(array, &cols) != 0)
+    {
+        fprintf(stderr, "Transient: column allocation failed\n");
+        return -1;
+    }
+
+    waves = malloc((array->waveform_count + 1) * sizeof(Waveform *));
+    wave_slot = malloc((array->waveform_count + 1) * sizeof(int));
+    output_count = spec->output_count ? spec->output_count : cols.n;
+    outputs = malloc((output_count + 1) * sizeof(int));
+    trial = cadMalloc((cols.n + 2) * sizeof(double));
+    writer.buffer = malloc(CHUNK_SIZE + (output_count + 1) * NUMBER_WIDTH);
+    if (!waves || !wave_slot || !outputs || !trial || !writer.buffer)
+        goto done;
+    for (size_t k = 0; k < array->waveform_count; k++)
+    {
+        const Waveform *w = &array->waveforms[k];
+        if (w->component < 0 || (size_t)w->component >= cols.n || cols.slots[w->component].type != POWERSUPPLY)
+            continue;
+        waves[wave_count] = w;
+        wave_slot[wave_count++] = cols.slots[w->component].slot;
+    }
+    for (size_t k = 0; k < output_count; k++)
+    {
+        outputs[k] = spec->output_count ? spec->outputs[k] : (int)k;
+        if (outputs[k] < 0 || (size_t)outputs[k] >= cols.n)
+        {
+            fprintf(stderr, "Transient: output %d is not a component\n", outputs[k]);
+            goto done;
+        }
+    }
+    if (!writeTransientHeader(&writer, outputs, output_count))
+        goto done;
+
+    current = cols.values;
+    memcpy(trial, current, (cols.n + 2) * sizeof(double));
+
+    double t = 0.0, dt = spec->step;
+    for (size_t k = 0; k < wave_count; k++)
+        cols.supplies.voltage[wave_slot[k]] = waveformValue(waves[k], t);
+    if (evaluateColumns(&cols) > 0)
+        unsolved++;
+    writeRecord(&writer, t, current, outputs, output_count);
+
+    while (t < spec->stop && !writer.failed)
+    {
+        double next, h;
+        if (spec->adaptive)
+        {
+            h = dt < spec->stop - t ? dt : spec->stop - t;
+            for (size_t k = 0; k < wave_count; k++)
+            {
+                double corner = waveformBreakpoint(waves[k], t + 0.5 * spec->min_step);
+                if (corner - t < h)
+                    h = corner - t;
+            }
+            next = t + h;
+        }
+        else
+        {
+            next = (steps + 1) * spec->step;
+            if (next > spec->stop - 1e-9 * spec->step)
+                next = spec->stop;
+            h = next - t;
+        }
+
+        for (size_t k = 0; k < wave_count; k++)
+            cols.supplies.voltage[wave_slot[k]] = waveformValue(waves[k], next);
+        if (cols.cyclic)
+            memcpy(trial, current, (cols.n + 2) * sizeof(double));
+        cols.values = trial;
+        bool settled = evaluateColumns(&cols) == 0;
+
+        if (spec->adaptive)
+        {
+            double error = stepError(current, trial, cols.n, spec->tolerance);
+            if (error > 1.0 && h > spec->min_step)
+            {
+                dt = h * 0.5 > spec->min_step ? h * 0.5 : spec->min_step;
+                rejected++;
+                continue;
+            }
+            if (error < 0.25)
+                dt = dt * 2.0 < spec->max_step ? dt * 2.0 : spec->max_step;
+        }
+
+        trial = current;
+        current = cols.values;
+        t = next;
+        steps++;
+        if (!settled)
+            unsolved++;
+        writeRecord(&writer, t, current, outputs, output_count);
+    }
+    flushWriter(&writer);
+
+    if (writer.failed || ferror(out))
+        perror("Transient output failed");
+    else
+        status = 0;
+    if (stats)
+    {
+        stats->steps = steps;
+        stats->rejected = rejected;
+        stats->unsolved = unsolved;
+        stats->components = cols.n;
+        stats->time = monotonicSeconds() - start;
+    }
+
+done:
+    /* freeColumns releases whichever value vector cols points at. */
+    cadFree(cols.values == trial ? current : trial);
+    free(waves);
+    free(wave_slot);
+    free(outputs);
+    free(writer.buffer);
+    freeColumns(&cols);
+    return status;
+}
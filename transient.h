@@ -0,0 +1,60 @@
+#ifndef TRANSIENT_H
+#define TRANSIENT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "circuit.h"
+
+#define TRANSIENT_MAGIC "CADT"
+#define TRANSIENT_VERSION 1
+
+/* Spec file:
+   {"stop": 1e-3, "step": 1e-6, "adaptive": true, "min_step": 1e-9,
+    "max_step": 1e-4, "tolerance": 1e-3, "outputs": [2, 5]}
+   Omitting "outputs" records every component. With "adaptive" the step
+   halves until no component output moves by more than tolerance (relative,
+   with an absolute floor of tolerance) in one step, grows again while
+   outputs are quiet, and always lands on waveform corners. */
+typedef struct
+{
+    double stop;
+    double step;
+    bool adaptive;
+    double min_step;
+    double max_step;
+    double tolerance;
+    int *outputs;
+    size_t output_count;
+} TransientSpec;
+
+/* Binary output: this header, int32 component ids[output_count] padded
+   to 8 bytes, then one record per accepted step of double time followed
+   by double output[output_count]. The record count follows from the file
+   size. The outputs are the component values: node voltages, and branch
+   currents for current-mode resistors and transistors. */
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t output_count;
+} TransientHeader;
+
+typedef struct
+{
+    size_t steps;
+    size_t rejected;
+    size_t unsolved;
+    size_t components;
+    double time;
+} TransientStats;
+
+double waveformValue(const Waveform *w, double t);
+double waveformBreakpoint(const Waveform *w, double t);
+
+bool loadTransientSpec(const char *file_name, TransientSpec *spec);
+void freeTransientSpec(TransientSpec *spec);
+int runTransient(const ComponentArray *array, const TransientSpec *spec, FILE *out, bool binary,
+                 TransientStats *stats);
+
+#endif
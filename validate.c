@@ -0,0 +1,341 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "validate.h"
+#include "arena.h"
+#include "subcircuit.h"
+#include "netgraph.h"
+
+/* Problems printed per netlist; the rest are only counted, since one
+   dropped entry misplaces every id after it. */
+#define VALIDATE_MESSAGES 100
+
+/* Ids found away from their own position, each mapped to the first
+   position holding it. Open addressing with linear probing; a valid
+   netlist never inserts, so the table is not even allocated. */
+typedef struct
+{
+    int *id;
+    int *at;
+    size_t capacity;
+    size_t count;
+} IdIndex;
+
+typedef struct
+{
+    const char *name;
+    const char *subcircuit;
+    const int *lines;
+    size_t errors;
+} Validator;
+
+static void locate(const Validator *v, size_t i)
+{
+    if (v->lines)
+        fprintf(stderr, "%s:%d: component %zu: ", v->name, v->lines[i], i);
+    else if (v->subcircuit)
+        fprintf(stderr, "%s: subcircuit %s, component %zu: ", v->name, v->subcircuit, i);
+    else
+        fprintf(stderr, "%s: component %zu: ", v->name, i);
+}
+
+static void report(Validator *v, size_t i, const char *format, ...)
+{
+    if (v->errors++ >= VALIDATE_MESSAGES)
+        return;
+    va_list args;
+    va_start(args, format);
+    locate(v, i);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+static size_t slotOf(const IdIndex *x, int id)
+{
+    return ((uint32_t)id * 2654435761u) & (x->capacity - 1);
+}
+
+/* Position first holding id, or -1. */
+static int findId(const IdIndex *x, int id)
+{
+    if (!x->count)
+        return -1;
+    for (size_t s = slotOf(x, id);; s = (s + 1) & (x->capacity - 1))
+    {
+        if (x->at[s] < 0)
+            return -1;
+        if (x->id[s] == id)
+            return x->at[s];
+    }
+}
+
+/* Kept at most half full. */
+static bool insertId(IdIndex *x, int id, int at)
+{
+    if (2 * (x->count + 1) > x->capacity)
+    {
+        IdIndex grown = {NULL, NULL, x->capacity ? 2 * x->capacity : 64, 0};
+        grown.id = cadMalloc(grown.capacity * sizeof(int));
+        grown.at = cadMalloc(grown.capacity * sizeof(int));
+        if (!grown.id || !grown.at)
+        {
+            cadFree(grown.id);
+            cadFree(grown.at);
+            return false;
+        }
+        for (size_t s = 0; s < grown.capacity; s++)
+            grown.at[s] = -1;
+        for (size_t s = 0; s < x->capacity; s++)
+            if (x->at[s] >= 0)
+                insertId(&grown, x->id[s], x->at[s]);
+        cadFree(x->id);
+        cadFree(x->at);
+        *x = grown;
+    }
+    size_t s = slotOf(x, id);
+    while (x->at[s] >= 0)
+        s = (s + 1) & (x->capacity - 1);
+    x->id[s] = id;
+    x->at[s] = at;
+    x->count++;
+    return true;
+}
+
+/* Pins are -1 when unconnected; below that they name a port, which only
+   a subcircuit body has. */
+static void checkPin(Validator *v, size_t i, const char *pin, int p, int n, int ports)
+{
+    if (p == -1 || (p >= 0 && p < n))
+        return;
+    if (p <= -2 && PIN_PORT(p) < ports)
+        return;
+    if (p <= -2 && v->subcircuit)
+        report(v, i, "%s refers to port %d, which the subcircuit does not have", pin, PIN_PORT(p));
+    else
+        report(v, i, "%s refers to missing component %d", pin, p);
+}
+
+static void checkValue(Validator *v, size_t i, const char *what, double value, bool positive)
+{
+    if (!isfinite(value))
+        report(v, i, "%s is not finite", what);
+    else if (positive && value <= 0.0)
+        report(v, i, "%s %g is not positive", what, value);
+}
+
+/* A second component with an id already seen: names where the id was
+   first used. */
+static void reportDuplicate(Validator *v, size_t i, int id, int first)
+{
+    if (v->lines)
+        report(v, i, "duplicate id %d, first used by component %d on line %d", id, first, v->lines[first]);
+    else
+        report(v, i, "duplicate id %d, first used by component %d", id, first);
+}
+
+/* Ports may be left unconnected with -1 but must not name a component
+   the design does not have, which flattening would alias to a body. */
+static void checkInstance(Validator *v, const ComponentArray *array, size_t i)
+{
+    const Instance *instance = &array->data[i].data.instance;
+    const Subcircuit *def = instanceSubcircuit(array, instance);
+    const int *ports = array->hierarchy->ports + instance->port_start;
+    const ParameterOverride *o = array->hierarchy->overrides + instance->override_start;
+    for (int k = 0; k < def->ports; k++)
+        if (ports[k] < -1 || ports[k] >= (int)array->size)
+            report(v, i, "port %d bound to missing component %d", k, ports[k]);
+    for (int k = 0; k < instance->override_count; k++)
+        checkValue(v, i, "parameter", o[k].value, def->body.data[o[k].component].type == RESISTOR);
+}
+
+/* One pass over the components: a bitmap marks the ids in [0, n) seen
+   so far and the index holds the others, so each id and pin costs a
+   constant number of lookups. */
+static void checkComponents(Validator *v, const ComponentArray *array, int ports)
+{
+    size_t n = array->size;
+    uint64_t *seen = cadCalloc(n / 64 + 1, sizeof(uint64_t));
+    IdIndex index = {0};
+
+    if (!seen)
+    {
+        perror("Failed to allocate memory");
+        v->errors++;
+        return;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        const Component *c = &array->data[i];
+        if (c->type < POWERSUPPLY || c->type > INSTANCE)
+        {
+            /* Zero is the place the reader keeps for an entry it could
+               not type, which it has already reported. */
+            if (c->type != 0)
+                report(v, i, "unknown component type");
+            continue;
+        }
+        int id = componentId(c);
+        bool known;
+
+        if (id >= 0 && (size_t)id < n)
+        {
+            uint64_t bit = (uint64_t)1 << (id & 63);
+            bool duplicate = (seen[id >> 6] & bit) != 0;
+            seen[id >> 6] |= bit;
+            if (duplicate)
+            {
+                /* Not in the index means it was first seen in place. */
+                int first = findId(&index, id);
+                reportDuplicate(v, i, id, first < 0 ? id : first);
+            }
+            known = duplicate;
+        }
+        else
+        {
+            int first = findId(&index, id);
+            if (first >= 0)
+                reportDuplicate(v, i, id, first);
+            known = first >= 0;
+        }
+        if ((size_t)id != i)
+        {
+            report(v, i, "id %d does not match its position %zu", id, i);
+            if (!known && !insertId(&index, id, (int)i))
+            {
+                perror("Failed to allocate memory");
+                v->errors++;
+                break;
+            }
+        }
+
+        switch (c->type)
+        {
+        case POWERSUPPLY:
+            checkValue(v, i, "voltage", c->data.powersupply.voltage, false);
+            checkPin(v, i, "pin1", c->data.powersupply.pin1, (int)n, ports);
+            break;
+        case RESISTOR:
+            checkValue(v, i, "resistance", c->data.resistor.resistance, true);
+            checkPin(v, i, "pin1", c->data.resistor.pin1, (int)n, ports);
+            checkPin(v, i, "pin2", c->data.resistor.pin2, (int)n, ports);
+            break;
+        case TRANSISTOR:
+            checkValue(v, i, "beta", c->data.transistor.beta, false);
+            checkPin(v, i, "pin1", c->data.transistor.pin1, (int)n, ports);
+            checkPin(v, i, "pin2", c->data.transistor.pin2, (int)n, ports);
+            checkPin(v, i, "pin3", c->data.transistor.pin3, (int)n, ports);
+            break;
+        case INSTANCE:
+            checkInstance(v, array, i);
+            break;
+        }
+    }
+    cadFree(seen);
+    cadFree(index.id);
+    cadFree(index.at);
+}
+
+static void checkWaveforms(Validator *v, const ComponentArray *array)
+{
+    for (size_t k = 0; k < array->waveform_count; k++)
+    {
+        const Waveform *w = &array->waveforms[k];
+        const double values[] = {w->v1, w->v2, w->delay, w->rise, w->fall, w->width, w->period, w->frequency,
+                                 w->phase};
+        for (size_t j = 0; j < sizeof(values) / sizeof(values[0]); j++)
+            if (!isfinite(values[j]))
+            {
+                report(v, (size_t)w->component, "waveform value is not finite");
+                break;
+            }
+    }
+}
+
+void freeLoadNotes(LoadNotes *notes)
+{
+    cadFree(notes->lines);
+    cadFree(notes->problems);
+    memset(notes, 0, sizeof(*notes));
+}
+
+/* Body entries have no line table, so their line goes with the message. */
+static void reportProblems(Validator *v, const ComponentArray *array, const LoadNotes *notes)
+{
+    for (size_t k = 0; k < notes->problem_count; k++)
+    {
+        const LoadProblem *p = &notes->problems[k];
+        if (p->subcircuit < 0)
+        {
+            report(v, (size_t)p->component, "%s", p->message);
+            continue;
+        }
+        Validator body = {v->name, array->hierarchy->subcircuits[p->subcircuit].name, NULL, v->errors};
+        report(&body, (size_t)p->component, "%s (line %d)", p->message, p->line);
+        v->errors = body.errors;
+    }
+}
+
+size_t validateCircuit(const ComponentArray *array, const char *name, const LoadNotes *notes)
+{
+    Validator v = {name, NULL, notes ? notes->lines : NULL, 0};
+
+    if (notes)
+        reportProblems(&v, array, notes);
+    checkComponents(&v, array, 0);
+    checkWaveforms(&v, array);
+    if (array->hierarchy)
+    {
+        v.lines = NULL;
+        for (size_t s = 0; s < array->hierarchy->count; s++)
+        {
+            const Subcircuit *def = &array->hierarchy->subcircuits[s];
+            v.subcircuit = def->name;
+            checkComponents(&v, &def->body, def->ports);
+        }
+    }
+    if (v.errors > VALIDATE_MESSAGES)
+        fprintf(stderr, "%s: %zu problems, the first %d shown\n", name, v.errors, VALIDATE_MESSAGES);
+    return v.errors;
+}
+
+/* Clears *pin when it names a later component that reads component i
+   back through an input pin. */
+static void dropLoadLink(Validator *v, const ComponentArray *array, size_t i, const char *name, int *pin)
+{
+    int j = *pin, inputs[2];
+    if (j <= (int)i || (size_t)j >= array->size)
+        return;
+    componentInputs(array, j, inputs);
+    if (inputs[0] != (int)i && inputs[1] != (int)i)
+        return;
+    if (v->errors++ < VALIDATE_MESSAGES)
+    {
+        locate(v, i);
+        fprintf(stderr, "%s names component %d, which reads this one; dropped as a load link\n", name, j);
+    }
+    *pin = -1;
+}
+
+size_t dropLoadLinks(ComponentArray *array, const char *name, const int *lines)
+{
+    Validator v = {name, NULL, lines, 0};
+
+    for (size_t i = 0; i < array->size; i++)
+    {
+        Component *c = &array->data[i];
+        if (c->type == RESISTOR)
+            dropLoadLink(&v, array, i, "pin1", &c->data.resistor.pin1);
+        else if (c->type == TRANSISTOR)
+        {
+            dropLoadLink(&v, array, i, "pin1", &c->data.transistor.pin1);
+            dropLoadLink(&v, array, i, "pin2", &c->data.transistor.pin2);
+        }
+    }
+    if (v.errors > VALIDATE_MESSAGES)
+        fprintf(stderr, "%s: %zu load links dropped, the first %d shown\n", name, v.errors, VALIDATE_MESSAGES);
+    return v.errors;
+}
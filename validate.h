@@ -0,0 +1,48 @@
+#ifndef VALIDATE_H
+#define VALIDATE_H
+
+#include <stddef.h>
+#include "circuit.h"
+
+/* A problem the JSON reader found in an entry it still kept a place
+   for, such as an unknown type or a missing field. subcircuit is the
+   definition whose body holds the entry, or -1 at the top level. */
+typedef struct
+{
+    int subcircuit;
+    int component;
+    int line;
+    char message[64];
+} LoadProblem;
+
+/* What the reader leaves for validateCircuit besides the components: the
+   line each top-level component starts on, and its problems. */
+typedef struct
+{
+    int *lines;
+    size_t line_count;
+    size_t line_capacity;
+    LoadProblem *problems;
+    size_t problem_count;
+    size_t problem_capacity;
+} LoadNotes;
+
+void freeLoadNotes(LoadNotes *notes);
+
+/* Checks a loaded netlist in one pass before anything follows its pins:
+   ids must be unique and equal to their position, pins and instance
+   ports must name a component of the same array or a port of the
+   subcircuit they are in, and values must be finite, resistances
+   positive. The reader's problems in notes, when given, are reported
+   first. Every problem goes to stderr with the component's position and
+   the line it starts on when that is known. Returns the number of
+   problems found. */
+size_t validateCircuit(const ComponentArray *array, const char *name, const LoadNotes *notes);
+/* Older versions of the editor wrote each new part's id into a free pin
+   of the part it was connected to, and some of those are input pins. An
+   input pin that names a later component reading this one back is such
+   a link: it is cleared, with a warning, so the circuit does not solve as
+   a false feedback loop. Returns the number of pins cleared. */
+size_t dropLoadLinks(ComponentArray *array, const char *name, const int *lines);
+
+#endif